@@ -11,26 +11,39 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <math.h>
 #include <stdio.h>
 #include "driver/i2c.h"
 #include "iot_i2c_bus.h"
 #include "iot_bme280.h"
-#include "math.h"
 #include "esp_log.h"
 
 typedef struct {
     i2c_bus_handle_t bus;
+    i2c_bus_device_handle_t i2c_dev;
     uint16_t dev_addr;
     bme280_data_t data_t;
     bme280_config_t config_t;
     bme280_ctrl_meas_t ctrl_meas_t;
     bme280_ctrl_hum_t ctrl_hum_t;
     int32_t t_fine;
+    bool meas_started;          // a forced conversion runs
+    TickType_t meas_start;      // tick it was started at
 } bme280_dev_t;
 
 bme280_handle_t iot_bme280_create(i2c_bus_handle_t bus, uint16_t dev_addr)
 {
     bme280_dev_t* dev = (bme280_dev_t*) calloc(1, sizeof(bme280_dev_t));
+    if (dev == NULL) {
+        return NULL;
+    }
+    // register accesses build their I2C links in the device object, with
+    // ESP-IDF 4.4 and later the sampling loop doesn't allocate
+    dev->i2c_dev = iot_i2c_bus_device_create(bus, dev_addr);
+    if (dev->i2c_dev == NULL) {
+        free(dev);
+        return NULL;
+    }
     dev->bus = bus;
     dev->dev_addr = dev_addr;
     return (bme280_handle_t) dev;
@@ -39,6 +52,7 @@ bme280_handle_t iot_bme280_create(i2c_bus_handle_t bus, uint16_t dev_addr)
 esp_err_t iot_bme280_delete(bme280_handle_t dev, bool del_bus)
 {
     bme280_dev_t* device = (bme280_dev_t*) dev;
+    iot_i2c_bus_device_delete(device->i2c_dev);
     if (del_bus) {
         iot_i2c_bus_delete(device->bus);
         device->bus = NULL;
@@ -50,141 +64,63 @@ esp_err_t iot_bme280_delete(bme280_handle_t dev, bool del_bus)
 esp_err_t iot_bme280_write_byte(bme280_handle_t dev, uint8_t addr, uint8_t data)
 {
     //start-device_addr-word_addr-data-stop
-    esp_err_t ret;
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT,
-    ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, addr, ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, data, ACK_CHECK_EN);
-    i2c_master_stop(cmd);
-    ret = iot_i2c_bus_cmd_begin(device->bus, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-    return ret;
+    return iot_i2c_bus_write_reg(device->i2c_dev, addr, &data, 1,
+            1000 / portTICK_RATE_MS);
 }
 
 esp_err_t iot_bme280_write(bme280_handle_t dev, uint8_t start_addr,
         uint8_t write_num, uint8_t *data_buf)
 {
-    uint32_t i = 0;
-    i2c_cmd_handle_t cmd;
-    esp_err_t ret = ESP_FAIL;
-    uint32_t writeNum = write_num;
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    if (data_buf != NULL) {
-        for (uint32_t j = 0; j < write_num; j += 8) {
-            cmd = i2c_cmd_link_create();
-            i2c_master_start(cmd);
-            i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT,
-            ACK_CHECK_EN);
-            i2c_master_write_byte(cmd, start_addr, ACK_CHECK_EN);
-            for (i = j; i < ((writeNum >= 8) ? 8 : writeNum); i++) {
-                i2c_master_write_byte(cmd, data_buf[i], ACK_CHECK_EN);
-            }
-            i2c_master_stop(cmd);
-            ret = iot_i2c_bus_cmd_begin(device->bus, cmd,
-                    1000 / portTICK_RATE_MS);
-            i2c_cmd_link_delete(cmd);
-
-            writeNum -= 8;              //write num count
-            if (ret == ESP_FAIL) {
-                return ret;
-            }
-        }
+    if (data_buf == NULL) {
+        return ESP_FAIL;
     }
-    return ret;
+    return iot_i2c_bus_write_reg(device->i2c_dev, start_addr, data_buf,
+            write_num, 1000 / portTICK_RATE_MS);
 }
 
 esp_err_t iot_bme280_read_byte(bme280_handle_t dev, uint8_t addr, uint8_t *data)
 {
     //start-device_addr-word_addr-start-device_addr-data-stop; no_ack of end data
-    esp_err_t ret;
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT,
-    ACK_CHECK_EN);
-    i2c_master_write_byte(cmd, addr, ACK_CHECK_EN);
-
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, (device->dev_addr << 1) | READ_BIT,
-    ACK_CHECK_EN);
-    i2c_master_read_byte(cmd, data, NACK_VAL);
-    i2c_master_stop(cmd);
-    ret = iot_i2c_bus_cmd_begin(device->bus, cmd, 1000 / portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-    return ret;
+    return iot_i2c_bus_read_reg(device->i2c_dev, addr, data, 1,
+            1000 / portTICK_RATE_MS);
 }
 
 esp_err_t iot_bme280_read(bme280_handle_t dev, uint8_t start_addr,
         uint8_t read_num, uint8_t *data_buf)
 {
-    uint32_t i = 0;
-    esp_err_t ret = ESP_FAIL;
-    if (data_buf != NULL) {
-        bme280_dev_t* device = (bme280_dev_t*) dev;
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, (device->dev_addr << 1) | WRITE_BIT,
-        ACK_CHECK_EN);
-        i2c_master_write_byte(cmd, start_addr, ACK_CHECK_EN);
-
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, (device->dev_addr << 1) | READ_BIT,
-        ACK_CHECK_EN);
-        for (i = 0; i < read_num - 1; i++) {
-            i2c_master_read_byte(cmd, &data_buf[i], ACK_VAL);
-        }
-        i2c_master_read_byte(cmd, &data_buf[i], NACK_VAL);
-        i2c_master_stop(cmd);
-        ret = iot_i2c_bus_cmd_begin(device->bus, cmd, 1000 / portTICK_RATE_MS);
-        i2c_cmd_link_delete(cmd);
+    bme280_dev_t* device = (bme280_dev_t*) dev;
+    if (data_buf == NULL) {
+        return ESP_FAIL;
     }
-    return ret;
+    return iot_i2c_bus_read_reg(device->i2c_dev, start_addr, data_buf,
+            read_num, 1000 / portTICK_RATE_MS);
 }
 
 static esp_err_t iot_bme280_read_uint16(bme280_handle_t dev, uint8_t addr,
         uint16_t *data)
 {
-    esp_err_t ret = ESP_FAIL;
-    uint8_t data0, data1;
-    if (iot_bme280_read_byte(dev, addr, &data0) == ESP_FAIL) {
-        return ret;
-    }
-    if (iot_bme280_read_byte(dev, addr + 1, &data1) == ESP_FAIL) {
-        return ret;
-    }
-    *data = (data0 << 8) | data1;
-    return ESP_OK;
-}
-
-static esp_err_t iot_bme280_read_uint16_le(bme280_handle_t dev, uint8_t addr,
-        uint16_t *data)
-{
-    esp_err_t ret = ESP_FAIL;
-    uint8_t data0, data1;
-    if (iot_bme280_read_byte(dev, addr, &data0) == ESP_FAIL) {
-        return ret;
-    }
-    if (iot_bme280_read_byte(dev, addr + 1, &data1) == ESP_FAIL) {
-        return ret;
+    uint8_t buf[2];
+    if (iot_bme280_read(dev, addr, sizeof(buf), buf) != ESP_OK) {
+        return ESP_FAIL;
     }
-    *data = (data1 << 8) | data0;
+    *data = (buf[0] << 8) | buf[1];
     return ESP_OK;
 }
 
 unsigned int iot_bme280_getconfig(bme280_handle_t dev)
 {
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    return (device->config_t.t_sb << 5) | (device->config_t.filter << 3)
+    return (device->config_t.t_sb << 5) | (device->config_t.filter << 2)
             | device->config_t.spi3w_en;
 }
 
 unsigned int iot_bme280_getctrl_meas(bme280_handle_t dev)
 {
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    return (device->ctrl_meas_t.osrs_t << 5) | (device->ctrl_meas_t.osrs_p << 3)
+    return (device->ctrl_meas_t.osrs_t << 5) | (device->ctrl_meas_t.osrs_p << 2)
             | device->ctrl_meas_t.mode;
 }
 
@@ -204,107 +140,70 @@ bool iot_bme280_is_reading_calibration(bme280_handle_t dev)
     return (rstatus & (1 << 0)) != 0;
 }
 
+// little-endian 16 bit value at register reg of a block read from base
+#define BME280_LE16(buf, base, reg) \
+    ((uint16_t) (((buf)[(reg) - (base) + 1] << 8) | (buf)[(reg) - (base)]))
+
 esp_err_t iot_bme280_read_coefficients(bme280_handle_t dev)
 {
-    uint8_t data = 0;
-    uint8_t data1 = 0;
-    uint16_t data16 = 0;
+    // the calibration data sits in two blocks, 0x88-0xA1 and 0xE1-0xE7 (DS 4.2.2)
+    uint8_t tp[BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1 + 1];
+    uint8_t h[BME280_REGISTER_DIG_H6 - BME280_REGISTER_DIG_H2 + 1];
     bme280_dev_t* device = (bme280_dev_t*) dev;
 
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_T1,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_t1 = data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_T2,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_t2 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_T3,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_t3 = (int16_t) data16;
-
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P1,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p1 = data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P2,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p2 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P3,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p3 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P4,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p4 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P5,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p5 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P6,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p6 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P7,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p7 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P8,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p8 = (int16_t) data16;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_P9,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_p9 = (int16_t) data16;
+    if (iot_bme280_read(dev, BME280_REGISTER_DIG_T1, sizeof(tp), tp) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (iot_bme280_read(dev, BME280_REGISTER_DIG_H2, sizeof(h), h) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    device->data_t.dig_t1 = BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_T1);
+    device->data_t.dig_t2 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_T2);
+    device->data_t.dig_t3 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_T3);
+
+    device->data_t.dig_p1 = BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P1);
+    device->data_t.dig_p2 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P2);
+    device->data_t.dig_p3 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P3);
+    device->data_t.dig_p4 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P4);
+    device->data_t.dig_p5 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P5);
+    device->data_t.dig_p6 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P6);
+    device->data_t.dig_p7 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P7);
+    device->data_t.dig_p8 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P8);
+    device->data_t.dig_p9 = (int16_t) BME280_LE16(tp, BME280_REGISTER_DIG_T1,
+            BME280_REGISTER_DIG_P9);
+
+    device->data_t.dig_h1 = tp[BME280_REGISTER_DIG_H1 - BME280_REGISTER_DIG_T1];
+    device->data_t.dig_h2 = (int16_t) BME280_LE16(h, BME280_REGISTER_DIG_H2,
+            BME280_REGISTER_DIG_H2);
+    device->data_t.dig_h3 = h[BME280_REGISTER_DIG_H3 - BME280_REGISTER_DIG_H2];
+    // H4 and H5 are 12 bit values sharing the nibbles of 0xE5
+    device->data_t.dig_h4 = (h[BME280_REGISTER_DIG_H4 - BME280_REGISTER_DIG_H2] << 4)
+            | (h[BME280_REGISTER_DIG_H5 - BME280_REGISTER_DIG_H2] & 0xF);
+    device->data_t.dig_h5 = (h[BME280_REGISTER_DIG_H5 + 1 - BME280_REGISTER_DIG_H2] << 4)
+            | (h[BME280_REGISTER_DIG_H5 - BME280_REGISTER_DIG_H2] >> 4);
+    device->data_t.dig_h6 = (int8_t) h[BME280_REGISTER_DIG_H6 - BME280_REGISTER_DIG_H2];
+    return ESP_OK;
+}
 
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H1, &data) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_h1 = data;
-    if (iot_bme280_read_uint16_le(dev, BME280_REGISTER_DIG_H2,
-            &data16) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_h2 = (int16_t) data16;
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H3, &data) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_h3 = data;
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H4, &data) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H4 + 1,
-            &data1) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_h4 = (data << 4) | (data1 & 0xF);
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H5 + 1, &data) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H5, &data1) == ESP_FAIL) {
-        return ESP_FAIL;
-    }
-    device->data_t.dig_h5 = (data << 4) | (data1 >> 4);
-    if (iot_bme280_read_byte(dev, BME280_REGISTER_DIG_H6, &data) == ESP_FAIL) {
+esp_err_t iot_bme280_get_coefficients(bme280_handle_t dev, bme280_data_t *data)
+{
+    bme280_dev_t* device = (bme280_dev_t*) dev;
+    if (data == NULL) {
         return ESP_FAIL;
     }
-    device->data_t.dig_h6 = (int8_t) data;
+    *data = device->data_t;
     return ESP_OK;
 }
 
@@ -379,31 +278,184 @@ esp_err_t iot_bme280_init(bme280_handle_t dev)
     return ESP_OK;
 }
 
-esp_err_t iot_bme280_take_forced_measurement(bme280_handle_t dev)
+// oversampling of an osrs setting, 0 when skipped
+static uint32_t iot_bme280_oversampling(unsigned int osrs)
+{
+    if (osrs > BME280_SAMPLING_X16) {
+        osrs = BME280_SAMPLING_X16;
+    }
+    return osrs ? 1 << (osrs - 1) : 0;
+}
+
+uint32_t iot_bme280_get_measurement_duration(bme280_handle_t dev)
+{
+    bme280_dev_t* device = (bme280_dev_t*) dev;
+    uint32_t osrs_t = iot_bme280_oversampling(device->ctrl_meas_t.osrs_t);
+    uint32_t osrs_p = iot_bme280_oversampling(device->ctrl_meas_t.osrs_p);
+    uint32_t osrs_h = iot_bme280_oversampling(device->ctrl_hum_t.osrs_h);
+
+    // maximum measurement time in us (DS 9.1)
+    uint32_t duration = 1250 + 2300 * osrs_t;
+    if (osrs_p) {
+        duration += 2300 * osrs_p + 575;
+    }
+    if (osrs_h) {
+        duration += 2300 * osrs_h + 575;
+    }
+
+    // in ticks, rounded up, plus one as the first tick of a delay can be short
+    uint32_t period_us = portTICK_PERIOD_MS * 1000;
+    return (duration + period_us - 1) / period_us + 1;
+}
+
+esp_err_t iot_bme280_start_forced_measurement(bme280_handle_t dev)
 {
-    uint8_t data = 0;
     bme280_dev_t* device = (bme280_dev_t*) dev;
-    if (device->ctrl_meas_t.mode == BME280_MODE_FORCED) {
-        // set to forced mode, i.e. "take next measurement"
-        if (iot_bme280_write_byte(dev, BME280_REGISTER_CONTROL,
-                iot_bme280_getctrl_meas(dev)) == ESP_FAIL) {
-            return ESP_FAIL;
+    if (device->ctrl_meas_t.mode != BME280_MODE_FORCED) {
+        // normal mode measures on its own
+        return ESP_OK;
+    }
+    // set to forced mode, i.e. "take next measurement"
+    esp_err_t ret = iot_bme280_write_byte(dev, BME280_REGISTER_CONTROL,
+            iot_bme280_getctrl_meas(dev));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    device->meas_started = true;
+    device->meas_start = xTaskGetTickCount();
+    return ESP_OK;
+}
+
+// waits out the conversion started by iot_bme280_start_forced_measurement
+static esp_err_t iot_bme280_wait_measurement(bme280_dev_t* device)
+{
+    uint8_t status;
+    esp_err_t ret;
+
+    if (device->ctrl_meas_t.mode != BME280_MODE_FORCED) {
+        return ESP_OK;
+    }
+    if (!device->meas_started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    device->meas_started = false;
+
+    TickType_t duration = iot_bme280_get_measurement_duration(device);
+    TickType_t elapsed = xTaskGetTickCount() - device->meas_start;
+    if (elapsed < duration) {
+        vTaskDelay(duration - elapsed);
+    }
+    // the conversion should be done by now, so one status read normally
+    // does; a slow sensor gets another duration, a failing read ends it
+    while (1) {
+        ret = iot_bme280_read_byte(device, BME280_REGISTER_STATUS, &status);
+        if (ret != ESP_OK) {
+            return ret;
         }
-        // wait until measurement has been completed, otherwise we would read, the values from the last measurement
-        if (iot_bme280_read_byte(dev, BME280_REGISTER_STATUS, &data) == ESP_FAIL) {
-            return ESP_FAIL;
+        if (!(status & 0x08)) {
+            return ESP_OK;
         }
-        while (data & 0x08) {
-            iot_bme280_read_byte(dev, BME280_REGISTER_STATUS, &data);
-            vTaskDelay(10 / portTICK_RATE_MS);
+        if (xTaskGetTickCount() - device->meas_start >= 2 * duration) {
+            return ESP_ERR_TIMEOUT;
         }
+        vTaskDelay(1);
     }
-    return ESP_OK;
 }
 
-float iot_bme280_read_temperature(bme280_handle_t dev)
+esp_err_t iot_bme280_collect_forced_measurement(bme280_handle_t dev,
+        bme280_values_fixed_t *values)
+{
+    esp_err_t ret = iot_bme280_wait_measurement((bme280_dev_t*) dev);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return iot_bme280_read_fixed(dev, values);
+}
+
+esp_err_t iot_bme280_take_forced_measurement(bme280_handle_t dev)
+{
+    esp_err_t ret = iot_bme280_start_forced_measurement(dev);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    // wait until measurement has been completed, otherwise we would read the
+    // values from the last measurement
+    return iot_bme280_wait_measurement((bme280_dev_t*) dev);
+}
+
+// temperature in 0.01 degC from a 20 bit reading, also updates t_fine
+static int32_t iot_bme280_compensate_temperature(bme280_dev_t* device,
+        int32_t adc_T)
 {
     int32_t var1, var2;
+
+    var1 = ((((adc_T >> 3) - ((int32_t) device->data_t.dig_t1 << 1)))
+            * ((int32_t) device->data_t.dig_t2)) >> 11;
+
+    var2 = (((((adc_T >> 4) - ((int32_t) device->data_t.dig_t1))
+            * ((adc_T >> 4) - ((int32_t) device->data_t.dig_t1))) >> 12)
+            * ((int32_t) device->data_t.dig_t3)) >> 14;
+
+    device->t_fine = var1 + var2;
+
+    return (device->t_fine * 5 + 128) >> 8;
+}
+
+// pressure in Pa * 256 from a 20 bit reading, needs t_fine; false on bad
+// calibration
+static bool iot_bme280_compensate_pressure(bme280_dev_t* device,
+        int32_t adc_P, int64_t *pressure)
+{
+    int64_t var1, var2, p;
+
+    var1 = ((int64_t) device->t_fine) - 128000;
+    var2 = var1 * var1 * (int64_t) device->data_t.dig_p6;
+    var2 = var2 + ((var1 * (int64_t) device->data_t.dig_p5) << 17);
+    var2 = var2 + (((int64_t) device->data_t.dig_p4) << 35);
+    var1 = ((var1 * var1 * (int64_t) device->data_t.dig_p3) >> 8)
+            + ((var1 * (int64_t) device->data_t.dig_p2) << 12);
+    var1 = (((((int64_t) 1) << 47) + var1)) * ((int64_t) device->data_t.dig_p1)
+            >> 33;
+
+    if (var1 == 0) {
+        return false; // avoid exception caused by division by zero
+    }
+    p = 1048576 - adc_P;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = (((int64_t) device->data_t.dig_p9) * (p >> 13) * (p >> 13)) >> 25;
+    var2 = (((int64_t) device->data_t.dig_p8) * p) >> 19;
+
+    *pressure = ((p + var1 + var2) >> 8) + (((int64_t) device->data_t.dig_p7) << 4);
+    return true;
+}
+
+// humidity in %RH * 1024 from a 16 bit reading, needs t_fine
+static int32_t iot_bme280_compensate_humidity(bme280_dev_t* device,
+        int32_t adc_H)
+{
+    int32_t v_x1_u32r;
+
+    v_x1_u32r = (device->t_fine - ((int32_t) 76800));
+
+    v_x1_u32r = (((((adc_H << 14) - (((int32_t) device->data_t.dig_h4) << 20)
+            - (((int32_t) device->data_t.dig_h5) * v_x1_u32r))
+            + ((int32_t) 16384)) >> 15)
+            * (((((((v_x1_u32r * ((int32_t) device->data_t.dig_h6)) >> 10)
+                    * (((v_x1_u32r * ((int32_t) device->data_t.dig_h3)) >> 11)
+                            + ((int32_t) 32768))) >> 10) + ((int32_t) 2097152))
+                    * ((int32_t) device->data_t.dig_h2) + 8192) >> 14));
+
+    v_x1_u32r = (v_x1_u32r
+            - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7)
+                    * ((int32_t) device->data_t.dig_h1)) >> 4));
+
+    v_x1_u32r = (v_x1_u32r < 0) ? 0 : v_x1_u32r;
+    v_x1_u32r = (v_x1_u32r > 419430400) ? 419430400 : v_x1_u32r;
+    return v_x1_u32r >> 12;
+}
+
+float iot_bme280_read_temperature(bme280_handle_t dev)
+{
     uint8_t data[3] = { 0 };
     bme280_dev_t* device = (bme280_dev_t*) dev;
 
@@ -417,21 +469,12 @@ float iot_bme280_read_temperature(bme280_handle_t dev)
     }
     adc_T >>= 4;
 
-    var1 = ((((adc_T >> 3) - ((int32_t) device->data_t.dig_t1 << 1)))
-            * ((int32_t) device->data_t.dig_t2)) >> 11;
-
-    var2 = (((((adc_T >> 4) - ((int32_t) device->data_t.dig_t1))
-            * ((adc_T >> 4) - ((int32_t) device->data_t.dig_t1))) >> 12)
-            * ((int32_t) device->data_t.dig_t3)) >> 14;
-
-    device->t_fine = var1 + var2;
-
-    return (((device->t_fine * 5 + 128) >> 8) / 100.0);
+    return iot_bme280_compensate_temperature(device, adc_T) / 100.0;
 }
 
 float iot_bme280_read_pressure(bme280_handle_t dev)
 {
-    int64_t var1, var2, p;
+    int64_t p;
     uint8_t data[3] = { 0 };
     bme280_dev_t* device = (bme280_dev_t*) dev;
 
@@ -451,26 +494,10 @@ float iot_bme280_read_pressure(bme280_handle_t dev)
 
     adc_P >>= 4;
 
-    var1 = ((int64_t) device->t_fine) - 128000;
-    var2 = var1 * var1 * (int64_t) device->data_t.dig_p6;
-    var2 = var2 + ((var1 * (int64_t) device->data_t.dig_p5) << 17);
-    var2 = var2 + (((int64_t) device->data_t.dig_p4) << 35);
-    var1 = ((var1 * var1 * (int64_t) device->data_t.dig_p3) >> 8)
-            + ((var1 * (int64_t) device->data_t.dig_p2) << 12);
-    var1 = (((((int64_t) 1) << 47) + var1)) * ((int64_t) device->data_t.dig_p1)
-            >> 33;
-
-    if (var1 == 0) {
-        return ESP_FAIL; // avoid exception caused by division by zero
+    if (!iot_bme280_compensate_pressure(device, adc_P, &p)) {
+        return ESP_FAIL;
     }
-    p = 1048576 - adc_P;
-    p = (((p << 31) - var2) * 3125) / var1;
-    var1 = (((int64_t) device->data_t.dig_p9) * (p >> 13) * (p >> 13)) >> 25;
-    var2 = (((int64_t) device->data_t.dig_p8) * p) >> 19;
-
-    p = ((p + var1 + var2) >> 8) + (((int64_t) device->data_t.dig_p7) << 4);
-    p = p >> 8; // /256
-    return ((float) p / 100);
+    return ((float) (p >> 8) / 100);
 }
 
 float iot_bme280_read_humidity(bme280_handle_t dev)
@@ -493,41 +520,136 @@ float iot_bme280_read_humidity(bme280_handle_t dev)
         return ESP_FAIL;
     }
 
-    int32_t v_x1_u32r;
+    return iot_bme280_compensate_humidity(device, adc_H) / 1024.0;
+}
 
-    v_x1_u32r = (device->t_fine - ((int32_t) 76800));
+esp_err_t iot_bme280_read_fixed(bme280_handle_t dev,
+        bme280_values_fixed_t *values)
+{
+    // pressure, temperature and humidity registers in one burst, so all three
+    // come from the same conversion (DS 4)
+    uint8_t data[BME280_REGISTER_HUMIDDATA + 2 - BME280_REGISTER_PRESSUREDATA];
+    int64_t p;
+    bme280_dev_t* device = (bme280_dev_t*) dev;
 
-    v_x1_u32r = (((((adc_H << 14) - (((int32_t) device->data_t.dig_h4) << 20)
-            - (((int32_t) device->data_t.dig_h5) * v_x1_u32r))
-            + ((int32_t) 16384)) >> 15)
-            * (((((((v_x1_u32r * ((int32_t) device->data_t.dig_h6)) >> 10)
-                    * (((v_x1_u32r * ((int32_t) device->data_t.dig_h3)) >> 11)
-                            + ((int32_t) 32768))) >> 10) + ((int32_t) 2097152))
-                    * ((int32_t) device->data_t.dig_h2) + 8192) >> 14));
+    if (values == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = iot_bme280_read(dev, BME280_REGISTER_PRESSUREDATA,
+            sizeof(data), data);
+    if (ret != ESP_OK) {
+        return ret;
+    }
 
-    v_x1_u32r = (v_x1_u32r
-            - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7)
-                    * ((int32_t) device->data_t.dig_h1)) >> 4));
+    int32_t adc_P = (data[0] << 16) | (data[1] << 8) | data[2];
+    int32_t adc_T = (data[3] << 16) | (data[4] << 8) | data[5];
+    int32_t adc_H = (data[6] << 8) | data[7];
+    if (adc_T == 0x800000 || adc_P == 0x800000 || adc_H == 0x8000) {
+        // one of the measurements is disabled
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    v_x1_u32r = (v_x1_u32r < 0) ? 0 : v_x1_u32r;
-    v_x1_u32r = (v_x1_u32r > 419430400) ? 419430400 : v_x1_u32r;
-    return ((v_x1_u32r >> 12) / 1024.0);
+    values->temperature = iot_bme280_compensate_temperature(device, adc_T >> 4);
+    if (!iot_bme280_compensate_pressure(device, adc_P >> 4, &p)) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    values->pressure = (uint32_t) p;
+    values->humidity = iot_bme280_compensate_humidity(device, adc_H);
+    return ESP_OK;
 }
 
-float iot_bme280_read_altitude(bme280_handle_t dev, float seaLevel)
+esp_err_t iot_bme280_read_all(bme280_handle_t dev, bme280_values_t *values)
 {
-    float pressure = 0;
-    if (iot_bme280_read_pressure(dev) == ESP_FAIL) {
+    bme280_values_fixed_t fixed;
+
+    if (values == NULL || iot_bme280_read_fixed(dev, &fixed) != ESP_OK) {
         return ESP_FAIL;
     }
+    values->temperature = fixed.temperature / 100.0;
+    values->pressure = (float) (fixed.pressure >> 8) / 100;
+    values->humidity = fixed.humidity / 1024.0;
+    return ESP_OK;
+}
+
+/*
+ * Single-precision x^y for x > 0 as 2^(y * log2(x)), without the double
+ * pow() the ESP32 only has in software. The exponent of x comes from its
+ * bits; the mantissa, scaled into [sqrt(1/2), sqrt(2)), goes through the
+ * atanh series of ln, and 2^f for |f| <= 1/2 through its Taylor series,
+ * each accurate to a few float ulp. Results out of the float range, and
+ * those of subnormal or infinite x, saturate to 0 or infinity; x below 0
+ * gives NAN.
+ */
+static float iot_bme280_powf(float x, float y)
+{
+    union {
+        float f;
+        uint32_t i;
+    } u = { .f = x };
+
+    if (isnan(x) || x < 0.0f) {
+        return NAN;
+    }
+    if (!isnormal(x)) {
+        return (x > 1.0f) == (y > 0.0f) ? INFINITY : 0.0f;
+    }
+    int e = (int) ((u.i >> 23) & 0xFF) - 127;
+    u.i = (u.i & 0x7FFFFF) | 0x3F800000;    // mantissa in [1, 2)
+    if (u.f > 1.41421356f) {
+        u.f *= 0.5f;
+        e++;
+    }
+    float s = (u.f - 1.0f) / (u.f + 1.0f);
+    float s2 = s * s;
+    float ln_m = 2.0f * s * (1.0f + s2 * (1.0f / 3 + s2 * (1.0f / 5
+            + s2 * (1.0f / 7 + s2 * (1.0f / 9)))));
+    float l = y * (e + ln_m * 1.44269504f);
+
+    if (l >= 128.0f) {
+        return INFINITY;
+    }
+    if (l < -126.0f) {
+        return 0.0f;
+    }
+    int n = (int) (l < 0 ? l - 0.5f : l + 0.5f);
+    float f = (l - n) * 0.69314718f;
+    float r = 1.0f + f * (1.0f + f * (1.0f / 2 + f * (1.0f / 6
+            + f * (1.0f / 24 + f * (1.0f / 120 + f * (1.0f / 720))))));
+    u.i = (uint32_t) (n + 127) << 23;       // 2^n
+    return r * u.f;
+}
+
+float iot_bme280_altitude(float pressure, float sea_level)
+{
+    // also false for NaN
+    if (!(pressure > 0.0f && sea_level > 0.0f) || isinf(pressure)
+            || isinf(sea_level)) {
+        return NAN;
+    }
+    return 44330.0f * (1.0f - iot_bme280_powf(pressure / sea_level, 0.1903f));
+}
 
-    float atmospheric = pressure / 100.0F;
-    return (44330.0 * (1.0 - pow(atmospheric / seaLevel, 0.1903)));
+float iot_bme280_sea_level_pressure(float pressure, float altitude)
+{
+    // the ratio 1 - h / 44330 has to stay positive
+    if (!(pressure > 0.0f && altitude < 44330.0f) || isinf(pressure)
+            || isinf(altitude)) {
+        return NAN;
+    }
+    return pressure * iot_bme280_powf(1.0f - altitude / 44330.0f, -5.255f);
+}
+
+float iot_bme280_read_altitude(bme280_handle_t dev, float seaLevel)
+{
+    float pressure = iot_bme280_read_pressure(dev);
+    if (pressure == ESP_FAIL) {
+        return ESP_FAIL;
+    }
+    return iot_bme280_altitude(pressure, seaLevel);
 }
 
 float iot_bme280_calculates_pressure(bme280_handle_t dev, float altitude,
         float atmospheric)
 {
-    return (atmospheric / pow(1.0 - (altitude / 44330.0), 5.255));
+    return iot_bme280_sea_level_pressure(atmospheric, altitude);
 }
-
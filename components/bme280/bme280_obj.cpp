@@ -54,6 +54,21 @@ esp_err_t CBme280::take_forced_measurement(void)
     return iot_bme280_take_forced_measurement(m_dev_handle);
 }
 
+uint32_t CBme280::measurement_duration(void)
+{
+    return iot_bme280_get_measurement_duration(m_dev_handle);
+}
+
+esp_err_t CBme280::start_forced_measurement(void)
+{
+    return iot_bme280_start_forced_measurement(m_dev_handle);
+}
+
+esp_err_t CBme280::collect_forced_measurement(bme280_values_fixed_t *values)
+{
+    return iot_bme280_collect_forced_measurement(m_dev_handle, values);
+}
+
 float CBme280::temperature()
 {
     return iot_bme280_read_temperature(m_dev_handle);
@@ -69,6 +84,16 @@ float CBme280::humidity()
     return iot_bme280_read_humidity(m_dev_handle);
 }
 
+esp_err_t CBme280::read_all(bme280_values_t *values)
+{
+    return iot_bme280_read_all(m_dev_handle, values);
+}
+
+esp_err_t CBme280::read_fixed(bme280_values_fixed_t *values)
+{
+    return iot_bme280_read_fixed(m_dev_handle, values);
+}
+
 float CBme280::altitude(float seaLevel)
 {
     return iot_bme280_read_altitude(m_dev_handle, seaLevel);
@@ -79,3 +104,12 @@ float CBme280::calculates_pressure(float altitude, float atmospheric)
     return iot_bme280_calculates_pressure(m_dev_handle, altitude, atmospheric);
 }
 
+float CBme280::altitude(float pressure, float sea_level)
+{
+    return iot_bme280_altitude(pressure, sea_level);
+}
+
+float CBme280::sea_level_pressure(float pressure, float altitude)
+{
+    return iot_bme280_sea_level_pressure(pressure, altitude);
+}
@@ -0,0 +1,319 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <string.h>
+#include "esp_timer.h"
+#include "iot_bme280.h"
+#include "bme280_sim.h"
+
+#define BME280_SIM_RESET_CMD        0xB6
+#define BME280_SIM_STATUS_MEASURING 0x08
+#define BME280_SIM_SKIPPED          0x80000     /* data of a disabled measurement */
+#define BME280_SIM_MAX_CATCH_UP     16          /* normal mode conversions replayed */
+
+/* compensation example of the datasheet, typical humidity coefficients */
+static const struct {
+    uint16_t t1;
+    int16_t t2, t3;
+    uint16_t p1;
+    int16_t p2, p3, p4, p5, p6, p7, p8, p9;
+    uint8_t h1, h3;
+    int16_t h2, h4, h5;
+    int8_t h6;
+} s_cal = {
+    .t1 = 27504, .t2 = 26435, .t3 = -1000,
+    .p1 = 36477, .p2 = -10685, .p3 = 3024, .p4 = 2855, .p5 = 140, .p6 = -7,
+    .p7 = 15500, .p8 = -14600, .p9 = 6000,
+    .h1 = 75, .h2 = 362, .h3 = 0, .h4 = 313, .h5 = 50, .h6 = 30,
+};
+
+static const uint32_t s_standby_us[] = {
+    500, 62500, 125000, 250000, 500000, 1000000, 10000, 20000
+};
+
+// the integer compensation of the datasheet (DS 4.2.3), run backwards by
+// bme280_sim_search to find the raw value of a reading
+static int32_t bme280_sim_t_fine(int32_t adc_T)
+{
+    int32_t var1 = ((((adc_T >> 3) - ((int32_t) s_cal.t1 << 1))) * s_cal.t2) >> 11;
+    int32_t var2 = (((((adc_T >> 4) - (int32_t) s_cal.t1)
+            * ((adc_T >> 4) - (int32_t) s_cal.t1)) >> 12) * s_cal.t3) >> 14;
+    return var1 + var2;
+}
+
+// Pa * 256
+static int64_t bme280_sim_pressure(int32_t adc_P, int32_t t_fine)
+{
+    int64_t var1, var2, p;
+
+    var1 = (int64_t) t_fine - 128000;
+    var2 = var1 * var1 * s_cal.p6;
+    var2 = var2 + var1 * s_cal.p5 * ((int64_t) 1 << 17);
+    var2 = var2 + ((int64_t) s_cal.p4 << 35);
+    var1 = ((var1 * var1 * s_cal.p3) >> 8) + var1 * s_cal.p2 * ((int64_t) 1 << 12);
+    var1 = ((((int64_t) 1) << 47) + var1) * s_cal.p1 >> 33;
+    if (var1 == 0) {
+        return 0;
+    }
+    p = 1048576 - adc_P;
+    p = (((p << 31) - var2) * 3125) / var1;
+    var1 = ((int64_t) s_cal.p9 * (p >> 13) * (p >> 13)) >> 25;
+    var2 = ((int64_t) s_cal.p8 * p) >> 19;
+    return ((p + var1 + var2) >> 8) + ((int64_t) s_cal.p7 << 4);
+}
+
+// %RH * 1024
+static int64_t bme280_sim_humidity(int32_t adc_H, int32_t t_fine)
+{
+    int32_t v = t_fine - 76800;
+
+    v = (((((adc_H << 14) - ((int32_t) s_cal.h4 << 20) - ((int32_t) s_cal.h5 * v))
+            + 16384) >> 15) * (((((((v * s_cal.h6) >> 10)
+            * (((v * (int32_t) s_cal.h3) >> 11) + 32768)) >> 10) + 2097152)
+            * s_cal.h2 + 8192) >> 14));
+    v = v - (((((v >> 15) * (v >> 15)) >> 7) * (int32_t) s_cal.h1) >> 4);
+    v = v < 0 ? 0 : v;
+    v = v > 419430400 ? 419430400 : v;
+    return v >> 12;
+}
+
+typedef int64_t (*bme280_sim_compensate_t)(int32_t adc, int32_t t_fine);
+
+static int64_t bme280_sim_temperature(int32_t adc_T, int32_t t_fine)
+{
+    return bme280_sim_t_fine(adc_T);
+}
+
+/**
+ * @brief smallest raw value in [0, max] the compensation turns into target
+ *        or more (less if it falls), by bisection
+ */
+static int32_t bme280_sim_search(bme280_sim_compensate_t compensate,
+        int64_t target, int32_t t_fine, int32_t max, bool falling)
+{
+    int32_t lo = 0, hi = max;
+
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        int64_t value = compensate(mid, t_fine);
+        if (falling ? value <= target : value >= target) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static uint32_t bme280_sim_oversampling(uint8_t osrs)
+{
+    return osrs == 0 ? 0 : 1 << ((osrs > 5 ? 5 : osrs) - 1);
+}
+
+uint32_t bme280_sim_conversion_us(const bme280_sim_t *sim)
+{
+    uint8_t ctrl_meas = sim->dev.regs[BME280_REGISTER_CONTROL];
+    uint32_t t = bme280_sim_oversampling(ctrl_meas >> 5);
+    uint32_t p = bme280_sim_oversampling((ctrl_meas >> 2) & 0x07);
+    uint32_t h = bme280_sim_oversampling(sim->osrs_h);
+
+    return 1000 + 2000 * t + (p ? 2000 * p + 500 : 0) + (h ? 2000 * h + 500 : 0);
+}
+
+static void bme280_sim_put20(uint8_t *regs, uint32_t value)
+{
+    regs[0] = (value >> 12) & 0xFF;
+    regs[1] = (value >> 4) & 0xFF;
+    regs[2] = (value << 4) & 0xF0;
+}
+
+/**
+ * @brief the ADC keeps 15 + osrs bits of a 20 bit reading, unless the IIR
+ *        filter is on (DS 3.4.2 and 3.4.3)
+ */
+static uint32_t bme280_sim_resolution(uint32_t adc, uint8_t osrs, bool filter)
+{
+    if (filter || osrs >= 5) {
+        return adc;
+    }
+    return adc & ~((1u << (5 - osrs)) - 1);
+}
+
+static uint32_t bme280_sim_filter(uint32_t state, uint32_t adc, uint8_t filter)
+{
+    uint32_t coefficient = 1 << (filter > 4 ? 4 : filter);
+    return (state * (coefficient - 1) + adc) / coefficient;
+}
+
+/**
+ * @brief measure the waveforms at the end of a conversion and latch the
+ *        raw values into the data registers
+ */
+static void bme280_sim_latch(bme280_sim_t *sim, int64_t at_us)
+{
+    uint8_t *regs = sim->dev.regs;
+    uint32_t t_ms = (at_us - sim->start_us) / 1000;
+    uint8_t osrs_t = regs[BME280_REGISTER_CONTROL] >> 5;
+    uint8_t osrs_p = (regs[BME280_REGISTER_CONTROL] >> 2) & 0x07;
+    uint8_t filter = (regs[BME280_REGISTER_CONFIG] >> 2) & 0x07;
+
+    float temperature = i2c_sim_wave_at(&sim->temperature, t_ms);
+    int32_t adc_t = bme280_sim_search(bme280_sim_temperature,
+            (int64_t) (temperature * 5120), 0, 0xFFFFF, false);
+    int32_t t_fine = bme280_sim_t_fine(adc_t);
+    float pressure = i2c_sim_wave_at(&sim->pressure, t_ms);
+    int32_t adc_p = bme280_sim_search(bme280_sim_pressure,
+            (int64_t) (pressure * 100 * 256), t_fine, 0xFFFFF, true);
+    float humidity = i2c_sim_wave_at(&sim->humidity, t_ms);
+    int32_t adc_h = bme280_sim_search(bme280_sim_humidity,
+            (int64_t) (humidity * 1024), t_fine, 0xFFFF, false);
+
+    adc_t = bme280_sim_resolution(adc_t, osrs_t, filter);
+    adc_p = bme280_sim_resolution(adc_p, osrs_p, filter);
+    if (filter && sim->filtered) {
+        adc_t = bme280_sim_filter(sim->adc_t, adc_t, filter);
+        adc_p = bme280_sim_filter(sim->adc_p, adc_p, filter);
+    }
+    sim->adc_t = adc_t;
+    sim->adc_p = adc_p;
+    sim->filtered = true;
+
+    bme280_sim_put20(&regs[BME280_REGISTER_TEMPDATA], osrs_t ? adc_t : BME280_SIM_SKIPPED);
+    bme280_sim_put20(&regs[BME280_REGISTER_PRESSUREDATA],
+            osrs_p ? adc_p : BME280_SIM_SKIPPED);
+    regs[BME280_REGISTER_HUMIDDATA] = sim->osrs_h ? adc_h >> 8 : 0x80;
+    regs[BME280_REGISTER_HUMIDDATA + 1] = sim->osrs_h ? adc_h & 0xFF : 0x00;
+    sim->conversions++;
+}
+
+/**
+ * @brief catch up with the conversions that ended since the last access
+ */
+static void bme280_sim_update(bme280_sim_t *sim)
+{
+    uint8_t *regs = sim->dev.regs;
+    int64_t now = esp_timer_get_time();
+    bool measuring = false;
+
+    switch (regs[BME280_REGISTER_CONTROL] & 0x03) {
+    case BME280_MODE_NORMAL: {
+        int64_t duration = bme280_sim_conversion_us(sim);
+        int64_t period = duration + s_standby_us[regs[BME280_REGISTER_CONFIG] >> 5];
+        if (now - sim->ready_us > BME280_SIM_MAX_CATCH_UP * period) {
+            sim->ready_us += (now - sim->ready_us) / period * period
+                    - BME280_SIM_MAX_CATCH_UP * period;
+        }
+        while (sim->ready_us <= now) {
+            bme280_sim_latch(sim, sim->ready_us);
+            sim->ready_us += period;
+        }
+        measuring = (now - sim->cycle_us) % period < duration;
+        break;
+    }
+    case BME280_MODE_SLEEP:
+        break;
+    default:
+        if (now >= sim->ready_us) {
+            bme280_sim_latch(sim, sim->ready_us);
+            regs[BME280_REGISTER_CONTROL] &= ~0x03;
+        } else {
+            measuring = true;
+        }
+        break;
+    }
+    regs[BME280_REGISTER_STATUS] = measuring ? BME280_SIM_STATUS_MEASURING : 0;
+}
+
+static void bme280_sim_read(i2c_sim_device_t *dev, uint8_t reg)
+{
+    bme280_sim_update((bme280_sim_t *) dev);
+}
+
+static void bme280_sim_reset(bme280_sim_t *sim)
+{
+    uint8_t *regs = sim->dev.regs;
+
+    regs[BME280_REGISTER_SOFTRESET] = 0;
+    regs[BME280_REGISTER_CONTROLHUMID] = 0;
+    regs[BME280_REGISTER_STATUS] = 0;
+    regs[BME280_REGISTER_CONTROL] = 0;
+    regs[BME280_REGISTER_CONFIG] = 0;
+    bme280_sim_put20(&regs[BME280_REGISTER_PRESSUREDATA], BME280_SIM_SKIPPED);
+    bme280_sim_put20(&regs[BME280_REGISTER_TEMPDATA], BME280_SIM_SKIPPED);
+    regs[BME280_REGISTER_HUMIDDATA] = 0x80;
+    regs[BME280_REGISTER_HUMIDDATA + 1] = 0x00;
+    sim->osrs_h = 0;
+    sim->ready_us = 0;
+    sim->filtered = false;
+}
+
+static void bme280_sim_written(i2c_sim_device_t *dev, uint8_t reg)
+{
+    bme280_sim_t *sim = (bme280_sim_t *) dev;
+
+    if (reg == BME280_REGISTER_SOFTRESET) {
+        if (dev->regs[reg] == BME280_SIM_RESET_CMD) {
+            bme280_sim_reset(sim);
+        }
+        dev->regs[reg] = 0;
+        return;
+    }
+    if (reg != BME280_REGISTER_CONTROL) {
+        return;
+    }
+    // ctrl_hum only takes effect with the next write of ctrl_meas (DS 5.4.3)
+    int64_t now = esp_timer_get_time();
+    sim->osrs_h = dev->regs[BME280_REGISTER_CONTROLHUMID] & 0x07;
+    sim->cycle_us = now;
+    sim->ready_us = now + bme280_sim_conversion_us(sim);
+    dev->regs[BME280_REGISTER_STATUS] = (dev->regs[reg] & 0x03)
+            ? BME280_SIM_STATUS_MEASURING : 0;
+}
+
+static void bme280_sim_put16(uint8_t *regs, uint8_t reg, int32_t value)
+{
+    regs[reg] = value & 0xFF;
+    regs[reg + 1] = (value >> 8) & 0xFF;
+}
+
+void bme280_sim_init(bme280_sim_t *sim, uint8_t port, uint8_t addr)
+{
+    i2c_sim_wave_t temperature = sim->temperature;
+    i2c_sim_wave_t humidity = sim->humidity;
+    i2c_sim_wave_t pressure = sim->pressure;
+    uint8_t *regs = sim->dev.regs;
+
+    memset(sim, 0, sizeof(*sim));
+    sim->temperature = temperature;
+    sim->humidity = humidity;
+    sim->pressure = pressure;
+    sim->start_us = esp_timer_get_time();
+    sim->dev.port = port;
+    sim->dev.addr = addr;
+    sim->dev.read = bme280_sim_read;
+    sim->dev.written = bme280_sim_written;
+
+    regs[BME280_REGISTER_CHIPID] = BME280_DEFAULT_CHIPID;
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_T1, s_cal.t1);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_T2, s_cal.t2);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_T3, s_cal.t3);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P1, s_cal.p1);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P2, s_cal.p2);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P3, s_cal.p3);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P4, s_cal.p4);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P5, s_cal.p5);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P6, s_cal.p6);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P7, s_cal.p7);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P8, s_cal.p8);
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_P9, s_cal.p9);
+    regs[BME280_REGISTER_DIG_H1] = s_cal.h1;
+    bme280_sim_put16(regs, BME280_REGISTER_DIG_H2, s_cal.h2);
+    regs[BME280_REGISTER_DIG_H3] = s_cal.h3;
+    // H4 and H5 are 12 bit values sharing the nibbles of 0xE5
+    regs[BME280_REGISTER_DIG_H4] = s_cal.h4 >> 4;
+    regs[BME280_REGISTER_DIG_H5] = ((s_cal.h5 & 0xF) << 4) | (s_cal.h4 & 0xF);
+    regs[BME280_REGISTER_DIG_H5 + 1] = s_cal.h5 >> 4;
+    regs[BME280_REGISTER_DIG_H6] = s_cal.h6;
+    bme280_sim_reset(sim);
+}
+#endif
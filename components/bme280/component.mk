@@ -5,4 +5,9 @@
 
 
 COMPONENT_ADD_INCLUDEDIRS := include
-COMPONENT_SRCDIRS := .
\ No newline at end of file
+COMPONENT_SRCDIRS := .
+
+ifndef CONFIG_IDF_TARGET_LINUX
+# the simulated sensor is for host builds only
+COMPONENT_OBJEXCLUDE := bme280_sim.o
+endif
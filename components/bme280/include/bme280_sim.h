@@ -0,0 +1,46 @@
+#ifndef _BME280_SIM_H_
+#define _BME280_SIM_H_
+
+#include <stdint.h>
+#include "i2c_sim.h"
+
+/*
+ * Register-level BME280 on the simulated bus, for host (linux target)
+ * builds. It has the calibration of the compensation example in the
+ * datasheet and measures the waveforms: a write of forced mode to
+ * ctrl_meas starts a conversion that takes the typical time of the
+ * oversampling settings (DS 9.1), with the measuring bit set in the status
+ * register until the data registers latch and the sensor goes back to
+ * sleep. Normal mode converts over and over with the standby time in
+ * between. The raw ADC values are what the integer compensation of the
+ * datasheet turns into the waveform values, at the resolution of the
+ * oversampling, through the IIR filter for temperature and pressure.
+ */
+typedef struct {
+    i2c_sim_device_t dev;           /*!< registers on the simulated bus, first */
+    i2c_sim_wave_t temperature;     /*!< degC */
+    i2c_sim_wave_t humidity;        /*!< %RH */
+    i2c_sim_wave_t pressure;        /*!< hPa */
+    int64_t start_us;               /*!< esp_timer time the waveforms start at */
+    uint32_t conversions;           /*!< measurements done */
+    int64_t ready_us;               /*!< end of the running conversion, 0 when idle */
+    int64_t cycle_us;               /*!< start of the normal mode cycles */
+    uint8_t osrs_h;                 /*!< ctrl_hum, applied by a write of ctrl_meas */
+    bool filtered;                  /*!< the IIR filter holds a value */
+    uint32_t adc_t;                 /*!< filter state, 20 bits */
+    uint32_t adc_p;
+} bme280_sim_t;
+
+/**
+ * @brief Power up a simulated BME280 at addr of an I2C port, to be put on
+ *        the bus with i2c_sim_attach(&sim->dev). The waveforms are kept.
+ */
+void bme280_sim_init(bme280_sim_t *sim, uint8_t port, uint8_t addr);
+
+/**
+ * @brief Time a conversion takes with the settings in ctrl_meas and the
+ *        last ctrl_hum applied
+ */
+uint32_t bme280_sim_conversion_us(const bme280_sim_t *sim);
+
+#endif
@@ -193,6 +193,19 @@ typedef struct ctrl_hum {
     unsigned int osrs_h :3;
 } bme280_ctrl_hum_t;
 
+typedef struct {
+    float temperature;  /*!< degrees Celsius */
+    float pressure;     /*!< hPa */
+    float humidity;     /*!< %RH */
+} bme280_values_t;
+
+/* The integers the compensation formulas of the datasheet (DS 4.2.3) deliver */
+typedef struct {
+    int32_t temperature;    /*!< degrees Celsius * 100 */
+    uint32_t pressure;      /*!< Pa * 256, (pressure + 128) >> 8 rounds to Pa */
+    uint32_t humidity;      /*!< %RH * 1024 */
+} bme280_values_fixed_t;
+
 typedef void* bme280_handle_t; /*handle of bme280*/
 
 /**
@@ -328,6 +341,18 @@ bool iot_bme280_is_reading_calibration(bme280_handle_t dev);
  */
 esp_err_t iot_bme280_read_coefficients(bme280_handle_t dev);
 
+/**
+ * @brief Get the coefficients read by iot_bme280_read_coefficients
+ *
+ * @param   dev object handle of bme280
+ * @param   data where to store the coefficients
+ *
+ * @return
+ *    - ESP_OK Success
+ *    - ESP_FAIL Fail
+ */
+esp_err_t iot_bme280_get_coefficients(bme280_handle_t dev, bme280_data_t *data);
+
 /**
  * @brief  setup sensor with given parameters / settings
  *
@@ -367,14 +392,68 @@ esp_err_t iot_bme280_init(bme280_handle_t dev);
  * it will take the next measurement and then return to sleep again.
  * In normal mode simply does new measurements periodically.
  *
+ * Starts the measurement and waits for it like
+ * iot_bme280_start_forced_measurement and
+ * iot_bme280_collect_forced_measurement, without reading the results.
+ *
  * @param   dev object handle of bme280
  *
  * @return
  *    - ESP_OK Success
- *    - ESP_FAIL Fail
+ *    - ESP_ERR_TIMEOUT the sensor is still measuring after twice the
+ *      measurement duration
+ *    - the error of the bus when the sensor could not be accessed
  */
 esp_err_t iot_bme280_take_forced_measurement(bme280_handle_t dev);
 
+/**
+ * @brief  Maximum duration of a measurement with the current oversampling
+ *         settings (DS 9.1), in RTOS ticks
+ *
+ * @param   dev object handle of bme280
+ *
+ * @return
+ *    - the duration, rounded up to ticks plus one
+ */
+uint32_t iot_bme280_get_measurement_duration(bme280_handle_t dev);
+
+/**
+ * @brief  Start a measurement in forced mode and return at once
+ *
+ * The caller can do other work during the conversion and then take the
+ * results with iot_bme280_collect_forced_measurement. In normal mode
+ * nothing needs to be started.
+ *
+ * @param   dev object handle of bme280
+ *
+ * @return
+ *    - ESP_OK Success
+ *    - the error of the bus when the measurement could not be started
+ */
+esp_err_t iot_bme280_start_forced_measurement(bme280_handle_t dev);
+
+/**
+ * @brief  Read the results of the measurement started by
+ *         iot_bme280_start_forced_measurement
+ *
+ * Sleeps for what is left of iot_bme280_get_measurement_duration since the
+ * start, then reads the status register once. Only when the sensor is
+ * still measuring does it check again each tick, until twice the
+ * duration has passed. In normal mode it reads the latest results.
+ *
+ * @param   dev object handle of bme280
+ * @param   values where to store the compensated values
+ *
+ * @return
+ *    - ESP_OK Success
+ *    - ESP_ERR_INVALID_STATE no measurement was started
+ *    - ESP_ERR_TIMEOUT the sensor is still measuring after twice the
+ *      measurement duration
+ *    - the errors of iot_bme280_read_fixed
+ */
+esp_err_t iot_bme280_collect_forced_measurement(bme280_handle_t dev,
+        bme280_values_fixed_t *values);
+
 /**
  * @brief  Returns the temperature from the sensor
  *
@@ -406,20 +485,98 @@ float iot_bme280_read_pressure(bme280_handle_t dev);
 float iot_bme280_read_humidity(bme280_handle_t dev);
 
 /**
- * @brief Calculates the altitude (in meters) from the specified atmospheric
- *  pressure (in hPa), and sea-level pressure (in hPa).
+ * @brief  Reads temperature, pressure and humidity of the same conversion
+ *
+ * Takes a single burst read and compensates the temperature once for the
+ * other two, instead of the several transactions of the separate reads.
+ *
+ * @param  dev object handle of bme280
+ * @param  values where to store the compensated values
+ *
+ * @return
+ *    - ESP_OK Success
+ *    - ESP_FAIL Fail, or one of the measurements is disabled
+ */
+esp_err_t iot_bme280_read_all(bme280_handle_t dev, bme280_values_t *values);
+
+/**
+ * @brief  Reads temperature, pressure and humidity of the same conversion
+ *         in fixed point
+ *
+ * Like iot_bme280_read_all, but returns the integers of the compensation
+ * without any floating point work, for encoders that take fixed point
+ * values.
+ *
+ * @param  dev object handle of bme280
+ * @param  values where to store the compensated values
+ *
+ * @return
+ *    - ESP_OK Success
+ *    - ESP_ERR_INVALID_ARG values is NULL
+ *    - ESP_ERR_INVALID_STATE one of the measurements is disabled
+ *    - ESP_ERR_INVALID_RESPONSE the calibration data is invalid
+ *    - the error of the bus when the registers could not be read
+ */
+esp_err_t iot_bme280_read_fixed(bme280_handle_t dev,
+        bme280_values_fixed_t *values);
+
+/**
+ * @brief Calculates the altitude (in meters) from the atmospheric pressure
+ *  and the sea-level pressure (both in hPa)
+ *
+ * The barometric formula 44330 * (1 - (p / p0)^0.1903) in single precision,
+ * without double pow(). For pressures of 300 to 1100 hPa, the BME280's
+ * range, and a sea-level pressure of 950 to 1050 hPa it stays within 0.01 m
+ * of the formula computed in double precision. Outside that range the error
+ * is not bounded.
+ *
+ * @param  pressure   Atmospheric pressure in hPa, from iot_bme280_read_all
+ *                    or iot_bme280_read_fixed (pressure / 25600.0f)
+ * @param  sea_level  Sea-level pressure (QNH) in hPa
+ *
+ * @return
+ *    - altitude value
+ *    - NAN if pressure or sea_level is not a positive finite number
+ */
+float iot_bme280_altitude(float pressure, float sea_level);
+
+/**
+ * @brief Calculates the pressure at sea level (QNH, in hPa) from the
+ *  atmospheric pressure (in hPa) at an altitude (in meters)
+ *
+ * The inverse of iot_bme280_altitude, p / (1 - h / 44330)^5.255, in single
+ * precision. For pressures of 300 to 1100 hPa at altitudes of -700 to
+ * 9200 m, where a sea-level pressure of 950 to 1050 hPa puts them, it stays
+ * within 0.001 hPa of the formula computed in double precision. Outside
+ * that range the error is not bounded.
+ *
+ * @param  pressure   Atmospheric pressure in hPa
+ * @param  altitude   Altitude in meters, below 44330 m
+ *
+ * @return
+ *    - pressure value
+ *    - NAN if pressure is not a positive finite number or altitude is not
+ *      below 44330 m
+ */
+float iot_bme280_sea_level_pressure(float pressure, float altitude);
+
+/**
+ * @brief Reads the pressure and calculates the altitude (in meters) from it
+ *  and the sea-level pressure (in hPa), see iot_bme280_altitude
  *
  * @param  dev object handle of bme280
  * @param  seaLevel: Sea-level pressure in hPa
  *
  * @return
  *    - altitude value
+ *    - ESP_FAIL the pressure could not be read
  */
 float iot_bme280_read_altitude(bme280_handle_t dev, float seaLevel);
 
 /**
  * Calculates the pressure at sea level (in hPa) from the specified altitude
- * (in meters), and atmospheric pressure (in hPa).
+ * (in meters), and atmospheric pressure (in hPa), see
+ * iot_bme280_sea_level_pressure
  *
  * @param  dev object handle of bme280
  * @param  altitude      Altitude in meters
@@ -520,6 +677,32 @@ public:
      */
     esp_err_t take_forced_measurement(void);
 
+    /**
+     * @brief  Maximum duration of a measurement, in RTOS ticks
+     */
+    uint32_t measurement_duration(void);
+
+    /**
+     * @brief  Start a measurement in forced mode and return at once
+     *
+     * @return
+     *    - ESP_OK Success
+     *    - the error of iot_bme280_start_forced_measurement
+     */
+    esp_err_t start_forced_measurement(void);
+
+    /**
+     * @brief  Read the results of the measurement started by
+     *         start_forced_measurement
+     *
+     * @param   values where to store the compensated values
+     *
+     * @return
+     *    - ESP_OK Success
+     *    - the error of iot_bme280_collect_forced_measurement
+     */
+    esp_err_t collect_forced_measurement(bme280_values_fixed_t *values);
+
     /**
      * @brief  Returns the temperature from the sensor
      *
@@ -549,6 +732,30 @@ public:
      *    - humidity value
      */
     float humidity();
+
+    /**
+     * @brief  Reads temperature, pressure and humidity of the same conversion
+     *
+     * @param   values where to store the compensated values
+     *
+     * @return
+     *    - ESP_OK Success
+     *    - ESP_FAIL Fail
+     */
+    esp_err_t read_all(bme280_values_t *values);
+
+    /**
+     * @brief  Reads temperature, pressure and humidity of the same conversion
+     *         in fixed point
+     *
+     * @param   values where to store the compensated values
+     *
+     * @return
+     *    - ESP_OK Success
+     *    - the error of iot_bme280_read_fixed
+     */
+    esp_err_t read_fixed(bme280_values_fixed_t *values);
+
     /**
      * @brief Calculates the altitude (in meters) from the specified atmospheric
      *  pressure (in hPa), and sea-level pressure (in hPa).
@@ -573,6 +780,18 @@ public:
      *    - pressure value
      */
     float calculates_pressure(float altitude, float atmospheric);
+
+    /**
+     * @brief Calculates the altitude (in meters) from the atmospheric
+     *  pressure and the sea-level pressure (both in hPa)
+     */
+    static float altitude(float pressure, float sea_level);
+
+    /**
+     * @brief Calculates the pressure at sea level (in hPa) from the
+     *  atmospheric pressure (in hPa) at an altitude (in meters)
+     */
+    static float sea_level_pressure(float pressure, float altitude);
 };
 #endif
 
@@ -0,0 +1,162 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "driver/i2c.h"
+#include "iot_bme280.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+/*
+ * Counting allocator, the test app links with --wrap for malloc, calloc and
+ * realloc so every heap call of the code under test passes through here.
+ */
+static bool s_counting;
+static unsigned s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    s_allocs += s_counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    s_allocs += s_counting;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    s_allocs += s_counting;
+    return __real_realloc(ptr, size);
+}
+
+static i2c_bus_handle_t bme280_sim_bus(i2c_sim_device_t *sim, uint8_t addr)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+
+    memset(sim, 0, sizeof(*sim));
+    sim->addr = addr;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(sim);
+    return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+/**
+ * @brief forced mode: trigger a conversion, poll the status, read the results
+ */
+static void bme280_sample(bme280_handle_t dev)
+{
+    bme280_values_t values;
+    uint8_t status;
+
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_write_byte(dev,
+            BME280_REGISTER_CONTROL, 0x25));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_byte(dev,
+            BME280_REGISTER_STATUS, &status));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_all(dev, &values));
+}
+
+TEST_CASE("bme280 sampling loop doesn't allocate", "[bme280][host]")
+{
+    static i2c_sim_device_t sim;
+
+    i2c_bus_handle_t bus = bme280_sim_bus(&sim, BME280_I2C_ADDRESS_DEFAULT);
+    sim.regs[BME280_REGISTER_CHIPID] = BME280_DEFAULT_CHIPID;
+    // a plausible calibration, T1 and P1 must not be 0
+    sim.regs[BME280_REGISTER_DIG_T1 + 1] = 0x6B;
+    sim.regs[BME280_REGISTER_DIG_P1 + 1] = 0x8E;
+    sim.regs[BME280_REGISTER_PRESSUREDATA] = 0x65;
+    sim.regs[BME280_REGISTER_TEMPDATA] = 0x7E;
+    sim.regs[BME280_REGISTER_HUMIDDATA] = 0x6A;
+    bme280_handle_t dev = iot_bme280_create(bus, BME280_I2C_ADDRESS_DEFAULT);
+    TEST_ASSERT_NOT_NULL(dev);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_init(dev));
+
+    // the first sample prepares the transactions init didn't need
+    bme280_sample(dev);
+    s_allocs = 0;
+    s_counting = true;
+    for (int i = 0; i < 100; i++) {
+        bme280_sample(dev);
+    }
+    s_counting = false;
+    TEST_ASSERT_EQUAL(0, s_allocs);
+
+    iot_bme280_delete(dev, true);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus device builds its links in place", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sim;
+    uint8_t data[40];
+    uint8_t back[sizeof(data)];
+
+    i2c_bus_handle_t bus = bme280_sim_bus(&sim, 0x50);
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x50);
+    TEST_ASSERT_NOT_NULL(dev);
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7 + 1;
+    }
+
+    // every size and register in turn lands in the right registers, no
+    // link carries over what the one before was built for
+    for (int round = 0; round < 3; round++) {
+        for (size_t len = 1; len <= 6; len++) {
+            uint8_t reg = 0x10 * len;
+            memset(back, 0, sizeof(back));
+            TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_write_reg(dev, reg, data, len,
+                    1000 / portTICK_RATE_MS));
+            TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, reg, back, len,
+                    1000 / portTICK_RATE_MS));
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(data, back, len);
+            TEST_ASSERT_EQUAL_HEX8_ARRAY(data, &sim.regs[reg], len);
+        }
+    }
+
+    // repeating the same accesses needs no heap
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_write_reg(dev, 0x20, data, 2,
+            1000 / portTICK_RATE_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0x20, back, 2,
+            1000 / portTICK_RATE_MS));
+    s_allocs = 0;
+    s_counting = true;
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_write_reg(dev, 0x20, data, 2,
+                1000 / portTICK_RATE_MS));
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0x20, back, 2,
+                1000 / portTICK_RATE_MS));
+    }
+    s_counting = false;
+    TEST_ASSERT_EQUAL(0, s_allocs);
+
+    // and so do long accesses
+    memset(back, 0, sizeof(back));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_write_reg(dev, 0x80, data,
+            sizeof(data), 1000 / portTICK_RATE_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0x80, back,
+            sizeof(back), 1000 / portTICK_RATE_MS));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(data, back, sizeof(data));
+
+    // a device that isn't there doesn't acknowledge
+    sim.addr = 0x51;
+    TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(dev, 0x20, back, 2,
+            1000 / portTICK_RATE_MS));
+
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -0,0 +1,121 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include "unity.h"
+#include "iot_bme280.h"
+
+#define ALTITUDE_MAX_ERROR_M        0.01
+#define QNH_MAX_ERROR_HPA           0.001
+#define BENCH_CALLS                 1000000
+
+static const float s_sea_levels[] = { 950.0f, 1013.25f, 1050.0f };
+
+static double reference_altitude(double pressure, double sea_level)
+{
+    return 44330.0 * (1.0 - pow(pressure / sea_level, 0.1903));
+}
+
+static double reference_sea_level(double pressure, double altitude)
+{
+    return pressure / pow(1.0 - altitude / 44330.0, 5.255);
+}
+
+TEST_CASE("bme280 altitude and QNH match the formulas from 300 to 1100 hPa",
+        "[bme280][host]")
+{
+    for (int i = 0; i < sizeof(s_sea_levels) / sizeof(s_sea_levels[0]); i++) {
+        double altitude_error = 0, qnh_error = 0;
+        float worst_pressure = 0;
+
+        // every 0.01 hPa
+        for (int step = 30000; step <= 110000; step++) {
+            float pressure = step / 100.0f;
+            double altitude = reference_altitude(pressure, s_sea_levels[i]);
+            double error = fabs(iot_bme280_altitude(pressure, s_sea_levels[i])
+                    - altitude);
+            if (error > altitude_error) {
+                altitude_error = error;
+                worst_pressure = pressure;
+            }
+            // the QNH of the pressure at the altitude it gives
+            error = fabs(iot_bme280_sea_level_pressure(pressure, altitude)
+                    - reference_sea_level(pressure, (float) altitude));
+            if (error > qnh_error) {
+                qnh_error = error;
+            }
+        }
+        printf("QNH %.2f hPa: altitude within %.4f m (at %.2f hPa), "
+                "QNH within %.5f hPa\n", s_sea_levels[i], altitude_error,
+                worst_pressure, qnh_error);
+        TEST_ASSERT_TRUE(altitude_error < ALTITUDE_MAX_ERROR_M);
+        TEST_ASSERT_TRUE(qnh_error < QNH_MAX_ERROR_HPA);
+    }
+    // the datasheet pressure at the altitudes of the standard atmosphere
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 0, iot_bme280_altitude(1013.25f, 1013.25f));
+    TEST_ASSERT_FLOAT_WITHIN(1, 110.9, iot_bme280_altitude(1000.0f, 1013.25f));
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 1013.25,
+            iot_bme280_sea_level_pressure(1000.0f,
+                    iot_bme280_altitude(1000.0f, 1013.25f)));
+}
+
+TEST_CASE("bme280 altitude and QNH reject pressures and altitudes out of "
+        "their domain", "[bme280][host]")
+{
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(0.0f, 1013.25f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(-1000.0f, 1013.25f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(1000.0f, 0.0f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(1000.0f, -1013.25f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(NAN, 1013.25f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_altitude(1000.0f, INFINITY)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_sea_level_pressure(0.0f, 100.0f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_sea_level_pressure(-1.0f, 100.0f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_sea_level_pressure(1000.0f, 44330.0f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_sea_level_pressure(1000.0f, 50000.0f)));
+    TEST_ASSERT_TRUE(isnan(iot_bme280_sea_level_pressure(1000.0f, NAN)));
+    // tiny and huge ratios saturate instead of wrapping the exponent
+    TEST_ASSERT_TRUE(iot_bme280_sea_level_pressure(1000.0f, 44329.99f) > 1e30f);
+    TEST_ASSERT_TRUE(isinf(iot_bme280_sea_level_pressure(1e30f, 44329.99f)));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 44330, iot_bme280_altitude(1e-30f, 1e30f));
+    TEST_ASSERT_TRUE(isinf(iot_bme280_altitude(1e30f, 1e-30f)));
+}
+
+static double bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+TEST_CASE("bme280 altitude benchmark", "[bme280][host]")
+{
+    volatile float sink = 0;
+    double start;
+
+    // on the host the FPU runs double pow() too, on the ESP32 it is software
+    start = bench_ns();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        sink += iot_bme280_altitude(300.0f + i % 8000 * 0.1f, 1013.25f);
+    }
+    double fast = (bench_ns() - start) / BENCH_CALLS;
+
+    start = bench_ns();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        sink += 44330.0f * (1.0f - powf((300.0f + i % 8000 * 0.1f) / 1013.25f,
+                0.1903f));
+    }
+    double single = (bench_ns() - start) / BENCH_CALLS;
+
+    start = bench_ns();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        sink += reference_altitude(300.0f + i % 8000 * 0.1f, 1013.25f);
+    }
+    double reference = (bench_ns() - start) / BENCH_CALLS;
+
+    printf("altitude: %.1f ns, powf %.1f ns, double pow %.1f ns a call\n",
+            fast, single, reference);
+    TEST_ASSERT_TRUE(sink != 0);
+}
+#endif
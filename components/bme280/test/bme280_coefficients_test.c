@@ -0,0 +1,113 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "driver/i2c.h"
+#include "iot_bme280.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+/**
+ * @brief the coefficients as the driver used to decode them, one register
+ *        at a time
+ */
+static void bme280_decode_by_register(const uint8_t *regs, bme280_data_t *data)
+{
+#define LE16(reg) ((uint16_t) ((regs[(reg) + 1] << 8) | regs[reg]))
+    data->dig_t1 = LE16(BME280_REGISTER_DIG_T1);
+    data->dig_t2 = (int16_t) LE16(BME280_REGISTER_DIG_T2);
+    data->dig_t3 = (int16_t) LE16(BME280_REGISTER_DIG_T3);
+    data->dig_p1 = LE16(BME280_REGISTER_DIG_P1);
+    data->dig_p2 = (int16_t) LE16(BME280_REGISTER_DIG_P2);
+    data->dig_p3 = (int16_t) LE16(BME280_REGISTER_DIG_P3);
+    data->dig_p4 = (int16_t) LE16(BME280_REGISTER_DIG_P4);
+    data->dig_p5 = (int16_t) LE16(BME280_REGISTER_DIG_P5);
+    data->dig_p6 = (int16_t) LE16(BME280_REGISTER_DIG_P6);
+    data->dig_p7 = (int16_t) LE16(BME280_REGISTER_DIG_P7);
+    data->dig_p8 = (int16_t) LE16(BME280_REGISTER_DIG_P8);
+    data->dig_p9 = (int16_t) LE16(BME280_REGISTER_DIG_P9);
+    data->dig_h1 = regs[BME280_REGISTER_DIG_H1];
+    data->dig_h2 = (int16_t) LE16(BME280_REGISTER_DIG_H2);
+    data->dig_h3 = regs[BME280_REGISTER_DIG_H3];
+    data->dig_h4 = (regs[BME280_REGISTER_DIG_H4] << 4)
+            | (regs[BME280_REGISTER_DIG_H4 + 1] & 0xF);
+    data->dig_h5 = (regs[BME280_REGISTER_DIG_H5 + 1] << 4)
+            | (regs[BME280_REGISTER_DIG_H5] >> 4);
+    data->dig_h6 = (int8_t) regs[BME280_REGISTER_DIG_H6];
+#undef LE16
+}
+
+static void bme280_check_coefficients(const bme280_data_t *expected,
+        const bme280_data_t *actual)
+{
+    TEST_ASSERT_EQUAL(expected->dig_t1, actual->dig_t1);
+    TEST_ASSERT_EQUAL(expected->dig_t2, actual->dig_t2);
+    TEST_ASSERT_EQUAL(expected->dig_t3, actual->dig_t3);
+    TEST_ASSERT_EQUAL(expected->dig_p1, actual->dig_p1);
+    TEST_ASSERT_EQUAL(expected->dig_p2, actual->dig_p2);
+    TEST_ASSERT_EQUAL(expected->dig_p3, actual->dig_p3);
+    TEST_ASSERT_EQUAL(expected->dig_p4, actual->dig_p4);
+    TEST_ASSERT_EQUAL(expected->dig_p5, actual->dig_p5);
+    TEST_ASSERT_EQUAL(expected->dig_p6, actual->dig_p6);
+    TEST_ASSERT_EQUAL(expected->dig_p7, actual->dig_p7);
+    TEST_ASSERT_EQUAL(expected->dig_p8, actual->dig_p8);
+    TEST_ASSERT_EQUAL(expected->dig_p9, actual->dig_p9);
+    TEST_ASSERT_EQUAL(expected->dig_h1, actual->dig_h1);
+    TEST_ASSERT_EQUAL(expected->dig_h2, actual->dig_h2);
+    TEST_ASSERT_EQUAL(expected->dig_h3, actual->dig_h3);
+    TEST_ASSERT_EQUAL(expected->dig_h4, actual->dig_h4);
+    TEST_ASSERT_EQUAL(expected->dig_h5, actual->dig_h5);
+    TEST_ASSERT_EQUAL(expected->dig_h6, actual->dig_h6);
+}
+
+TEST_CASE("bme280 reads coefficients in two transactions", "[bme280][host]")
+{
+    static i2c_sim_device_t sim;
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    bme280_data_t expected, actual;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.addr = BME280_I2C_ADDRESS_DEFAULT;
+    sim.regs[BME280_REGISTER_CHIPID] = BME280_DEFAULT_CHIPID;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sim);
+    i2c_bus_handle_t bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    bme280_handle_t dev = iot_bme280_create(bus, BME280_I2C_ADDRESS_DEFAULT);
+    TEST_ASSERT_NOT_NULL(dev);
+
+    // random maps hit every sign and nibble combination, the first two are
+    // the extremes
+    srand(280);
+    for (int i = 0; i < 200; i++) {
+        for (int reg = BME280_REGISTER_DIG_T1; reg <= BME280_REGISTER_DIG_H6;
+                reg++) {
+            if (reg <= BME280_REGISTER_DIG_H1 || reg >= BME280_REGISTER_DIG_H2) {
+                sim.regs[reg] = i == 0 ? 0x00 : i == 1 ? 0xFF : rand();
+            }
+        }
+        bme280_decode_by_register(sim.regs, &expected);
+
+        sim.transactions = 0;
+        TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_coefficients(dev));
+        TEST_ASSERT_EQUAL(2, sim.transactions);
+        TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_get_coefficients(dev, &actual));
+        bme280_check_coefficients(&expected, &actual);
+    }
+
+    // the whole bring-up, for comparison with the 30 reads this used to take
+    sim.transactions = 0;
+    sim.bytes = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_init(dev));
+    printf("iot_bme280_init: %u transactions, %u bytes\n",
+            (unsigned) sim.transactions, (unsigned) sim.bytes);
+
+    iot_bme280_delete(dev, true);
+    i2c_sim_attach(NULL);
+}
+#endif
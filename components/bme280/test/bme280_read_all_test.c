@@ -0,0 +1,151 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "driver/i2c.h"
+#include "iot_bme280.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+static void bme280_sim_put16(i2c_sim_device_t *sim, uint8_t reg, int32_t value)
+{
+    sim->regs[reg] = value & 0xFF;
+    sim->regs[reg + 1] = (value >> 8) & 0xFF;
+}
+
+static void bme280_sim_put20(i2c_sim_device_t *sim, uint8_t reg, int32_t value)
+{
+    sim->regs[reg] = (value >> 12) & 0xFF;
+    sim->regs[reg + 1] = (value >> 4) & 0xFF;
+    sim->regs[reg + 2] = (value << 4) & 0xF0;
+}
+
+/**
+ * @brief the calibration and readings of the compensation example in the
+ *        Bosch datasheet, with typical humidity coefficients
+ */
+static void bme280_sim_datasheet(i2c_sim_device_t *sim)
+{
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_T1, 27504);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_T2, 26435);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_T3, -1000);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P1, 36477);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P2, -10685);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P3, 3024);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P4, 2855);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P5, 140);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P6, -7);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P7, 15500);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P8, -14600);
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_P9, 6000);
+    sim->regs[BME280_REGISTER_DIG_H1] = 75;
+    bme280_sim_put16(sim, BME280_REGISTER_DIG_H2, 362);
+    sim->regs[BME280_REGISTER_DIG_H3] = 0;
+    // H4 and H5 are 12 bit values sharing the nibbles of 0xE5
+    sim->regs[BME280_REGISTER_DIG_H4] = 313 >> 4;
+    sim->regs[BME280_REGISTER_DIG_H5] = ((50 & 0xF) << 4) | (313 & 0xF);
+    sim->regs[BME280_REGISTER_DIG_H5 + 1] = 50 >> 4;
+    sim->regs[BME280_REGISTER_DIG_H6] = 30;
+
+    bme280_sim_put20(sim, BME280_REGISTER_PRESSUREDATA, 415148);
+    bme280_sim_put20(sim, BME280_REGISTER_TEMPDATA, 519888);
+    sim->regs[BME280_REGISTER_HUMIDDATA] = 0x6A;
+    sim->regs[BME280_REGISTER_HUMIDDATA + 1] = 0x40;
+}
+
+TEST_CASE("bme280 reads all measurements in one transaction", "[bme280][host]")
+{
+    static i2c_sim_device_t sim;
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    bme280_values_t values;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.addr = BME280_I2C_ADDRESS_DEFAULT;
+    sim.regs[BME280_REGISTER_CHIPID] = BME280_DEFAULT_CHIPID;
+    bme280_sim_datasheet(&sim);
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sim);
+    i2c_bus_handle_t bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    bme280_handle_t dev = iot_bme280_create(bus, BME280_I2C_ADDRESS_DEFAULT);
+    TEST_ASSERT_NOT_NULL(dev);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_coefficients(dev));
+
+    sim.transactions = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_all(dev, &values));
+    TEST_ASSERT_EQUAL(1, sim.transactions);
+
+    // the same values the separate reads return, for a fifth of the bus time
+    sim.transactions = 0;
+    float temperature = iot_bme280_read_temperature(dev);
+    float pressure = iot_bme280_read_pressure(dev);
+    float humidity = iot_bme280_read_humidity(dev);
+    printf("separate reads: %u transactions\n", (unsigned) sim.transactions);
+    TEST_ASSERT_EQUAL_FLOAT(temperature, values.temperature);
+    TEST_ASSERT_EQUAL_FLOAT(pressure, values.pressure);
+    TEST_ASSERT_EQUAL_FLOAT(humidity, values.humidity);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 25.08, values.temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 1006.53, values.pressure);
+    TEST_ASSERT_TRUE(values.humidity > 0 && values.humidity < 100);
+
+    // a skipped humidity measurement reads back as 0x8000
+    sim.regs[BME280_REGISTER_HUMIDDATA] = 0x80;
+    sim.regs[BME280_REGISTER_HUMIDDATA + 1] = 0x00;
+    TEST_ASSERT_EQUAL(ESP_FAIL, iot_bme280_read_all(dev, &values));
+
+    iot_bme280_delete(dev, true);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("bme280 reads fixed point values", "[bme280][host]")
+{
+    static i2c_sim_device_t sim;
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    bme280_values_fixed_t fixed;
+    bme280_values_t values;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.addr = BME280_I2C_ADDRESS_DEFAULT;
+    sim.regs[BME280_REGISTER_CHIPID] = BME280_DEFAULT_CHIPID;
+    bme280_sim_datasheet(&sim);
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sim);
+    i2c_bus_handle_t bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    bme280_handle_t dev = iot_bme280_create(bus, BME280_I2C_ADDRESS_DEFAULT);
+    TEST_ASSERT_NOT_NULL(dev);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_coefficients(dev));
+
+    sim.transactions = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_fixed(dev, &fixed));
+    TEST_ASSERT_EQUAL(1, sim.transactions);
+    printf("%d cC, %u Pa/256, %u %%RH/1024\n", fixed.temperature,
+            fixed.pressure, fixed.humidity);
+    // the results of the compensation example of the datasheet
+    TEST_ASSERT_EQUAL_INT32(2508, fixed.temperature);
+    TEST_ASSERT_INT_WITHIN(8, 25767236, fixed.pressure);
+    TEST_ASSERT_EQUAL_UINT32(100653, (fixed.pressure + 128) >> 8);
+
+    // the floats are the same integers scaled
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_all(dev, &values));
+    TEST_ASSERT_EQUAL_FLOAT(fixed.temperature / 100.0, values.temperature);
+    TEST_ASSERT_EQUAL_FLOAT((fixed.pressure >> 8) / 100.0, values.pressure);
+    TEST_ASSERT_EQUAL_FLOAT(fixed.humidity / 1024.0, values.humidity);
+
+    // errors don't look like values
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, iot_bme280_read_fixed(dev, NULL));
+    sim.regs[BME280_REGISTER_HUMIDDATA] = 0x80;
+    sim.regs[BME280_REGISTER_HUMIDDATA + 1] = 0x00;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, iot_bme280_read_fixed(dev, &fixed));
+    i2c_sim_attach(NULL);
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, iot_bme280_read_fixed(dev, &fixed));
+
+    iot_bme280_delete(dev, true);
+}
+#endif
@@ -0,0 +1,183 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "iot_bme280.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+#include "bme280_sim.h"
+
+#define SIM_PERIOD_MS       1000
+#define SIM_SAMPLES         10
+
+/* a warm front: it gets warmer and more humid while the pressure falls */
+static const i2c_sim_point_t s_temperature[] = { { 0, 20 }, { 10000, 30 } };
+static const i2c_sim_point_t s_humidity[] = { { 0, 40 }, { 10000, 60 } };
+static const i2c_sim_point_t s_pressure[] = { { 0, 1000 }, { 10000, 990 } };
+
+static bme280_sim_t s_sim;
+
+static bme280_handle_t sim_sensor(uint32_t clk_hz, i2c_bus_handle_t *bus)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = clk_hz,
+    };
+
+    s_sim.temperature = (i2c_sim_wave_t) { s_temperature, 2 };
+    s_sim.humidity = (i2c_sim_wave_t) { s_humidity, 2 };
+    s_sim.pressure = (i2c_sim_wave_t) { s_pressure, 2 };
+    bme280_sim_init(&s_sim, I2C_NUM_0, BME280_I2C_ADDRESS_DEFAULT);
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&s_sim.dev);
+    *bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    bme280_handle_t dev = iot_bme280_create(*bus, BME280_I2C_ADDRESS_DEFAULT);
+    TEST_ASSERT_NOT_NULL(dev);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_init(dev));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_set_sampling(dev, BME280_MODE_FORCED,
+            BME280_SAMPLING_X1, BME280_SAMPLING_X1, BME280_SAMPLING_X1,
+            BME280_FILTER_OFF, BME280_STANDBY_MS_0_5));
+    return dev;
+}
+
+static void sim_sample(bme280_handle_t dev, bme280_values_t *values)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_take_forced_measurement(dev));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_all(dev, values));
+}
+
+TEST_CASE("bme280 model follows the waveforms", "[bme280][host]")
+{
+    i2c_bus_handle_t bus;
+    bme280_values_t values;
+
+    bme280_handle_t dev = sim_sensor(100000, &bus);
+    for (int i = 0; i < SIM_SAMPLES; i++) {
+        vTaskDelay(SIM_PERIOD_MS / portTICK_PERIOD_MS);
+        sim_sample(dev, &values);
+        // the values of when the conversion ended, a few ms ago
+        uint32_t t_ms = (esp_timer_get_time() - s_sim.start_us) / 1000;
+        float temperature = i2c_sim_wave_at(&s_sim.temperature, t_ms);
+        float humidity = i2c_sim_wave_at(&s_sim.humidity, t_ms);
+        float pressure = i2c_sim_wave_at(&s_sim.pressure, t_ms);
+        printf("%5u ms: %.2f C %.2f %% %.2f hPa, model %.2f C %.2f %% %.2f hPa\n",
+                t_ms, values.temperature, values.humidity, values.pressure,
+                temperature, humidity, pressure);
+        TEST_ASSERT_FLOAT_WITHIN(0.05, temperature, values.temperature);
+        TEST_ASSERT_FLOAT_WITHIN(0.1, humidity, values.humidity);
+        TEST_ASSERT_FLOAT_WITHIN(0.05, pressure, values.pressure);
+    }
+    TEST_ASSERT_EQUAL(SIM_SAMPLES, s_sim.conversions);
+
+    // normal mode keeps converting on its own
+    uint32_t conversions = s_sim.conversions;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_set_sampling(dev, BME280_MODE_NORMAL,
+            BME280_SAMPLING_X1, BME280_SAMPLING_X1, BME280_SAMPLING_X1,
+            BME280_FILTER_OFF, BME280_STANDBY_MS_125));
+    vTaskDelay(1000 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_read_all(dev, &values));
+    printf("normal mode: %u conversions in 1 s of %u us each\n",
+            s_sim.conversions - conversions, bme280_sim_conversion_us(&s_sim));
+    TEST_ASSERT_INT_WITHIN(1, 1000000 / (125000 + bme280_sim_conversion_us(&s_sim)),
+            s_sim.conversions - conversions);
+
+    iot_bme280_delete(dev, false);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("bme280 forced measurement sleeps the conversion time", "[bme280][host]")
+{
+    static const bme280_sensor_sampling samplings[] = {
+        BME280_SAMPLING_X1, BME280_SAMPLING_X4, BME280_SAMPLING_X16
+    };
+    i2c_bus_handle_t bus;
+    bme280_values_fixed_t values;
+
+    bme280_handle_t dev = sim_sensor(400000, &bus);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+            iot_bme280_collect_forced_measurement(dev, &values));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_set_sampling(dev, BME280_MODE_FORCED,
+                samplings[i], samplings[i], samplings[i], BME280_FILTER_OFF,
+                BME280_STANDBY_MS_0_5));
+        uint32_t ticks = iot_bme280_get_measurement_duration(dev);
+        int64_t start = esp_timer_get_time();
+        s_sim.dev.transactions = 0;
+        TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_start_forced_measurement(dev));
+        TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_collect_forced_measurement(dev, &values));
+        int64_t elapsed = esp_timer_get_time() - start;
+        printf("osrs %d: %lld us for a %u us conversion, %u transactions\n",
+                samplings[i], elapsed, bme280_sim_conversion_us(&s_sim),
+                s_sim.dev.transactions);
+        // one sleep, then ctrl_meas, status and data each take one command
+        TEST_ASSERT_EQUAL(ticks * portTICK_PERIOD_MS * 1000, elapsed);
+        TEST_ASSERT_TRUE(elapsed >= bme280_sim_conversion_us(&s_sim));
+        TEST_ASSERT_EQUAL(3, s_sim.dev.transactions);
+    }
+
+    // time spent elsewhere during the conversion counts
+    uint32_t conversions = s_sim.conversions;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_start_forced_measurement(dev));
+    vTaskDelay(2 * iot_bme280_get_measurement_duration(dev));
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_collect_forced_measurement(dev, &values));
+    TEST_ASSERT_EQUAL(start, esp_timer_get_time());
+    TEST_ASSERT_EQUAL(conversions + 1, s_sim.conversions);
+
+    // a sensor that never finishes times out after twice the duration
+    uint32_t ticks = iot_bme280_get_measurement_duration(dev);
+    TickType_t tick = xTaskGetTickCount();
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_start_forced_measurement(dev));
+    s_sim.ready_us = INT64_MAX;
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_bme280_collect_forced_measurement(dev, &values));
+    TEST_ASSERT_INT_WITHIN(1, 2 * ticks, xTaskGetTickCount() - tick);
+
+    // and a failing status read ends the wait instead of spinning
+    TEST_ASSERT_EQUAL(ESP_OK, iot_bme280_start_forced_measurement(dev));
+    i2c_sim_attach(NULL);
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, iot_bme280_collect_forced_measurement(dev, &values));
+
+    iot_bme280_delete(dev, false);
+    iot_i2c_bus_delete(bus);
+}
+
+TEST_CASE("bme280 bus time per sample at each clock", "[bme280][host]")
+{
+    static const uint32_t clocks[] = { 100000, 400000, 1000000 };
+    i2c_sim_stats_t stats[3];
+    i2c_bus_handle_t bus;
+    bme280_values_t values;
+
+    for (int i = 0; i < 3; i++) {
+        bme280_handle_t dev = sim_sensor(clocks[i], &bus);
+        i2c_sim_reset_stats();
+        for (int n = 0; n < SIM_SAMPLES; n++) {
+            sim_sample(dev, &values);
+        }
+        i2c_sim_get_stats(I2C_NUM_0, &stats[i]);
+        printf("%7u Hz: %.1f commands, %.1f bytes, %.1f us on the bus per sample\n",
+                clocks[i], (float) stats[i].transactions / SIM_SAMPLES,
+                (float) stats[i].bytes / SIM_SAMPLES,
+                (float) stats[i].bus_ns / SIM_SAMPLES / 1000);
+        iot_bme280_delete(dev, false);
+        iot_i2c_bus_delete(bus);
+    }
+    // the same traffic, the time on the wire goes with the clock
+    for (int i = 1; i < 3; i++) {
+        TEST_ASSERT_EQUAL(stats[0].transactions, stats[i].transactions);
+        TEST_ASSERT_EQUAL(stats[0].bytes, stats[i].bytes);
+        TEST_ASSERT_UINT64_WITHIN(stats[i].transactions,
+                stats[0].bus_ns * clocks[0] / clocks[i], stats[i].bus_ns);
+    }
+    // 9 bits a byte, a START or STOP takes one bit time
+    TEST_ASSERT_TRUE(stats[0].bus_ns >= stats[0].bytes * 9 * 10000ULL);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -3,3 +3,8 @@
 #
 
 COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
+
+ifdef CONFIG_IDF_TARGET_LINUX
+# bme280_alloc_test counts the heap calls of the sampling loop
+COMPONENT_ADD_LDFLAGS += -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+endif
@@ -52,5 +52,152 @@
 
 #include "bme680_platform.h"
 
+#include "driver/i2c.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "esp_timer.h"
+#include "i2c_sim.h"
+#endif
+
 SemaphoreHandle_t spi_sem = 0;
 
+#ifdef ESP_PLATFORM  // ESP32 (ESP-IDF)
+
+// esp-open-rtos I2C interface on top of the iot_i2c_bus driver, so the BME680
+// shares its port, register accesses, locking, statistics and clock with
+// every other device on it
+
+#define I2C_MAX_DEVICES 4
+#define I2C_TIMEOUT (1000 / portTICK_RATE_MS)
+
+static i2c_bus_handle_t i2c_buses[I2C_NUM_MAX];
+static bool i2c_buses_owned[I2C_NUM_MAX];
+static struct {
+  uint8_t bus;
+  uint8_t addr;
+  i2c_bus_device_handle_t dev;
+} i2c_devices[I2C_MAX_DEVICES];
+
+void i2c_init(int bus, gpio_num_t scl, gpio_num_t sda, uint32_t freq) {
+  if (bus < 0 || bus >= I2C_NUM_MAX || i2c_buses[bus]) return;
+
+  i2c_config_t conf;
+  conf.mode = I2C_MODE_MASTER;
+  conf.sda_io_num = sda;
+  conf.scl_io_num = scl;
+  conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
+  conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
+  conf.master.clk_speed = freq;
+  i2c_buses[bus] = iot_i2c_bus_create(bus, &conf);
+  i2c_buses_owned[bus] = i2c_buses[bus] != NULL;
+}
+
+void i2c_attach(int bus, i2c_bus_handle_t handle) {
+  if (bus < 0 || bus >= I2C_NUM_MAX) return;
+
+  if (handle) {
+    if (!i2c_buses[bus]) i2c_buses[bus] = handle;
+    return;
+  }
+
+  for (int i = 0; i < I2C_MAX_DEVICES; i++) {
+    if (i2c_devices[i].dev && i2c_devices[i].bus == bus) {
+      iot_i2c_bus_device_delete(i2c_devices[i].dev);
+      i2c_devices[i].dev = NULL;
+    }
+  }
+  if (i2c_buses_owned[bus]) iot_i2c_bus_delete(i2c_buses[bus]);
+  i2c_buses[bus] = NULL;
+  i2c_buses_owned[bus] = false;
+}
+
+static i2c_bus_device_handle_t i2c_device(uint8_t bus, uint8_t addr) {
+  if (bus >= I2C_NUM_MAX || !i2c_buses[bus]) return NULL;
+
+  int free_slot = -1;
+  for (int i = 0; i < I2C_MAX_DEVICES; i++) {
+    if (!i2c_devices[i].dev) {
+      if (free_slot < 0) free_slot = i;
+    } else if (i2c_devices[i].bus == bus && i2c_devices[i].addr == addr) {
+      return i2c_devices[i].dev;
+    }
+  }
+  if (free_slot < 0) return NULL;
+
+  i2c_devices[free_slot].dev = iot_i2c_bus_device_create(i2c_buses[bus], addr);
+  i2c_devices[free_slot].bus = bus;
+  i2c_devices[free_slot].addr = addr;
+  return i2c_devices[free_slot].dev;
+}
+
+// accesses without a register queue a command of their own on the device
+static esp_err_t i2c_cmd_begin(i2c_bus_device_handle_t dev, uint8_t addr,
+                               const uint8_t *reg, uint8_t *data, uint32_t len,
+                               bool read) {
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  if (!cmd) return ESP_ERR_NO_MEM;
+
+  if (reg || !read) {
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (addr << 1) | I2C_MASTER_WRITE, true);
+    if (reg) i2c_master_write_byte(cmd, *reg, true);
+    if (!read && data) i2c_master_write(cmd, data, len, true);
+  }
+  if (read && data) {
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (addr << 1) | I2C_MASTER_READ, true);
+    if (len > 1) i2c_master_read(cmd, data, len - 1, I2C_MASTER_ACK);
+    i2c_master_read_byte(cmd, data + len - 1, I2C_MASTER_NACK);
+  }
+  i2c_master_stop(cmd);
+  esp_err_t err =
+      iot_i2c_bus_device_cmd_begin(dev, cmd, data ? len : 0, I2C_TIMEOUT);
+  i2c_cmd_link_delete(cmd);
+
+  return err;
+}
+
+int i2c_slave_write(uint8_t bus, uint8_t addr, const uint8_t *reg,
+                    uint8_t *data, uint32_t len) {
+  i2c_bus_device_handle_t dev = i2c_device(bus, addr);
+  if (!dev) return ESP_ERR_INVALID_STATE;
+
+  if (reg)
+    return iot_i2c_bus_write_reg(dev, *reg, data, data ? len : 0, I2C_TIMEOUT);
+  return i2c_cmd_begin(dev, addr, NULL, data, len, false);
+}
+
+int i2c_slave_read(uint8_t bus, uint8_t addr, const uint8_t *reg, uint8_t *data,
+                   uint32_t len) {
+  if (len == 0) return true;
+
+  i2c_bus_device_handle_t dev = i2c_device(bus, addr);
+  if (!dev) return ESP_ERR_INVALID_STATE;
+
+  if (reg && data)
+    return iot_i2c_bus_read_reg(dev, *reg, data, len, I2C_TIMEOUT);
+  return i2c_cmd_begin(dev, addr, reg, data, len, true);
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+// the host build has no esp-open-rtos wrapper, only what the driver needs to
+// run on the simulated I2C and SPI buses, with the wrapper's SPI clock
+
+#define SPI_SIM_CLK_HZ 1000000
+
+uint32_t sdk_system_get_time() { return esp_timer_get_time(); }
+
+bool spi_device_init(uint8_t bus, uint8_t cs) {
+  return i2c_sim_spi_present(bus, cs);
+}
+
+size_t spi_transfer_pf(uint8_t bus, uint8_t cs, const uint8_t *mosi,
+                       uint8_t *miso, uint16_t len) {
+  return i2c_sim_spi_transfer(bus, cs, SPI_SIM_CLK_HZ, mosi, miso, len) ? len
+                                                                        : 0;
+}
+#endif
+
+#endif  // ESP_PLATFORM
+
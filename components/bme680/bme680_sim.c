@@ -0,0 +1,382 @@
+// Simulated BME680 for host builds, see bme680_sim.h
+
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "bme680_sim.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+
+#define BME680_SIM_REG_MEAS_STATUS 0x1d
+#define BME680_SIM_REG_PRESS 0x1f
+#define BME680_SIM_REG_TEMP 0x22
+#define BME680_SIM_REG_HUM 0x25
+#define BME680_SIM_REG_GAS 0x2a
+#define BME680_SIM_REG_RES_HEAT 0x5a
+#define BME680_SIM_REG_GAS_WAIT 0x64
+#define BME680_SIM_REG_CTRL_GAS_0 0x70
+#define BME680_SIM_REG_CTRL_GAS_1 0x71
+#define BME680_SIM_REG_CTRL_HUM 0x72
+#define BME680_SIM_REG_STATUS 0x73
+#define BME680_SIM_REG_CTRL_MEAS 0x74
+#define BME680_SIM_REG_CONFIG 0x75
+#define BME680_SIM_REG_ID 0xd0
+#define BME680_SIM_REG_RESET 0xe0
+
+#define BME680_SIM_NEW_DATA 0x80
+#define BME680_SIM_GAS_MEASURING 0x40
+#define BME680_SIM_MEASURING 0x20
+#define BME680_SIM_GAS_VALID 0x20
+#define BME680_SIM_HEAT_STAB 0x10
+#define BME680_SIM_RUN_GAS 0x10
+#define BME680_SIM_MEM_PAGE 0x10
+#define BME680_SIM_SKIPPED 0x80000  // data of a disabled measurement
+
+// typical calibration, the registers are written from it in bme680_sim_init
+static const struct {
+  uint16_t t1;
+  int16_t t2;
+  int8_t t3;
+  uint16_t p1;
+  int16_t p2;
+  int8_t p3;
+  int16_t p4, p5;
+  int8_t p6, p7;
+  int16_t p8, p9;
+  uint8_t p10;
+  uint16_t h1, h2;
+  int8_t h3, h4, h5;
+  uint8_t h6;
+  int8_t h7;
+  int8_t gh1;
+  int16_t gh2;
+  int8_t gh3;
+  uint8_t res_heat_range;
+  int8_t res_heat_val;
+  int8_t range_sw_err;
+} cal = {
+    .t1 = 26184, .t2 = 26354, .t3 = 3,
+    .p1 = 36241, .p2 = -10432, .p3 = 88, .p4 = 7059, .p5 = -136,
+    .p6 = 30, .p7 = 37, .p8 = -3245, .p9 = -2521, .p10 = 30,
+    .h1 = 822, .h2 = 1012, .h3 = 0, .h4 = 45, .h5 = 20, .h6 = 120, .h7 = -100,
+    .gh1 = -30, .gh2 = -5969, .gh3 = 18,
+    .res_heat_range = 1, .res_heat_val = 48, .range_sw_err = 0,
+};
+
+// gas range constants, BME680 datasheet page 19
+static const float gas_range_k[16][2] = {
+    {1.0, 8000000.0}, {1.0, 4000000.0}, {1.0, 2000000.0}, {1.0, 1000000.0},
+    {1.0, 499500.4995}, {0.99, 248262.1648}, {1.0, 125000.0},
+    {0.992, 63004.03226}, {1.0, 31281.28128}, {1.0, 15625.0}, {0.998, 7812.5},
+    {0.995, 3906.25}, {1.0, 1953.125}, {0.99, 976.5625}, {1.0, 488.28125},
+    {1.0, 244.140625}};
+
+// The integer compensation of the Bosch driver, run backwards by
+// bme680_sim_search to find the raw value of a reading. Temperature gives
+// t_fine, pressure Pa and humidity %RH * 1000.
+
+static int64_t bme680_sim_t_fine(int32_t adc, int32_t t_fine) {
+  int64_t var1 = ((int64_t)((adc >> 3) - ((int32_t)cal.t1 << 1)) * cal.t2) >> 11;
+  int64_t var2 = (((((adc >> 4) - (int32_t)cal.t1) *
+                    ((adc >> 4) - (int32_t)cal.t1)) >> 12) * cal.t3) >> 14;
+  return var1 + var2;
+}
+
+static int64_t bme680_sim_pressure(int32_t adc, int32_t t_fine) {
+  int32_t var1, var2, pressure;
+
+  var1 = (t_fine >> 1) - 64000;
+  var2 = ((((var1 >> 2) * (var1 >> 2)) >> 11) * (int32_t)cal.p6) >> 2;
+  var2 = (var2 * (int32_t)cal.p6) >> 2;
+  var2 = var2 + ((var1 * (int32_t)cal.p5) << 1);
+  var2 = (var2 >> 2) + ((int32_t)cal.p4 << 16);
+  var1 = ((var1 >> 2) * (var1 >> 2)) >> 13;
+  var1 = ((var1 * ((int32_t)cal.p3 << 5)) >> 3) + (((int32_t)cal.p2 * var1) >> 1);
+  var1 = var1 >> 18;
+  var1 = ((32768 + var1) * (int32_t)cal.p1) >> 15;
+  if (var1 == 0) return 0;
+  pressure = 1048576 - adc;
+  pressure = (int32_t)((pressure - (var2 >> 12)) * ((uint32_t)3125));
+  pressure = (uint32_t)pressure / (uint32_t)var1 << 1;
+
+  // in 64 bits, the search goes far beyond the pressures the sensor sees
+  int64_t p = pressure;
+  int64_t var4 = (cal.p9 * (((p >> 3) * (p >> 3)) >> 13)) >> 12;
+  int64_t var5 = ((p >> 2) * cal.p8) >> 13;
+  int64_t var6 = ((p >> 8) * (p >> 8) * (p >> 8) * cal.p10) >> 17;
+  return p + ((var4 + var5 + var6 + ((int32_t)cal.p7 << 7)) >> 4);
+}
+
+static int64_t bme680_sim_humidity(int32_t adc, int32_t t_fine) {
+  int32_t temp_scaled = ((t_fine * 5) + 128) >> 8;
+  int64_t var1 = (adc - ((int32_t)cal.h1 << 4)) -
+                 (((temp_scaled * (int32_t)cal.h3) / 100) >> 1);
+  int64_t var2 =
+      ((int32_t)cal.h2 *
+       (((temp_scaled * (int32_t)cal.h4) / 100) +
+        (((temp_scaled * ((temp_scaled * (int32_t)cal.h5) / 100)) >> 6) / 100) +
+        (1 << 14))) >> 10;
+  int64_t var3 = var1 * var2;
+  int64_t var4 = (int32_t)cal.h6 << 7;
+  var4 = (var4 + ((temp_scaled * (int32_t)cal.h7) / 100)) >> 4;
+  int64_t var5 = ((var3 >> 14) * (var3 >> 14)) >> 10;
+  int64_t var6 = (var4 * var5) >> 1;
+  int64_t humidity = (((var3 + var6) >> 10) * 1000) >> 12;
+
+  if (humidity > 100000) return 100000;
+  if (humidity < 0) return 0;
+  return humidity;
+}
+
+typedef int64_t (*bme680_sim_compensate_t)(int32_t adc, int32_t t_fine);
+
+// smallest raw value in [0, max] the compensation turns into target or
+// more (less if it falls), by bisection
+static int32_t bme680_sim_search(bme680_sim_compensate_t compensate,
+                                 int64_t target, int32_t t_fine, int32_t max,
+                                 bool falling) {
+  int32_t lo = 0, hi = max;
+
+  while (lo < hi) {
+    int32_t mid = lo + (hi - lo) / 2;
+    int64_t value = compensate(mid, t_fine);
+    if (falling ? value <= target : value >= target)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// 10 bit gas ADC value and range for a resistance, in the finest range the
+// value fits in
+static void bme680_sim_gas(float ohm, uint16_t* adc, uint8_t* range) {
+  for (uint8_t r = 0; r < 16; r++) {
+    float var1 = (1340.0 + 5.0 * cal.range_sw_err) * gas_range_k[r][0];
+    float value = var1 * gas_range_k[r][1] / ohm - var1 + 512;
+    if (value <= 1023 || r == 15) {
+      *adc = value < 0 ? 0 : value > 1023 ? 1023 : (uint16_t)(value + 0.5f);
+      *range = r;
+      return;
+    }
+  }
+}
+
+static uint32_t bme680_sim_oversampling(uint8_t osr) {
+  return osr == 0 ? 0 : 1 << ((osr > 5 ? 5 : osr) - 1);
+}
+
+// heating time of the selected profile in ms, 0 without gas measurement
+static uint32_t bme680_sim_heat_ms(const bme680_sim_t* sim) {
+  const uint8_t* regs = sim->dev.regs;
+  uint8_t ctrl_gas = regs[BME680_SIM_REG_CTRL_GAS_1];
+
+  if (!(ctrl_gas & BME680_SIM_RUN_GAS)) return 0;
+  uint8_t wait = regs[BME680_SIM_REG_GAS_WAIT + (ctrl_gas & 0x0f)];
+  return (wait & 0x3f) << (2 * (wait >> 6));
+}
+
+uint32_t bme680_sim_conversion_us(const bme680_sim_t* sim) {
+  const uint8_t* regs = sim->dev.regs;
+  uint8_t ctrl_meas = regs[BME680_SIM_REG_CTRL_MEAS];
+  uint32_t cycles = bme680_sim_oversampling(ctrl_meas >> 5) +
+                    bme680_sim_oversampling((ctrl_meas >> 2) & 0x07) +
+                    bme680_sim_oversampling(regs[BME680_SIM_REG_CTRL_HUM] & 0x07);
+
+  // TPH switching, gas measurement and wake up as the Bosch driver has them
+  return cycles * 1963 + 477 * 4 + 477 * 5 + 500 +
+         bme680_sim_heat_ms(sim) * 1000;
+}
+
+static void bme680_sim_put20(uint8_t* regs, uint32_t value) {
+  regs[0] = (value >> 12) & 0xff;
+  regs[1] = (value >> 4) & 0xff;
+  regs[2] = (value << 4) & 0xf0;
+}
+
+// the ADC keeps 15 + osr bits of a 20 bit reading, unless the IIR filter is
+// on
+static uint32_t bme680_sim_resolution(uint32_t adc, uint8_t osr, bool filter) {
+  if (filter || osr >= 5) return adc;
+  return adc & ~((1u << (5 - osr)) - 1);
+}
+
+static uint32_t bme680_sim_filter(uint32_t state, uint32_t adc, uint8_t size) {
+  uint32_t coefficient = (1u << size) - 1;
+  return (state * coefficient + adc) / (coefficient + 1);
+}
+
+// measure the waveforms at the end of a cycle and latch the raw values into
+// the data registers
+static void bme680_sim_latch(bme680_sim_t* sim, int64_t at_us) {
+  uint8_t* regs = sim->dev.regs;
+  uint32_t t_ms = (at_us - sim->start_us) / 1000;
+  uint8_t osr_t = regs[BME680_SIM_REG_CTRL_MEAS] >> 5;
+  uint8_t osr_p = (regs[BME680_SIM_REG_CTRL_MEAS] >> 2) & 0x07;
+  uint8_t osr_h = regs[BME680_SIM_REG_CTRL_HUM] & 0x07;
+  uint8_t filter = (regs[BME680_SIM_REG_CONFIG] >> 2) & 0x07;
+
+  float temperature = i2c_sim_wave_at(&sim->temperature, t_ms);
+  int32_t adc_t = bme680_sim_search(bme680_sim_t_fine,
+                                    (int64_t)(temperature * 5120), 0, 0xfffff,
+                                    false);
+  int32_t t_fine = bme680_sim_t_fine(adc_t, 0);
+  float pressure = i2c_sim_wave_at(&sim->pressure, t_ms);
+  int32_t adc_p = bme680_sim_search(bme680_sim_pressure,
+                                    (int64_t)(pressure * 100), t_fine, 0xfffff,
+                                    true);
+  float humidity = i2c_sim_wave_at(&sim->humidity, t_ms);
+  int32_t adc_h = bme680_sim_search(bme680_sim_humidity,
+                                    (int64_t)(humidity * 1000), t_fine, 0xffff,
+                                    false);
+
+  adc_t = bme680_sim_resolution(adc_t, osr_t, filter);
+  adc_p = bme680_sim_resolution(adc_p, osr_p, filter);
+  if (filter && sim->filtered) {
+    adc_t = bme680_sim_filter(sim->adc_t, adc_t, filter);
+    adc_p = bme680_sim_filter(sim->adc_p, adc_p, filter);
+  }
+  sim->adc_t = adc_t;
+  sim->adc_p = adc_p;
+  sim->filtered = true;
+
+  bme680_sim_put20(&regs[BME680_SIM_REG_TEMP], osr_t ? adc_t : BME680_SIM_SKIPPED);
+  bme680_sim_put20(&regs[BME680_SIM_REG_PRESS], osr_p ? adc_p : BME680_SIM_SKIPPED);
+  regs[BME680_SIM_REG_HUM] = osr_h ? adc_h >> 8 : 0x80;
+  regs[BME680_SIM_REG_HUM + 1] = osr_h ? adc_h & 0xff : 0x00;
+
+  uint8_t ctrl_gas = regs[BME680_SIM_REG_CTRL_GAS_1];
+  uint16_t gas_adc = 0;
+  uint8_t gas_range = 0;
+  uint8_t gas_flags = 0;
+  if (ctrl_gas & BME680_SIM_RUN_GAS) {
+    bme680_sim_gas(i2c_sim_wave_at(&sim->gas, t_ms), &gas_adc, &gas_range);
+    gas_flags = BME680_SIM_GAS_VALID;
+    // the heater gets there if it was given a target and some time
+    if (bme680_sim_heat_ms(sim) &&
+        regs[BME680_SIM_REG_RES_HEAT + (ctrl_gas & 0x0f)])
+      gas_flags |= BME680_SIM_HEAT_STAB;
+  }
+  regs[BME680_SIM_REG_GAS] = gas_adc >> 2;
+  regs[BME680_SIM_REG_GAS + 1] = ((gas_adc & 0x03) << 6) | gas_flags | gas_range;
+
+  regs[BME680_SIM_REG_MEAS_STATUS] = BME680_SIM_NEW_DATA | (ctrl_gas & 0x0f);
+  sim->conversions++;
+}
+
+static void bme680_sim_read(i2c_sim_device_t* dev, uint8_t reg) {
+  bme680_sim_t* sim = (bme680_sim_t*)dev;
+
+  if (sim->ready_us && esp_timer_get_time() >= sim->ready_us) {
+    bme680_sim_latch(sim, sim->ready_us);
+    dev->regs[BME680_SIM_REG_CTRL_MEAS] &= ~0x03;
+    sim->ready_us = 0;
+  }
+}
+
+static void bme680_sim_reset(bme680_sim_t* sim) {
+  uint8_t* regs = sim->dev.regs;
+
+  memset(&regs[BME680_SIM_REG_MEAS_STATUS], 0,
+         BME680_SIM_REG_GAS + 2 - BME680_SIM_REG_MEAS_STATUS);
+  bme680_sim_put20(&regs[BME680_SIM_REG_PRESS], BME680_SIM_SKIPPED);
+  bme680_sim_put20(&regs[BME680_SIM_REG_TEMP], BME680_SIM_SKIPPED);
+  regs[BME680_SIM_REG_HUM] = 0x80;
+  memset(&regs[BME680_SIM_REG_RES_HEAT], 0, 10);
+  memset(&regs[BME680_SIM_REG_GAS_WAIT], 0, 10);
+  memset(&regs[BME680_SIM_REG_CTRL_GAS_0], 0,
+         BME680_SIM_REG_CONFIG + 1 - BME680_SIM_REG_CTRL_GAS_0);
+  regs[BME680_SIM_REG_RESET] = 0;
+  sim->ready_us = 0;
+  sim->filtered = false;
+}
+
+static void bme680_sim_written(i2c_sim_device_t* dev, uint8_t reg) {
+  bme680_sim_t* sim = (bme680_sim_t*)dev;
+
+  if (reg == BME680_SIM_REG_RESET) {
+    if (dev->regs[reg] == 0xb6) bme680_sim_reset(sim);
+    dev->regs[reg] = 0;
+    return;
+  }
+  if (reg != BME680_SIM_REG_CTRL_MEAS || (dev->regs[reg] & 0x03) != 0x01)
+    return;
+
+  // forced mode starts a TPHG cycle
+  uint8_t ctrl_gas = dev->regs[BME680_SIM_REG_CTRL_GAS_1];
+  sim->ready_us = esp_timer_get_time() + bme680_sim_conversion_us(sim);
+  dev->regs[BME680_SIM_REG_MEAS_STATUS] =
+      BME680_SIM_MEASURING | (ctrl_gas & 0x0f) |
+      (ctrl_gas & BME680_SIM_RUN_GAS ? BME680_SIM_GAS_MEASURING : 0);
+}
+
+// SPI sees half of the register map at a time, the status register in both
+static uint8_t bme680_sim_spi_reg(i2c_sim_device_t* dev, uint8_t addr) {
+  if (addr == BME680_SIM_REG_STATUS ||
+      (dev->regs[BME680_SIM_REG_STATUS] & BME680_SIM_MEM_PAGE))
+    return addr;
+  return addr | 0x80;
+}
+
+static void bme680_sim_put16(uint8_t* regs, uint8_t reg, uint16_t value) {
+  regs[reg] = value & 0xff;
+  regs[reg + 1] = value >> 8;
+}
+
+void bme680_sim_init(bme680_sim_t* sim, uint8_t bus, uint8_t addr, uint8_t cs) {
+  i2c_sim_wave_t temperature = sim->temperature;
+  i2c_sim_wave_t humidity = sim->humidity;
+  i2c_sim_wave_t pressure = sim->pressure;
+  i2c_sim_wave_t gas = sim->gas;
+  uint8_t* regs = sim->dev.regs;
+
+  memset(sim, 0, sizeof(*sim));
+  sim->temperature = temperature;
+  sim->humidity = humidity;
+  sim->pressure = pressure;
+  sim->gas = gas;
+  sim->start_us = esp_timer_get_time();
+  sim->dev.port = bus;
+  sim->dev.addr = addr;
+  sim->dev.spi = addr == 0;
+  sim->dev.cs = cs;
+  sim->dev.read = bme680_sim_read;
+  sim->dev.written = bme680_sim_written;
+  sim->dev.spi_reg = bme680_sim_spi_reg;
+
+  regs[BME680_SIM_REG_ID] = 0x61;
+  // calibration data from 0x89
+  bme680_sim_put16(regs, 0x8a, cal.t2);
+  regs[0x8c] = cal.t3;
+  bme680_sim_put16(regs, 0x8e, cal.p1);
+  bme680_sim_put16(regs, 0x90, cal.p2);
+  regs[0x92] = cal.p3;
+  bme680_sim_put16(regs, 0x94, cal.p4);
+  bme680_sim_put16(regs, 0x96, cal.p5);
+  regs[0x98] = cal.p7;
+  regs[0x99] = cal.p6;
+  bme680_sim_put16(regs, 0x9c, cal.p8);
+  bme680_sim_put16(regs, 0x9e, cal.p9);
+  regs[0xa0] = cal.p10;
+  // calibration data from 0xe1, H1 and H2 share the nibbles of 0xe2
+  regs[0xe1] = cal.h2 >> 4;
+  regs[0xe2] = ((cal.h2 & 0x0f) << 4) | (cal.h1 & 0x0f);
+  regs[0xe3] = cal.h1 >> 4;
+  regs[0xe4] = cal.h3;
+  regs[0xe5] = cal.h4;
+  regs[0xe6] = cal.h5;
+  regs[0xe7] = cal.h6;
+  regs[0xe8] = cal.h7;
+  bme680_sim_put16(regs, 0xe9, cal.t1);
+  bme680_sim_put16(regs, 0xeb, cal.gh2);
+  regs[0xed] = cal.gh1;
+  regs[0xee] = cal.gh3;
+  // device specific calibration data from 0x00
+  regs[0x00] = cal.res_heat_val;
+  regs[0x02] = cal.res_heat_range << 4;
+  regs[0x04] = cal.range_sw_err << 4;
+  bme680_sim_reset(sim);
+}
+#endif
@@ -2,3 +2,10 @@
 # Component makefile.
 #
 COMPONENT_ADD_INCLUDEDIRS := .
+
+ifdef CONFIG_IDF_TARGET_LINUX
+# the host build runs on the simulated I2C and SPI buses, without the wrapper
+COMPONENT_OBJEXCLUDE := esp8266_wrapper.o
+else
+COMPONENT_OBJEXCLUDE := bme680_sim.o
+endif
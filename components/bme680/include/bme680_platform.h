@@ -61,6 +61,13 @@
 #include <errno.h>
 
 #include "esp8266_wrapper.h"
+#include "iot_i2c_bus.h"
+
+// Use a bus the application already created, e.g. to probe for the sensor,
+// instead of i2c_init. The handle has to stay valid while the sensor is used.
+// NULL detaches the bus again and deletes the devices the sensors used, and
+// the bus too if i2c_init created it.
+void i2c_attach(int bus, i2c_bus_handle_t handle);
 
 #endif  // ESP_PLATFORM
 
@@ -0,0 +1,47 @@
+/**
+ * Register-level BME680 on the simulated I2C or SPI bus, for host (linux
+ * target) builds.
+ *
+ * It has the calibration of a typical sensor and measures the waveforms: a
+ * write of forced mode to ctrl_meas starts a TPHG cycle that takes as long
+ * as the Bosch reference driver expects for the oversampling rates, plus
+ * the heating time of the selected heater profile when gas measurement
+ * runs. The measuring bits are set in the status register until the data
+ * registers latch and the sensor goes back to sleep. The raw ADC values are
+ * what the integer compensation turns into the waveform values, at the
+ * resolution of the oversampling, through the IIR filter for temperature
+ * and pressure. The gas resistance is given in Ohm and picks the finest
+ * ADC range it fits in. On SPI the memory page bit of the status register
+ * selects the half of the register map below 0x80.
+ */
+
+#ifndef __BME680_SIM_H__
+#define __BME680_SIM_H__
+
+#include <stdint.h>
+
+#include "i2c_sim.h"
+
+typedef struct {
+  i2c_sim_device_t dev;        // registers on the simulated bus, first
+  i2c_sim_wave_t temperature;  // degC
+  i2c_sim_wave_t humidity;     // %RH
+  i2c_sim_wave_t pressure;     // hPa
+  i2c_sim_wave_t gas;          // gas resistance in Ohm
+  int64_t start_us;            // esp_timer time the waveforms start at
+  uint32_t conversions;        // TPHG cycles done
+  int64_t ready_us;            // end of the running cycle, 0 when idle
+  bool filtered;               // the IIR filter holds a value
+  uint32_t adc_t;              // filter state, 20 bits
+  uint32_t adc_p;
+} bme680_sim_t;
+
+// Power up a simulated BME680 at addr of an I2C port or, with addr 0, at
+// chip select cs of an SPI host, like bme680_init_sensor takes them. Put it
+// on the bus with i2c_sim_attach(&sim->dev). The waveforms are kept.
+void bme680_sim_init(bme680_sim_t* sim, uint8_t bus, uint8_t addr, uint8_t cs);
+
+// Time a TPHG cycle takes with the current settings
+uint32_t bme680_sim_conversion_us(const bme680_sim_t* sim);
+
+#endif  // __BME680_SIM_H__
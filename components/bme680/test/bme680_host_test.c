@@ -0,0 +1,189 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bme680.h"
+#include "bme680_sim.h"
+#include "driver/i2c.h"
+#include "i2c_sim.h"
+#include "iot_i2c_bus.h"
+#include "unity.h"
+
+#define BME680_TEST_ADDR 0x77
+#define BME280_TEST_ADDR 0x76
+#define BME680_TEST_SPI_HOST 1
+#define BME680_TEST_SPI_CS 5
+
+// par_t1 = 0 and par_t2 = 2048 make the temperature raw / 8 * 5 / 256
+static void bme680_regs_init(i2c_sim_device_t* sim) {
+  memset(sim, 0, sizeof(*sim));
+  sim->addr = BME680_TEST_ADDR;
+  sim->regs[0xd0] = 0x61;  // chip id
+  sim->regs[0x8b] = 0x08;  // par_t2 msb
+  sim->regs[0x1d] = 0x80;  // new data
+  sim->regs[0x22] = 0xfa;  // raw temperature 0xfa000
+  sim->regs[0x25] = 0x80;  // raw humidity 0x8000
+}
+
+static i2c_bus_handle_t bme680_test_bus(void) {
+  i2c_config_t conf = {
+      .mode = I2C_MODE_MASTER,
+      .master.clk_speed = 100000,
+  };
+  return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+TEST_CASE("bme680 measures on the shared i2c_bus", "[bme680][host]") {
+  static i2c_sim_device_t bme680, bme280;
+  i2c_bus_device_stats_t stats[2];
+  size_t count = 2;
+  bme680_values_fixed_t values;
+  uint8_t id;
+
+  bme680_regs_init(&bme680);
+  memset(&bme280, 0, sizeof(bme280));
+  bme280.addr = BME280_TEST_ADDR;
+  bme280.regs[0xd0] = 0x60;
+  i2c_sim_attach(NULL);
+  i2c_sim_attach(&bme680);
+  i2c_sim_attach(&bme280);
+  i2c_bus_handle_t bus = bme680_test_bus();
+  i2c_attach(I2C_NUM_0, bus);
+
+  bme680_sensor_t* sensor = bme680_init_sensor(I2C_NUM_0, BME680_TEST_ADDR, 0);
+  TEST_ASSERT_NOT_NULL(sensor);
+  TEST_ASSERT_EQUAL_HEX8(0xb6, bme680.regs[0xe0]);
+  TEST_ASSERT_TRUE(
+      bme680_set_oversampling_rates(sensor, osr_1x, osr_none, osr_1x));
+
+  TEST_ASSERT_TRUE(bme680_force_measurement(sensor));
+  TEST_ASSERT_EQUAL_HEX8(0x01, bme680.regs[0x74] & 0x03);  // forced mode
+  TEST_ASSERT_TRUE(bme680_get_results_fixed(sensor, &values));
+  TEST_ASSERT_EQUAL(2500, values.temperature);
+
+  // the other sensor on the port answers in between
+  i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, BME280_TEST_ADDR);
+  TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0xd0, &id, 1,
+                                                 portMAX_DELAY));
+  TEST_ASSERT_EQUAL_HEX8(0x60, id);
+
+  // the BME680 traffic shows up in the bus statistics
+  TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_device_stats(bus, stats, &count));
+  TEST_ASSERT_EQUAL(2, count);
+  for (size_t i = 0; i < count; i++) {
+    printf("0x%02x: %u transactions, %u bytes\n", stats[i].addr,
+           stats[i].transactions, stats[i].bytes);
+    TEST_ASSERT_EQUAL(0, stats[i].nacks);
+    if (stats[i].addr == BME680_TEST_ADDR) {
+      TEST_ASSERT_EQUAL(bme680.transactions, stats[i].transactions);
+      TEST_ASSERT_EQUAL(bme680.bytes, stats[i].bytes);
+    }
+  }
+
+  free(sensor);
+  iot_i2c_bus_device_delete(dev);
+  i2c_attach(I2C_NUM_0, NULL);
+  count = 2;
+  TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_device_stats(bus, stats, &count));
+  TEST_ASSERT_EQUAL(0, count);
+  iot_i2c_bus_delete(bus);
+  i2c_sim_attach(NULL);
+}
+
+TEST_CASE("bme680 needs a bus and a sensor", "[bme680][host]") {
+  i2c_bus_device_stats_t stats;
+  size_t count = 1;
+
+  i2c_sim_attach(NULL);
+  // nothing attached, nothing goes to the driver
+  TEST_ASSERT_NULL(bme680_init_sensor(I2C_NUM_0, BME680_TEST_ADDR, 0));
+
+  i2c_bus_handle_t bus = bme680_test_bus();
+  i2c_attach(I2C_NUM_0, bus);
+  TEST_ASSERT_NULL(bme680_init_sensor(I2C_NUM_0, BME680_TEST_ADDR, 0));
+  TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_device_stats(bus, &stats, &count));
+  TEST_ASSERT_EQUAL(1, count);
+  TEST_ASSERT_EQUAL_HEX8(BME680_TEST_ADDR, stats.addr);
+  TEST_ASSERT_EQUAL(1, stats.nacks);
+
+  i2c_attach(I2C_NUM_0, NULL);
+  iot_i2c_bus_delete(bus);
+}
+
+static const i2c_sim_point_t temperature[] = {{0, 23.5}};
+static const i2c_sim_point_t humidity[] = {{0, 45}};
+static const i2c_sim_point_t pressure[] = {{0, 1013.25}};
+static const i2c_sim_point_t gas[] = {{0, 50000}};
+
+// one forced TPHG cycle, checked against the waveforms
+static void bme680_model_measure(bme680_sensor_t* sensor, bme680_sim_t* sim) {
+  bme680_values_fixed_t values;
+
+  TEST_ASSERT_TRUE(bme680_force_measurement(sensor));
+  TEST_ASSERT_TRUE(bme680_is_measuring(sensor));
+  // the driver's estimate leaves room for the cycle to end
+  vTaskDelay(bme680_get_measurement_duration(sensor));
+  TEST_ASSERT_TRUE(bme680_get_results_fixed(sensor, &values));
+  printf("%d.%02d C, %u.%03u %%, %u Pa, %u Ohm in %u us\n",
+         values.temperature / 100, values.temperature % 100,
+         values.humidity / 1000, values.humidity % 1000, values.pressure,
+         values.gas_resistance, bme680_sim_conversion_us(sim));
+  TEST_ASSERT_INT_WITHIN(1, 2350, values.temperature);
+  TEST_ASSERT_INT_WITHIN(100, 45000, values.humidity);
+  TEST_ASSERT_INT_WITHIN(2, 101325, values.pressure);
+  TEST_ASSERT_INT_WITHIN(500, 50000, values.gas_resistance);
+  TEST_ASSERT_EQUAL(1, sim->conversions);
+}
+
+TEST_CASE("bme680 model measures over I2C and SPI", "[bme680][host]") {
+  static bme680_sim_t i2c_sim, spi_sim;
+  i2c_sim_stats_t stats;
+
+  bme680_sim_t* sims[] = {&i2c_sim, &spi_sim};
+  for (int i = 0; i < 2; i++) {
+    sims[i]->temperature = (i2c_sim_wave_t){temperature, 1};
+    sims[i]->humidity = (i2c_sim_wave_t){humidity, 1};
+    sims[i]->pressure = (i2c_sim_wave_t){pressure, 1};
+    sims[i]->gas = (i2c_sim_wave_t){gas, 1};
+  }
+  bme680_sim_init(&i2c_sim, I2C_NUM_0, BME680_TEST_ADDR, 0);
+  bme680_sim_init(&spi_sim, BME680_TEST_SPI_HOST, 0, BME680_TEST_SPI_CS);
+  i2c_sim_attach(NULL);
+  i2c_sim_attach(&i2c_sim.dev);
+  i2c_sim_attach(&spi_sim.dev);
+  i2c_sim_reset_stats();
+  i2c_bus_handle_t bus = bme680_test_bus();
+  i2c_attach(I2C_NUM_0, bus);
+
+  bme680_sensor_t* sensor = bme680_init_sensor(I2C_NUM_0, BME680_TEST_ADDR, 0);
+  TEST_ASSERT_NOT_NULL(sensor);
+  bme680_model_measure(sensor, &i2c_sim);
+  free(sensor);
+  i2c_sim_get_stats(I2C_NUM_0, &stats);
+  printf("I2C: %u commands, %u bytes, %llu us on the bus\n",
+         stats.transactions, stats.bytes,
+         (unsigned long long)stats.bus_ns / 1000);
+  TEST_ASSERT_EQUAL(i2c_sim.dev.transactions, stats.transactions);
+
+  // the same sensor on SPI, through the memory pages
+  TEST_ASSERT_NULL(bme680_init_sensor(BME680_TEST_SPI_HOST, 0,
+                                      BME680_TEST_SPI_CS + 1));
+  sensor = bme680_init_sensor(BME680_TEST_SPI_HOST, 0, BME680_TEST_SPI_CS);
+  TEST_ASSERT_NOT_NULL(sensor);
+  bme680_model_measure(sensor, &spi_sim);
+  free(sensor);
+  i2c_sim_get_spi_stats(BME680_TEST_SPI_HOST, &stats);
+  printf("SPI: %u transfers, %u bytes, %llu us on the bus\n",
+         stats.transactions, stats.bytes,
+         (unsigned long long)stats.bus_ns / 1000);
+  TEST_ASSERT_EQUAL(spi_sim.dev.transactions, stats.transactions);
+  TEST_ASSERT_EQUAL(stats.bytes * 8000ULL, stats.bus_ns);  // at 1 MHz
+
+  i2c_attach(I2C_NUM_0, NULL);
+  iot_i2c_bus_delete(bus);
+  i2c_sim_attach(NULL);
+}
+#endif
@@ -4,4 +4,9 @@
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
 COMPONENT_ADD_INCLUDEDIRS := include
-COMPONENT_SRCDIRS := .
\ No newline at end of file
+COMPONENT_SRCDIRS := .
+
+ifndef CONFIG_IDF_TARGET_LINUX
+# the simulated bus only replaces the I2C driver in host builds
+COMPONENT_OBJEXCLUDE := i2c_sim.o
+endif
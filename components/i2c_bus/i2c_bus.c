@@ -12,15 +12,74 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include <stdio.h>
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "iot_i2c_bus.h"
 
+typedef struct i2c_bus_waiter {
+    TaskHandle_t task;                 /*!<task waiting for the bus */
+    UBaseType_t priority;              /*!<position in the queue */
+    bool granted;                      /*!<the bus was handed over to it, guarded by the bus lock */
+    SemaphoreHandle_t ready;           /*!<given when the bus is handed over */
+    StaticSemaphore_t ready_buf;
+    struct i2c_bus_waiter* next;
+} i2c_bus_waiter_t;
+
 typedef struct {
     i2c_config_t i2c_conf;   /*!<I2C bus parameters*/
     i2c_port_t i2c_port;     /*!<I2C port number */
+    int refs;                /*!<handles given out for the port */
+    SemaphoreHandle_t lock;  /*!<guards the fields below */
+    TaskHandle_t owner;      /*!<task using the bus, NULL when it's free */
+    int nesting;             /*!<times the owner acquired it */
+    i2c_bus_waiter_t* waiters;  /*!<queued transactions, highest priority first */
+    i2c_bus_stats_t stats;
+    QueueHandle_t async_queue;  /*!<requests for the worker, NULL until the first */
+    SemaphoreHandle_t async_exit;  /*!<given by the worker when it stops */
+    bool auto_clock;         /*!<step the clock down on repeated errors */
+    i2c_bus_clock_cb_t clock_cb;  /*!<told about every step */
+    void* clock_arg;
+    uint32_t errors_in_row;  /*!<errors toward a clock step since the last success, owner only */
+    uint32_t clock_epoch;    /*!<clock steps taken, owner only */
+    struct i2c_bus_device* devices;  /*!<devices created on the bus */
+    uint32_t retry_errors;   /*!<failed accesses in a row that bench a device, 0 never */
+    uint32_t backoff_ms;     /*!<first time a device is benched for */
 } i2c_bus_t;
 
+typedef struct i2c_bus_device {
+    i2c_bus_t* bus;                            /*!<I2C bus the device is on */
+    uint8_t addr;                              /*!<7 bit device address */
+    int priority;                              /*!<queue priority of its accesses */
+#ifdef I2C_BUS_LINK_SIZE
+    uint8_t link[I2C_BUS_LINK_SIZE]            /*!<link of the running access, owner only */
+            __attribute__((aligned(sizeof(void*))));
+#endif
+    i2c_bus_device_stats_t stats;              /*!<only written by the bus owner */
+    uint32_t errors_in_row;                    /*!<failed accesses since the last success, owner only */
+    int backoff_shift;                         /*!<times the backoff doubled, owner only */
+    uint32_t clock_counted;                    /*!<clock_epoch + 1 its NACKs were counted at, 0 none, owner only */
+    volatile bool benched;                     /*!<refused until backoff_until_us */
+    int64_t backoff_until_us;                  /*!<guarded by the bus lock */
+    struct i2c_bus_device* next;               /*!<next device on the bus */
+} i2c_bus_device_t;
+
+/* a register access, all it takes to build its command link again */
+typedef struct {
+    uint8_t* link;                             /*!<storage of the link, unused by older drivers */
+    uint8_t addr;
+    i2c_bus_xfer_dir_t dir;
+    uint8_t reg;
+    uint8_t* data;
+    size_t len;
+} i2c_bus_access_t;
+
 static const char* I2C_BUS_TAG = "i2c_bus";
 #define I2C_BUS_CHECK(a, str, ret)  if(!(a)) {                                             \
     ESP_LOGE(I2C_BUS_TAG,"%s:%d (%s):%s", __FILE__, __LINE__, __FUNCTION__, str);      \
@@ -28,14 +87,85 @@ static const char* I2C_BUS_TAG = "i2c_bus";
     }
 #define ESP_INTR_FLG_DEFAULT  (0)
 #define ESP_I2C_MASTER_BUF_LEN  (0)
+#define I2C_BUS_WORKER_STACK  (3072)
+#define I2C_BUS_WORKER_PRIORITY  (10)
+#define I2C_BUS_RECOVERY_HALF_US  (5)   /* SCL pulses at 100 kHz */
+
+/* where an object keeps the link of its running access, the older drivers
+ * have no static links and allocate every one */
+#ifdef I2C_BUS_LINK_SIZE
+#define I2C_BUS_LINK_OF(obj)  ((obj)->link)
+#else
+#define I2C_BUS_LINK_OF(obj)  (NULL)
+#endif
+
+/* auto clock rates, fastest first */
+static const uint32_t s_i2c_bus_clocks[] = { 1000000, 400000, 100000 };
+
+/* one bus object per port, shared by every driver that creates it */
+static i2c_bus_t* s_i2c_buses[I2C_NUM_MAX];
+static SemaphoreHandle_t s_i2c_buses_lock;
+static StaticSemaphore_t s_i2c_buses_lock_buf;
+static int s_i2c_buses_lock_state;    /*!<0 none, 1 being created, 2 ready */
+
+static void i2c_bus_registry_lock(void)
+{
+    // the first caller creates the mutex, the kernel call stays out of any
+    // critical section and the others wait until it is published
+    int state = 0;
+    if (__atomic_compare_exchange_n(&s_i2c_buses_lock_state, &state, 1, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        s_i2c_buses_lock = xSemaphoreCreateMutexStatic(&s_i2c_buses_lock_buf);
+        __atomic_store_n(&s_i2c_buses_lock_state, 2, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&s_i2c_buses_lock_state, __ATOMIC_ACQUIRE) != 2) {
+            vTaskDelay(1);
+        }
+    }
+    xSemaphoreTake(s_i2c_buses_lock, portMAX_DELAY);
+}
+
+static void i2c_bus_registry_unlock(void)
+{
+    xSemaphoreGive(s_i2c_buses_lock);
+}
 
 i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf)
 {
     I2C_BUS_CHECK(port < I2C_NUM_MAX, "I2C port error", NULL);
     I2C_BUS_CHECK(conf != NULL, "Pointer error", NULL);
-    i2c_bus_t* bus = (i2c_bus_t*) calloc(1, sizeof(i2c_bus_t));
+    i2c_bus_registry_lock();
+    i2c_bus_t* bus = s_i2c_buses[port];
+    if (bus != NULL) {
+        if (bus->i2c_conf.mode != conf->mode
+                || bus->i2c_conf.sda_io_num != conf->sda_io_num
+                || bus->i2c_conf.scl_io_num != conf->scl_io_num
+                || bus->i2c_conf.sda_pullup_en != conf->sda_pullup_en
+                || bus->i2c_conf.scl_pullup_en != conf->scl_pullup_en) {
+            ESP_LOGE(I2C_BUS_TAG, "port %d is already set up with other pins", port);
+            i2c_bus_registry_unlock();
+            return NULL;
+        }
+        if (bus->i2c_conf.master.clk_speed != conf->master.clk_speed) {
+            ESP_LOGW(I2C_BUS_TAG, "port %d is shared at %u Hz", port,
+                    bus->i2c_conf.master.clk_speed);
+        }
+        bus->refs++;
+        i2c_bus_registry_unlock();
+        return (i2c_bus_handle_t) bus;
+    }
+
+    bus = (i2c_bus_t*) calloc(1, sizeof(i2c_bus_t));
+    if (bus == NULL) {
+        goto error;
+    }
     bus->i2c_conf = *conf;
     bus->i2c_port = port;
+    bus->refs = 1;
+    bus->lock = xSemaphoreCreateMutex();
+    if (bus->lock == NULL) {
+        goto error;
+    }
     esp_err_t ret = i2c_param_config(bus->i2c_port, &bus->i2c_conf);
     if(ret != ESP_OK) {
         goto error;
@@ -44,12 +174,19 @@ i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf)
     if(ret != ESP_OK) {
         goto error;
     }
+    bus->stats.clk_hz = bus->i2c_conf.master.clk_speed;
+    s_i2c_buses[port] = bus;
+    i2c_bus_registry_unlock();
     return (i2c_bus_handle_t) bus;
 
     error:
     if(bus) {
+        if (bus->lock) {
+            vSemaphoreDelete(bus->lock);
+        }
         free(bus);
     }
+    i2c_bus_registry_unlock();
     return NULL;
 }
 
@@ -57,15 +194,781 @@ esp_err_t iot_i2c_bus_delete(i2c_bus_handle_t bus)
 {
     I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
     i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
-    i2c_driver_delete(i2c_bus->i2c_port);
-    free(bus);
+    i2c_bus_registry_lock();
+    if (--i2c_bus->refs == 0) {
+        s_i2c_buses[i2c_bus->i2c_port] = NULL;
+        if (i2c_bus->async_queue != NULL) {
+            i2c_bus_async_t* stop = NULL;
+            xQueueSend(i2c_bus->async_queue, &stop, portMAX_DELAY);
+            xSemaphoreTake(i2c_bus->async_exit, portMAX_DELAY);
+            vQueueDelete(i2c_bus->async_queue);
+            vSemaphoreDelete(i2c_bus->async_exit);
+        }
+        i2c_driver_delete(i2c_bus->i2c_port);
+        vSemaphoreDelete(i2c_bus->lock);
+        free(bus);
+    }
+    i2c_bus_registry_unlock();
     return ESP_OK;
 }
 
+/* ticks left of a timeout that started at start */
+static TickType_t i2c_bus_remaining(TickType_t start, TickType_t ticks_to_wait)
+{
+    if (ticks_to_wait == portMAX_DELAY) {
+        return portMAX_DELAY;
+    }
+    TickType_t waited = xTaskGetTickCount() - start;
+    return waited < ticks_to_wait ? ticks_to_wait - waited : 0;
+}
+
+static void i2c_bus_unqueue(i2c_bus_t* bus, i2c_bus_waiter_t* waiter)
+{
+    for (i2c_bus_waiter_t** pos = &bus->waiters; *pos != NULL; pos = &(*pos)->next) {
+        if (*pos == waiter) {
+            *pos = waiter->next;
+            bus->stats.queue_depth--;
+            return;
+        }
+    }
+}
+
+/*
+ * Take the bus for the calling task. If another task has it, the caller
+ * queues behind every transaction of the same or higher priority and sleeps
+ * until the bus is handed over to it or ticks_to_wait runs out. It sleeps
+ * on a semaphore of its own, the task notifications stay the application's.
+ */
+static esp_err_t i2c_bus_acquire(i2c_bus_t* bus, int priority,
+        TickType_t ticks_to_wait)
+{
+    TickType_t start = xTaskGetTickCount();
+    i2c_bus_waiter_t waiter = {
+        .task = xTaskGetCurrentTaskHandle(),
+        .priority = priority < 0 ? uxTaskPriorityGet(NULL) : priority,
+    };
+
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (bus->owner == NULL || bus->owner == waiter.task) {
+        bus->owner = waiter.task;
+        bus->nesting++;
+        xSemaphoreGive(bus->lock);
+        return ESP_OK;
+    }
+    waiter.ready = xSemaphoreCreateBinaryStatic(&waiter.ready_buf);
+    i2c_bus_waiter_t** pos = &bus->waiters;
+    while (*pos != NULL && (*pos)->priority >= waiter.priority) {
+        pos = &(*pos)->next;
+    }
+    waiter.next = *pos;
+    *pos = &waiter;
+    bus->stats.contended++;
+    if (++bus->stats.queue_depth > bus->stats.max_queue_depth) {
+        bus->stats.max_queue_depth = bus->stats.queue_depth;
+    }
+    xSemaphoreGive(bus->lock);
+
+    int64_t queued_us = esp_timer_get_time();
+    xSemaphoreTake(waiter.ready, i2c_bus_remaining(start, ticks_to_wait));
+    // the bus may have been handed over just as the wait timed out, and
+    // once unqueued nobody gives the semaphore any more
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (!waiter.granted) {
+        i2c_bus_unqueue(bus, &waiter);
+        bus->stats.timeouts++;
+        xSemaphoreGive(bus->lock);
+        vSemaphoreDelete(waiter.ready);
+        return ESP_ERR_TIMEOUT;
+    }
+    uint32_t waited_us = esp_timer_get_time() - queued_us;
+    bus->stats.wait_us += waited_us;
+    if (waited_us > bus->stats.max_wait_us) {
+        bus->stats.max_wait_us = waited_us;
+    }
+    xSemaphoreGive(bus->lock);
+    vSemaphoreDelete(waiter.ready);
+    return ESP_OK;
+}
+
+static void i2c_bus_release(i2c_bus_t* bus, uint32_t transactions)
+{
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    bus->stats.transactions += transactions;
+    if (--bus->nesting == 0) {
+        i2c_bus_waiter_t* next = bus->waiters;
+        if (next != NULL) {
+            // straight to the head of the queue, nobody can cut in
+            bus->waiters = next->next;
+            bus->stats.queue_depth--;
+            bus->owner = next->task;
+            bus->nesting = 1;
+            next->granted = true;
+            xSemaphoreGive(next->ready);
+        } else {
+            bus->owner = NULL;
+        }
+    }
+    xSemaphoreGive(bus->lock);
+}
+
+static void i2c_bus_clock_step(i2c_bus_t* bus)
+{
+    uint32_t clk_hz = bus->i2c_conf.master.clk_speed;
+    int i = 0;
+    while (i < sizeof(s_i2c_bus_clocks) / sizeof(s_i2c_bus_clocks[0])
+            && s_i2c_bus_clocks[i] >= clk_hz) {
+        i++;
+    }
+    if (i == sizeof(s_i2c_bus_clocks) / sizeof(s_i2c_bus_clocks[0])) {
+        return;     // already at the slowest
+    }
+    bus->i2c_conf.master.clk_speed = s_i2c_bus_clocks[i];
+    if (i2c_param_config(bus->i2c_port, &bus->i2c_conf) != ESP_OK) {
+        bus->i2c_conf.master.clk_speed = clk_hz;
+        return;
+    }
+    ESP_LOGW(I2C_BUS_TAG, "port %d: %u errors in a row, clock %u -> %u Hz",
+            bus->i2c_port, bus->errors_in_row, clk_hz, s_i2c_bus_clocks[i]);
+    bus->errors_in_row = 0;
+    bus->clock_epoch++;
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    bus->stats.clock_steps++;
+    bus->stats.clk_hz = s_i2c_bus_clocks[i];
+    xSemaphoreGive(bus->lock);
+    if (bus->clock_cb != NULL) {
+        bus->clock_cb(bus->i2c_port, s_i2c_bus_clocks[i], bus->clock_arg);
+    }
+}
+
+/* busy-waits, the recovery holds the bus and has to be quick */
+static void i2c_bus_delay_us(uint32_t us)
+{
+    int64_t end_us = esp_timer_get_time() + us;
+    while (esp_timer_get_time() < end_us) {
+    }
+}
+
+/*
+ * A device that reset in the middle of sending a byte holds SDA low until
+ * it has seen the rest of its clocks, and every command after that times
+ * out. If that is what the lines show after a timeout, take the pins over,
+ * clock SCL until SDA is let go, send a STOP and reinstall the driver.
+ * With SDA high, or SCL still held low by a device stretching the clock,
+ * clocking can't help and the timeout is left an ordinary one. Returns
+ * true if SDA was held and is free now. The caller owns the bus.
+ */
+static bool i2c_bus_recover(i2c_bus_t* bus)
+{
+    int64_t start_us = esp_timer_get_time();
+    gpio_num_t scl = bus->i2c_conf.scl_io_num;
+    gpio_num_t sda = bus->i2c_conf.sda_io_num;
+
+    // the driver sets the pins up as open drain inputs and outputs, so
+    // their levels read back while it has them
+    if (gpio_get_level(sda) != 0 || gpio_get_level(scl) == 0) {
+        return false;
+    }
+    i2c_driver_delete(bus->i2c_port);
+    gpio_set_level(scl, 1);
+    gpio_set_level(sda, 1);
+    gpio_set_direction(scl, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_direction(sda, GPIO_MODE_INPUT_OUTPUT_OD);
+    i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+    uint32_t clocks = 0;
+    while (gpio_get_level(sda) == 0 && clocks < I2C_BUS_RECOVERY_CLOCKS) {
+        gpio_set_level(scl, 0);
+        i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+        gpio_set_level(scl, 1);
+        i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+        clocks++;
+    }
+    bool freed = gpio_get_level(sda) != 0;
+    // STOP, SDA rising while SCL is high
+    gpio_set_level(scl, 0);
+    i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+    gpio_set_level(sda, 0);
+    i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+    gpio_set_level(scl, 1);
+    i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+    gpio_set_level(sda, 1);
+    i2c_bus_delay_us(I2C_BUS_RECOVERY_HALF_US);
+    i2c_param_config(bus->i2c_port, &bus->i2c_conf);
+    i2c_driver_install(bus->i2c_port, bus->i2c_conf.mode, ESP_I2C_MASTER_BUF_LEN,
+            ESP_I2C_MASTER_BUF_LEN, ESP_INTR_FLG_DEFAULT);
+
+    uint32_t us = esp_timer_get_time() - start_us;
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    bus->stats.recoveries++;
+    bus->stats.recovery_clocks += clocks;
+    bus->stats.recovery_us += us;
+    if (!freed) {
+        bus->stats.stuck++;
+    }
+    xSemaphoreGive(bus->lock);
+    if (!freed) {
+        ESP_LOGE(I2C_BUS_TAG, "port %d: SDA still low after %u clocks", bus->i2c_port,
+                clocks);
+    } else {
+        ESP_LOGW(I2C_BUS_TAG, "port %d: SDA freed with %u clocks in %u us",
+                bus->i2c_port, clocks, us);
+    }
+    return freed;
+}
+
+/*
+ * Count a failed access against the budget of the device and bench it once
+ * that is used up, for twice as long as the last time. The caller owns the
+ * bus.
+ */
+static void i2c_bus_device_budget(i2c_bus_t* bus, i2c_bus_device_t* dev,
+        esp_err_t ret)
+{
+    if (ret == ESP_OK) {
+        dev->errors_in_row = 0;
+        dev->backoff_shift = 0;
+        return;
+    }
+    if (++dev->errors_in_row < bus->retry_errors || bus->retry_errors == 0) {
+        return;
+    }
+    uint32_t backoff_ms = bus->backoff_ms << dev->backoff_shift;
+    if (dev->backoff_shift < I2C_BUS_BACKOFF_MAX_SHIFT) {
+        dev->backoff_shift++;
+    }
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    dev->backoff_until_us = esp_timer_get_time() + backoff_ms * 1000LL;
+    dev->benched = true;
+    xSemaphoreGive(bus->lock);
+    ESP_LOGW(I2C_BUS_TAG, "port %d: 0x%02x failed %u times, backing off %u ms",
+            bus->i2c_port, dev->addr, dev->errors_in_row, backoff_ms);
+}
+
+/*
+ * A benched device is refused before it queues for the bus. The refusals
+ * are counted under the lock, the other counters belong to the bus owner.
+ */
+static bool i2c_bus_device_benched(i2c_bus_device_t* dev)
+{
+    if (!dev->benched) {
+        return false;
+    }
+    xSemaphoreTake(dev->bus->lock, portMAX_DELAY);
+    bool benched = esp_timer_get_time() < dev->backoff_until_us;
+    if (benched) {
+        dev->stats.skipped++;
+    } else {
+        // the next access is the retry
+        dev->benched = false;
+    }
+    xSemaphoreGive(dev->bus->lock);
+    return benched;
+}
+
+static int i2c_bus_latency_bucket(uint32_t us)
+{
+    if (us < I2C_BUS_LATENCY_MIN_US) {
+        return 0;
+    }
+    // 64 us and up land in bucket 1, every doubling one further
+    int bucket = 31 - __builtin_clz(us / I2C_BUS_LATENCY_MIN_US) + 1;
+    return bucket < I2C_BUS_LATENCY_BUCKETS ? bucket : I2C_BUS_LATENCY_BUCKETS - 1;
+}
+
+/* only the bus owner records, so the counters need no lock */
+static void i2c_bus_device_record(i2c_bus_device_t* dev, esp_err_t ret,
+        size_t bytes, uint32_t us)
+{
+    i2c_bus_device_stats_t* stats = &dev->stats;
+    stats->transactions++;
+    if (ret == ESP_OK) {
+        stats->bytes += bytes;
+    } else if (ret == ESP_ERR_TIMEOUT) {
+        stats->timeouts++;
+    } else {
+        stats->nacks++;
+    }
+    stats->busy_us += us;
+    if (us > stats->max_us) {
+        stats->max_us = us;
+    }
+    stats->latency[i2c_bus_latency_bucket(us)]++;
+}
+
+static esp_err_t i2c_bus_build(i2c_cmd_handle_t cmd,
+        const i2c_bus_access_t* access)
+{
+    // the driver copies single bytes into the link and only refers to
+    // longer data, which has to stay put until the link ran
+    esp_err_t ret = i2c_master_start(cmd);
+    ret |= i2c_master_write_byte(cmd, (access->addr << 1) | I2C_MASTER_WRITE, true);
+    ret |= i2c_master_write_byte(cmd, access->reg, true);
+    if (access->dir == I2C_BUS_XFER_WRITE) {
+        //start-device_addr-word_addr-data-stop
+        if (access->len > 0) {
+            ret |= i2c_master_write(cmd, access->data, access->len, true);
+        }
+    } else {
+        //start-device_addr-word_addr-start-device_addr-data-stop; no_ack of end data
+        ret |= i2c_master_start(cmd);
+        ret |= i2c_master_write_byte(cmd, (access->addr << 1) | I2C_MASTER_READ, true);
+        if (access->len > 1) {
+            ret |= i2c_master_read(cmd, access->data, access->len - 1, I2C_MASTER_ACK);
+        }
+        ret |= i2c_master_read_byte(cmd, access->data + access->len - 1,
+                I2C_MASTER_NACK);
+    }
+    ret |= i2c_master_stop(cmd);
+    return ret == ESP_OK ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* build the link of a register access and run it once */
+static esp_err_t i2c_bus_access_run(i2c_bus_t* bus,
+        const i2c_bus_access_t* access, TickType_t ticks_to_wait)
+{
+#ifdef I2C_BUS_LINK_SIZE
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(access->link, I2C_BUS_LINK_SIZE);
+#else
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+#endif
+    if (cmd == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = i2c_bus_build(cmd, access);
+    if (ret == ESP_OK) {
+        ret = i2c_master_cmd_begin(bus->i2c_port, cmd, ticks_to_wait);
+    }
+#ifdef I2C_BUS_LINK_SIZE
+    i2c_cmd_link_delete_static(cmd);
+#else
+    i2c_cmd_link_delete(cmd);
+#endif
+    return ret;
+}
+
+/*
+ * run a command link, or build and run the link of a register access, in
+ * what is left of a timeout that started at start, and count its errors,
+ * and with a device its bytes and latency, the caller owns the bus. A link
+ * is used up by running it, only an access can be built again and retried
+ * after a recovery.
+ */
+static esp_err_t i2c_bus_cmd(i2c_bus_t* bus, i2c_bus_device_t* dev,
+        i2c_cmd_handle_t cmd, const i2c_bus_access_t* access, size_t bytes,
+        TickType_t start, TickType_t ticks_to_wait)
+{
+    int64_t start_us = esp_timer_get_time();
+    TickType_t left = i2c_bus_remaining(start, ticks_to_wait);
+    esp_err_t ret = cmd != NULL ? i2c_master_cmd_begin(bus->i2c_port, cmd, left)
+            : i2c_bus_access_run(bus, access, left);
+    if (ret == ESP_ERR_TIMEOUT && i2c_bus_recover(bus) && cmd == NULL) {
+        // the access was lost to the held bus rather than to the device,
+        // the recovery took some of the time too
+        left = i2c_bus_remaining(start, ticks_to_wait);
+        if (left > 0) {
+            ret = i2c_bus_access_run(bus, access, left);
+        }
+    }
+    if (ret == ESP_ERR_NO_MEM) {
+        return ret;     // never reached the bus
+    }
+    if (dev != NULL) {
+        i2c_bus_device_record(dev, ret, bytes, esp_timer_get_time() - start_us);
+        i2c_bus_device_budget(bus, dev, ret);
+    }
+    if (ret == ESP_OK) {
+        bus->errors_in_row = 0;
+        if (dev != NULL) {
+            dev->clock_counted = 0;
+        }
+        return ret;
+    }
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (ret == ESP_ERR_TIMEOUT) {
+        bus->stats.cmd_timeouts++;
+    } else {
+        bus->stats.nacks++;
+    }
+    xSemaphoreGive(bus->lock);
+    // a clock stretched past the timeout hints at a clock too fast for the
+    // wiring, NACKs only when they come from several devices: an absent or
+    // broken device counts once per clock rate until it answers again, and
+    // a plain command link can't tell which device it was
+    bool clock_error = ret == ESP_ERR_TIMEOUT;
+    if (!clock_error && dev != NULL && dev->clock_counted != bus->clock_epoch + 1) {
+        dev->clock_counted = bus->clock_epoch + 1;
+        clock_error = true;
+    }
+    if (clock_error && ++bus->errors_in_row >= I2C_BUS_CLOCK_STEP_ERRORS
+            && bus->auto_clock) {
+        i2c_bus_clock_step(bus);
+    }
+    return ret;
+}
+
+/*
+ * Queue for the bus and run a command link or register access in the time
+ * left. When the queue took all of it nothing runs: that's contention,
+ * neither the bus nor the device failed, so it doesn't count as their
+ * error.
+ */
+static esp_err_t i2c_bus_run(i2c_bus_t* bus, i2c_bus_device_t* dev, int priority,
+        i2c_cmd_handle_t cmd, const i2c_bus_access_t* access, size_t bytes,
+        TickType_t ticks_to_wait)
+{
+    TickType_t start = xTaskGetTickCount();
+    esp_err_t ret = i2c_bus_acquire(bus, priority, ticks_to_wait);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (i2c_bus_remaining(start, ticks_to_wait) == 0) {
+        xSemaphoreTake(bus->lock, portMAX_DELAY);
+        bus->stats.timeouts++;
+        xSemaphoreGive(bus->lock);
+        i2c_bus_release(bus, 0);
+        return ESP_ERR_TIMEOUT;
+    }
+    ret = i2c_bus_cmd(bus, dev, cmd, access, bytes, start, ticks_to_wait);
+    i2c_bus_release(bus, 1);
+    return ret;
+}
+
 esp_err_t iot_i2c_bus_cmd_begin(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd, portBASE_TYPE ticks_to_wait)
 {
     I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
     I2C_BUS_CHECK(cmd != NULL, "I2C cmd error", ESP_FAIL);
+    return i2c_bus_run((i2c_bus_t*) bus, NULL, I2C_BUS_PRIORITY_TASK, cmd, NULL, 0,
+            ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_lock(i2c_bus_handle_t bus, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
+    return i2c_bus_acquire((i2c_bus_t*) bus, I2C_BUS_PRIORITY_TASK, ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_unlock(i2c_bus_handle_t bus)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
     i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
-    return i2c_master_cmd_begin(i2c_bus->i2c_port, cmd, ticks_to_wait);
+    I2C_BUS_CHECK(i2c_bus->owner == xTaskGetCurrentTaskHandle(), "Not the owner",
+            ESP_FAIL);
+    i2c_bus_release(i2c_bus, 0);
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_set_auto_clock(i2c_bus_handle_t bus, bool enable,
+        i2c_bus_clock_cb_t cb, void* arg)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
+    i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
+    xSemaphoreTake(i2c_bus->lock, portMAX_DELAY);
+    i2c_bus->auto_clock = enable;
+    i2c_bus->clock_cb = cb;
+    i2c_bus->clock_arg = arg;
+    xSemaphoreGive(i2c_bus->lock);
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_set_retry_budget(i2c_bus_handle_t bus, uint32_t errors,
+        uint32_t backoff_ms)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
+    i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
+    xSemaphoreTake(i2c_bus->lock, portMAX_DELAY);
+    i2c_bus->retry_errors = errors;
+    i2c_bus->backoff_ms = backoff_ms;
+    xSemaphoreGive(i2c_bus->lock);
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_get_stats(i2c_bus_handle_t bus, i2c_bus_stats_t* stats)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(stats != NULL, "Pointer error", ESP_FAIL);
+    i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
+    xSemaphoreTake(i2c_bus->lock, portMAX_DELAY);
+    *stats = i2c_bus->stats;
+    xSemaphoreGive(i2c_bus->lock);
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_probe(i2c_bus_handle_t bus, uint8_t id_reg,
+        const uint8_t* addrs, size_t addr_count, i2c_bus_probe_result_t* found,
+        size_t* found_count, int64_t deadline_us)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_ERR_INVALID_ARG);
+    I2C_BUS_CHECK(addrs != NULL && found != NULL && found_count != NULL,
+            "Pointer error", ESP_ERR_INVALID_ARG);
+    i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
+    size_t capacity = *found_count;
+    TickType_t ticks_to_wait = portMAX_DELAY;
+    if (deadline_us > 0) {
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        ticks_to_wait = left_us > 0 ? left_us / 1000 / portTICK_PERIOD_MS + 1 : 0;
+    }
+
+    *found_count = 0;
+    esp_err_t ret = i2c_bus_acquire(i2c_bus, I2C_BUS_PRIORITY_TASK, ticks_to_wait);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    uint32_t transactions = 0;
+    for (size_t i = 0; i < addr_count && *found_count < capacity; i++) {
+        if (deadline_us > 0 && esp_timer_get_time() >= deadline_us) {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+        // an absent device doesn't acknowledge its address, so the read
+        // fails, which is expected here and not counted as a bus error
+        uint8_t id;
+        i2c_bus_access_t access = {
+            .addr = addrs[i],
+            .dir = I2C_BUS_XFER_READ,
+            .reg = id_reg,
+            .data = &id,
+            .len = 1,
+        };
+#ifdef I2C_BUS_LINK_SIZE
+        uint8_t link[I2C_BUS_LINK_SIZE] __attribute__((aligned(sizeof(void*))));
+        access.link = link;
+#endif
+        esp_err_t err = i2c_bus_access_run(i2c_bus, &access,
+                I2C_BUS_PROBE_TIMEOUT_MS / portTICK_PERIOD_MS);
+        if (err == ESP_ERR_NO_MEM) {
+            ret = err;
+            break;
+        }
+        transactions++;
+        if (err == ESP_OK) {
+            found[*found_count].addr = addrs[i];
+            found[*found_count].id = id;
+            (*found_count)++;
+        }
+    }
+    i2c_bus_release(i2c_bus, transactions);
+    return ret;
+}
+
+i2c_bus_device_handle_t iot_i2c_bus_device_create(i2c_bus_handle_t bus,
+        uint8_t addr)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", NULL);
+    i2c_bus_device_t* dev = (i2c_bus_device_t*) calloc(1, sizeof(i2c_bus_device_t));
+    I2C_BUS_CHECK(dev != NULL, "Memory error", NULL);
+    dev->bus = (i2c_bus_t*) bus;
+    dev->addr = addr;
+    dev->priority = I2C_BUS_PRIORITY_TASK;
+    dev->stats.addr = addr;
+    xSemaphoreTake(dev->bus->lock, portMAX_DELAY);
+    dev->next = dev->bus->devices;
+    dev->bus->devices = dev;
+    xSemaphoreGive(dev->bus->lock);
+    return (i2c_bus_device_handle_t) dev;
+}
+
+esp_err_t iot_i2c_bus_device_set_priority(i2c_bus_device_handle_t dev,
+        int priority)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    ((i2c_bus_device_t*) dev)->priority = priority;
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_device_cmd_begin(i2c_bus_device_handle_t dev,
+        i2c_cmd_handle_t cmd, size_t bytes, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(cmd != NULL, "I2C cmd error", ESP_FAIL);
+    i2c_bus_device_t* device = (i2c_bus_device_t*) dev;
+    if (i2c_bus_device_benched(device)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return i2c_bus_run(device->bus, device, device->priority, cmd, NULL, bytes,
+            ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_device_get_stats(i2c_bus_device_handle_t dev,
+        i2c_bus_device_stats_t* stats)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(stats != NULL, "Pointer error", ESP_FAIL);
+    i2c_bus_device_t* device = (i2c_bus_device_t*) dev;
+    // owning the bus keeps the recording side out, the copy is consistent
+    esp_err_t ret = i2c_bus_acquire(device->bus, I2C_BUS_PRIORITY_TASK, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    *stats = device->stats;
+    i2c_bus_release(device->bus, 0);
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_get_device_stats(i2c_bus_handle_t bus,
+        i2c_bus_device_stats_t* stats, size_t* count)
+{
+    I2C_BUS_CHECK(bus != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(stats != NULL && count != NULL, "Pointer error", ESP_FAIL);
+    i2c_bus_t* i2c_bus = (i2c_bus_t*) bus;
+    size_t capacity = *count;
+    esp_err_t ret = i2c_bus_acquire(i2c_bus, I2C_BUS_PRIORITY_TASK, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    *count = 0;
+    xSemaphoreTake(i2c_bus->lock, portMAX_DELAY);
+    for (i2c_bus_device_t* dev = i2c_bus->devices; dev != NULL; dev = dev->next) {
+        if (*count == capacity) {
+            ret = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        stats[(*count)++] = dev->stats;
+    }
+    xSemaphoreGive(i2c_bus->lock);
+    i2c_bus_release(i2c_bus, 0);
+    return ret;
+}
+
+esp_err_t iot_i2c_bus_device_delete(i2c_bus_device_handle_t dev)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    i2c_bus_device_t* device = (i2c_bus_device_t*) dev;
+    xSemaphoreTake(device->bus->lock, portMAX_DELAY);
+    i2c_bus_device_t** link = &device->bus->devices;
+    while (*link != device) {
+        link = &(*link)->next;
+    }
+    *link = device->next;
+    xSemaphoreGive(device->bus->lock);
+    free(device);
+    return ESP_OK;
+}
+
+static esp_err_t i2c_bus_device_access(i2c_bus_device_t* dev,
+        i2c_bus_xfer_dir_t dir, uint8_t reg, uint8_t* data, size_t len,
+        TickType_t ticks_to_wait)
+{
+    if (i2c_bus_device_benched(dev)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // the link storage of a device is only touched while owning the bus,
+    // several tasks can share it
+    i2c_bus_access_t access = {
+        .link = I2C_BUS_LINK_OF(dev),
+        .addr = dev->addr,
+        .dir = dir,
+        .reg = reg,
+        .data = data,
+        .len = len,
+    };
+    return i2c_bus_run(dev->bus, dev, dev->priority, NULL, &access, len,
+            ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_read_reg(i2c_bus_device_handle_t dev, uint8_t reg,
+        uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(data != NULL && len > 0, "Pointer error", ESP_FAIL);
+    return i2c_bus_device_access((i2c_bus_device_t*) dev, I2C_BUS_XFER_READ,
+            reg, data, len, ticks_to_wait);
+}
+
+esp_err_t iot_i2c_bus_write_reg(i2c_bus_device_handle_t dev, uint8_t reg,
+        const uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(dev != NULL, "Handle error", ESP_FAIL);
+    I2C_BUS_CHECK(data != NULL || len == 0, "Pointer error", ESP_FAIL);
+    return i2c_bus_device_access((i2c_bus_device_t*) dev, I2C_BUS_XFER_WRITE,
+            reg, (uint8_t*) data, len, ticks_to_wait);
+}
+
+static void i2c_bus_async_worker(void* arg)
+{
+    i2c_bus_t* bus = (i2c_bus_t*) arg;
+    i2c_bus_async_t* req;
+
+    while (xQueueReceive(bus->async_queue, &req, portMAX_DELAY) == pdTRUE
+            && req != NULL) {
+        esp_err_t ret = i2c_bus_device_access((i2c_bus_device_t*) req->dev,
+                req->dir, req->reg, req->data, req->len, req->ticks_to_wait);
+        // once done is set the submitter may reuse req, the release store
+        // makes ret visible to a waiter on the other core before done is
+        i2c_bus_async_cb_t cb = req->cb;
+        if (cb != NULL) {
+            req->ret = ret;
+            __atomic_store_n(&req->done, true, __ATOMIC_RELEASE);
+            cb(req);
+            continue;
+        }
+        // iot_i2c_bus_wait returns once it has the semaphore and then the
+        // bus lock, by then done is set and req is the submitter's again
+        xSemaphoreTake(bus->lock, portMAX_DELAY);
+        req->ret = ret;
+        xSemaphoreGive(req->sem);
+        __atomic_store_n(&req->done, true, __ATOMIC_RELEASE);
+        xSemaphoreGive(bus->lock);
+    }
+    xSemaphoreGive(bus->async_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t i2c_bus_async_start(i2c_bus_t* bus)
+{
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    if (bus->async_queue == NULL) {
+        bus->async_exit = xSemaphoreCreateBinary();
+        bus->async_queue = xQueueCreate(I2C_BUS_ASYNC_QUEUE_LEN,
+                sizeof(i2c_bus_async_t*));
+        if (bus->async_exit == NULL || bus->async_queue == NULL
+                || xTaskCreate(i2c_bus_async_worker, "i2c_bus", I2C_BUS_WORKER_STACK,
+                        bus, I2C_BUS_WORKER_PRIORITY, NULL) != pdPASS) {
+            if (bus->async_exit != NULL) {
+                vSemaphoreDelete(bus->async_exit);
+            }
+            if (bus->async_queue != NULL) {
+                vQueueDelete(bus->async_queue);
+            }
+            bus->async_exit = NULL;
+            bus->async_queue = NULL;
+            ret = ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreGive(bus->lock);
+    return ret;
+}
+
+esp_err_t iot_i2c_bus_submit(i2c_bus_async_t* req)
+{
+    I2C_BUS_CHECK(req != NULL && req->dev != NULL, "Request error", ESP_ERR_INVALID_ARG);
+    I2C_BUS_CHECK(req->data != NULL || (req->len == 0 && req->dir == I2C_BUS_XFER_WRITE),
+            "Pointer error", ESP_ERR_INVALID_ARG);
+    i2c_bus_t* bus = ((i2c_bus_device_t*) req->dev)->bus;
+    if (bus->async_queue == NULL && i2c_bus_async_start(bus) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    __atomic_store_n(&req->done, false, __ATOMIC_RELAXED);
+    req->ret = ESP_FAIL;
+    req->sem = req->cb == NULL ? xSemaphoreCreateBinaryStatic(&req->sem_buf) : NULL;
+    if (xQueueSend(bus->async_queue, &req, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t iot_i2c_bus_wait(i2c_bus_async_t* req, portBASE_TYPE ticks_to_wait)
+{
+    I2C_BUS_CHECK(req != NULL && req->dev != NULL, "Request error", ESP_ERR_INVALID_ARG);
+    if (__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+        return req->ret;
+    }
+    if (req->sem == NULL || xSemaphoreTake(req->sem, ticks_to_wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    // the worker gave the semaphore holding the bus lock and sets done
+    // before it lets go of it
+    i2c_bus_t* bus = ((i2c_bus_device_t*) req->dev)->bus;
+    xSemaphoreTake(bus->lock, portMAX_DELAY);
+    xSemaphoreGive(bus->lock);
+    return req->ret;
 }
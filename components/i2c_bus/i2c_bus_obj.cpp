@@ -39,7 +39,78 @@ esp_err_t CI2CBus::send(i2c_cmd_handle_t cmd, portBASE_TYPE ticks_to_wait)
     return iot_i2c_bus_cmd_begin(m_i2c_bus_handle, cmd, ticks_to_wait);
 }
 
+esp_err_t CI2CBus::lock(portBASE_TYPE ticks_to_wait)
+{
+    return iot_i2c_bus_lock(m_i2c_bus_handle, ticks_to_wait);
+}
+
+esp_err_t CI2CBus::unlock()
+{
+    return iot_i2c_bus_unlock(m_i2c_bus_handle);
+}
+
+esp_err_t CI2CBus::submit(i2c_bus_async_t *req)
+{
+    return iot_i2c_bus_submit(req);
+}
+
+esp_err_t CI2CBus::wait(i2c_bus_async_t *req, portBASE_TYPE ticks_to_wait)
+{
+    return iot_i2c_bus_wait(req, ticks_to_wait);
+}
+
+esp_err_t CI2CBus::set_auto_clock(bool enable, i2c_bus_clock_cb_t cb, void *arg)
+{
+    return iot_i2c_bus_set_auto_clock(m_i2c_bus_handle, enable, cb, arg);
+}
+
+esp_err_t CI2CBus::set_retry_budget(uint32_t errors, uint32_t backoff_ms)
+{
+    return iot_i2c_bus_set_retry_budget(m_i2c_bus_handle, errors, backoff_ms);
+}
+
+esp_err_t CI2CBus::get_stats(i2c_bus_stats_t *stats)
+{
+    return iot_i2c_bus_get_stats(m_i2c_bus_handle, stats);
+}
+
 i2c_bus_handle_t CI2CBus::get_bus_handle()
 {
     return m_i2c_bus_handle;
 }
+
+CI2CDevice::CI2CDevice(CI2CBus *bus, uint8_t addr)
+{
+    m_dev_handle = iot_i2c_bus_device_create(bus->get_bus_handle(), addr);
+}
+
+CI2CDevice::~CI2CDevice()
+{
+    iot_i2c_bus_device_delete(m_dev_handle);
+    m_dev_handle = NULL;
+}
+
+esp_err_t CI2CDevice::read(uint8_t reg, uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait)
+{
+    return iot_i2c_bus_read_reg(m_dev_handle, reg, data, len, ticks_to_wait);
+}
+
+esp_err_t CI2CDevice::write(uint8_t reg, const uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait)
+{
+    return iot_i2c_bus_write_reg(m_dev_handle, reg, data, len, ticks_to_wait);
+}
+
+esp_err_t CI2CDevice::set_priority(int priority)
+{
+    return iot_i2c_bus_device_set_priority(m_dev_handle, priority);
+}
+
+esp_err_t CI2CDevice::get_stats(i2c_bus_device_stats_t *stats)
+{
+    return iot_i2c_bus_device_get_stats(m_dev_handle, stats);
+}
+
+i2c_bus_device_handle_t CI2CDevice::get_device_handle()
+{
+    return m_dev_handle;
+}
@@ -0,0 +1,458 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "driver/i2c.h"
+#include "i2c_sim.h"
+
+#define I2C_SIM_MAX_DEVICES 8
+#define I2C_SIM_MAX_OPS 64
+#define I2C_SIM_MAX_HANG_MS 1000
+#define I2C_SIM_SPI_HOSTS 3
+#define I2C_SIM_BYTE_BITS 9     /* 8 data bits and the ACK */
+
+typedef enum {
+    I2C_SIM_START,
+    I2C_SIM_WRITE,
+    I2C_SIM_READ,
+    I2C_SIM_STOP,
+} i2c_sim_op_type_t;
+
+typedef struct {
+    i2c_sim_op_type_t type;
+    uint8_t value;          /*!< byte to write, if src is NULL */
+    const uint8_t *src;     /*!< bytes to write, read when the link runs */
+    uint8_t *data;          /*!< where read bytes go */
+    size_t len;
+} i2c_sim_op_t;
+
+/* like the driver's links, refers to longer written data rather than copying it */
+typedef struct {
+    int count;
+    int capacity;
+    i2c_sim_op_t ops[];
+} i2c_sim_cmd_t;
+
+static i2c_sim_device_t *s_devices[I2C_SIM_MAX_DEVICES];
+static int s_active[I2C_NUM_MAX];      /* commands running on each port */
+static uint32_t s_clk_hz[I2C_NUM_MAX];  /* clock each port was configured at */
+static gpio_num_t s_scl[I2C_NUM_MAX];   /* pins each port was configured with */
+static gpio_num_t s_sda[I2C_NUM_MAX];
+static bool s_installed[I2C_NUM_MAX];
+static uint32_t s_scl_level[I2C_NUM_MAX];  /* levels the master drives */
+static uint32_t s_sda_level[I2C_NUM_MAX];
+static uint32_t s_collisions;
+static i2c_sim_stats_t s_stats[I2C_NUM_MAX];
+static i2c_sim_stats_t s_spi_stats[I2C_SIM_SPI_HOSTS];
+
+void i2c_sim_attach(i2c_sim_device_t *dev)
+{
+    if (dev == NULL) {
+        memset(s_devices, 0, sizeof(s_devices));
+        return;
+    }
+    for (int i = 0; i < I2C_SIM_MAX_DEVICES; i++) {
+        if (s_devices[i] == NULL) {
+            s_devices[i] = dev;
+            return;
+        }
+    }
+    abort();
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf)
+{
+    s_clk_hz[i2c_num] = i2c_conf->master.clk_speed;
+    s_scl[i2c_num] = i2c_conf->scl_io_num;
+    s_sda[i2c_num] = i2c_conf->sda_io_num;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode,
+        size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags)
+{
+    s_installed[i2c_num] = true;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num)
+{
+    // the driver leaves both lines released
+    s_installed[i2c_num] = false;
+    s_scl_level[i2c_num] = 1;
+    s_sda_level[i2c_num] = 1;
+    return ESP_OK;
+}
+
+static bool i2c_sim_sda_held(i2c_port_t port)
+{
+    for (int i = 0; i < I2C_SIM_MAX_DEVICES; i++) {
+        if (s_devices[i] && !s_devices[i]->spi && s_devices[i]->port == port
+                && s_devices[i]->stuck_clocks) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the pins only matter once the driver let go of them */
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    for (int port = 0; port < I2C_NUM_MAX; port++) {
+        if (s_installed[port]) {
+            continue;
+        }
+        if (gpio_num == s_scl[port]) {
+            if (level && !s_scl_level[port]) {
+                for (int i = 0; i < I2C_SIM_MAX_DEVICES; i++) {
+                    if (s_devices[i] && !s_devices[i]->spi
+                            && s_devices[i]->port == port && s_devices[i]->stuck_clocks) {
+                        s_devices[i]->stuck_clocks--;
+                    }
+                }
+            }
+            s_scl_level[port] = level;
+        } else if (gpio_num == s_sda[port]) {
+            s_sda_level[port] = level;
+        }
+    }
+    return ESP_OK;
+}
+
+/* the driver leaves both lines released between commands, a stretching
+ * device only holds SCL while it is addressed */
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    for (int port = 0; port < I2C_NUM_MAX; port++) {
+        if (gpio_num == s_sda[port]) {
+            return (s_installed[port] || s_sda_level[port]) && !i2c_sim_sda_held(port);
+        }
+        if (gpio_num == s_scl[port]) {
+            return s_installed[port] || s_scl_level[port];
+        }
+    }
+    return 1;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void)
+{
+    i2c_sim_cmd_t *cmd = (i2c_sim_cmd_t *) calloc(1,
+            sizeof(i2c_sim_cmd_t) + I2C_SIM_MAX_OPS * sizeof(i2c_sim_op_t));
+    if (cmd) {
+        cmd->capacity = I2C_SIM_MAX_OPS;
+    }
+    return (i2c_cmd_handle_t) cmd;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t *buffer, uint32_t size)
+{
+    if (size < sizeof(i2c_sim_cmd_t) + sizeof(i2c_sim_op_t)) {
+        return NULL;
+    }
+    i2c_sim_cmd_t *cmd = (i2c_sim_cmd_t *) buffer;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->capacity = (size - sizeof(i2c_sim_cmd_t)) / sizeof(i2c_sim_op_t);
+    return (i2c_cmd_handle_t) cmd;
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle)
+{
+    free(cmd_handle);
+}
+
+void i2c_cmd_link_delete_static(i2c_cmd_handle_t cmd_handle)
+{
+}
+
+static esp_err_t i2c_sim_add(i2c_cmd_handle_t cmd_handle,
+        i2c_sim_op_type_t type, uint8_t value, const uint8_t *src,
+        uint8_t *data, size_t len)
+{
+    i2c_sim_cmd_t *cmd = (i2c_sim_cmd_t *) cmd_handle;
+    if (cmd->count == cmd->capacity) {
+        return ESP_ERR_NO_MEM;
+    }
+    cmd->ops[cmd->count].type = type;
+    cmd->ops[cmd->count].value = value;
+    cmd->ops[cmd->count].src = src;
+    cmd->ops[cmd->count].data = data;
+    cmd->ops[cmd->count].len = len;
+    cmd->count++;
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle)
+{
+    return i2c_sim_add(cmd_handle, I2C_SIM_START, 0, NULL, NULL, 0);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle)
+{
+    return i2c_sim_add(cmd_handle, I2C_SIM_STOP, 0, NULL, NULL, 0);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data,
+        bool ack_en)
+{
+    return i2c_sim_add(cmd_handle, I2C_SIM_WRITE, data, NULL, NULL, 1);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, const uint8_t *data,
+        size_t data_len, bool ack_en)
+{
+    // like the driver, a single byte is copied as the link is built
+    if (data_len == 1) {
+        return i2c_master_write_byte(cmd_handle, data[0], ack_en);
+    }
+    return i2c_sim_add(cmd_handle, I2C_SIM_WRITE, 0, data, NULL, data_len);
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data,
+        i2c_ack_type_t ack)
+{
+    return i2c_sim_add(cmd_handle, I2C_SIM_READ, 0, NULL, data, 1);
+}
+
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t *data,
+        size_t data_len, i2c_ack_type_t ack)
+{
+    return i2c_sim_add(cmd_handle, I2C_SIM_READ, 0, NULL, data, data_len);
+}
+
+static i2c_sim_device_t *i2c_sim_find(i2c_port_t port, uint8_t addr)
+{
+    for (int i = 0; i < I2C_SIM_MAX_DEVICES; i++) {
+        if (s_devices[i] && !s_devices[i]->spi && s_devices[i]->port == port
+                && s_devices[i]->addr == addr) {
+            return s_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* bytes and bits went over the wire, up to the byte nobody acknowledged */
+static esp_err_t i2c_sim_run(i2c_port_t port, i2c_sim_cmd_t *cmd,
+        i2c_sim_device_t **last, uint32_t *bytes, uint32_t *bits)
+{
+    i2c_sim_device_t *dev = NULL;
+    bool addressed = false;     /* the byte after a start is the address */
+    bool reg_set = false;       /* the first byte written selects a register */
+    bool reading = false;       /* a read phase is under way */
+    bool counted = false;
+    uint8_t reg = 0;
+
+    for (int i = 0; i < cmd->count; i++) {
+        i2c_sim_op_t *op = &cmd->ops[i];
+        if (op->type == I2C_SIM_START) {
+            addressed = false;
+            reading = false;
+            (*bits)++;
+            continue;
+        }
+        if (op->type == I2C_SIM_STOP) {
+            dev = NULL;
+            (*bits)++;
+            continue;
+        }
+        for (size_t n = 0; n < op->len; n++) {
+            uint8_t byte = op->src ? op->src[n] : op->value;
+            (*bytes)++;
+            *bits += I2C_SIM_BYTE_BITS;
+            if (op->type == I2C_SIM_READ) {
+                if (dev == NULL) {
+                    return ESP_FAIL;
+                }
+                if (!reading && dev->read) {
+                    dev->read(dev, reg);
+                }
+                reading = true;
+                op->data[n] = dev->regs[reg++];
+                dev->bytes++;
+            } else if (!addressed) {
+                addressed = true;
+                dev = i2c_sim_find(port, byte >> 1);
+                *last = dev;
+                if (dev == NULL) {
+                    return ESP_FAIL;    /* nobody acknowledged the address */
+                }
+                if (dev->max_clk_hz && s_clk_hz[port] > dev->max_clk_hz) {
+                    return ESP_FAIL;    /* it couldn't follow the clock */
+                }
+                if (dev->stretch) {
+                    return ESP_ERR_TIMEOUT;
+                }
+                if (!counted) {
+                    dev->transactions++;
+                    counted = true;
+                }
+                if ((byte & 1) == I2C_MASTER_WRITE) {
+                    reg_set = false;
+                }
+            } else if (!reg_set) {
+                reg = byte;
+                reg_set = true;
+            } else {
+                dev->regs[reg] = byte;
+                dev->bytes++;
+                if (dev->written) {
+                    dev->written(dev, reg);
+                }
+                reg++;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+uint32_t i2c_sim_collisions(void)
+{
+    return __atomic_load_n(&s_collisions, __ATOMIC_SEQ_CST);
+}
+
+static void i2c_sim_charge(i2c_sim_stats_t *stats, uint32_t bytes,
+        uint32_t bits, uint32_t clk_hz)
+{
+    __atomic_fetch_add(&stats->transactions, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&stats->bytes, bytes, __ATOMIC_SEQ_CST);
+    if (clk_hz) {
+        __atomic_fetch_add(&stats->bus_ns, (uint64_t) bits * 1000000000 / clk_hz,
+                __ATOMIC_SEQ_CST);
+    }
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle,
+        TickType_t ticks_to_wait)
+{
+    i2c_sim_device_t *dev = NULL;
+    uint32_t bytes = 0, bits = 0;
+    esp_err_t ret;
+
+    if (!s_installed[i2c_num]) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // a port runs one command at a time, like the hardware
+    if (__atomic_fetch_add(&s_active[i2c_num], 1, __ATOMIC_SEQ_CST) != 0) {
+        __atomic_fetch_add(&s_collisions, 1, __ATOMIC_SEQ_CST);
+    }
+    if (i2c_sim_sda_held(i2c_num)) {
+        ret = ESP_ERR_TIMEOUT;      /* no START while SDA is low */
+    } else {
+        ret = i2c_sim_run(i2c_num, (i2c_sim_cmd_t *) cmd_handle, &dev, &bytes,
+                &bits);
+        if (ret == ESP_FAIL) {
+            bits++;     /* the STOP after a NACK */
+        }
+        i2c_sim_charge(&s_stats[i2c_num], bytes, bits, s_clk_hz[i2c_num]);
+    }
+    if (ret == ESP_ERR_TIMEOUT) {
+        TickType_t max_ticks = I2C_SIM_MAX_HANG_MS / portTICK_PERIOD_MS;
+        usleep(1000 * portTICK_PERIOD_MS
+                * (ticks_to_wait < max_ticks ? ticks_to_wait : max_ticks));
+    } else if (dev && dev->busy_us) {
+        usleep(dev->busy_us);
+    }
+    __atomic_fetch_sub(&s_active[i2c_num], 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+void i2c_sim_get_stats(int port, i2c_sim_stats_t *stats)
+{
+    stats->transactions = __atomic_load_n(&s_stats[port].transactions, __ATOMIC_SEQ_CST);
+    stats->bytes = __atomic_load_n(&s_stats[port].bytes, __ATOMIC_SEQ_CST);
+    stats->bus_ns = __atomic_load_n(&s_stats[port].bus_ns, __ATOMIC_SEQ_CST);
+}
+
+void i2c_sim_get_spi_stats(int host, i2c_sim_stats_t *stats)
+{
+    *stats = s_spi_stats[host];
+}
+
+void i2c_sim_reset_stats(void)
+{
+    memset(s_stats, 0, sizeof(s_stats));
+    memset(s_spi_stats, 0, sizeof(s_spi_stats));
+}
+
+static i2c_sim_device_t *i2c_sim_spi_find(int host, uint8_t cs)
+{
+    for (int i = 0; i < I2C_SIM_MAX_DEVICES; i++) {
+        if (s_devices[i] && s_devices[i]->spi && s_devices[i]->port == host
+                && s_devices[i]->cs == cs) {
+            return s_devices[i];
+        }
+    }
+    return NULL;
+}
+
+bool i2c_sim_spi_present(int host, uint8_t cs)
+{
+    return host >= 0 && host < I2C_SIM_SPI_HOSTS && i2c_sim_spi_find(host, cs);
+}
+
+bool i2c_sim_spi_transfer(int host, uint8_t cs, uint32_t clk_hz,
+        const uint8_t *mosi, uint8_t *miso, size_t len)
+{
+    if (!i2c_sim_spi_present(host, cs) || mosi == NULL || len == 0) {
+        return false;
+    }
+    i2c_sim_device_t *dev = i2c_sim_spi_find(host, cs);
+    bool read = mosi[0] & 0x80;
+    uint8_t addr = mosi[0] & 0x7F;
+    uint8_t reg = dev->spi_reg ? dev->spi_reg(dev, addr) : addr | 0x80;
+
+    dev->transactions++;
+    if (miso) {
+        miso[0] = 0xFF;
+    }
+    if (read && len > 1 && dev->read) {
+        dev->read(dev, reg);
+    }
+    for (size_t n = 1; n < len; n++, reg++) {
+        if (read) {
+            if (miso) {
+                miso[n] = dev->regs[reg];
+            }
+        } else {
+            dev->regs[reg] = mosi[n];
+            if (dev->written) {
+                dev->written(dev, reg);
+            }
+        }
+        dev->bytes++;
+    }
+    i2c_sim_charge(&s_spi_stats[host], len, len * 8, clk_hz);
+    if (dev->busy_us) {
+        usleep(dev->busy_us);
+    }
+    return true;
+}
+
+float i2c_sim_wave_at(const i2c_sim_wave_t *wave, uint32_t t_ms)
+{
+    if (wave->count == 0) {
+        return 0;
+    }
+    if (t_ms <= wave->points[0].t_ms) {
+        return wave->points[0].value;
+    }
+    for (size_t i = 1; i < wave->count; i++) {
+        const i2c_sim_point_t *a = &wave->points[i - 1];
+        const i2c_sim_point_t *b = &wave->points[i];
+        if (t_ms < b->t_ms) {
+            return a->value + (b->value - a->value) * (float) (t_ms - a->t_ms)
+                    / (float) (b->t_ms - a->t_ms);
+        }
+    }
+    return wave->points[wave->count - 1].value;
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef _I2C_SIM_H_
+#define _I2C_SIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Register-mapped I2C and SPI devices behind a fake ESP-IDF I2C master
+ * driver, for running the drivers in a host (linux target) build, where it
+ * replaces the driver. It implements the i2c_cmd_link and i2c_master_*
+ * calls: the first byte written after the address selects a register,
+ * further writes store to it and reads return it, both auto-incrementing
+ * like the Bosch sensors do. Like the driver's links, a link copies a
+ * single byte given to i2c_master_write() as it is built and refers to
+ * longer buffers, reading them when it runs. Sensor
+ * models hook into the accesses through the read and written callbacks.
+ *
+ * Every command and SPI transfer is charged the time it takes on the wire
+ * at the clock of its port: 9 bits per I2C byte and one per START and STOP,
+ * 8 bits per SPI byte. This is virtual time, only counted in the stats;
+ * busy_us is what a device really sleeps for.
+ *
+ * Faults are injected per device: a stuck device holds SDA low, so every
+ * command on its port times out until the SCL pin set up by
+ * i2c_param_config() was pulsed through gpio_set_level(), and a stretching
+ * one times out the commands addressed to it. gpio_get_level() reads the
+ * lines as the devices leave them. A timeout takes the ticks the
+ * command was given, at most a second.
+ */
+typedef struct i2c_sim_device i2c_sim_device_t;
+
+/**
+ * @brief Model hook for an access to reg, called before each read phase
+ *        with the register it starts at, or after a byte was written to it
+ */
+typedef void (*i2c_sim_access_cb_t)(i2c_sim_device_t *dev, uint8_t reg);
+
+/**
+ * @brief Register an SPI access goes to, from the 7 address bits of its
+ *        first byte
+ */
+typedef uint8_t (*i2c_sim_spi_reg_cb_t)(i2c_sim_device_t *dev, uint8_t addr);
+
+struct i2c_sim_device {
+    uint8_t port;              /*!< I2C port or SPI host it is wired to */
+    uint8_t addr;              /*!< 7 bit device address */
+    bool spi;                  /*!< on the SPI host `port` rather than I2C */
+    uint8_t cs;                /*!< SPI chip select GPIO */
+    uint8_t regs[256];         /*!< register map */
+    uint32_t transactions;     /*!< i2c_master_cmd_begin calls that reached it */
+    uint32_t bytes;            /*!< data bytes read or written */
+    uint32_t busy_us;          /*!< time each transaction holds the bus */
+    uint32_t max_clk_hz;       /*!< NACKs at faster clocks, 0 for any clock */
+    uint32_t stuck_clocks;     /*!< SCL pulses until it lets go of SDA */
+    bool stretch;              /*!< holds SCL low whenever it is addressed */
+    i2c_sim_access_cb_t read;          /*!< updates registers before they are read */
+    i2c_sim_access_cb_t written;       /*!< acts on a register write */
+    i2c_sim_spi_reg_cb_t spi_reg;      /*!< SPI register map, NULL for addr | 0x80 */
+};
+
+/**
+ * @brief Traffic of a port, with the time it took on the wire
+ */
+typedef struct {
+    uint32_t transactions;     /*!< commands or transfers that ran */
+    uint32_t bytes;            /*!< bytes on the wire, addresses included */
+    uint64_t bus_ns;           /*!< time they take at the port's clock */
+} i2c_sim_stats_t;
+
+/**
+ * @brief One point of a waveform, the value at t_ms
+ */
+typedef struct {
+    uint32_t t_ms;
+    float value;
+} i2c_sim_point_t;
+
+/**
+ * @brief Piecewise linear waveform through points ordered by time, holding
+ *        the first and last value outside of them
+ */
+typedef struct {
+    const i2c_sim_point_t *points;
+    size_t count;
+} i2c_sim_wave_t;
+
+/**
+ * @brief Put a device on the simulated bus, NULL removes all of them
+ */
+void i2c_sim_attach(i2c_sim_device_t *dev);
+
+/**
+ * @brief Commands that started while another one ran on the same port
+ */
+uint32_t i2c_sim_collisions(void);
+
+/**
+ * @brief Traffic on an I2C port since the last i2c_sim_reset_stats()
+ */
+void i2c_sim_get_stats(int port, i2c_sim_stats_t *stats);
+
+/**
+ * @brief Traffic on an SPI host since the last i2c_sim_reset_stats()
+ */
+void i2c_sim_get_spi_stats(int host, i2c_sim_stats_t *stats);
+
+/**
+ * @brief Clear the traffic counters of all ports and hosts
+ */
+void i2c_sim_reset_stats(void);
+
+/**
+ * @brief Full duplex SPI transfer with the device at chip select cs
+ *
+ * The first byte sent is the register address, with bit 7 set for a read.
+ * The other bytes are written to or read from consecutive registers, and
+ * miso (which may be NULL) gets what the device sent, 0xFF while it
+ * receives the address.
+ *
+ * @return
+ *     - true Success
+ *     - false No device at cs
+ */
+bool i2c_sim_spi_transfer(int host, uint8_t cs, uint32_t clk_hz,
+        const uint8_t *mosi, uint8_t *miso, size_t len);
+
+/**
+ * @brief Whether a device answers at chip select cs of the SPI host
+ */
+bool i2c_sim_spi_present(int host, uint8_t cs);
+
+/**
+ * @brief Value of the waveform at t_ms, 0 without points
+ */
+float i2c_sim_wave_at(const i2c_sim_wave_t *wave, uint32_t t_ms);
+
+#endif
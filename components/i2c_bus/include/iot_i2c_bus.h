@@ -14,6 +14,9 @@
 #ifndef _IOT_I2C_BUS_H_
 #define _IOT_I2C_BUS_H_
 #include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -21,21 +24,159 @@ extern "C"
 #endif
 
 typedef void* i2c_bus_handle_t;
+typedef void* i2c_bus_device_handle_t;
+
+/**
+ * Queue priority meaning the priority of the calling task
+ */
+#define I2C_BUS_PRIORITY_TASK   (-1)
+
+/**
+ * Arbitration and error counters of a bus
+ */
+typedef struct {
+    uint32_t transactions;      /*!< commands run on the bus */
+    uint32_t contended;         /*!< times a task had to queue for the bus */
+    uint32_t timeouts;          /*!< times a task gave up waiting */
+    uint32_t queue_depth;       /*!< tasks queued now */
+    uint32_t max_queue_depth;   /*!< most tasks queued at once */
+    uint64_t wait_us;           /*!< total time spent queued */
+    uint32_t max_wait_us;       /*!< longest time spent queued */
+    uint32_t nacks;             /*!< commands a device didn't acknowledge */
+    uint32_t cmd_timeouts;      /*!< commands that didn't finish in time */
+    uint32_t clock_steps;       /*!< times auto clock slowed the bus down */
+    uint32_t clk_hz;            /*!< clock the bus runs at */
+    uint32_t recoveries;        /*!< driver reinstalls after a command timed out with SDA held low */
+    uint32_t recovery_clocks;   /*!< SCL pulses sent to free a held SDA */
+    uint32_t stuck;             /*!< recoveries that couldn't free SDA */
+    uint64_t recovery_us;       /*!< total time spent recovering */
+} i2c_bus_stats_t;
+
+/**
+ * Latency histogram of a device: bucket 0 counts transactions shorter than
+ * I2C_BUS_LATENCY_MIN_US, each further bucket covers twice the time of the
+ * one before, the last one everything longer
+ */
+#define I2C_BUS_LATENCY_MIN_US  (64)
+#define I2C_BUS_LATENCY_BUCKETS (10)
+
+/**
+ * Traffic counters of a device, timed from the start of the command to
+ * its end, without the time spent queued for the bus
+ */
+typedef struct {
+    uint8_t addr;               /*!< 7 bit device address */
+    uint32_t transactions;      /*!< commands run */
+    uint32_t bytes;             /*!< data bytes of the ones that succeeded */
+    uint32_t nacks;             /*!< commands the device didn't acknowledge */
+    uint32_t timeouts;          /*!< commands that didn't finish in time */
+    uint64_t busy_us;           /*!< total time on the bus */
+    uint32_t max_us;            /*!< longest command */
+    uint32_t latency[I2C_BUS_LATENCY_BUCKETS]; /*!< commands by duration */
+    uint32_t skipped;           /*!< accesses refused while backing off */
+} i2c_bus_device_stats_t;
+
+/**
+ * Failed commands in a row after which auto clock slows the bus down
+ */
+#define I2C_BUS_CLOCK_STEP_ERRORS (3)
+
+/**
+ * SCL pulses a recovery sends at most, enough for a device to finish the
+ * byte it was sending and see a NACK
+ */
+#define I2C_BUS_RECOVERY_CLOCKS (9)
+
+/**
+ * Longest backoff of a failing device, as a multiple of the first one
+ */
+#define I2C_BUS_BACKOFF_MAX_SHIFT (6)
+
+/**
+ * Called with the new clock after auto clock slowed a bus down
+ */
+typedef void (*i2c_bus_clock_cb_t)(i2c_port_t port, uint32_t clk_hz, void* arg);
+
+typedef enum {
+    I2C_BUS_XFER_READ = 0,      /*!< write the register address, read data back */
+    I2C_BUS_XFER_WRITE,         /*!< write the register address and data */
+} i2c_bus_xfer_dir_t;
+
+#ifdef I2C_LINK_RECOMMENDED_SIZE
+/**
+ * Storage for the command link of one register access, with the static
+ * link API of ESP-IDF 4.4 and later
+ */
+#define I2C_BUS_LINK_SIZE       I2C_LINK_RECOMMENDED_SIZE(2)
+#endif
+
+/**
+ * Longest a probe waits for one address to answer
+ */
+#define I2C_BUS_PROBE_TIMEOUT_MS (10)
+
+/**
+ * A device that answered a probe
+ */
+typedef struct {
+    uint8_t addr;               /*!< 7 bit device address */
+    uint8_t id;                 /*!< value of its ID register */
+} i2c_bus_probe_result_t;
+
+/**
+ * Requests a bus worker holds before iot_i2c_bus_submit refuses more
+ */
+#define I2C_BUS_ASYNC_QUEUE_LEN (16)
+
+typedef struct i2c_bus_async i2c_bus_async_t;
+
+/**
+ * Completion callback, runs in the bus worker task
+ */
+typedef void (*i2c_bus_async_cb_t)(i2c_bus_async_t* req);
+
+/**
+ * @brief A register access run by the worker task of the bus
+ *
+ * The caller owns the request and fills in the first fields. It must stay
+ * valid, along with data, until the request is done.
+ */
+struct i2c_bus_async {
+    i2c_bus_device_handle_t dev;   /*!< device to access */
+    i2c_bus_xfer_dir_t dir;        /*!< read or write */
+    uint8_t reg;                   /*!< first register address */
+    uint8_t* data;                 /*!< len bytes to write, or room for them */
+    size_t len;                    /*!< number of registers */
+    portBASE_TYPE ticks_to_wait;   /*!< maximum blocking time of the access */
+    i2c_bus_async_cb_t cb;         /*!< called when done, NULL to wait with iot_i2c_bus_wait */
+    void* arg;                     /*!< for the callback */
+    bool done;                     /*!< set by the worker when ret is valid, read it with __atomic_load_n(__ATOMIC_ACQUIRE) */
+    esp_err_t ret;                 /*!< result of the access */
+    SemaphoreHandle_t sem;         /*!< given by the worker when done, without a callback */
+    StaticSemaphore_t sem_buf;
+};
 
 /**
  * @brief Create and init I2C bus and return a I2C bus handle
  *
+ * There is one bus per port: creating a port that already exists returns
+ * the same bus, so every driver on it shares its transaction queue. The
+ * configuration of the first call wins: a later call with another mode,
+ * other pins or other pull-ups fails, one with another clock speed gets
+ * the bus at the first clock speed.
+ *
  * @param port I2C port number
  * @param conf Pointer to I2C parameters
  *
  * @return
- *     - NULL Fail
+ *     - NULL Fail, or the port is already set up differently
  *     - Others Success
  */
 i2c_bus_handle_t iot_i2c_bus_create(i2c_port_t port, i2c_config_t* conf);
 
 /**
- * @brief Delete and release the I2C bus object
+ * @brief Delete and release the I2C bus object, the driver is removed
+ *        with the last handle of the port
  *
  * @param bus I2C bus handle
  * @return
@@ -47,16 +188,305 @@ esp_err_t iot_i2c_bus_delete(i2c_bus_handle_t bus);
 /**
  * @brief I2C start sending buffered commands
  *
+ * While another task uses the bus the command waits in the queue of the
+ * port, behind the commands of the same or higher priority.
+ *
  * @param bus I2C bus handle
  * @param cmd I2C cmd handle
- * @param ticks_to_wait Maximum blocking time
+ * @param ticks_to_wait Maximum blocking time, queueing included
  *
  * @return
  *     - ESP_OK Success
  *     - ESP_FAIL Fail
+ *     - ESP_ERR_TIMEOUT The bus didn't become free in time
  */
 esp_err_t iot_i2c_bus_cmd_begin(i2c_bus_handle_t bus, i2c_cmd_handle_t cmd,
 portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief Keep the bus for a sequence of commands
+ *
+ * Commands of the calling task go through while it holds the bus, those of
+ * other tasks queue until iot_i2c_bus_unlock. Calls nest.
+ *
+ * @param bus I2C bus handle
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_TIMEOUT The bus didn't become free in time
+ */
+esp_err_t iot_i2c_bus_lock(i2c_bus_handle_t bus, portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief Hand the bus to the next queued command
+ *
+ * @param bus I2C bus handle
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL The calling task doesn't hold the bus
+ */
+esp_err_t iot_i2c_bus_unlock(i2c_bus_handle_t bus);
+
+/**
+ * @brief Get the arbitration and error counters of a bus
+ *
+ * @param bus I2C bus handle
+ * @param stats where the counters go
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_get_stats(i2c_bus_handle_t bus, i2c_bus_stats_t* stats);
+
+/**
+ * @brief Create a device on the bus that builds the links of its register
+ *        accesses in its own storage
+ *
+ * The link is built again for every access, the driver copies single bytes
+ * such as the register address into it. With the static link API of
+ * ESP-IDF 4.4 and later (I2C_BUS_LINK_SIZE defined) a sampling loop runs
+ * without allocating; older releases have no static links, and every
+ * access allocates its link and frees it again. The storage is only used
+ * while holding the bus, so several tasks can share a device.
+ *
+ * @param bus I2C bus handle
+ * @param addr 7 bit device address
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+i2c_bus_device_handle_t iot_i2c_bus_device_create(i2c_bus_handle_t bus,
+        uint8_t addr);
+
+/**
+ * @brief Delete a device
+ *
+ * @param dev I2C device handle
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_device_delete(i2c_bus_device_handle_t dev);
+
+/**
+ * @brief Set the queue priority of the accesses of a device
+ *
+ * @param dev I2C device handle
+ * @param priority 0 and up, higher goes first, or I2C_BUS_PRIORITY_TASK
+ *        (the default) for the priority of the calling task
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_device_set_priority(i2c_bus_device_handle_t dev,
+        int priority);
+
+/**
+ * @brief Send a command link to a device, queued like its register accesses
+ *
+ * For commands that aren't register accesses, so they show up in the
+ * device's counters too.
+ *
+ * @param dev I2C device handle
+ * @param cmd I2C command handle
+ * @param bytes data bytes the command moves, for the counters
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+ *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+ *     - ESP_ERR_INVALID_STATE The device is backing off after too many errors.
+ */
+esp_err_t iot_i2c_bus_device_cmd_begin(i2c_bus_device_handle_t dev,
+        i2c_cmd_handle_t cmd, size_t bytes, portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief Get a snapshot of the traffic counters of a device
+ *
+ * Accesses record their counters without locking, the snapshot waits for
+ * the bus so it never sees one half done.
+ *
+ * @param dev I2C device handle
+ * @param stats where the counters go
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_device_get_stats(i2c_bus_device_handle_t dev,
+        i2c_bus_device_stats_t* stats);
+
+/**
+ * @brief Get a snapshot of the traffic counters of every device on a bus
+ *
+ * @param bus I2C bus handle
+ * @param stats where the counters go, one entry per device handle
+ * @param count room in stats, then the number of entries filled
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_SIZE More devices than room in stats
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_get_device_stats(i2c_bus_handle_t bus,
+        i2c_bus_device_stats_t* stats, size_t* count);
+
+/**
+ * @brief Read consecutive registers of a device
+ *
+ * @param dev I2C device handle
+ * @param reg first register address
+ * @param data where the register values go
+ * @param len number of registers
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+ *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+ *     - ESP_ERR_INVALID_STATE The device is backing off after too many errors.
+ */
+esp_err_t iot_i2c_bus_read_reg(i2c_bus_device_handle_t dev, uint8_t reg,
+        uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait);
+
+/**
+ * @brief Write consecutive registers of a device
+ *
+ * @param dev I2C device handle
+ * @param reg first register address
+ * @param data register values, NULL if len is 0
+ * @param len number of registers, 0 writes the register address only
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+ *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+ *     - ESP_ERR_INVALID_STATE The device is backing off after too many errors.
+ */
+esp_err_t iot_i2c_bus_write_reg(i2c_bus_device_handle_t dev, uint8_t reg,
+        const uint8_t* data, size_t len, portBASE_TYPE ticks_to_wait);
+/**
+ * @brief Let the bus slow its clock down when commands keep failing
+ *
+ * After I2C_BUS_CLOCK_STEP_ERRORS errors in a row that point at the clock
+ * it steps down from the rate in the bus configuration to the next of
+ * 1 MHz, 400 kHz and 100 kHz, and cb is called from the task whose
+ * command failed, while it holds the bus. Every timeout counts, a NACK
+ * only if its device hasn't failed since its last success or the last
+ * step, so one absent device never slows the bus down. NACKs of command
+ * links run with iot_i2c_bus_cmd_begin and of probes don't count.
+ *
+ * @param bus I2C bus handle
+ * @param enable true to step down, false to keep the clock
+ * @param cb called after each step, can be NULL
+ * @param arg for the callback
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_set_auto_clock(i2c_bus_handle_t bus, bool enable,
+        i2c_bus_clock_cb_t cb, void* arg);
+
+/**
+ * @brief Give every device on the bus a budget of failed accesses
+ *
+ * A device whose accesses failed errors times in a row is benched: for
+ * backoff_ms its accesses return ESP_ERR_INVALID_STATE at once, without
+ * waiting for the bus. The next access after that is a retry, and if it
+ * fails too the device is benched for twice as long, up to
+ * backoff_ms << I2C_BUS_BACKOFF_MAX_SHIFT. One success clears it all. This
+ * keeps a device that times out from taking the bus away from the others
+ * for the length of its timeout again and again.
+ *
+ * Independently of the budget, a command that times out while a device
+ * holds SDA low makes the bus recover: it clocks SCL up to
+ * I2C_BUS_RECOVERY_CLOCKS times, sends a STOP and reinstalls the driver. A
+ * timeout with the lines free, such as a device stretching the clock, is
+ * an ordinary timeout and leaves the driver alone. When a recovery freed
+ * SDA a register access is built and run once more, if its timeout has
+ * time left; a command link from the caller is used up, so that one fails
+ * and the caller retries it. A timeout spent queueing for the bus runs no
+ * command and counts against neither the budget nor the clock, only as a
+ * timeout in the bus stats.
+ *
+ * @param bus I2C bus handle
+ * @param errors failed accesses in a row that bench a device, 0 to never
+ * @param backoff_ms how long it is benched the first time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL Fail
+ */
+esp_err_t iot_i2c_bus_set_retry_budget(i2c_bus_handle_t bus, uint32_t errors,
+        uint32_t backoff_ms);
+
+/**
+ * @brief Look for devices by reading an ID register at candidate addresses
+ *
+ * The bus is held for the whole scan. Addresses nobody acknowledges are
+ * skipped, the others are reported with the value of id_reg, so one scan
+ * tells apart chips that share an address range, e.g. the Bosch sensors
+ * with their chip ID at 0xD0.
+ *
+ * @param bus I2C bus handle
+ * @param id_reg register holding the chip ID
+ * @param addrs addresses to try, in order
+ * @param addr_count number of addresses
+ * @param found devices that answered
+ * @param found_count room in found, then the number of devices found
+ * @param deadline_us esp_timer_get_time() at which to give up, 0 for none
+ *
+ * @return
+ *     - ESP_OK All addresses tried, or found is full
+ *     - ESP_ERR_TIMEOUT The deadline passed first, found holds the devices seen before
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - ESP_ERR_NO_MEM Out of memory for the command link
+ */
+esp_err_t iot_i2c_bus_probe(i2c_bus_handle_t bus, uint8_t id_reg,
+        const uint8_t* addrs, size_t addr_count, i2c_bus_probe_result_t* found,
+        size_t* found_count, int64_t deadline_us);
+
+/**
+ * @brief Queue a register access to the worker task of the bus and return
+ *
+ * The worker, started with the first request, runs the accesses in order
+ * through the device's link storage. When one is done it calls
+ * req->cb, or if there is none gives a semaphore in the request that
+ * iot_i2c_bus_wait takes. The task notifications of the caller are left
+ * alone.
+ * Requests on different ports run in parallel. Don't wait for a request
+ * while holding the bus with iot_i2c_bus_lock.
+ *
+ * @param req request, see i2c_bus_async_t
+ *
+ * @return
+ *     - ESP_OK Queued
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - ESP_ERR_NO_MEM The queue is full or the worker couldn't start
+ */
+esp_err_t iot_i2c_bus_submit(i2c_bus_async_t* req);
+
+/**
+ * @brief Wait for a request submitted without a callback
+ *
+ * @param req request
+ * @param ticks_to_wait Maximum blocking time
+ *
+ * @return
+ *     - ESP_ERR_TIMEOUT Not done yet
+ *     - Others the result of the access
+ */
+esp_err_t iot_i2c_bus_wait(i2c_bus_async_t* req, portBASE_TYPE ticks_to_wait);
+
 #ifdef __cplusplus
 }
 #endif
@@ -106,12 +536,160 @@ public:
      */
     esp_err_t send(i2c_cmd_handle_t cmd, portBASE_TYPE ticks_to_wait);
 
+    /**
+     * @brief Keep the bus for a sequence of commands
+     * @ticks_to_wait max block time
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_ERR_TIMEOUT The bus didn't become free in time
+     */
+    esp_err_t lock(portBASE_TYPE ticks_to_wait = portMAX_DELAY);
+
+    /**
+     * @brief Hand the bus to the next queued command
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL The calling task doesn't hold the bus
+     */
+    esp_err_t unlock();
+
+    /**
+     * @brief Queue a register access to the bus worker and return
+     * @param req request, see i2c_bus_async_t
+     * @return
+     *     - ESP_OK Queued
+     *     - ESP_ERR_INVALID_ARG Parameter error
+     *     - ESP_ERR_NO_MEM The queue is full or the worker couldn't start
+     */
+    esp_err_t submit(i2c_bus_async_t *req);
+
+    /**
+     * @brief Wait for a request submitted without a callback
+     * @param req request
+     * @ticks_to_wait max block time
+     * @return
+     *     - ESP_ERR_TIMEOUT Not done yet
+     *     - Others the result of the access
+     */
+    esp_err_t wait(i2c_bus_async_t *req, portBASE_TYPE ticks_to_wait = portMAX_DELAY);
+
+    /**
+     * @brief Let the bus slow its clock down when commands keep failing
+     * @param enable true to step down, false to keep the clock
+     * @param cb called after each step, can be NULL
+     * @param arg for the callback
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Fail
+     */
+    esp_err_t set_auto_clock(bool enable, i2c_bus_clock_cb_t cb = NULL, void *arg = NULL);
+
+    /**
+     * @brief Give every device on the bus a budget of failed accesses
+     * @param errors failed accesses in a row that bench a device, 0 to never
+     * @param backoff_ms how long it is benched the first time
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Fail
+     */
+    esp_err_t set_retry_budget(uint32_t errors, uint32_t backoff_ms);
+
+    /**
+     * @brief Get the arbitration and error counters of the bus
+     * @param stats where the counters go
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Fail
+     */
+    esp_err_t get_stats(i2c_bus_stats_t *stats);
+
     /**
      * @brief Get bus handle
      * @return bus handle
      */
     i2c_bus_handle_t get_bus_handle();
 };
+
+/**
+ * class of a device on an I2C bus, with register accesses built in place
+ */
+class CI2CDevice
+{
+private:
+    i2c_bus_device_handle_t m_dev_handle;
+
+    /**
+     * prevent copy constructing
+     */
+    CI2CDevice(const CI2CDevice&);
+    CI2CDevice& operator =(const CI2CDevice&);
+public:
+    /**
+     * @brief Constructor for CI2CDevice class
+     * @param bus pointer to the bus the device is on
+     * @param addr 7 bit device address
+     */
+    CI2CDevice(CI2CBus *bus, uint8_t addr);
+
+    /**
+     * @brief Destructor function of CI2CDevice class
+     */
+    ~CI2CDevice();
+
+    /**
+     * @brief Read consecutive registers
+     * @param reg first register address
+     * @param data where the register values go
+     * @param len number of registers
+     * @param ticks_to_wait max block time
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+     *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+     *     - ESP_ERR_INVALID_STATE The device is backing off after too many errors.
+     */
+    esp_err_t read(uint8_t reg, uint8_t* data, size_t len,
+            portBASE_TYPE ticks_to_wait = 1000 / portTICK_RATE_MS);
+
+    /**
+     * @brief Write consecutive registers
+     * @param reg first register address
+     * @param data register values
+     * @param len number of registers
+     * @param ticks_to_wait max block time
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Sending command error, slave doesn't ACK the transfer.
+     *     - ESP_ERR_TIMEOUT Operation timeout because the bus is busy.
+     *     - ESP_ERR_INVALID_STATE The device is backing off after too many errors.
+     */
+    esp_err_t write(uint8_t reg, const uint8_t* data, size_t len,
+            portBASE_TYPE ticks_to_wait = 1000 / portTICK_RATE_MS);
+
+    /**
+     * @brief Set the queue priority of the device's accesses
+     * @param priority 0 and up, or I2C_BUS_PRIORITY_TASK
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Fail
+     */
+    esp_err_t set_priority(int priority);
+
+    /**
+     * @brief Get a snapshot of the traffic counters of the device
+     * @param stats where the counters go
+     * @return
+     *     - ESP_OK Success
+     *     - ESP_FAIL Fail
+     */
+    esp_err_t get_stats(i2c_bus_device_stats_t *stats);
+
+    /**
+     * @brief Get device handle
+     * @return device handle
+     */
+    i2c_bus_device_handle_t get_device_handle();
+};
 #endif
 
 #endif
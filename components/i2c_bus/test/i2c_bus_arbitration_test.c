@@ -0,0 +1,264 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+#define ARBITRATION_TASKS       4
+#define ARBITRATION_ROUNDS      100
+
+typedef struct {
+    i2c_bus_device_handle_t dev;
+    uint8_t reg;                /* registers of its own on the device */
+    int priority;
+    int order;                  /* position it finished in */
+    esp_err_t ret;
+    SemaphoreHandle_t done;
+} arbitration_task_t;
+
+static int s_finished;
+
+static i2c_bus_handle_t arbitration_bus(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+static void arbitration_round_trips(void *arg)
+{
+    arbitration_task_t *task = (arbitration_task_t *) arg;
+    uint8_t out[8], in[8];
+
+    task->ret = ESP_OK;
+    for (int i = 0; i < ARBITRATION_ROUNDS && task->ret == ESP_OK; i++) {
+        for (int j = 0; j < sizeof(out); j++) {
+            out[j] = task->reg + i + j;
+        }
+        task->ret = iot_i2c_bus_write_reg(task->dev, task->reg, out, sizeof(out),
+                portMAX_DELAY);
+        if (task->ret == ESP_OK) {
+            task->ret = iot_i2c_bus_read_reg(task->dev, task->reg, in, sizeof(in),
+                    portMAX_DELAY);
+        }
+        if (task->ret == ESP_OK && memcmp(out, in, sizeof(in)) != 0) {
+            task->ret = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("i2c_bus serializes tasks sharing a port", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor_a, sensor_b;
+    arbitration_task_t tasks[ARBITRATION_TASKS];
+    i2c_bus_stats_t stats;
+
+    memset(&sensor_a, 0, sizeof(sensor_a));
+    memset(&sensor_b, 0, sizeof(sensor_b));
+    sensor_a.addr = 0x76;
+    sensor_b.addr = 0x77;
+    sensor_a.busy_us = sensor_b.busy_us = 200;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor_a);
+    i2c_sim_attach(&sensor_b);
+
+    // two drivers creating the same port get the same bus
+    i2c_bus_handle_t bus = arbitration_bus();
+    i2c_bus_handle_t other = arbitration_bus();
+    TEST_ASSERT_NOT_NULL(bus);
+    TEST_ASSERT_EQUAL(bus, other);
+    i2c_bus_device_handle_t dev_a = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_device_handle_t dev_b = iot_i2c_bus_device_create(other, 0x77);
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(ARBITRATION_TASKS, 0);
+
+    // two tasks per sensor, the first two share one device handle
+    uint32_t collisions = i2c_sim_collisions();
+    for (int i = 0; i < ARBITRATION_TASKS; i++) {
+        tasks[i].dev = i < 2 ? dev_a : dev_b;
+        tasks[i].reg = 0x10 * (i + 1);
+        tasks[i].done = done;
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(arbitration_round_trips, "arb",
+                4096, &tasks[i], 5, NULL));
+    }
+    for (int i = 0; i < ARBITRATION_TASKS; i++) {
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(done, 3000 / portTICK_PERIOD_MS));
+    }
+    for (int i = 0; i < ARBITRATION_TASKS; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, tasks[i].ret);
+    }
+
+    TEST_ASSERT_EQUAL(collisions, i2c_sim_collisions());
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_stats(bus, &stats));
+    printf("%u transactions, %u queued, at most %u waiting, longest %u us\n",
+            stats.transactions, stats.contended, stats.max_queue_depth,
+            stats.max_wait_us);
+    TEST_ASSERT_EQUAL(ARBITRATION_TASKS * ARBITRATION_ROUNDS * 2,
+            stats.transactions);
+    TEST_ASSERT_GREATER_THAN(0, stats.contended);
+    TEST_ASSERT_LESS_THAN(ARBITRATION_TASKS, stats.max_queue_depth);
+    TEST_ASSERT_EQUAL(0, stats.queue_depth);
+    TEST_ASSERT_EQUAL(0, stats.timeouts);
+
+    vSemaphoreDelete(done);
+    iot_i2c_bus_device_delete(dev_a);
+    iot_i2c_bus_device_delete(dev_b);
+    iot_i2c_bus_delete(other);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+static void arbitration_one_access(void *arg)
+{
+    arbitration_task_t *task = (arbitration_task_t *) arg;
+    uint8_t value = task->priority;
+
+    iot_i2c_bus_device_set_priority(task->dev, task->priority);
+    task->ret = iot_i2c_bus_write_reg(task->dev, task->reg, &value, 1,
+            1000 / portTICK_PERIOD_MS);
+    task->order = __atomic_fetch_add(&s_finished, 1, __ATOMIC_SEQ_CST);
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("i2c_bus serves higher priorities first", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor;
+    static const int priorities[] = { 1, 3, 2 };
+    arbitration_task_t tasks[3];
+    i2c_bus_stats_t stats;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.addr = 0x76;
+    // long enough that a task records its turn before the next one is done
+    sensor.busy_us = 20000;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor);
+    i2c_bus_handle_t bus = arbitration_bus();
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(3, 0);
+
+    // hold the bus until all three are queued
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_lock(bus, portMAX_DELAY));
+    s_finished = 0;
+    for (int i = 0; i < 3; i++) {
+        tasks[i].dev = iot_i2c_bus_device_create(bus, 0x76);
+        tasks[i].reg = i;
+        tasks[i].priority = priorities[i];
+        tasks[i].done = done;
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(arbitration_one_access, "arb",
+                4096, &tasks[i], 5, NULL));
+    }
+    do {
+        vTaskDelay(1);
+        iot_i2c_bus_get_stats(bus, &stats);
+    } while (stats.queue_depth < 3);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_unlock(bus));
+
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(done, 3000 / portTICK_PERIOD_MS));
+    }
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, tasks[i].ret);
+        TEST_ASSERT_EQUAL(3 - tasks[i].priority, tasks[i].order);
+        TEST_ASSERT_EQUAL(priorities[i], sensor.regs[i]);
+        iot_i2c_bus_device_delete(tasks[i].dev);
+    }
+
+    vSemaphoreDelete(done);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+static void arbitration_impatient(void *arg)
+{
+    arbitration_task_t *task = (arbitration_task_t *) arg;
+    uint8_t value;
+
+    task->ret = iot_i2c_bus_read_reg(task->dev, task->reg, &value, 1,
+            50 / portTICK_PERIOD_MS);
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("i2c_bus refuses a port set up with other pins", "[i2c_bus][host]")
+{
+    i2c_bus_handle_t bus = arbitration_bus();
+    TEST_ASSERT_NOT_NULL(bus);
+
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = 21,
+        .scl_io_num = 22,
+        .master.clk_speed = 100000,
+    };
+    TEST_ASSERT_NULL(iot_i2c_bus_create(I2C_NUM_0, &conf));
+
+    // another clock speed still shares the bus, at the first one
+    i2c_bus_stats_t stats;
+    conf.sda_io_num = conf.scl_io_num = 0;
+    conf.master.clk_speed = 400000;
+    i2c_bus_handle_t other = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    TEST_ASSERT_EQUAL(bus, other);
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(100000, stats.clk_hz);
+
+    // the refused call took no reference, two deletes free the port
+    iot_i2c_bus_delete(other);
+    iot_i2c_bus_delete(bus);
+    conf.sda_io_num = 21;
+    conf.scl_io_num = 22;
+    bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+    TEST_ASSERT_NOT_NULL(bus);
+    iot_i2c_bus_delete(bus);
+}
+
+TEST_CASE("i2c_bus gives up waiting after the timeout", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor;
+    arbitration_task_t task;
+    i2c_bus_stats_t stats;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.addr = 0x76;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor);
+    i2c_bus_handle_t bus = arbitration_bus();
+    task.dev = iot_i2c_bus_device_create(bus, 0x76);
+    task.reg = 0;
+    task.done = xSemaphoreCreateCounting(1, 0);
+
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_lock(bus, portMAX_DELAY));
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(arbitration_impatient, "arb", 4096,
+            &task, 5, NULL));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(task.done, 1000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, task.ret);
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(1, stats.timeouts);
+    TEST_ASSERT_EQUAL(0, stats.queue_depth);
+    TEST_ASSERT_EQUAL(0, sensor.transactions);
+
+    // the holder's own commands still go through, and the bus is free after
+    uint8_t value;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(task.dev, 0, &value, 1,
+            portMAX_DELAY));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_unlock(bus));
+    TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_unlock(bus));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(task.dev, 0, &value, 1,
+            portMAX_DELAY));
+
+    vSemaphoreDelete(task.done);
+    iot_i2c_bus_device_delete(task.dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -0,0 +1,206 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+#define ASYNC_SENSORS           4
+#define ASYNC_ROUNDS            20
+#define ASYNC_READ_LEN          8
+#define ASYNC_BUS_US            2000    /* a burst read at 100 kHz */
+#define ASYNC_COMPENSATE_US     1000
+
+static i2c_sim_device_t s_sensors[ASYNC_SENSORS];
+static i2c_bus_handle_t s_buses[I2C_NUM_MAX];
+static i2c_bus_device_handle_t s_devs[ASYNC_SENSORS];
+
+/**
+ * @brief sensors alternate between the two ports
+ */
+static void async_setup(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+
+    i2c_sim_attach(NULL);
+    for (int i = 0; i < I2C_NUM_MAX; i++) {
+        s_buses[i] = iot_i2c_bus_create(i, &conf);
+        TEST_ASSERT_NOT_NULL(s_buses[i]);
+    }
+    for (int i = 0; i < ASYNC_SENSORS; i++) {
+        memset(&s_sensors[i], 0, sizeof(s_sensors[i]));
+        s_sensors[i].port = i % I2C_NUM_MAX;
+        s_sensors[i].addr = 0x70 + i;
+        s_sensors[i].busy_us = ASYNC_BUS_US;
+        memset(s_sensors[i].regs, 0x10 * (i + 1), sizeof(s_sensors[i].regs));
+        i2c_sim_attach(&s_sensors[i]);
+        s_devs[i] = iot_i2c_bus_device_create(s_buses[s_sensors[i].port], 0x70 + i);
+        TEST_ASSERT_NOT_NULL(s_devs[i]);
+    }
+}
+
+static void async_teardown(void)
+{
+    for (int i = 0; i < ASYNC_SENSORS; i++) {
+        iot_i2c_bus_device_delete(s_devs[i]);
+    }
+    for (int i = 0; i < I2C_NUM_MAX; i++) {
+        iot_i2c_bus_delete(s_buses[i]);
+    }
+    i2c_sim_attach(NULL);
+}
+
+static void async_compensate(int sensor, const uint8_t *data)
+{
+    TEST_ASSERT_EACH_EQUAL_HEX8(0x10 * (sensor + 1), data, ASYNC_READ_LEN);
+    usleep(ASYNC_COMPENSATE_US);
+}
+
+static int64_t async_blocking_round(int sensors)
+{
+    uint8_t data[ASYNC_READ_LEN];
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < sensors; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(s_devs[i], 0, data,
+                sizeof(data), portMAX_DELAY));
+        async_compensate(i, data);
+    }
+    return esp_timer_get_time() - start;
+}
+
+static int64_t async_submitted_round(int sensors)
+{
+    static uint8_t data[ASYNC_SENSORS][ASYNC_READ_LEN];
+    i2c_bus_async_t reqs[ASYNC_SENSORS];
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < sensors; i++) {
+        reqs[i] = (i2c_bus_async_t) {
+            .dev = s_devs[i],
+            .dir = I2C_BUS_XFER_READ,
+            .data = data[i],
+            .len = ASYNC_READ_LEN,
+            .ticks_to_wait = portMAX_DELAY,
+        };
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_submit(&reqs[i]));
+    }
+    // compensate each result while the later reads are still on the bus
+    for (int i = 0; i < sensors; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_wait(&reqs[i], portMAX_DELAY));
+        async_compensate(i, data[i]);
+    }
+    return esp_timer_get_time() - start;
+}
+
+TEST_CASE("i2c_bus async reads overlap the bus with compensation", "[i2c_bus][host]")
+{
+    async_setup();
+    // first round starts the workers and prepares the transactions
+    async_blocking_round(ASYNC_SENSORS);
+    async_submitted_round(ASYNC_SENSORS);
+
+    for (int sensors = 1; sensors <= ASYNC_SENSORS; sensors *= 2) {
+        int64_t blocking = 0, submitted = 0;
+        for (int i = 0; i < ASYNC_ROUNDS; i++) {
+            blocking += async_blocking_round(sensors);
+            submitted += async_submitted_round(sensors);
+        }
+        printf("%d sensors: blocking %lld us, async %lld us per round (%.2fx)\n",
+                sensors, (long long) blocking / ASYNC_ROUNDS,
+                (long long) submitted / ASYNC_ROUNDS, (double) blocking / submitted);
+        if (sensors == ASYNC_SENSORS) {
+            // 4 x (2 + 1) ms against 2 x 2 ms on each port plus the last 2 ms
+            TEST_ASSERT_LESS_THAN(blocking * 3 / 4, submitted);
+        }
+    }
+    async_teardown();
+}
+
+typedef struct {
+    SemaphoreHandle_t done;
+    TaskHandle_t task;
+    int calls;
+} async_completion_t;
+
+static void async_done(i2c_bus_async_t *req)
+{
+    async_completion_t *completion = (async_completion_t *) req->arg;
+
+    completion->task = xTaskGetCurrentTaskHandle();
+    completion->calls++;
+    xSemaphoreGive(completion->done);
+}
+
+TEST_CASE("i2c_bus async callback runs in the bus worker", "[i2c_bus][host]")
+{
+    async_completion_t completion = { .done = xSemaphoreCreateBinary() };
+    uint8_t out[4] = { 1, 2, 3, 4 };
+    uint8_t in[4];
+
+    async_setup();
+    i2c_bus_async_t req = {
+        .dev = s_devs[0],
+        .dir = I2C_BUS_XFER_WRITE,
+        .reg = 0x20,
+        .data = out,
+        .len = sizeof(out),
+        .ticks_to_wait = portMAX_DELAY,
+        .cb = async_done,
+        .arg = &completion,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_submit(&req));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(completion.done, 1000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_TRUE(__atomic_load_n(&req.done, __ATOMIC_ACQUIRE));
+    TEST_ASSERT_EQUAL(ESP_OK, req.ret);
+    TEST_ASSERT_EQUAL(1, completion.calls);
+    TEST_ASSERT_NOT_EQUAL(xTaskGetCurrentTaskHandle(), completion.task);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(out, &s_sensors[0].regs[0x20], sizeof(out));
+
+    // a request can be submitted again once it is done
+    req.dir = I2C_BUS_XFER_READ;
+    req.data = in;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_submit(&req));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(completion.done, 1000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, req.ret);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(out, in, sizeof(in));
+
+    vSemaphoreDelete(completion.done);
+    async_teardown();
+}
+
+TEST_CASE("i2c_bus async wait times out while the bus is held", "[i2c_bus][host]")
+{
+    uint8_t data[2];
+
+    async_setup();
+    i2c_bus_async_t req = {
+        .dev = s_devs[0],
+        .dir = I2C_BUS_XFER_READ,
+        .data = data,
+        .len = sizeof(data),
+        .ticks_to_wait = portMAX_DELAY,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_lock(s_buses[0], portMAX_DELAY));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_submit(&req));
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_wait(&req, 50 / portTICK_PERIOD_MS));
+    TEST_ASSERT_FALSE(__atomic_load_n(&req.done, __ATOMIC_ACQUIRE));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_unlock(s_buses[0]));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_wait(&req, 1000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL_HEX8(0x10, data[0]);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, iot_i2c_bus_submit(NULL));
+    async_teardown();
+}
+#endif
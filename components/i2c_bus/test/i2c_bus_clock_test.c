@@ -0,0 +1,180 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+static uint32_t s_saved_hz;
+static int s_steps;
+
+static void clock_saved(i2c_port_t port, uint32_t clk_hz, void *arg)
+{
+    TEST_ASSERT_EQUAL(I2C_NUM_0, port);
+    s_saved_hz = clk_hz;
+    s_steps++;
+}
+
+static i2c_bus_handle_t clock_bus(uint32_t clk_hz)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = clk_hz,
+    };
+    return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+TEST_CASE("i2c_bus auto clock steps down until the devices answer", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensors[I2C_BUS_CLOCK_STEP_ERRORS];
+    i2c_bus_device_handle_t devs[I2C_BUS_CLOCK_STEP_ERRORS];
+    i2c_bus_stats_t stats;
+    uint8_t value;
+
+    i2c_sim_attach(NULL);
+    i2c_bus_handle_t bus = clock_bus(1000000);
+    for (int i = 0; i < I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        memset(&sensors[i], 0, sizeof(sensors[i]));
+        sensors[i].addr = 0x76 + i;
+        sensors[i].max_clk_hz = 100000;
+        i2c_sim_attach(&sensors[i]);
+        devs[i] = iot_i2c_bus_device_create(bus, 0x76 + i);
+    }
+    s_saved_hz = 0;
+    s_steps = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_set_auto_clock(bus, true, clock_saved, NULL));
+
+    // absent devices in a probe don't slow the bus down
+    static const uint8_t addrs[] = { 0x10, 0x11, 0x12, 0x13 };
+    i2c_bus_probe_result_t found[4];
+    size_t found_count = 4;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_probe(bus, 0xD0, addrs, sizeof(addrs),
+            found, &found_count, 0));
+    TEST_ASSERT_EQUAL(0, found_count);
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(1000000, stats.clk_hz);
+    TEST_ASSERT_EQUAL(0, stats.nacks);
+
+    // every device fails at 1 MHz and at 400 kHz, then they all answer
+    int failures = 0;
+    for (bool answered = false; !answered; ) {
+        answered = true;
+        for (int i = 0; i < I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+            if (iot_i2c_bus_read_reg(devs[i], 0, &value, 1, portMAX_DELAY) != ESP_OK) {
+                answered = false;
+                TEST_ASSERT_LESS_THAN(10, ++failures);
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL(2 * I2C_BUS_CLOCK_STEP_ERRORS, failures);
+    TEST_ASSERT_EQUAL(2, s_steps);
+    TEST_ASSERT_EQUAL(100000, s_saved_hz);
+    iot_i2c_bus_get_stats(bus, &stats);
+    printf("%u NACKs, %u clock steps, now %u Hz\n", stats.nacks,
+            stats.clock_steps, stats.clk_hz);
+    TEST_ASSERT_EQUAL(2 * I2C_BUS_CLOCK_STEP_ERRORS, stats.nacks);
+    TEST_ASSERT_EQUAL(0, stats.cmd_timeouts);
+    TEST_ASSERT_EQUAL(2, stats.clock_steps);
+    TEST_ASSERT_EQUAL(100000, stats.clk_hz);
+
+    // the slowest clock is the floor
+    for (int i = 0; i < I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        sensors[i].addr = 0x50 + i;
+    }
+    for (int i = 0; i < 2 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(
+                devs[i % I2C_BUS_CLOCK_STEP_ERRORS], 0, &value, 1, portMAX_DELAY));
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(2, stats.clock_steps);
+    TEST_ASSERT_EQUAL(100000, stats.clk_hz);
+
+    for (int i = 0; i < I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        iot_i2c_bus_device_delete(devs[i]);
+    }
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus keeps a fixed clock and stray errors don't add up", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor;
+    i2c_bus_stats_t stats;
+    uint8_t value;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.addr = 0x76;
+    sensor.max_clk_hz = 100000;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor);
+    i2c_bus_handle_t bus = clock_bus(400000);
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x76);
+
+    // without auto clock the errors are only counted
+    for (int i = 0; i < 2 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(dev, 0, &value, 1,
+                portMAX_DELAY));
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(2 * I2C_BUS_CLOCK_STEP_ERRORS, stats.nacks);
+    TEST_ASSERT_EQUAL(0, stats.clock_steps);
+    TEST_ASSERT_EQUAL(400000, stats.clk_hz);
+
+    // a success in between starts the count again
+    sensor.max_clk_hz = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_set_auto_clock(bus, true, NULL, NULL));
+    for (int i = 0; i < 3 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        sensor.addr = i % I2C_BUS_CLOCK_STEP_ERRORS ? 0x77 : 0x76;
+        iot_i2c_bus_read_reg(dev, 0, &value, 1, portMAX_DELAY);
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(0, stats.clock_steps);
+    TEST_ASSERT_EQUAL(400000, stats.clk_hz);
+
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus auto clock holds when a device is absent", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor;
+    i2c_bus_stats_t stats;
+    uint8_t value;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.addr = 0x76;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor);
+    i2c_bus_handle_t bus = clock_bus(400000);
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_device_handle_t absent = iot_i2c_bus_device_create(bus, 0x77);
+    s_steps = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_set_auto_clock(bus, true, clock_saved, NULL));
+
+    // its NACKs in a row, and between the other device's accesses
+    for (int i = 0; i < 2 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(absent, 0, &value, 1,
+                portMAX_DELAY));
+    }
+    for (int i = 0; i < 2 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0, &value, 1,
+                portMAX_DELAY));
+        TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(absent, 0, &value, 1,
+                portMAX_DELAY));
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(4 * I2C_BUS_CLOCK_STEP_ERRORS, stats.nacks);
+    TEST_ASSERT_EQUAL(0, stats.clock_steps);
+    TEST_ASSERT_EQUAL(0, s_steps);
+    TEST_ASSERT_EQUAL(400000, stats.clk_hz);
+
+    iot_i2c_bus_device_delete(absent);
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
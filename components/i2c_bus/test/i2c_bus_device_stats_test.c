@@ -0,0 +1,211 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+#define STATS_FAST_US   300     /* bucket 256..512 us */
+#define STATS_SLOW_US   3000    /* bucket 2048..4096 us */
+
+static i2c_bus_handle_t stats_bus(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+static const i2c_bus_device_stats_t *stats_find(const i2c_bus_device_stats_t *stats,
+        size_t count, uint8_t addr)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (stats[i].addr == addr) {
+            return &stats[i];
+        }
+    }
+    TEST_FAIL_MESSAGE("device missing");
+    return NULL;
+}
+
+/**
+ * @brief a sleep never ends early but can overshoot on a busy host: nothing
+ *        below the bucket of the simulated bus time and most in it
+ */
+static void stats_check_bucket(const i2c_bus_device_stats_t *stats, int bucket)
+{
+    for (int i = 0; i < bucket; i++) {
+        TEST_ASSERT_EQUAL(0, stats->latency[i]);
+    }
+    TEST_ASSERT_GREATER_THAN(stats->transactions / 2, stats->latency[bucket]);
+}
+
+static uint32_t stats_histogram_total(const i2c_bus_device_stats_t *stats)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < I2C_BUS_LATENCY_BUCKETS; i++) {
+        total += stats->latency[i];
+    }
+    return total;
+}
+
+TEST_CASE("i2c_bus counts traffic and latency per device", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t fast, slow;
+    i2c_bus_device_stats_t stats[4];
+    size_t count = 4;
+    uint8_t data[6];
+
+    memset(&fast, 0, sizeof(fast));
+    memset(&slow, 0, sizeof(slow));
+    fast.addr = 0x76;
+    fast.busy_us = STATS_FAST_US;
+    slow.addr = 0x77;
+    slow.busy_us = STATS_SLOW_US;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&fast);
+    i2c_sim_attach(&slow);
+    i2c_bus_handle_t bus = stats_bus();
+    i2c_bus_device_handle_t dev_fast = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_device_handle_t dev_slow = iot_i2c_bus_device_create(bus, 0x77);
+    i2c_bus_device_handle_t dev_absent = iot_i2c_bus_device_create(bus, 0x10);
+
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev_fast, 0, data,
+                sizeof(data), portMAX_DELAY));
+    }
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_write_reg(dev_slow, 0, data, 2,
+                portMAX_DELAY));
+    }
+    TEST_ASSERT_EQUAL(ESP_FAIL, iot_i2c_bus_read_reg(dev_absent, 0, data, 1,
+            portMAX_DELAY));
+
+    // raw commands count too, with the bytes the caller gives
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (0x77 << 1) | I2C_MASTER_WRITE, true);
+    i2c_master_write(cmd, data, 3, true);
+    i2c_master_stop(cmd);
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_device_cmd_begin(dev_slow, cmd, 2,
+            portMAX_DELAY));
+    i2c_cmd_link_delete(cmd);
+
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_device_stats(bus, stats, &count));
+    TEST_ASSERT_EQUAL(3, count);
+    const i2c_bus_device_stats_t *s = stats_find(stats, count, 0x76);
+    printf("0x76: %u transactions, %llu us, longest %u us\n", s->transactions,
+            (unsigned long long) s->busy_us, s->max_us);
+    TEST_ASSERT_EQUAL(20, s->transactions);
+    TEST_ASSERT_EQUAL(20 * sizeof(data), s->bytes);
+    TEST_ASSERT_EQUAL(0, s->nacks);
+    stats_check_bucket(s, 3);
+    TEST_ASSERT_TRUE(s->busy_us >= 20 * STATS_FAST_US);
+
+    s = stats_find(stats, count, 0x77);
+    printf("0x77: %u transactions, %llu us, longest %u us\n", s->transactions,
+            (unsigned long long) s->busy_us, s->max_us);
+    TEST_ASSERT_EQUAL(11, s->transactions);
+    TEST_ASSERT_EQUAL(10 * 2 + 2, s->bytes);
+    stats_check_bucket(s, 6);
+    TEST_ASSERT_TRUE(s->max_us >= STATS_SLOW_US);
+
+    s = stats_find(stats, count, 0x10);
+    TEST_ASSERT_EQUAL(1, s->transactions);
+    TEST_ASSERT_EQUAL(0, s->bytes);
+    TEST_ASSERT_EQUAL(1, s->nacks);
+    TEST_ASSERT_EQUAL(1, s->latency[0]);
+
+    // too little room still fills what there is
+    count = 2;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, iot_i2c_bus_get_device_stats(bus, stats,
+            &count));
+    TEST_ASSERT_EQUAL(2, count);
+
+    // deleted devices leave the list
+    iot_i2c_bus_device_delete(dev_absent);
+    count = 4;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_get_device_stats(bus, stats, &count));
+    TEST_ASSERT_EQUAL(2, count);
+
+    iot_i2c_bus_device_delete(dev_fast);
+    iot_i2c_bus_device_delete(dev_slow);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+typedef struct {
+    i2c_bus_device_handle_t dev;
+    volatile bool stop;
+    SemaphoreHandle_t done;
+} stats_task_t;
+
+static void stats_traffic(void *arg)
+{
+    stats_task_t *task = (stats_task_t *) arg;
+    uint8_t data[4];
+
+    while (!task->stop) {
+        iot_i2c_bus_read_reg(task->dev, 0, data, sizeof(data), portMAX_DELAY);
+    }
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("i2c_bus device snapshots are consistent under traffic", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t sensor;
+    stats_task_t tasks[2];
+    i2c_bus_device_stats_t stats;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.addr = 0x76;
+    sensor.busy_us = 50;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&sensor);
+    i2c_bus_handle_t bus = stats_bus();
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x76);
+    SemaphoreHandle_t done = xSemaphoreCreateCounting(2, 0);
+
+    for (int i = 0; i < 2; i++) {
+        tasks[i].dev = dev;
+        tasks[i].stop = false;
+        tasks[i].done = done;
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(stats_traffic, "stats", 4096,
+                &tasks[i], 5, NULL));
+    }
+    // the snapshots queue for the bus like any access, don't lose to the
+    // tasks every time, and keep taking them until there was some traffic
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, 5);
+    uint32_t last = 0;
+    for (int i = 0; i < 200 || last < 200; i++) {
+        TEST_ASSERT_LESS_THAN(1000000, i);
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_device_get_stats(dev, &stats));
+        TEST_ASSERT_EQUAL(stats.transactions, stats_histogram_total(&stats));
+        TEST_ASSERT_EQUAL(stats.transactions * 4, stats.bytes);
+        TEST_ASSERT_TRUE(stats.transactions >= last);
+        last = stats.transactions;
+    }
+    vTaskPrioritySet(NULL, priority);
+    for (int i = 0; i < 2; i++) {
+        tasks[i].stop = true;
+    }
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(done, 1000 / portTICK_PERIOD_MS));
+    }
+    printf("%u transactions while taking snapshots\n", last);
+
+    vSemaphoreDelete(done);
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -0,0 +1,143 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+#define PROBE_ID_REG    0xD0
+#define PROBE_BME280    0x60
+#define PROBE_BME680    0x61
+
+static const uint8_t s_probe_addrs[] = { 0x76, 0x77 };
+
+typedef struct {
+    uint8_t port;
+    uint8_t addr;
+    uint8_t id;
+} probe_sim_t;
+
+/**
+ * @brief put the devices on the simulated ports, scan both and check every
+ *        device is found on its port with its chip ID
+ */
+static void probe_check(const probe_sim_t *sims, int count)
+{
+    static i2c_sim_device_t devices[4];
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+
+    i2c_sim_attach(NULL);
+    for (int i = 0; i < count; i++) {
+        memset(&devices[i], 0, sizeof(devices[i]));
+        devices[i].port = sims[i].port;
+        devices[i].addr = sims[i].addr;
+        devices[i].regs[PROBE_ID_REG] = sims[i].id;
+        i2c_sim_attach(&devices[i]);
+    }
+
+    int64_t start = esp_timer_get_time();
+    int total = 0;
+    for (int port = 0; port < I2C_NUM_MAX; port++) {
+        i2c_bus_probe_result_t found[2];
+        size_t found_count = 2;
+        i2c_bus_handle_t bus = iot_i2c_bus_create(port, &conf);
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_probe(bus, PROBE_ID_REG, s_probe_addrs,
+                sizeof(s_probe_addrs), found, &found_count, start + 100000));
+
+        int expected = 0;
+        for (int i = 0; i < count; i++) {
+            if (sims[i].port != port) {
+                continue;
+            }
+            TEST_ASSERT_LESS_THAN(found_count, expected);
+            // found in the order of the candidate addresses
+            TEST_ASSERT_EQUAL_HEX8(sims[i].addr, found[expected].addr);
+            TEST_ASSERT_EQUAL_HEX8(sims[i].id, found[expected].id);
+            expected++;
+        }
+        TEST_ASSERT_EQUAL(expected, found_count);
+        total += found_count;
+        iot_i2c_bus_delete(bus);
+    }
+    printf("%d devices found in %lld us\n", total,
+            (long long) (esp_timer_get_time() - start));
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus probe finds sensors on each port", "[i2c_bus][host]")
+{
+    // nothing connected
+    probe_check(NULL, 0);
+
+    // the two sensors the firmware used to hard-code, one per port
+    static const probe_sim_t split[] = {
+        { 0, 0x77, PROBE_BME680 },
+        { 1, 0x76, PROBE_BME280 },
+    };
+    probe_check(split, 2);
+
+    // both on one port, the other empty
+    static const probe_sim_t shared[] = {
+        { 0, 0x76, PROBE_BME280 },
+        { 0, 0x77, PROBE_BME680 },
+    };
+    probe_check(shared, 2);
+
+    // two of a kind on each port
+    static const probe_sim_t full[] = {
+        { 0, 0x76, PROBE_BME280 },
+        { 0, 0x77, PROBE_BME280 },
+        { 1, 0x76, PROBE_BME680 },
+        { 1, 0x77, PROBE_BME680 },
+    };
+    probe_check(full, 4);
+}
+
+TEST_CASE("i2c_bus probe stops at the deadline", "[i2c_bus][host]")
+{
+    static i2c_sim_device_t slow[2];
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .master.clk_speed = 100000,
+    };
+    i2c_bus_probe_result_t found[2];
+    size_t found_count = 2;
+
+    i2c_sim_attach(NULL);
+    for (int i = 0; i < 2; i++) {
+        memset(&slow[i], 0, sizeof(slow[i]));
+        slow[i].addr = s_probe_addrs[i];
+        slow[i].regs[PROBE_ID_REG] = PROBE_BME280;
+        slow[i].busy_us = 20000;
+        i2c_sim_attach(&slow[i]);
+    }
+    i2c_bus_handle_t bus = iot_i2c_bus_create(I2C_NUM_0, &conf);
+
+    // the first answer uses up the budget, the second address isn't tried
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_probe(bus, PROBE_ID_REG,
+            s_probe_addrs, sizeof(s_probe_addrs), found, &found_count, start + 10000));
+    int64_t elapsed = esp_timer_get_time() - start;
+    printf("budget 10000 us, stopped after %lld us\n", (long long) elapsed);
+    TEST_ASSERT_EQUAL(1, found_count);
+    TEST_ASSERT_EQUAL_HEX8(0x76, found[0].addr);
+    TEST_ASSERT_EQUAL(0, slow[1].transactions);
+    TEST_ASSERT_LESS_THAN(40000, elapsed);
+
+    // no room left also ends the scan
+    found_count = 1;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_probe(bus, PROBE_ID_REG, s_probe_addrs,
+            sizeof(s_probe_addrs), found, &found_count, 0));
+    TEST_ASSERT_EQUAL(1, found_count);
+
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -0,0 +1,254 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "driver/i2c.h"
+#include "iot_i2c_bus.h"
+#include "i2c_sim.h"
+
+#define RECOVERY_TIMEOUT_MS     100
+#define RECOVERY_SIM_HANG_MS    1000    /* longest i2c_sim hangs on a timeout */
+#define RECOVERY_WINDOW_US      1000000
+#define RECOVERY_HANG_MS        50
+#define RECOVERY_PERIOD_MS      10      /* sampling period of the bad sensor */
+
+static i2c_sim_device_t s_good, s_bad;
+
+static i2c_bus_handle_t recovery_setup(void)
+{
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .scl_io_num = 22,
+        .sda_io_num = 21,
+        .master.clk_speed = 100000,
+    };
+
+    memset(&s_good, 0, sizeof(s_good));
+    memset(&s_bad, 0, sizeof(s_bad));
+    s_good.addr = 0x76;
+    s_good.regs[0xD0] = 0x60;
+    s_bad.addr = 0x77;
+    i2c_sim_attach(NULL);
+    i2c_sim_attach(&s_good);
+    i2c_sim_attach(&s_bad);
+    return iot_i2c_bus_create(I2C_NUM_0, &conf);
+}
+
+TEST_CASE("i2c_bus frees SDA held by a device and carries on", "[i2c_bus][host]")
+{
+    i2c_bus_handle_t bus = recovery_setup();
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_stats_t stats;
+    uint8_t id = 0;
+
+    // the other sensor reset while it was sending a byte, 7 bits to go
+    s_bad.stuck_clocks = 7;
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1, portMAX_DELAY));
+    int64_t elapsed = esp_timer_get_time() - start;
+    TEST_ASSERT_EQUAL_HEX8(0x60, id);
+    TEST_ASSERT_EQUAL(0, s_bad.stuck_clocks);
+    iot_i2c_bus_get_stats(bus, &stats);
+    printf("recovered in %lld us: one %d ms timeout, %u clocks in %llu us\n",
+            (long long) elapsed, RECOVERY_SIM_HANG_MS, stats.recovery_clocks,
+            (unsigned long long) stats.recovery_us);
+    TEST_ASSERT_EQUAL(1, stats.recoveries);
+    TEST_ASSERT_EQUAL(7, stats.recovery_clocks);
+    TEST_ASSERT_EQUAL(0, stats.stuck);
+    TEST_ASSERT_LESS_THAN(2 * RECOVERY_SIM_HANG_MS * 1000, elapsed);
+
+    // a timeout the held bus used up leaves no time for the retry, the
+    // access fails but the bus is free again
+    s_bad.stuck_clocks = 7;
+    start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    TEST_ASSERT_LESS_THAN(2 * RECOVERY_TIMEOUT_MS * 1000, esp_timer_get_time() - start);
+    TEST_ASSERT_EQUAL(0, s_bad.stuck_clocks);
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(2, stats.recoveries);
+
+    // back to normal, no more recoveries
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(2, stats.recoveries);
+
+    // nine clocks are all it gets, then the command fails
+    s_bad.stuck_clocks = 100;
+    TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(3, stats.recoveries);
+    TEST_ASSERT_EQUAL(2 * 7 + I2C_BUS_RECOVERY_CLOCKS, stats.recovery_clocks);
+    TEST_ASSERT_EQUAL(1, stats.stuck);
+    // the STOP clocks once more
+    TEST_ASSERT_EQUAL(100 - I2C_BUS_RECOVERY_CLOCKS - 1, s_bad.stuck_clocks);
+
+    // the driver was reinstalled either way
+    s_bad.stuck_clocks = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus leaves the driver alone when a device stretches the clock", "[i2c_bus][host]")
+{
+    i2c_bus_handle_t bus = recovery_setup();
+    i2c_bus_device_handle_t good = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_device_handle_t slow = iot_i2c_bus_device_create(bus, 0x77);
+    i2c_bus_stats_t stats;
+    uint8_t id = 0;
+
+    // SCL held past the timeout, SDA never
+    s_bad.stretch = true;
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_read_reg(slow, 0xD0, &id, 1,
+                RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    TEST_ASSERT_EQUAL(3, stats.cmd_timeouts);
+    TEST_ASSERT_EQUAL(0, stats.recoveries);
+    TEST_ASSERT_EQUAL(0, stats.recovery_clocks);
+
+    // the port is fine for the other device
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(good, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL_HEX8(0x60, id);
+
+    iot_i2c_bus_device_delete(slow);
+    iot_i2c_bus_device_delete(good);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+TEST_CASE("i2c_bus doesn't blame the bus for time lost in the queue", "[i2c_bus][host]")
+{
+    i2c_bus_handle_t bus = recovery_setup();
+    i2c_bus_device_handle_t dev = iot_i2c_bus_device_create(bus, 0x76);
+    i2c_bus_device_stats_t dev_stats;
+    i2c_bus_stats_t stats;
+    uint8_t id = 0;
+
+    iot_i2c_bus_set_auto_clock(bus, true, NULL, NULL);
+    iot_i2c_bus_set_retry_budget(bus, 1, RECOVERY_HANG_MS);
+    // no time left once the bus is ours, like after a long wait in the queue
+    for (int i = 0; i < 2 * I2C_BUS_CLOCK_STEP_ERRORS; i++) {
+        TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1, 0));
+    }
+    iot_i2c_bus_get_stats(bus, &stats);
+    iot_i2c_bus_device_get_stats(dev, &dev_stats);
+    TEST_ASSERT_EQUAL(0, s_good.transactions);
+    TEST_ASSERT_EQUAL(2 * I2C_BUS_CLOCK_STEP_ERRORS, stats.timeouts);
+    TEST_ASSERT_EQUAL(0, stats.transactions);
+    TEST_ASSERT_EQUAL(0, stats.cmd_timeouts);
+    TEST_ASSERT_EQUAL(0, stats.recoveries);
+    TEST_ASSERT_EQUAL(0, stats.clock_steps);
+    TEST_ASSERT_EQUAL(0, dev_stats.transactions);
+
+    // the device wasn't benched either
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(dev, 0xD0, &id, 1,
+            RECOVERY_TIMEOUT_MS / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL_HEX8(0x60, id);
+
+    iot_i2c_bus_device_delete(dev);
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+
+typedef struct {
+    i2c_bus_device_handle_t dev;
+    volatile bool stop;
+    SemaphoreHandle_t done;
+} recovery_task_t;
+
+static void recovery_bad_sensor(void *arg)
+{
+    recovery_task_t *task = (recovery_task_t *) arg;
+    uint8_t data[2];
+
+    while (!task->stop) {
+        iot_i2c_bus_read_reg(task->dev, 0, data, sizeof(data),
+                RECOVERY_HANG_MS / portTICK_PERIOD_MS);
+        vTaskDelay(RECOVERY_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+    xSemaphoreGive(task->done);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief read the good sensor as fast as it goes for a while, next to a
+ *        sensor that hangs every access, and return the reads done
+ */
+static uint32_t recovery_run(i2c_bus_handle_t bus, uint32_t *max_us,
+        i2c_bus_device_stats_t *bad_stats)
+{
+    i2c_bus_device_handle_t good = iot_i2c_bus_device_create(bus, 0x76);
+    recovery_task_t task = {
+        .dev = iot_i2c_bus_device_create(bus, 0x77),
+        .done = xSemaphoreCreateBinary(),
+    };
+    uint32_t reads = 0;
+    uint8_t data[2];
+
+    s_bad.stretch = true;
+    s_good.busy_us = 200;
+    *max_us = 0;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(recovery_bad_sensor, "bad", 4096, &task,
+            uxTaskPriorityGet(NULL), NULL));
+    int64_t start = esp_timer_get_time();
+    int64_t now = start;
+    while (now - start < RECOVERY_WINDOW_US) {
+        TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_read_reg(good, 0, data, sizeof(data),
+                portMAX_DELAY));
+        int64_t end = esp_timer_get_time();
+        if (end - now > *max_us) {
+            *max_us = end - now;
+        }
+        now = end;
+        reads++;
+    }
+    task.stop = true;
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(task.done, 1000 / portTICK_PERIOD_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_device_get_stats(task.dev, bad_stats));
+
+    vSemaphoreDelete(task.done);
+    iot_i2c_bus_device_delete(task.dev);
+    iot_i2c_bus_device_delete(good);
+    return reads;
+}
+
+TEST_CASE("i2c_bus retry budget keeps a hanging device off the bus", "[i2c_bus][host]")
+{
+    i2c_bus_device_stats_t bad;
+    uint32_t max_us;
+
+    i2c_bus_handle_t bus = recovery_setup();
+    uint32_t unlimited = recovery_run(bus, &max_us, &bad);
+    printf("no budget: %u reads, longest %u us, bad sensor %u timeouts\n",
+            unlimited, max_us, bad.timeouts);
+    TEST_ASSERT_EQUAL(0, bad.skipped);
+    TEST_ASSERT_TRUE(max_us >= RECOVERY_HANG_MS * 1000 / 2);
+
+    // two failures bench it for 20 ms, then 40, 80 ...
+    TEST_ASSERT_EQUAL(ESP_OK, iot_i2c_bus_set_retry_budget(bus, 2, 20));
+    uint32_t budget = recovery_run(bus, &max_us, &bad);
+    printf("budget: %u reads, longest %u us, bad sensor %u timeouts, %u skipped\n",
+            budget, max_us, bad.timeouts, bad.skipped);
+    TEST_ASSERT_GREATER_THAN(0, bad.skipped);
+    TEST_ASSERT_LESS_THAN(12, bad.timeouts);
+    TEST_ASSERT_GREATER_THAN(2 * unlimited, budget);
+
+    iot_i2c_bus_delete(bus);
+    i2c_sim_attach(NULL);
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef _INFLUX_GZIP_H_
+#define _INFLUX_GZIP_H_
+
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct influx_gzip *influx_gzip_handle_t;
+
+/**
+ * @brief Create a gzip compressor with a preallocated output window
+ *
+ * The compressor emits a single deflate block with the fixed Huffman codes
+ * and finds matches with a one-entry-per-bucket hash table. That is enough
+ * for line protocol, where most of every line repeats the line before it,
+ * and needs no memory besides the output window and a 2 KiB table.
+ *
+ * @param window_size largest compressed body in bytes
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_gzip_handle_t influx_gzip_create(size_t window_size);
+
+void influx_gzip_delete(influx_gzip_handle_t gzip);
+
+/**
+ * @brief Compress a request body into the output window
+ *
+ * @param gzip compressor
+ * @param body body to compress, both segments are treated as one stream
+ * @param out set to a single segment body pointing into the window, valid
+ *            until the next call
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_SIZE the body is too large or would not shrink, send
+ *       it uncompressed
+ */
+esp_err_t influx_gzip_compress(influx_gzip_handle_t gzip,
+                               const influx_body_t *body, influx_body_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
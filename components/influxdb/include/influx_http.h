@@ -0,0 +1,69 @@
+#ifndef _INFLUX_HTTP_H_
+#define _INFLUX_HTTP_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  uint32_t connects;           // connections opened, including reconnects
+  uint32_t reused;             // requests sent on an already open connection
+  uint32_t requests;           // requests that got a response
+  uint32_t errors;             // requests that failed without a response
+  uint32_t connect_us_last;    // DNS + TCP connect + TLS handshake
+  uint64_t connect_us_total;
+  uint32_t request_us_last;    // first header byte sent to response received
+  uint64_t request_us_total;
+  uint64_t body_bytes;         // uncompressed bytes of answered requests
+  uint64_t sent_bytes;         // body bytes on the wire, after compression
+  uint32_t gzip_fallbacks;     // times the server made us stop compressing
+} influx_http_stats_t;
+
+typedef struct influx_http *influx_http_handle_t;
+
+/**
+ * @brief Create a long-lived client for CONFIG_INFLUXDB_URI
+ *
+ * The connection is opened on the first request and kept alive across
+ * requests. It is only re-established after an error or when the server
+ * closed it. https URIs are verified against the embedded certs/ca_cert.pem.
+ *
+ * With CONFIG_INFLUXDB_GZIP bodies are sent with Content-Encoding: gzip. If
+ * the server rejects a compressed body but accepts the same body
+ * uncompressed, compression stays off for the lifetime of the client.
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_http_handle_t influx_http_create(void);
+
+/**
+ * @brief Close the connection and release the client
+ */
+void influx_http_delete(influx_http_handle_t http);
+
+void influx_http_get_stats(influx_http_handle_t http,
+                           influx_http_stats_t *stats);
+
+/**
+ * @brief influx_transport_t that POSTs a batch to CONFIG_INFLUXDB_URI
+ *
+ * Error responses are parsed for the line the server rejected and 429 or 503
+ * responses for their Retry-After header.
+ *
+ * @param ctx influx_http_handle_t to send the batch on
+ */
+esp_err_t influx_http_transport(void *ctx, const influx_body_t *body,
+                                influx_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
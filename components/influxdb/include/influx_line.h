@@ -0,0 +1,90 @@
+#ifndef _INFLUX_LINE_H_
+#define _INFLUX_LINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INFLUX_SERIES_MAX 96  // escaped measurement and tag set
+
+/**
+ * Measurement name and tag set, escaped and rendered once so that encoding
+ * a sample only appends fields and a timestamp.
+ */
+typedef struct {
+  char prefix[INFLUX_SERIES_MAX];
+  size_t len;
+} influx_series_t;
+
+/**
+ * Line under construction in a caller-supplied buffer. The encoder never
+ * allocates and never formats floating point values.
+ */
+typedef struct {
+  char *buf;
+  size_t size;
+  size_t len;
+  uint8_t fields;
+  bool overflow;
+} influx_line_t;
+
+/**
+ * @brief Render the measurement and tag set of a series
+ *
+ * @param series series to initialise
+ * @param measurement measurement name
+ * @param tags tag key/value pairs: key0, value0, key1, value1, ... InfluxDB
+ *             parses tags fastest when they are sorted by key
+ * @param tag_count number of key/value pairs
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_SIZE the escaped series does not fit
+ */
+esp_err_t influx_series_init(influx_series_t *series, const char *measurement,
+                             const char *const *tags, size_t tag_count);
+
+/**
+ * @brief Start a line for series in buf
+ */
+void influx_line_begin(influx_line_t *line, char *buf, size_t size,
+                       const influx_series_t *series);
+
+/**
+ * @brief Append a float field from a fixed-point value
+ *
+ * The field is written as value / 10^decimals, e.g. 2153 with 2 decimals
+ * becomes 21.53. Field keys are written as given and must not need escaping.
+ *
+ * @param decimals number of fractional digits, at most 9
+ */
+void influx_line_add_fixed(influx_line_t *line, const char *key, int32_t value,
+                           uint8_t decimals);
+
+/**
+ * @brief Append an integer field (written with the "i" suffix)
+ */
+void influx_line_add_int(influx_line_t *line, const char *key, int64_t value);
+
+/**
+ * @brief Terminate the line
+ *
+ * @param timestamp timestamp in the precision of the write URI, 0 to let the
+ *                  server assign one
+ *
+ * @return length of the line without the terminating NUL, or -1 if it did
+ *         not fit or has no fields
+ */
+int influx_line_finish(influx_line_t *line, int64_t timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
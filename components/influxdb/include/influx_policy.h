@@ -0,0 +1,69 @@
+#ifndef _INFLUX_POLICY_H_
+#define _INFLUX_POLICY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  size_t min_batch_bytes;
+  size_t max_batch_bytes;
+  uint32_t min_age_ms;
+  uint32_t max_age_ms;
+  uint32_t target_latency_ms;  // slower requests shrink the batches
+  uint32_t min_backoff_ms;     // delay after the first failed request
+  uint32_t max_backoff_ms;
+} influx_policy_config_t;
+
+typedef struct {
+  size_t batch_bytes;       // flush once this many bytes are pending
+  uint32_t age_ms;          // flush once the oldest record is this old
+  uint32_t latency_ms;      // moving average of request latency
+  uint32_t error_permille;  // moving average of failed requests
+  uint32_t failures;        // failed requests in a row
+  uint32_t backoff_ms;      // pause before the next request, 0 if none
+} influx_policy_metrics_t;
+
+/**
+ * Flush thresholds that follow how the server is doing. Requests that come
+ * back quickly let batches and flush intervals grow, so the radio stays idle
+ * longer. Slow or failed ones shrink them again, and each failure doubles a
+ * jittered pause before the next request.
+ */
+typedef struct {
+  influx_policy_config_t config;
+  influx_policy_metrics_t metrics;
+  int64_t retry_at_us;  // no requests before this time
+  bool measured;        // latency_ms holds a sample
+} influx_policy_t;
+
+/**
+ * @brief Start at the largest batches and no backoff
+ */
+void influx_policy_init(influx_policy_t *policy,
+                        const influx_policy_config_t *config);
+
+/**
+ * @brief Account for a finished request
+ *
+ * @param ok whether the server took the batch or at least answered for it
+ * @param latency_ms how long the request took
+ * @param now_us esp_timer_get_time() when it finished
+ */
+void influx_policy_update(influx_policy_t *policy, bool ok,
+                          uint32_t latency_ms, int64_t now_us);
+
+/**
+ * @brief Whether the backoff after a failure is over
+ */
+bool influx_policy_ready(const influx_policy_t *policy, int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
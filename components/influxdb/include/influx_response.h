@@ -0,0 +1,79 @@
+#ifndef _INFLUX_RESPONSE_H_
+#define _INFLUX_RESPONSE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INFLUX_RESPONSE_CODE_MAX 24
+#define INFLUX_RESPONSE_MESSAGE_MAX 160
+
+/**
+ * What an InfluxDB error body says, e.g.
+ * {"code":"invalid","message":"unable to parse 'x': missing fields","line":3}
+ *
+ * 1.x servers send {"error":"..."} instead, which ends up in message. Long
+ * strings are truncated, everything else in the body is skipped.
+ */
+typedef struct {
+  char code[INFLUX_RESPONSE_CODE_MAX];
+  char message[INFLUX_RESPONSE_MESSAGE_MAX];
+  uint32_t line;  // line-protocol line the error refers to, 0 if none
+  size_t length;  // body bytes seen
+
+  // parser state
+  uint8_t state;
+  uint8_t depth;
+  uint8_t field;
+  uint8_t key_len;
+  uint8_t unicode_left;
+  uint16_t unicode;
+  bool want_key;
+  bool in_key;
+  char key[8];
+  size_t value_len;
+} influx_response_t;
+
+/**
+ * @brief Reset the parser for a new response
+ */
+void influx_response_init(influx_response_t *resp);
+
+/**
+ * @brief Parse the next piece of a response body
+ *
+ * Pieces may be split anywhere, also inside strings and escapes. Neither
+ * allocates nor fails, malformed input just yields empty fields.
+ */
+void influx_response_feed(influx_response_t *resp, const char *data,
+                          size_t len);
+
+/**
+ * @brief Find the line of body an error refers to
+ *
+ * Uses the line number if the server sent one, otherwise looks for the line
+ * quoted in an "unable to parse '...'" message.
+ *
+ * @return 1-based line number, 0 if the error does not point at a line
+ */
+uint32_t influx_response_error_line(const influx_response_t *resp,
+                                    const influx_body_t *body);
+
+/**
+ * @brief Whether the server stored the lines it did not complain about
+ *
+ * InfluxDB reports that as a "partial write" error.
+ */
+bool influx_response_partial(const influx_response_t *resp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _INFLUX_SPOOL_H_
+#define _INFLUX_SPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * NOR flash the spool lives on: erased bytes read 0xff and writes can only
+ * clear bits. Addresses are relative to the start of the region.
+ */
+typedef struct {
+  esp_err_t (*read)(void *ctx, size_t addr, void *buf, size_t len);
+  esp_err_t (*write)(void *ctx, size_t addr, const void *buf, size_t len);
+  esp_err_t (*erase)(void *ctx, size_t addr, size_t len);
+  size_t size;         // multiple of sector_size, at least two sectors
+  size_t sector_size;  // erase unit
+  void *ctx;
+} influx_spool_flash_t;
+
+typedef struct {
+  uint32_t appended;  // records written to flash
+  uint32_t drained;   // records consumed after a successful upload
+  uint32_t evicted;   // records erased unsent to make room
+  uint32_t corrupt;   // torn or damaged records skipped during recovery
+  uint32_t erases;    // sector erases, for wear estimates
+  size_t pending;     // bytes of unsent line protocol
+} influx_spool_stats_t;
+
+typedef struct influx_spool *influx_spool_handle_t;
+
+/**
+ * @brief Mount a spool, recovering whatever an earlier boot left behind
+ *
+ * The region is used as a ring of segments, one per sector. Every segment
+ * starts with a header carrying a sequence number and holds CRC protected
+ * records appended back to back. Records are only ever appended and
+ * drained records are marked by clearing bits. Segments are erased in ring
+ * order when the head reaches them, evicting whatever the oldest segment
+ * still holds if the ring is full. A power cut can at worst lose the record
+ * being written.
+ *
+ * @param flash flash region, copied
+ * @param batch_size largest body returned by influx_spool_peek
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_spool_handle_t influx_spool_open(const influx_spool_flash_t *flash,
+                                        size_t batch_size);
+
+void influx_spool_close(influx_spool_handle_t spool);
+
+/**
+ * @brief Flash region of a data partition
+ *
+ * @param label partition label from partitions.csv
+ * @param flash filled in on success
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NOT_FOUND there is no such partition
+ */
+esp_err_t influx_spool_partition(const char *label,
+                                 influx_spool_flash_t *flash);
+
+/**
+ * @brief Largest body a single influx_spool_append can take
+ */
+size_t influx_spool_max_record(influx_spool_handle_t spool);
+
+/**
+ * @brief Append newline terminated records, evicting the oldest segment if
+ *        the spool is full
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_SIZE the body is larger than influx_spool_max_record
+ *     - others flash error
+ */
+esp_err_t influx_spool_append(influx_spool_handle_t spool,
+                              const influx_body_t *body);
+
+/**
+ * @brief Read the oldest pending records
+ *
+ * Collects whole records up to batch_size bytes. They stay pending until
+ * influx_spool_consume is called, so a failed upload simply peeks again.
+ *
+ * @param body set to a single segment body pointing into the spool, valid
+ *             until the next call
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NOT_FOUND the spool is empty
+ *     - others flash error
+ */
+esp_err_t influx_spool_peek(influx_spool_handle_t spool, influx_body_t *body);
+
+/**
+ * @brief Mark the records returned by the last influx_spool_peek as sent
+ */
+esp_err_t influx_spool_consume(influx_spool_handle_t spool);
+
+void influx_spool_get_stats(influx_spool_handle_t spool,
+                            influx_spool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
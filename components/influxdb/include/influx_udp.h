@@ -0,0 +1,63 @@
+#ifndef _INFLUX_UDP_H_
+#define _INFLUX_UDP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  const char *host;     // InfluxDB or Telegraf UDP listener, copied
+  uint16_t port;        // 8089 for both by default
+  size_t payload_size;  // largest datagram payload, MTU minus IP/UDP headers
+} influx_udp_config_t;
+
+typedef struct {
+  uint32_t datagrams;  // datagrams handed to the network stack
+  uint64_t bytes;      // payload bytes in them
+  uint32_t oversized;  // lines dropped for not fitting into a datagram
+  uint32_t errors;     // datagrams the stack refused, or failed lookups
+} influx_udp_stats_t;
+
+typedef struct influx_udp *influx_udp_handle_t;
+
+/**
+ * @brief Create a fire-and-forget line-protocol sender
+ *
+ * The host is looked up on the first send and again after a failed lookup
+ * or send, so the sender can be created before the network is up.
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_udp_handle_t influx_udp_create(const influx_udp_config_t *config);
+
+void influx_udp_delete(influx_udp_handle_t udp);
+
+void influx_udp_get_stats(influx_udp_handle_t udp, influx_udp_stats_t *stats);
+
+/**
+ * @brief influx_transport_t that sends a batch as UDP datagrams
+ *
+ * Lines are packed into as few datagrams as fit the payload size, never
+ * splitting a line. Nothing is acknowledged, so every batch is reported
+ * as accepted with status 204 and lost datagrams only show up as gaps in
+ * the data. Safe to call from several tasks, batches are sent one at a
+ * time.
+ *
+ * @param ctx influx_udp_handle_t to send on
+ */
+esp_err_t influx_udp_transport(void *ctx, const influx_body_t *body,
+                               influx_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef _INFLUX_UPLOADER_H_
+#define _INFLUX_UPLOADER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "influx_writer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * What influx_uploader_enqueue gives up when the queue is full.
+ */
+typedef enum {
+  INFLUX_DROP_OLDEST,  // overwrite the oldest queued record, keep fresh data
+  INFLUX_DROP_NEWEST,  // refuse the new record, keep what was queued
+} influx_drop_policy_t;
+
+typedef struct {
+  influx_writer_handle_t writer;     // records are handed to this writer
+  size_t queue_len;                  // records the queue holds
+  size_t record_max;                 // largest record, including the NUL
+  influx_drop_policy_t drop_policy;  // what to drop when the queue is full
+  uint32_t poll_ms;  // how often an idle task checks the batch age
+  uint32_t task_stack_size;
+  uint32_t task_priority;
+} influx_uploader_config_t;
+
+typedef struct {
+  uint32_t enqueued;        // records accepted into the queue
+  uint32_t dropped_oldest;  // queued records overwritten by newer ones
+  uint32_t dropped_newest;  // records refused because the queue was full
+  uint32_t dropped_busy;    // records refused because the queue was busy
+  uint32_t written;         // records handed to the writer
+  size_t high_water;        // most records ever queued at once
+} influx_uploader_stats_t;
+
+typedef struct influx_uploader *influx_uploader_handle_t;
+
+/**
+ * @brief Start an upload task that feeds a writer from a bounded queue
+ *
+ * Batches are flushed from the upload task, so a slow or unreachable server
+ * only ever stalls that task. All memory is allocated here, enqueueing never
+ * allocates.
+ *
+ * @param config uploader configuration, copied
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_uploader_handle_t influx_uploader_create(
+    const influx_uploader_config_t *config);
+
+/**
+ * @brief Stop the upload task after it has handed over what is queued
+ *
+ * Waits for a request in flight to finish. The writer is not deleted.
+ */
+void influx_uploader_delete(influx_uploader_handle_t uploader);
+
+/**
+ * @brief Queue one line-protocol record without blocking
+ *
+ * The record must not contain the trailing newline. The queue lock is only
+ * held to copy a record, a caller that can't get it within a few ms drops
+ * the new record, whatever the drop policy, and counts it as dropped_busy.
+ *
+ * @return
+ *     - ESP_OK the record was queued, possibly dropping the oldest one
+ *     - ESP_ERR_NO_MEM the queue is full and the record was dropped
+ *     - ESP_ERR_TIMEOUT the queue was busy and the record was dropped
+ *     - ESP_ERR_INVALID_SIZE the record is longer than record_max
+ */
+esp_err_t influx_uploader_enqueue(influx_uploader_handle_t uploader,
+                                  const char *line);
+
+void influx_uploader_get_stats(influx_uploader_handle_t uploader,
+                               influx_uploader_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
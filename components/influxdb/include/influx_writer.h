@@ -0,0 +1,151 @@
+#ifndef _INFLUX_WRITER_H_
+#define _INFLUX_WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "influx_policy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A request body handed to a transport. The writer keeps pending records in
+ * a ring buffer, so a batch may wrap around the end of the buffer and arrive
+ * as two segments that have to be sent back to back.
+ */
+typedef struct {
+  const char *data[2];
+  size_t len[2];
+} influx_body_t;
+
+/**
+ * What the server made of a batch.
+ */
+typedef struct {
+  int status_code;         // HTTP status code, 0 if there was no response
+  uint32_t error_line;     // 1-based line of the body it rejected, 0 if unknown
+  bool partial;            // it stored the other lines of a rejected batch
+  uint32_t retry_after_s;  // Retry-After of the response, 0 if there was none
+} influx_result_t;
+
+/**
+ * @brief Send one batch of newline separated line-protocol records
+ *
+ * @param ctx transport context from influx_writer_config_t
+ * @param body batch to send
+ * @param result filled in with the response, zeroed by the caller
+ *
+ * @return
+ *     - ESP_OK the request was performed (check result)
+ *     - others the request could not be performed
+ */
+typedef esp_err_t (*influx_transport_t)(void *ctx, const influx_body_t *body,
+                                        influx_result_t *result);
+
+typedef struct {
+  size_t buffer_size;         // ring buffer capacity in bytes
+  size_t batch_max_bytes;     // flush once this many bytes are pending
+  uint32_t batch_max_age_ms;  // flush once the oldest record is this old
+  influx_transport_t transport;
+  void *transport_ctx;
+  struct influx_spool *spool;  // optional influx_spool_handle_t for outages
+  // optional adaptive thresholds, batch_max_bytes and batch_max_age_ms are
+  // used as they are without one
+  const influx_policy_config_t *policy;
+} influx_writer_config_t;
+
+typedef struct {
+  uint32_t records;        // records accepted into the buffer
+  uint32_t dropped;        // records dropped because the buffer was full
+  uint32_t requests;       // batches sent
+  uint32_t failed;         // batches that failed and were kept for retry
+  uint32_t rejected;       // batches dropped after a 4xx response
+  uint32_t quarantined;    // lines the server rejected, dropped from batches
+  uint32_t deferred;       // flushes held back by Retry-After or backoff
+  uint32_t spooled;        // failed batches moved to the flash spool
+  uint64_t bytes;          // body bytes sent in successful batches
+  size_t pending;          // bytes currently waiting in the buffer
+} influx_writer_stats_t;
+
+typedef struct influx_writer *influx_writer_handle_t;
+
+/**
+ * @brief Create a batching writer
+ *
+ * @param config writer configuration, a NULL transport selects
+ *               influx_http_transport
+ *
+ * @return
+ *     - NULL Fail
+ *     - Others Success
+ */
+influx_writer_handle_t influx_writer_create(
+    const influx_writer_config_t *config);
+
+/**
+ * @brief Delete a writer, pending records are discarded
+ */
+void influx_writer_delete(influx_writer_handle_t writer);
+
+/**
+ * @brief Append one line-protocol record
+ *
+ * The record must not contain the trailing newline. If the batch reaches its
+ * size or age threshold the batch is flushed from the calling task.
+ *
+ * @return
+ *     - ESP_OK the record was queued
+ *     - ESP_ERR_NO_MEM the buffer is full and the record was dropped
+ *     - ESP_ERR_INVALID_SIZE the record can never fit into the buffer
+ */
+esp_err_t influx_writer_write(influx_writer_handle_t writer, const char *line);
+
+/**
+ * @brief Flush the batch if its age threshold has passed
+ *
+ * Lets idle callers enforce the age threshold without writing a record.
+ */
+esp_err_t influx_writer_poll(influx_writer_handle_t writer);
+
+/**
+ * @brief Send all pending records now
+ *
+ * With a spool, records saved there during an outage are sent first. While
+ * uploads keep failing, the batch moves to the spool instead of waiting in
+ * RAM, so the buffer never fills up and drops records.
+ *
+ * If the server names a line it cannot take, only that line is dropped and
+ * the rest of the batch is sent again, unless the server says it already
+ * stored it. After a 429 or 503 with Retry-After nothing is sent until that
+ * time has passed, and with a policy nothing is sent while it backs off.
+ *
+ * @return
+ *     - ESP_OK the batch was sent or there was nothing to send
+ *     - ESP_ERR_INVALID_STATE another task is flushing right now
+ *     - ESP_ERR_INVALID_RESPONSE the server rejected the batch, it was dropped
+ *     - ESP_ERR_TIMEOUT the server asked to retry later or the policy backs
+ *       off, the batch was kept
+ *     - others the batch was kept for a later retry
+ */
+esp_err_t influx_writer_flush(influx_writer_handle_t writer);
+
+void influx_writer_get_stats(influx_writer_handle_t writer,
+                             influx_writer_stats_t *stats);
+
+/**
+ * @brief Current flush thresholds and what they are based on
+ *
+ * Without a policy only the fixed thresholds are filled in.
+ */
+void influx_writer_get_policy(influx_writer_handle_t writer,
+                              influx_policy_metrics_t *metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
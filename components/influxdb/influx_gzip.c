@@ -0,0 +1,236 @@
+#include "influx_gzip.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "influx_crc.h"
+
+#define HASH_BITS 10
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_DIST 32768
+#define MAX_INPUT 0xfffe  // positions are kept as uint16_t + 1
+
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8
+
+struct influx_gzip {
+  uint8_t *out;
+  size_t window_size;
+  size_t out_len;
+  bool overflow;
+  uint32_t bits;  // pending output bits, LSB first
+  int nbits;
+  uint16_t head[HASH_SIZE];  // last position + 1 of each hash, 0 if none
+};
+
+/* Body segments read as one contiguous input. */
+typedef struct {
+  const uint8_t *data[2];
+  size_t len[2];
+  size_t total;
+} input_t;
+
+static const uint16_t LEN_BASE[29] = {3,  4,  5,  6,   7,   8,   9,   10,
+                                      11, 13, 15, 17,  19,  23,  27,  31,
+                                      35, 43, 51, 59,  67,  83,  99,  115,
+                                      131, 163, 195, 227, 258};
+static const uint8_t LEN_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                      1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                      4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DIST_BASE[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                       4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                       9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static inline uint8_t input_at(const input_t *in, size_t i) {
+  return i < in->len[0] ? in->data[0][i] : in->data[1][i - in->len[0]];
+}
+
+static inline uint32_t input_hash(const input_t *in, size_t i) {
+  uint32_t v = input_at(in, i) | input_at(in, i + 1) << 8 |
+               input_at(in, i + 2) << 16;
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void put_byte(influx_gzip_handle_t gzip, uint8_t byte) {
+  if (gzip->out_len >= gzip->window_size) {
+    gzip->overflow = true;
+    return;
+  }
+  gzip->out[gzip->out_len++] = byte;
+}
+
+static void put_bits(influx_gzip_handle_t gzip, uint32_t value, int n) {
+  gzip->bits |= value << gzip->nbits;
+  gzip->nbits += n;
+  while (gzip->nbits >= 8) {
+    put_byte(gzip, gzip->bits & 0xff);
+    gzip->bits >>= 8;
+    gzip->nbits -= 8;
+  }
+}
+
+/* Huffman codes are packed starting with their most significant bit. */
+static void put_code(influx_gzip_handle_t gzip, uint32_t code, int n) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < n; i++) {
+    reversed = (reversed << 1) | ((code >> i) & 1);
+  }
+  put_bits(gzip, reversed, n);
+}
+
+/* Literal/length symbol with the fixed Huffman code of RFC 1951 3.2.6. */
+static void put_symbol(influx_gzip_handle_t gzip, int sym) {
+  if (sym < 144) {
+    put_code(gzip, 0x30 + sym, 8);
+  } else if (sym < 256) {
+    put_code(gzip, 0x190 + sym - 144, 9);
+  } else if (sym < 280) {
+    put_code(gzip, sym - 256, 7);
+  } else {
+    put_code(gzip, 0xc0 + sym - 280, 8);
+  }
+}
+
+static void put_match(influx_gzip_handle_t gzip, size_t len, size_t dist) {
+  int code = 28;
+  while (LEN_BASE[code] > len) {
+    code--;
+  }
+  put_symbol(gzip, 257 + code);
+  put_bits(gzip, len - LEN_BASE[code], LEN_EXTRA[code]);
+
+  code = 29;
+  while (DIST_BASE[code] > dist) {
+    code--;
+  }
+  put_code(gzip, code, 5);
+  put_bits(gzip, dist - DIST_BASE[code], DIST_EXTRA[code]);
+}
+
+static void put_le32(influx_gzip_handle_t gzip, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    put_byte(gzip, v >> (i * 8));
+  }
+}
+
+static void deflate_block(influx_gzip_handle_t gzip, const input_t *in) {
+  size_t n = in->total;
+  size_t i = 0;
+
+  memset(gzip->head, 0, sizeof(gzip->head));
+  // BFINAL, BTYPE=01 (fixed Huffman codes)
+  put_bits(gzip, 1, 1);
+  put_bits(gzip, 1, 2);
+
+  while (i < n && !gzip->overflow) {
+    size_t match_len = 0;
+    size_t match_dist = 0;
+
+    if (i + MIN_MATCH <= n) {
+      uint32_t h = input_hash(in, i);
+      size_t candidate = gzip->head[h];
+      gzip->head[h] = i + 1;
+      if (candidate && i - (candidate - 1) <= MAX_DIST) {
+        size_t from = candidate - 1;
+        size_t max = n - i < MAX_MATCH ? n - i : MAX_MATCH;
+        size_t len = 0;
+        while (len < max && input_at(in, from + len) == input_at(in, i + len)) {
+          len++;
+        }
+        if (len >= MIN_MATCH) {
+          match_len = len;
+          match_dist = i - from;
+        }
+      }
+    }
+
+    if (!match_len) {
+      put_symbol(gzip, input_at(in, i));
+      i++;
+      continue;
+    }
+
+    put_match(gzip, match_len, match_dist);
+    // index the strings inside the match so later lines can refer to them
+    for (size_t end = i + match_len; ++i < end;) {
+      if (i + MIN_MATCH <= n) {
+        gzip->head[input_hash(in, i)] = i + 1;
+      }
+    }
+  }
+
+  put_symbol(gzip, 256);  // end of block
+  if (gzip->nbits) {
+    put_bits(gzip, 0, 8 - gzip->nbits);
+  }
+}
+
+influx_gzip_handle_t influx_gzip_create(size_t window_size) {
+  if (window_size < GZIP_HEADER_LEN + GZIP_TRAILER_LEN) {
+    return NULL;
+  }
+  struct influx_gzip *gzip = calloc(1, sizeof(struct influx_gzip));
+  if (!gzip) {
+    return NULL;
+  }
+  gzip->out = malloc(window_size);
+  if (!gzip->out) {
+    free(gzip);
+    return NULL;
+  }
+  gzip->window_size = window_size;
+  return gzip;
+}
+
+void influx_gzip_delete(influx_gzip_handle_t gzip) {
+  if (!gzip) {
+    return;
+  }
+  free(gzip->out);
+  free(gzip);
+}
+
+esp_err_t influx_gzip_compress(influx_gzip_handle_t gzip,
+                               const influx_body_t *body, influx_body_t *out) {
+  static const uint8_t header[GZIP_HEADER_LEN] = {
+      0x1f, 0x8b, 8 /* deflate */, 0, 0, 0, 0, 0, 0, 0xff /* unknown OS */};
+  input_t in = {
+      .data = {(const uint8_t *)body->data[0], (const uint8_t *)body->data[1]},
+      .len = {body->len[0], body->len[1]},
+      .total = body->len[0] + body->len[1],
+  };
+  if (in.total > MAX_INPUT ||
+      in.total <= GZIP_HEADER_LEN + GZIP_TRAILER_LEN) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  memcpy(gzip->out, header, sizeof(header));
+  gzip->out_len = sizeof(header);
+  gzip->overflow = false;
+  gzip->bits = 0;
+  gzip->nbits = 0;
+
+  deflate_block(gzip, &in);
+
+  uint32_t crc = influx_crc32(0, in.data[0], in.len[0]);
+  crc = influx_crc32(crc, in.data[1], in.len[1]);
+  put_le32(gzip, crc);
+  put_le32(gzip, in.total);
+
+  if (gzip->overflow || gzip->out_len >= in.total) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  out->data[0] = (const char *)gzip->out;
+  out->len[0] = gzip->out_len;
+  out->data[1] = NULL;
+  out->len[1] = 0;
+  return ESP_OK;
+}
@@ -0,0 +1,299 @@
+#include "influx_http.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "influx_gzip.h"
+#include "influx_response.h"
+#include "sdkconfig.h"
+
+/*
+echo "" | openssl s_client -showcerts -connect strims.gg:443 | sed -n \
+ "1,/Root/d; /BEGIN/,/END/p" | openssl x509 -outform PEM >certs/ca_cert.pem
+*/
+// CA certificate embedded by main through EMBED_TXTFILES
+extern const uint8_t ca_cert_pem_start[] asm("_binary_ca_cert_pem_start");
+extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_cert_pem_end");
+static const char *HTTP_TAG = "HTTP";
+
+struct influx_http {
+  esp_http_client_handle_t client;
+  SemaphoreHandle_t lock;  // one request at a time on the connection
+  bool connected;          // between ON_CONNECTED and DISCONNECTED
+  bool server_close;       // the last response asked to close the connection
+  int64_t open_us;         // start of the current esp_http_client_open
+  int64_t connected_us;    // time the current connection was established
+  influx_response_t response;  // error details of the last response
+  uint32_t retry_after_s;      // Retry-After of the last response
+  influx_gzip_handle_t gzip;  // NULL when compression is off
+  bool gzip_disabled;         // the server only took uncompressed bodies
+  influx_http_stats_t stats;
+};
+
+static influx_http_handle_t default_http = NULL;
+static portMUX_TYPE default_http_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
+  influx_http_handle_t http = (influx_http_handle_t)evt->user_data;
+
+  switch (evt->event_id) {
+    case HTTP_EVENT_ERROR:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ERROR");
+      break;
+    case HTTP_EVENT_ON_CONNECTED:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_CONNECTED");
+      http->connected = true;
+      http->connected_us = esp_timer_get_time();
+      http->stats.connects++;
+      http->stats.connect_us_last = http->connected_us - http->open_us;
+      http->stats.connect_us_total += http->stats.connect_us_last;
+      break;
+    case HTTP_EVENT_HEADER_SENT:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_HEADER_SENT");
+      break;
+    case HTTP_EVENT_ON_HEADER:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s",
+               evt->header_key, evt->header_value);
+      if (!strcasecmp(evt->header_key, "Connection") &&
+          !strcasecmp(evt->header_value, "close")) {
+        http->server_close = true;
+      }
+      if (!strcasecmp(evt->header_key, "Retry-After")) {
+        // the HTTP-date form is not worth a date parser, it gets no hint
+        char *end;
+        unsigned long seconds = strtoul(evt->header_value, &end, 10);
+        if (end != evt->header_value && !*end) {
+          http->retry_after_s = seconds;
+        }
+      }
+      break;
+    case HTTP_EVENT_ON_DATA:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_DATA, len%d", evt->data_len);
+      break;
+
+    case HTTP_EVENT_ON_FINISH:
+      ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_FINISH");
+      break;
+
+    case HTTP_EVENT_DISCONNECTED:
+      ESP_LOGI(HTTP_TAG, "HTTP_EVENT_DISCONNECTED");
+      http->connected = false;
+      int mbedtls_err = 0;
+      esp_err_t err =
+          esp_tls_get_and_clear_last_error(evt->data, &mbedtls_err, NULL);
+      if (err != 0) {
+        ESP_LOGI(HTTP_TAG, "Last esp error code: 0x%x", err);
+        ESP_LOGI(HTTP_TAG, "Last mbedtls failure: 0x%x", mbedtls_err);
+      }
+      break;
+  }
+
+  return ESP_OK;
+}
+
+influx_http_handle_t influx_http_create(void) {
+  struct influx_http *http = calloc(1, sizeof(struct influx_http));
+  if (!http) {
+    return NULL;
+  }
+
+  esp_http_client_config_t conf = {.url = CONFIG_INFLUXDB_URI,
+                                   .cert_pem = (const char *)ca_cert_pem_start,
+                                   .event_handler = http_event_handler,
+                                   .user_data = http,
+                                   .method = HTTP_METHOD_POST};
+  http->client = esp_http_client_init(&conf);
+  http->lock = xSemaphoreCreateMutex();
+#ifdef CONFIG_INFLUXDB_GZIP
+  // a batch is never larger than the writer's ring buffer
+  http->gzip = influx_gzip_create(CONFIG_INFLUXDB_BATCH_BUFFER_SIZE);
+  if (!http->gzip) {
+    ESP_LOGW(HTTP_TAG, "no memory for gzip, sending uncompressed bodies");
+  }
+#endif
+  if (!http->client || !http->lock) {
+    ESP_LOGE(HTTP_TAG, "failed to create HTTP client");
+    influx_http_delete(http);
+    return NULL;
+  }
+  return http;
+}
+
+void influx_http_delete(influx_http_handle_t http) {
+  if (!http) {
+    return;
+  }
+  if (http->client) {
+    esp_err_t err = esp_http_client_cleanup(http->client);
+    if (err != ESP_OK) {
+      ESP_LOGE(HTTP_TAG, "HTTP client cleanup failed: %s",
+               esp_err_to_name(err));
+    }
+  }
+  if (http->lock) {
+    vSemaphoreDelete(http->lock);
+  }
+  influx_gzip_delete(http->gzip);
+  free(http);
+}
+
+void influx_http_get_stats(influx_http_handle_t http,
+                           influx_http_stats_t *stats) {
+  xSemaphoreTake(http->lock, portMAX_DELAY);
+  *stats = http->stats;
+  xSemaphoreGive(http->lock);
+}
+
+static void http_close(influx_http_handle_t http) {
+  esp_http_client_close(http->client);
+  http->connected = false;
+  http->server_close = false;
+}
+
+static esp_err_t http_request(influx_http_handle_t http,
+                              const influx_body_t *body, int *status_code) {
+  char chunk[64];
+  size_t total = body->len[0] + body->len[1];
+  bool reused = http->connected;
+
+  influx_response_init(&http->response);
+  http->retry_after_s = 0;
+  http->open_us = esp_timer_get_time();
+
+  // stream both ring buffer segments instead of copying them together
+  esp_err_t err = esp_http_client_open(http->client, total);
+  for (int i = 0; err == ESP_OK && i < 2; i++) {
+    if (body->len[i] &&
+        esp_http_client_write(http->client, body->data[i], body->len[i]) !=
+            (int)body->len[i]) {
+      err = ESP_ERR_HTTP_WRITE_DATA;
+    }
+  }
+  if (err == ESP_OK && esp_http_client_fetch_headers(http->client) < 0) {
+    err = ESP_ERR_HTTP_FETCH_HEADER;
+  }
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // the whole response has to be read before the connection can be reused,
+  // the client undoes chunked encoding so the parser sees the plain body
+  int len;
+  while ((len = esp_http_client_read(http->client, chunk, sizeof(chunk))) >
+         0) {
+    influx_response_feed(&http->response, chunk, len);
+  }
+  if (len < 0) {
+    // the connection broke mid-response, whether the batch was written is
+    // unknown so it has to be sent again
+    return ESP_FAIL;
+  }
+  *status_code = esp_http_client_get_status_code(http->client);
+
+  int64_t started = reused ? http->open_us : http->connected_us;
+  http->stats.request_us_last = esp_timer_get_time() - started;
+  http->stats.request_us_total += http->stats.request_us_last;
+  http->stats.requests++;
+  if (reused) {
+    http->stats.reused++;
+  }
+
+  ESP_LOGI(HTTP_TAG, "HTTP POST Status = %d, body = %u, %s connection",
+           *status_code, (unsigned)total, reused ? "reused" : "new");
+  if (*status_code >= 300 && http->response.length) {
+    ESP_LOGW(HTTP_TAG, "%s: %s", http->response.code, http->response.message);
+  }
+  return ESP_OK;
+}
+
+/* Send body, retrying once if a kept-alive connection turned out dead. */
+static esp_err_t http_send(influx_http_handle_t http, const influx_body_t *body,
+                           bool gzipped, int *status_code) {
+  if (gzipped) {
+    esp_http_client_set_header(http->client, "Content-Encoding", "gzip");
+  } else {
+    esp_http_client_delete_header(http->client, "Content-Encoding");
+  }
+
+  bool reused = http->connected;
+  esp_err_t err = http_request(http, body, status_code);
+  if (err != ESP_OK && reused) {
+    // the server may have dropped the idle connection, retry on a new one
+    ESP_LOGD(HTTP_TAG, "kept-alive connection failed, reconnecting");
+    http_close(http);
+    err = http_request(http, body, status_code);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(HTTP_TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+    http->stats.errors++;
+    http_close(http);
+  } else {
+    http->stats.sent_bytes += body->len[0] + body->len[1];
+    if (http->server_close) {
+      http_close(http);
+    }
+  }
+  return err;
+}
+
+esp_err_t influx_http_transport(void *ctx, const influx_body_t *body,
+                                influx_result_t *result) {
+  influx_http_handle_t http = (influx_http_handle_t)ctx;
+  if (!http) {
+    http = default_http;
+  }
+  if (!http) {
+    influx_http_handle_t created = influx_http_create();
+    if (!created) {
+      return ESP_ERR_NO_MEM;
+    }
+    portENTER_CRITICAL(&default_http_mux);
+    if (!default_http) {
+      default_http = created;
+      created = NULL;
+    }
+    http = default_http;
+    portEXIT_CRITICAL(&default_http_mux);
+    // another task won the race
+    influx_http_delete(created);
+  }
+
+  int *status_code = &result->status_code;
+  xSemaphoreTake(http->lock, portMAX_DELAY);
+  influx_body_t compressed;
+  bool gzipped = http->gzip && !http->gzip_disabled &&
+                 influx_gzip_compress(http->gzip, body, &compressed) == ESP_OK;
+  esp_err_t err =
+      http_send(http, gzipped ? &compressed : body, gzipped, status_code);
+  if (gzipped && err == ESP_OK &&
+      (*status_code == 400 || *status_code == 415) &&
+      !influx_response_error_line(&http->response, body)) {
+    // either the batch is bad or the server does not take gzip, an
+    // uncompressed retry tells the two apart
+    err = http_send(http, body, false, status_code);
+    if (err == ESP_OK && *status_code >= 200 && *status_code <= 299) {
+      ESP_LOGW(HTTP_TAG, "server rejected gzip, sending uncompressed bodies");
+      http->gzip_disabled = true;
+      http->stats.gzip_fallbacks++;
+    }
+  }
+  if (err == ESP_OK) {
+    http->stats.body_bytes += body->len[0] + body->len[1];
+    if (*status_code >= 400) {
+      result->error_line = influx_response_error_line(&http->response, body);
+      result->partial = influx_response_partial(&http->response);
+    }
+    if (*status_code == 429 || *status_code == 503) {
+      result->retry_after_s = http->retry_after_s;
+    }
+  }
+  xSemaphoreGive(http->lock);
+  return err;
+}
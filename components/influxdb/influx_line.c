@@ -0,0 +1,166 @@
+#include "influx_line.h"
+
+#include <string.h>
+
+static const char DIGITS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t POW10[] = {1,      10,      100,      1000,      10000,
+                                 100000, 1000000, 10000000, 100000000,
+                                 1000000000};
+
+/* Write v in decimal so that it ends right before end, two digits at a time.
+ * Returns the first digit. */
+static char *u64_to_dec(char *end, uint64_t v) {
+  // stay in 32-bit arithmetic once the value fits, the common case
+  while (v > UINT32_MAX) {
+    uint32_t r = (uint32_t)(v % 100);
+    v /= 100;
+    *--end = DIGITS[r * 2 + 1];
+    *--end = DIGITS[r * 2];
+  }
+  uint32_t w = (uint32_t)v;
+  while (w >= 100) {
+    uint32_t r = w % 100;
+    w /= 100;
+    *--end = DIGITS[r * 2 + 1];
+    *--end = DIGITS[r * 2];
+  }
+  if (w >= 10) {
+    *--end = DIGITS[w * 2 + 1];
+    *--end = DIGITS[w * 2];
+  } else {
+    *--end = '0' + w;
+  }
+  return end;
+}
+
+static void line_put(influx_line_t *line, const char *data, size_t len) {
+  // keep one byte for the terminating NUL
+  if (line->overflow || len >= line->size - line->len) {
+    line->overflow = true;
+    return;
+  }
+  memcpy(line->buf + line->len, data, len);
+  line->len += len;
+}
+
+static void line_put_int(influx_line_t *line, int64_t value) {
+  char digits[21];
+  char *end = digits + sizeof(digits);
+  uint64_t abs = value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value;
+  char *start = u64_to_dec(end, abs);
+  if (value < 0) {
+    *--start = '-';
+  }
+  line_put(line, start, end - start);
+}
+
+static void line_put_key(influx_line_t *line, const char *key) {
+  line_put(line, line->fields ? "," : " ", 1);
+  line_put(line, key, strlen(key));
+  line_put(line, "=", 1);
+  line->fields++;
+}
+
+/* Append src escaping every character found in special with a backslash. */
+static size_t escape(char *dst, size_t pos, size_t size, const char *src,
+                     const char *special) {
+  for (; *src && pos < size; src++) {
+    if (strchr(special, *src)) {
+      dst[pos++] = '\\';
+      if (pos == size) {
+        break;
+      }
+    }
+    dst[pos++] = *src;
+  }
+  return *src ? size : pos;
+}
+
+esp_err_t influx_series_init(influx_series_t *series, const char *measurement,
+                             const char *const *tags, size_t tag_count) {
+  const size_t size = sizeof(series->prefix);
+  size_t pos = escape(series->prefix, 0, size, measurement, ", ");
+  for (size_t i = 0; i < tag_count && pos < size; i++) {
+    series->prefix[pos++] = ',';
+    pos = escape(series->prefix, pos, size, tags[i * 2], ",= ");
+    if (pos < size) {
+      series->prefix[pos++] = '=';
+    }
+    pos = escape(series->prefix, pos, size, tags[i * 2 + 1], ",= ");
+  }
+  if (pos >= size) {
+    series->len = 0;
+    return ESP_ERR_INVALID_SIZE;
+  }
+  series->len = pos;
+  return ESP_OK;
+}
+
+void influx_line_begin(influx_line_t *line, char *buf, size_t size,
+                       const influx_series_t *series) {
+  line->buf = buf;
+  line->size = size;
+  line->len = 0;
+  line->fields = 0;
+  line->overflow = size == 0;
+  line_put(line, series->prefix, series->len);
+}
+
+void influx_line_add_fixed(influx_line_t *line, const char *key, int32_t value,
+                           uint8_t decimals) {
+  char digits[16];
+  char *end = digits + sizeof(digits);
+  uint32_t abs = value < 0 ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+  char *start;
+
+  if (decimals > 9) {
+    decimals = 9;
+  }
+  if (decimals == 0) {
+    start = u64_to_dec(end, abs);
+  } else {
+    uint32_t frac = abs % POW10[decimals];
+    // fractional digits including leading zeros, then the integer part
+    start = u64_to_dec(end, frac + POW10[decimals]) + 1;
+    *--start = '.';
+    start = u64_to_dec(start, abs / POW10[decimals]);
+  }
+  if (value < 0) {
+    *--start = '-';
+  }
+
+  line_put_key(line, key);
+  line_put(line, start, end - start);
+}
+
+void influx_line_add_int(influx_line_t *line, const char *key, int64_t value) {
+  line_put_key(line, key);
+  line_put_int(line, value);
+  line_put(line, "i", 1);
+}
+
+int influx_line_finish(influx_line_t *line, int64_t timestamp) {
+  if (timestamp) {
+    line_put(line, " ", 1);
+    line_put_int(line, timestamp);
+  }
+  if (line->overflow || !line->fields) {
+    if (line->size) {
+      line->buf[0] = '\0';
+    }
+    return -1;
+  }
+  line->buf[line->len] = '\0';
+  return line->len;
+}
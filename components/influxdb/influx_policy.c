@@ -0,0 +1,89 @@
+#include "influx_policy.h"
+
+#include <string.h>
+
+#include "esp_system.h"
+
+// weight of a new sample in the moving averages, as a shift
+#define LATENCY_SHIFT 2
+#define ERROR_SHIFT 3
+// thresholds only grow while fewer requests than this fail
+#define GOOD_ERROR_PERMILLE 100
+// batches grow by 1/8 per good request and halve on a bad one
+#define GROW_SHIFT 3
+// stop doubling the backoff long before it could overflow
+#define MAX_BACKOFF_DOUBLINGS 16
+
+void influx_policy_init(influx_policy_t *policy,
+                        const influx_policy_config_t *config) {
+  memset(policy, 0, sizeof(influx_policy_t));
+  policy->config = *config;
+  policy->metrics.batch_bytes = config->max_batch_bytes;
+  policy->metrics.age_ms = config->max_age_ms;
+}
+
+static uint32_t average(uint32_t avg, uint32_t sample, int shift) {
+  int64_t delta = (int64_t)sample - avg;
+  return avg + delta / (1 << shift);
+}
+
+static void grow(influx_policy_t *policy) {
+  influx_policy_metrics_t *m = &policy->metrics;
+  size_t bytes = m->batch_bytes + (m->batch_bytes >> GROW_SHIFT) + 1;
+  uint32_t age = m->age_ms + (m->age_ms >> GROW_SHIFT) + 1;
+  m->batch_bytes = bytes < policy->config.max_batch_bytes
+                       ? bytes
+                       : policy->config.max_batch_bytes;
+  m->age_ms = age < policy->config.max_age_ms ? age : policy->config.max_age_ms;
+}
+
+static void shrink(influx_policy_t *policy) {
+  influx_policy_metrics_t *m = &policy->metrics;
+  m->batch_bytes = m->batch_bytes / 2 > policy->config.min_batch_bytes
+                       ? m->batch_bytes / 2
+                       : policy->config.min_batch_bytes;
+  m->age_ms = m->age_ms / 2 > policy->config.min_age_ms
+                  ? m->age_ms / 2
+                  : policy->config.min_age_ms;
+}
+
+void influx_policy_update(influx_policy_t *policy, bool ok,
+                          uint32_t latency_ms, int64_t now_us) {
+  influx_policy_metrics_t *m = &policy->metrics;
+
+  m->latency_ms = policy->measured
+                      ? average(m->latency_ms, latency_ms, LATENCY_SHIFT)
+                      : latency_ms;
+  policy->measured = true;
+  m->error_permille = average(m->error_permille, ok ? 0 : 1000, ERROR_SHIFT);
+
+  if (ok) {
+    m->failures = 0;
+    m->backoff_ms = 0;
+    policy->retry_at_us = 0;
+    if (m->latency_ms > policy->config.target_latency_ms) {
+      shrink(policy);
+    } else if (m->error_permille < GOOD_ERROR_PERMILLE) {
+      grow(policy);
+    }
+    return;
+  }
+
+  shrink(policy);
+  m->failures++;
+  // exponential, with half of it random so that devices that lost the
+  // server together do not come back together
+  uint32_t doublings = m->failures - 1 < MAX_BACKOFF_DOUBLINGS
+                           ? m->failures - 1
+                           : MAX_BACKOFF_DOUBLINGS;
+  uint64_t base = (uint64_t)policy->config.min_backoff_ms << doublings;
+  if (base > policy->config.max_backoff_ms) {
+    base = policy->config.max_backoff_ms;
+  }
+  m->backoff_ms = base / 2 + esp_random() % (base / 2 + 1);
+  policy->retry_at_us = now_us + m->backoff_ms * 1000LL;
+}
+
+bool influx_policy_ready(const influx_policy_t *policy, int64_t now_us) {
+  return now_us >= policy->retry_at_us;
+}
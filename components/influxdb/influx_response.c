@@ -0,0 +1,289 @@
+#include "influx_response.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+enum {
+  STATE_TOKEN,
+  STATE_STRING,
+  STATE_ESCAPE,
+  STATE_UNICODE,
+  STATE_NUMBER,
+};
+
+enum {
+  FIELD_NONE,
+  FIELD_CODE,
+  FIELD_MESSAGE,
+  FIELD_LINE,
+};
+
+// key_len of a key too long to be one we look for
+#define KEY_OVERFLOW 0xff
+
+void influx_response_init(influx_response_t *resp) {
+  memset(resp, 0, sizeof(influx_response_t));
+}
+
+static uint8_t match_key(const influx_response_t *resp) {
+  if (resp->key_len == KEY_OVERFLOW) {
+    return FIELD_NONE;
+  }
+  if (!strcmp(resp->key, "code")) {
+    return FIELD_CODE;
+  }
+  if (!strcmp(resp->key, "message") || !strcmp(resp->key, "error")) {
+    return FIELD_MESSAGE;
+  }
+  if (!strcmp(resp->key, "line")) {
+    return FIELD_LINE;
+  }
+  return FIELD_NONE;
+}
+
+// buffer the current string value goes to, NULL if it is skipped
+static char *field_value(influx_response_t *resp, size_t *size) {
+  if (resp->field == FIELD_CODE) {
+    *size = sizeof(resp->code);
+    return resp->code;
+  }
+  if (resp->field == FIELD_MESSAGE) {
+    *size = sizeof(resp->message);
+    return resp->message;
+  }
+  return NULL;
+}
+
+// append one decoded character of the current string
+static void put(influx_response_t *resp, char c) {
+  if (resp->in_key) {
+    if (resp->key_len < sizeof(resp->key) - 1) {
+      resp->key[resp->key_len++] = c;
+      resp->key[resp->key_len] = '\0';
+    } else {
+      resp->key_len = KEY_OVERFLOW;
+    }
+    return;
+  }
+
+  size_t size;
+  char *out = field_value(resp, &size);
+  if (out && resp->value_len < size - 1) {
+    out[resp->value_len++] = c;
+    out[resp->value_len] = '\0';
+  }
+}
+
+static void begin_string(influx_response_t *resp) {
+  resp->state = STATE_STRING;
+  resp->in_key = resp->depth == 1 && resp->want_key;
+  if (resp->in_key) {
+    resp->key_len = 0;
+    resp->key[0] = '\0';
+  } else if (resp->depth != 1) {
+    // strings in nested values are skipped
+    resp->field = FIELD_NONE;
+  } else {
+    size_t size;
+    char *out = field_value(resp, &size);
+    if (out) {
+      out[0] = '\0';
+    }
+    resp->value_len = 0;
+  }
+}
+
+static void end_string(influx_response_t *resp) {
+  resp->state = STATE_TOKEN;
+  if (resp->in_key) {
+    resp->field = match_key(resp);
+    resp->want_key = false;
+  }
+  resp->in_key = false;
+}
+
+static void string(influx_response_t *resp, char c) {
+  if (c == '\\') {
+    resp->state = STATE_ESCAPE;
+  } else if (c == '"') {
+    end_string(resp);
+  } else {
+    put(resp, c);
+  }
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c |= 0x20;
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+static void token(influx_response_t *resp, char c) {
+  switch (c) {
+    case '{':
+    case '[':
+      if (resp->depth < UINT8_MAX) {
+        resp->depth++;
+      }
+      resp->want_key = resp->depth == 1 && c == '{';
+      break;
+    case '}':
+    case ']':
+      if (resp->depth) {
+        resp->depth--;
+      }
+      break;
+    case ',':
+      if (resp->depth == 1) {
+        resp->want_key = true;
+        resp->field = FIELD_NONE;
+      }
+      break;
+    case ':':
+      resp->want_key = false;
+      break;
+    case '"':
+      begin_string(resp);
+      break;
+    default:
+      if (c >= '0' && c <= '9' && resp->depth == 1 &&
+          resp->field == FIELD_LINE) {
+        resp->state = STATE_NUMBER;
+        resp->line = c - '0';
+      }
+      break;
+  }
+}
+
+void influx_response_feed(influx_response_t *resp, const char *data,
+                          size_t len) {
+  resp->length += len;
+
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (resp->state) {
+      case STATE_TOKEN:
+        token(resp, c);
+        break;
+
+      case STATE_STRING:
+        string(resp, c);
+        break;
+
+      case STATE_ESCAPE:
+        resp->state = STATE_STRING;
+        switch (c) {
+          case 'n':
+            put(resp, '\n');
+            break;
+          case 't':
+            put(resp, '\t');
+            break;
+          case 'r':
+            put(resp, '\r');
+            break;
+          case 'b':
+            put(resp, '\b');
+            break;
+          case 'f':
+            put(resp, '\f');
+            break;
+          case 'u':
+            resp->state = STATE_UNICODE;
+            resp->unicode = 0;
+            resp->unicode_left = 4;
+            break;
+          default:
+            // \" \\ \/ and anything malformed stand for themselves
+            put(resp, c);
+            break;
+        }
+        break;
+
+      case STATE_UNICODE: {
+        int v = hex_value(c);
+        if (v < 0) {
+          // not an escape after all, keep parsing the string
+          resp->state = STATE_STRING;
+          put(resp, '?');
+          string(resp, c);
+          break;
+        }
+        resp->unicode = resp->unicode << 4 | v;
+        if (!--resp->unicode_left) {
+          // messages are logged as ASCII
+          put(resp, resp->unicode < 0x80 ? (char)resp->unicode : '?');
+          resp->state = STATE_STRING;
+        }
+        break;
+      }
+
+      case STATE_NUMBER:
+        if (c >= '0' && c <= '9') {
+          resp->line = resp->line < (UINT32_MAX - 9) / 10
+                           ? resp->line * 10 + (c - '0')
+                           : UINT32_MAX;
+        } else {
+          resp->state = STATE_TOKEN;
+          token(resp, c);
+        }
+        break;
+    }
+  }
+}
+
+#define UNABLE_TO_PARSE "unable to parse '"
+#define PARTIAL_WRITE "partial write"
+
+static char body_at(const influx_body_t *body, size_t i) {
+  return i < body->len[0] ? body->data[0][i] : body->data[1][i - body->len[0]];
+}
+
+uint32_t influx_response_error_line(const influx_response_t *resp,
+                                    const influx_body_t *body) {
+  if (resp->line) {
+    return resp->line;
+  }
+
+  const char *quoted = strstr(resp->message, UNABLE_TO_PARSE);
+  if (!quoted) {
+    return 0;
+  }
+  quoted += strlen(UNABLE_TO_PARSE);
+  // the line may contain quotes itself, a truncated message has no end
+  const char *end = strstr(quoted, "': ");
+  bool whole = end != NULL;
+  size_t quoted_len = whole ? (size_t)(end - quoted) : strlen(quoted);
+  if (!quoted_len) {
+    return 0;
+  }
+
+  size_t total = body->len[0] + body->len[1];
+  uint32_t line = 1;
+  size_t start = 0;
+  while (start < total) {
+    size_t len = 0;
+    bool match = true;
+    while (start + len < total && body_at(body, start + len) != '\n') {
+      if (len < quoted_len && body_at(body, start + len) != quoted[len]) {
+        match = false;
+      }
+      len++;
+    }
+    if (match && (whole ? len == quoted_len : len >= quoted_len)) {
+      return line;
+    }
+    start += len + 1;
+    line++;
+  }
+  return 0;
+}
+
+bool influx_response_partial(const influx_response_t *resp) {
+  return strstr(resp->message, PARTIAL_WRITE) != NULL;
+}
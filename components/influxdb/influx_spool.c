@@ -0,0 +1,432 @@
+#include "influx_spool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "influx_crc.h"
+
+static const char *TAG = "SPOOL";
+
+#define SEGMENT_MAGIC 0x4c4f5053  // "SPOL"
+#define RECORD_FREE 0xffff
+#define RECORD_PENDING 0xffff
+#define RECORD_DRAINED 0x0000
+
+/* Written right after a sector is erased. */
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;  // increases by one for every segment opened
+  uint32_t crc;  // of magic and seq
+  uint32_t reserved;
+} segment_header_t;
+
+/* Precedes every record, records are padded to 4 bytes. */
+typedef struct {
+  uint16_t len;    // payload bytes, RECORD_FREE past the last record
+  uint16_t state;  // RECORD_PENDING until drained
+  uint32_t crc;    // of the payload
+} record_header_t;
+
+#define SEGMENT_HDR sizeof(segment_header_t)
+#define RECORD_HDR sizeof(record_header_t)
+#define RECORD_SIZE(len) ((RECORD_HDR + (len) + 3) & ~(size_t)3)
+
+/* Position of a record: sector index and offset inside the sector. */
+typedef struct {
+  size_t sector;
+  size_t off;
+} spool_pos_t;
+
+struct influx_spool {
+  influx_spool_flash_t flash;
+  SemaphoreHandle_t lock;
+  size_t sectors;
+  size_t max_record;
+  spool_pos_t head;  // where the next record goes
+  uint32_t head_seq;
+  spool_pos_t tail;  // oldest pending record, == head when empty
+  spool_pos_t peek_end;
+  bool peeked;  // peek_end is valid
+  char *buf;
+  size_t batch_size;
+  influx_spool_stats_t stats;
+};
+
+static inline size_t pos_addr(influx_spool_handle_t spool, spool_pos_t pos) {
+  return pos.sector * spool->flash.sector_size + pos.off;
+}
+
+static inline bool pos_equal(spool_pos_t a, spool_pos_t b) {
+  return a.sector == b.sector && a.off == b.off;
+}
+
+/* Step to the first record of the following segment, stopping at head. */
+static void pos_next_segment(influx_spool_handle_t spool, spool_pos_t *pos) {
+  if (pos->sector == spool->head.sector) {
+    *pos = spool->head;
+    return;
+  }
+  pos->sector = (pos->sector + 1) % spool->sectors;
+  pos->off = SEGMENT_HDR;
+}
+
+/*
+ * Read the record header at pos. Returns false if the segment has no more
+ * records there: free space, a header that cannot be valid, or the end.
+ */
+static bool read_record(influx_spool_handle_t spool, spool_pos_t pos,
+                        record_header_t *rec) {
+  if (pos.off + RECORD_HDR > spool->flash.sector_size ||
+      spool->flash.read(spool->flash.ctx, pos_addr(spool, pos), rec,
+                        sizeof(*rec)) != ESP_OK) {
+    memset(rec, 0, sizeof(*rec));
+    return false;
+  }
+  return rec->len != RECORD_FREE && rec->len &&
+         pos.off + RECORD_HDR + rec->len <= spool->flash.sector_size;
+}
+
+static bool read_payload(influx_spool_handle_t spool, spool_pos_t pos,
+                         const record_header_t *rec, char *buf) {
+  return spool->flash.read(spool->flash.ctx, pos_addr(spool, pos) + RECORD_HDR,
+                           buf, rec->len) == ESP_OK &&
+         influx_crc32(0, buf, rec->len) == rec->crc;
+}
+
+static esp_err_t mark_drained(influx_spool_handle_t spool, spool_pos_t pos) {
+  uint16_t state = RECORD_DRAINED;
+  return spool->flash.write(spool->flash.ctx,
+                            pos_addr(spool, pos) + offsetof(record_header_t,
+                                                            state),
+                            &state, sizeof(state));
+}
+
+/* Move the tail forward to the next pending record. */
+static void tail_seek(influx_spool_handle_t spool) {
+  record_header_t rec;
+  while (!pos_equal(spool->tail, spool->head)) {
+    if (!read_record(spool, spool->tail, &rec)) {
+      pos_next_segment(spool, &spool->tail);
+    } else if (rec.state != RECORD_PENDING) {
+      spool->tail.off += RECORD_SIZE(rec.len);
+    } else {
+      return;
+    }
+  }
+}
+
+static esp_err_t segment_open(influx_spool_handle_t spool, size_t sector,
+                              uint32_t seq) {
+  segment_header_t hdr = {.magic = SEGMENT_MAGIC, .seq = seq,
+                          .reserved = 0xffffffff};
+  hdr.crc = influx_crc32(0, &hdr, offsetof(segment_header_t, crc));
+
+  size_t addr = sector * spool->flash.sector_size;
+  esp_err_t err =
+      spool->flash.erase(spool->flash.ctx, addr, spool->flash.sector_size);
+  spool->stats.erases++;
+  if (err == ESP_OK) {
+    err = spool->flash.write(spool->flash.ctx, addr, &hdr, sizeof(hdr));
+  }
+  return err;
+}
+
+static bool segment_valid(influx_spool_handle_t spool, size_t sector,
+                          uint32_t *seq) {
+  segment_header_t hdr;
+  if (spool->flash.read(spool->flash.ctx, sector * spool->flash.sector_size,
+                        &hdr, sizeof(hdr)) != ESP_OK ||
+      hdr.magic != SEGMENT_MAGIC ||
+      hdr.crc != influx_crc32(0, &hdr, offsetof(segment_header_t, crc))) {
+    return false;
+  }
+  *seq = hdr.seq;
+  return true;
+}
+
+/* Drop the oldest segment, the ring is full. */
+static void evict_oldest(influx_spool_handle_t spool) {
+  record_header_t rec;
+  spool_pos_t pos = spool->tail;
+  uint32_t evicted = 0;
+
+  while (read_record(spool, pos, &rec)) {
+    if (rec.state == RECORD_PENDING) {
+      evicted++;
+      spool->stats.pending -= rec.len;
+    }
+    pos.off += RECORD_SIZE(rec.len);
+  }
+  spool->stats.evicted += evicted;
+  spool->peeked = false;
+  ESP_LOGW(TAG, "spool full, evicted %u records", (unsigned)evicted);
+
+  pos_next_segment(spool, &spool->tail);
+  tail_seek(spool);
+}
+
+/* Rebuild head, tail and the pending count from the segment headers. */
+static esp_err_t recover(influx_spool_handle_t spool) {
+  uint32_t seq;
+  bool found = false;
+
+  for (size_t i = 0; i < spool->sectors; i++) {
+    if (segment_valid(spool, i, &seq) &&
+        (!found || (int32_t)(seq - spool->head_seq) > 0)) {
+      spool->head.sector = i;
+      spool->head_seq = seq;
+      found = true;
+    }
+  }
+  if (!found) {
+    spool->head.sector = 0;
+    spool->head.off = SEGMENT_HDR;
+    spool->head_seq = 1;
+    spool->tail = spool->head;
+    return segment_open(spool, 0, spool->head_seq);
+  }
+
+  // the live segments are the ones right before head with consecutive seqs
+  size_t oldest = spool->head.sector;
+  for (size_t n = 1; n < spool->sectors; n++) {
+    size_t sector = (spool->head.sector + spool->sectors - n) % spool->sectors;
+    if (!segment_valid(spool, sector, &seq) || seq != spool->head_seq - n) {
+      break;
+    }
+    oldest = sector;
+  }
+
+  // walk every record once, the head segment ends at the first free byte
+  record_header_t rec;
+  spool_pos_t pos = {.sector = oldest, .off = SEGMENT_HDR};
+  spool->head.off = spool->flash.sector_size;
+  while (true) {
+    if (!read_record(spool, pos, &rec)) {
+      if (pos.sector != spool->head.sector) {
+        pos.sector = (pos.sector + 1) % spool->sectors;
+        pos.off = SEGMENT_HDR;
+        continue;
+      }
+      if (rec.len == RECORD_FREE && rec.state == RECORD_PENDING &&
+          rec.crc == 0xffffffff) {
+        spool->head.off = pos.off;
+      }
+      // else a torn header: leave the segment sealed, appends start anew
+      break;
+    }
+    if (rec.state == RECORD_PENDING) {
+      if (rec.len <= spool->batch_size &&
+          read_payload(spool, pos, &rec, spool->buf)) {
+        spool->stats.pending += rec.len;
+      } else {
+        // cut short by a power loss, or damaged flash
+        spool->stats.corrupt++;
+        mark_drained(spool, pos);
+      }
+    }
+    pos.off += RECORD_SIZE(rec.len);
+  }
+
+  spool->tail.sector = oldest;
+  spool->tail.off = SEGMENT_HDR;
+  tail_seek(spool);
+  ESP_LOGI(TAG, "recovered %u pending bytes, %u corrupt records",
+           (unsigned)spool->stats.pending, (unsigned)spool->stats.corrupt);
+  return ESP_OK;
+}
+
+influx_spool_handle_t influx_spool_open(const influx_spool_flash_t *flash,
+                                        size_t batch_size) {
+  if (!flash || !flash->sector_size || flash->size % flash->sector_size ||
+      flash->size / flash->sector_size < 2 ||
+      flash->sector_size <= SEGMENT_HDR + RECORD_HDR || !batch_size) {
+    ESP_LOGE(TAG, "invalid spool geometry");
+    return NULL;
+  }
+
+  struct influx_spool *spool = calloc(1, sizeof(struct influx_spool));
+  if (!spool) {
+    return NULL;
+  }
+  spool->flash = *flash;
+  spool->sectors = flash->size / flash->sector_size;
+  spool->max_record = flash->sector_size - SEGMENT_HDR - RECORD_HDR;
+  if (spool->max_record > batch_size) {
+    spool->max_record = batch_size;
+  }
+  if (spool->max_record >= RECORD_FREE) {
+    spool->max_record = RECORD_FREE - 1;
+  }
+  spool->batch_size = batch_size;
+  spool->buf = malloc(batch_size);
+  spool->lock = xSemaphoreCreateMutex();
+  if (!spool->buf || !spool->lock) {
+    influx_spool_close(spool);
+    return NULL;
+  }
+
+  esp_err_t err = recover(spool);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "spool recovery failed: %s", esp_err_to_name(err));
+    influx_spool_close(spool);
+    return NULL;
+  }
+  return spool;
+}
+
+void influx_spool_close(influx_spool_handle_t spool) {
+  if (!spool) {
+    return;
+  }
+  if (spool->lock) {
+    vSemaphoreDelete(spool->lock);
+  }
+  free(spool->buf);
+  free(spool);
+}
+
+size_t influx_spool_max_record(influx_spool_handle_t spool) {
+  return spool->max_record;
+}
+
+esp_err_t influx_spool_append(influx_spool_handle_t spool,
+                              const influx_body_t *body) {
+  size_t len = body->len[0] + body->len[1];
+  if (len > spool->max_record) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!len) {
+    return ESP_OK;
+  }
+
+  xSemaphoreTake(spool->lock, portMAX_DELAY);
+  esp_err_t err = ESP_OK;
+  if (spool->head.off + RECORD_SIZE(len) > spool->flash.sector_size) {
+    size_t next = (spool->head.sector + 1) % spool->sectors;
+    if (spool->stats.pending && next == spool->tail.sector) {
+      evict_oldest(spool);
+    }
+    err = segment_open(spool, next, spool->head_seq + 1);
+    if (err == ESP_OK) {
+      bool empty = pos_equal(spool->tail, spool->head);
+      spool->head.sector = next;
+      spool->head.off = SEGMENT_HDR;
+      spool->head_seq++;
+      if (empty) {
+        spool->tail = spool->head;
+      }
+    }
+  }
+
+  if (err == ESP_OK) {
+    record_header_t rec = {.len = len, .state = RECORD_PENDING};
+    rec.crc = influx_crc32(0, body->data[0], body->len[0]);
+    rec.crc = influx_crc32(rec.crc, body->data[1], body->len[1]);
+
+    size_t addr = pos_addr(spool, spool->head);
+    err = spool->flash.write(spool->flash.ctx, addr, &rec, sizeof(rec));
+    for (int i = 0; err == ESP_OK && i < 2; i++) {
+      if (body->len[i]) {
+        err = spool->flash.write(spool->flash.ctx, addr + RECORD_HDR,
+                                 body->data[i], body->len[i]);
+        addr += body->len[i];
+      }
+    }
+    if (err == ESP_OK) {
+      spool->stats.appended++;
+      spool->stats.pending += len;
+    } else {
+      // keep the half written record from being counted when it is read
+      mark_drained(spool, spool->head);
+    }
+    // whatever happened, nothing else can be written behind this header
+    spool->head.off += RECORD_SIZE(len);
+  }
+  xSemaphoreGive(spool->lock);
+
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "spool append failed: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+esp_err_t influx_spool_peek(influx_spool_handle_t spool, influx_body_t *body) {
+  record_header_t rec;
+  size_t len = 0;
+
+  xSemaphoreTake(spool->lock, portMAX_DELAY);
+  spool_pos_t pos = spool->tail;
+  while (!pos_equal(pos, spool->head)) {
+    if (!read_record(spool, pos, &rec)) {
+      pos_next_segment(spool, &pos);
+      continue;
+    }
+    if (rec.state == RECORD_PENDING) {
+      if (len && len + rec.len > spool->batch_size) {
+        break;
+      }
+      // records larger than the batch were written with another batch size
+      if (rec.len > spool->batch_size ||
+          !read_payload(spool, pos, &rec, spool->buf + len)) {
+        spool->stats.corrupt++;
+        spool->stats.pending -= rec.len;
+        mark_drained(spool, pos);
+      } else {
+        len += rec.len;
+      }
+    }
+    pos.off += RECORD_SIZE(rec.len);
+  }
+  spool->peek_end = pos;
+  spool->peeked = true;
+  xSemaphoreGive(spool->lock);
+
+  if (!len) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  body->data[0] = spool->buf;
+  body->len[0] = len;
+  body->data[1] = NULL;
+  body->len[1] = 0;
+  return ESP_OK;
+}
+
+esp_err_t influx_spool_consume(influx_spool_handle_t spool) {
+  record_header_t rec;
+  esp_err_t err = ESP_OK;
+
+  xSemaphoreTake(spool->lock, portMAX_DELAY);
+  if (!spool->peeked) {
+    // the peeked records were evicted in the meantime
+    xSemaphoreGive(spool->lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  while (err == ESP_OK && !pos_equal(spool->tail, spool->peek_end)) {
+    if (!read_record(spool, spool->tail, &rec)) {
+      pos_next_segment(spool, &spool->tail);
+      continue;
+    }
+    if (rec.state == RECORD_PENDING) {
+      err = mark_drained(spool, spool->tail);
+      spool->stats.pending -= rec.len;
+      spool->stats.drained++;
+    }
+    spool->tail.off += RECORD_SIZE(rec.len);
+  }
+  spool->peeked = false;
+  tail_seek(spool);
+  xSemaphoreGive(spool->lock);
+  return err;
+}
+
+void influx_spool_get_stats(influx_spool_handle_t spool,
+                            influx_spool_stats_t *stats) {
+  xSemaphoreTake(spool->lock, portMAX_DELAY);
+  *stats = spool->stats;
+  xSemaphoreGive(spool->lock);
+}
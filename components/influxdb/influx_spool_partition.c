@@ -0,0 +1,33 @@
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "influx_spool.h"
+
+static esp_err_t partition_read(void *ctx, size_t addr, void *buf,
+                                size_t len) {
+  return esp_partition_read((const esp_partition_t *)ctx, addr, buf, len);
+}
+
+static esp_err_t partition_write(void *ctx, size_t addr, const void *buf,
+                                 size_t len) {
+  return esp_partition_write((const esp_partition_t *)ctx, addr, buf, len);
+}
+
+static esp_err_t partition_erase(void *ctx, size_t addr, size_t len) {
+  return esp_partition_erase_range((const esp_partition_t *)ctx, addr, len);
+}
+
+esp_err_t influx_spool_partition(const char *label,
+                                 influx_spool_flash_t *flash) {
+  const esp_partition_t *part = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!part) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  flash->read = partition_read;
+  flash->write = partition_write;
+  flash->erase = partition_erase;
+  flash->size = part->size - part->size % SPI_FLASH_SEC_SIZE;
+  flash->sector_size = SPI_FLASH_SEC_SIZE;
+  flash->ctx = (void *)part;
+  return ESP_OK;
+}
@@ -0,0 +1,175 @@
+#include "influx_udp.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+
+static const char *UDP_TAG = "UDP";
+
+struct influx_udp {
+  char *host;
+  uint16_t port;
+  size_t payload_size;
+  int sock;
+  struct sockaddr_in addr;
+  bool resolved;
+  SemaphoreHandle_t lock;  // protects the datagram and stats
+  char *datagram;
+  size_t datagram_len;
+  influx_udp_stats_t stats;
+};
+
+influx_udp_handle_t influx_udp_create(const influx_udp_config_t *config) {
+  if (!config || !config->host || !config->port || !config->payload_size) {
+    ESP_LOGE(UDP_TAG, "invalid UDP configuration");
+    return NULL;
+  }
+
+  struct influx_udp *udp = calloc(1, sizeof(struct influx_udp));
+  if (!udp) {
+    return NULL;
+  }
+  udp->port = config->port;
+  udp->payload_size = config->payload_size;
+  udp->host = strdup(config->host);
+  udp->datagram = malloc(config->payload_size);
+  udp->lock = xSemaphoreCreateMutex();
+  udp->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (!udp->host || !udp->datagram || !udp->lock || udp->sock < 0) {
+    ESP_LOGE(UDP_TAG, "failed to create UDP sender");
+    influx_udp_delete(udp);
+    return NULL;
+  }
+  return udp;
+}
+
+void influx_udp_delete(influx_udp_handle_t udp) {
+  if (!udp) {
+    return;
+  }
+  // calloc left sock at 0, which is a valid descriptor
+  if (udp->sock > 0) {
+    close(udp->sock);
+  }
+  if (udp->lock) {
+    vSemaphoreDelete(udp->lock);
+  }
+  free(udp->datagram);
+  free(udp->host);
+  free(udp);
+}
+
+void influx_udp_get_stats(influx_udp_handle_t udp, influx_udp_stats_t *stats) {
+  xSemaphoreTake(udp->lock, portMAX_DELAY);
+  *stats = udp->stats;
+  xSemaphoreGive(udp->lock);
+}
+
+static bool resolve(influx_udp_handle_t udp) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM};
+  struct addrinfo *res = NULL;
+
+  int err = getaddrinfo(udp->host, NULL, &hints, &res);
+  if (err || !res) {
+    ESP_LOGW(UDP_TAG, "DNS lookup of %s failed: %d", udp->host, err);
+    return false;
+  }
+  memcpy(&udp->addr, res->ai_addr, sizeof(struct sockaddr_in));
+  udp->addr.sin_port = htons(udp->port);
+  freeaddrinfo(res);
+  udp->resolved = true;
+  return true;
+}
+
+static void send_datagram(influx_udp_handle_t udp) {
+  if (!udp->datagram_len) {
+    return;
+  }
+  int sent = sendto(udp->sock, udp->datagram, udp->datagram_len, 0,
+                    (struct sockaddr *)&udp->addr, sizeof(udp->addr));
+  if (sent < 0) {
+    // usually the stack is out of buffers, but the host may have moved or
+    // the network changed, so it is looked up again before the next batch;
+    // the datagram is lost either way
+    ESP_LOGD(UDP_TAG, "sendto failed: errno %d", errno);
+    udp->stats.errors++;
+    udp->resolved = false;
+  } else {
+    udp->stats.datagrams++;
+    udp->stats.bytes += sent;
+  }
+  udp->datagram_len = 0;
+}
+
+// offset of the first newline at or after off, the body length if none
+static size_t body_eol(const influx_body_t *body, size_t off) {
+  size_t base = 0;
+  for (int i = 0; i < 2; i++) {
+    if (off < base + body->len[i]) {
+      const char *eol = memchr(body->data[i] + (off - base), '\n',
+                               body->len[i] - (off - base));
+      if (eol) {
+        return base + (eol - body->data[i]);
+      }
+      off = base + body->len[i];
+    }
+    base += body->len[i];
+  }
+  return base;
+}
+
+// copy body bytes [off, off + len) to dst
+static void body_copy(const influx_body_t *body, size_t off, size_t len,
+                      char *dst) {
+  for (int i = 0; i < 2 && len; i++) {
+    if (off >= body->len[i]) {
+      off -= body->len[i];
+      continue;
+    }
+    size_t take = body->len[i] - off < len ? body->len[i] - off : len;
+    memcpy(dst, body->data[i] + off, take);
+    dst += take;
+    len -= take;
+    off = 0;
+  }
+}
+
+esp_err_t influx_udp_transport(void *ctx, const influx_body_t *body,
+                               influx_result_t *result) {
+  influx_udp_handle_t udp = (influx_udp_handle_t)ctx;
+  size_t total = body->len[0] + body->len[1];
+
+  xSemaphoreTake(udp->lock, portMAX_DELAY);
+  if (!udp->resolved && !resolve(udp)) {
+    udp->stats.errors++;
+    xSemaphoreGive(udp->lock);
+    // keep the batch until the network is up
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  for (size_t off = 0; off < total;) {
+    size_t eol = body_eol(body, off);
+    size_t len = (eol < total ? eol + 1 : total) - off;
+    if (len > udp->payload_size) {
+      udp->stats.oversized++;
+    } else {
+      if (udp->datagram_len + len > udp->payload_size) {
+        send_datagram(udp);
+      }
+      body_copy(body, off, len, udp->datagram + udp->datagram_len);
+      udp->datagram_len += len;
+    }
+    off += len;
+  }
+  send_datagram(udp);
+  xSemaphoreGive(udp->lock);
+
+  result->status_code = 204;
+  return ESP_OK;
+}
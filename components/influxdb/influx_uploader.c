@@ -0,0 +1,178 @@
+#include "influx_uploader.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "INFLUX";
+
+// the lock is only held to copy a record, a sampling task that can't get it
+// within this long drops its record rather than wait
+#define ENQUEUE_WAIT_MS 10
+
+struct influx_uploader {
+  influx_uploader_config_t config;
+  SemaphoreHandle_t lock;   // protects the queue and stats, only held to copy
+  SemaphoreHandle_t ready;  // given whenever a record is queued
+  SemaphoreHandle_t done;   // given by the task once it has stopped
+  bool running;
+  volatile bool stop;
+  char *slots;  // queue_len slots of record_max bytes
+  size_t head;  // slot of the oldest queued record
+  size_t count;
+  char *line;  // the record being handed to the writer
+  influx_uploader_stats_t stats;
+  uint32_t busy;  // records dropped without the lock, updated atomically
+};
+
+static char *slot(influx_uploader_handle_t uploader, size_t i) {
+  return uploader->slots +
+         (i % uploader->config.queue_len) * uploader->config.record_max;
+}
+
+// copy the oldest record to uploader->line, false if the queue is empty
+static bool dequeue(influx_uploader_handle_t uploader) {
+  xSemaphoreTake(uploader->lock, portMAX_DELAY);
+  bool found = uploader->count > 0;
+  if (found) {
+    strcpy(uploader->line, slot(uploader, uploader->head));
+    uploader->head = (uploader->head + 1) % uploader->config.queue_len;
+    uploader->count--;
+  }
+  xSemaphoreGive(uploader->lock);
+  return found;
+}
+
+static void upload_task(void *arg) {
+  influx_uploader_handle_t uploader = (influx_uploader_handle_t)arg;
+  TickType_t poll = uploader->config.poll_ms / portTICK_PERIOD_MS;
+
+  while (true) {
+    xSemaphoreTake(uploader->ready, poll ? poll : 1);
+    bool stop = uploader->stop;
+    while (dequeue(uploader)) {
+      influx_writer_write(uploader->config.writer, uploader->line);
+      xSemaphoreTake(uploader->lock, portMAX_DELAY);
+      uploader->stats.written++;
+      xSemaphoreGive(uploader->lock);
+    }
+    if (stop) {
+      break;
+    }
+    influx_writer_poll(uploader->config.writer);
+  }
+
+  xSemaphoreGive(uploader->done);
+  vTaskDelete(NULL);
+}
+
+influx_uploader_handle_t influx_uploader_create(
+    const influx_uploader_config_t *config) {
+  if (!config || !config->writer || !config->queue_len ||
+      config->record_max < 2) {
+    ESP_LOGE(TAG, "invalid uploader configuration");
+    return NULL;
+  }
+
+  struct influx_uploader *uploader = calloc(1, sizeof(struct influx_uploader));
+  if (!uploader) {
+    return NULL;
+  }
+  uploader->config = *config;
+  uploader->slots = malloc(config->queue_len * config->record_max);
+  uploader->line = malloc(config->record_max);
+  uploader->lock = xSemaphoreCreateMutex();
+  uploader->ready = xSemaphoreCreateBinary();
+  uploader->done = xSemaphoreCreateBinary();
+  if (!uploader->slots || !uploader->line || !uploader->lock ||
+      !uploader->ready || !uploader->done) {
+    ESP_LOGE(TAG, "failed to allocate uploader");
+    influx_uploader_delete(uploader);
+    return NULL;
+  }
+  if (xTaskCreate(upload_task, "influx_upload", config->task_stack_size,
+                  uploader, config->task_priority, NULL) != pdPASS) {
+    ESP_LOGE(TAG, "failed to start upload task");
+    influx_uploader_delete(uploader);
+    return NULL;
+  }
+  uploader->running = true;
+  return uploader;
+}
+
+void influx_uploader_delete(influx_uploader_handle_t uploader) {
+  if (!uploader) {
+    return;
+  }
+  if (uploader->running) {
+    // the task drains the queue once more on its way out
+    uploader->stop = true;
+    xSemaphoreGive(uploader->ready);
+    xSemaphoreTake(uploader->done, portMAX_DELAY);
+  }
+  if (uploader->done) {
+    vSemaphoreDelete(uploader->done);
+  }
+  if (uploader->ready) {
+    vSemaphoreDelete(uploader->ready);
+  }
+  if (uploader->lock) {
+    vSemaphoreDelete(uploader->lock);
+  }
+  free(uploader->line);
+  free(uploader->slots);
+  free(uploader);
+}
+
+esp_err_t influx_uploader_enqueue(influx_uploader_handle_t uploader,
+                                  const char *line) {
+  size_t len = strlen(line);
+  if (len + 1 > uploader->config.record_max) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  esp_err_t err = ESP_OK;
+  if (xSemaphoreTake(uploader->lock,
+                     ENQUEUE_WAIT_MS / portTICK_PERIOD_MS + 1) != pdTRUE) {
+    // the stats are behind the lock, this one is added when they are read
+    __atomic_fetch_add(&uploader->busy, 1, __ATOMIC_RELAXED);
+    return ESP_ERR_TIMEOUT;
+  }
+  if (uploader->count == uploader->config.queue_len) {
+    if (uploader->config.drop_policy == INFLUX_DROP_NEWEST) {
+      uploader->stats.dropped_newest++;
+      err = ESP_ERR_NO_MEM;
+    } else {
+      uploader->head = (uploader->head + 1) % uploader->config.queue_len;
+      uploader->count--;
+      uploader->stats.dropped_oldest++;
+    }
+  }
+  if (err == ESP_OK) {
+    memcpy(slot(uploader, uploader->head + uploader->count), line, len + 1);
+    uploader->count++;
+    uploader->stats.enqueued++;
+    if (uploader->count > uploader->stats.high_water) {
+      uploader->stats.high_water = uploader->count;
+    }
+  }
+  xSemaphoreGive(uploader->lock);
+
+  if (err == ESP_OK) {
+    xSemaphoreGive(uploader->ready);
+  }
+  return err;
+}
+
+void influx_uploader_get_stats(influx_uploader_handle_t uploader,
+                               influx_uploader_stats_t *stats) {
+  xSemaphoreTake(uploader->lock, portMAX_DELAY);
+  *stats = uploader->stats;
+  xSemaphoreGive(uploader->lock);
+  stats->dropped_busy = __atomic_load_n(&uploader->busy, __ATOMIC_RELAXED);
+}
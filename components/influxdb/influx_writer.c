@@ -0,0 +1,514 @@
+#include "influx_writer.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "influx_http.h"
+#include "influx_spool.h"
+
+static const char *TAG = "INFLUX";
+
+// lines cut from one batch before the rest of it is given up on
+#define MAX_QUARANTINE 8
+// longest Retry-After that is honoured
+#define MAX_RETRY_AFTER_S 3600
+
+struct influx_writer {
+  influx_writer_config_t config;
+  SemaphoreHandle_t lock;        // protects the ring indices and stats
+  SemaphoreHandle_t flush_lock;  // only one batch is in flight at a time
+  char *buf;
+  size_t tail;        // offset of the oldest pending byte
+  size_t used;        // pending bytes, starting at tail
+  int64_t oldest_us;  // time the oldest pending record was queued
+  int64_t retry_at_us;  // no requests before this time, set by Retry-After
+  bool adaptive;           // thresholds come from policy
+  influx_policy_t policy;  // protected by lock
+  influx_writer_stats_t stats;
+};
+
+influx_writer_handle_t influx_writer_create(
+    const influx_writer_config_t *config) {
+  if (!config || !config->buffer_size ||
+      config->batch_max_bytes > config->buffer_size ||
+      (config->policy &&
+       (config->policy->max_batch_bytes > config->buffer_size ||
+        config->policy->min_batch_bytes > config->policy->max_batch_bytes ||
+        config->policy->min_age_ms > config->policy->max_age_ms))) {
+    ESP_LOGE(TAG, "invalid writer configuration");
+    return NULL;
+  }
+
+  struct influx_writer *writer = calloc(1, sizeof(struct influx_writer));
+  if (!writer) {
+    return NULL;
+  }
+  writer->config = *config;
+  if (!writer->config.transport) {
+    writer->config.transport = influx_http_transport;
+  }
+  if (config->policy) {
+    writer->adaptive = true;
+    influx_policy_init(&writer->policy, config->policy);
+    writer->config.policy = NULL;
+  }
+  writer->buf = malloc(config->buffer_size);
+  writer->lock = xSemaphoreCreateMutex();
+  writer->flush_lock = xSemaphoreCreateMutex();
+  if (!writer->buf || !writer->lock || !writer->flush_lock) {
+    ESP_LOGE(TAG, "failed to allocate writer");
+    influx_writer_delete(writer);
+    return NULL;
+  }
+  return writer;
+}
+
+void influx_writer_delete(influx_writer_handle_t writer) {
+  if (!writer) {
+    return;
+  }
+  if (writer->lock) {
+    vSemaphoreDelete(writer->lock);
+  }
+  if (writer->flush_lock) {
+    vSemaphoreDelete(writer->flush_lock);
+  }
+  free(writer->buf);
+  free(writer);
+}
+
+// copy into the ring at off, wrapping around the end of the buffer
+static void ring_put(influx_writer_handle_t writer, size_t off,
+                     const char *data, size_t len) {
+  size_t first = writer->config.buffer_size - off;
+  if (first > len) {
+    first = len;
+  }
+  memcpy(writer->buf + off, data, first);
+  memcpy(writer->buf, data + first, len - first);
+}
+
+// must be called with the lock held
+static bool batch_due(influx_writer_handle_t writer, int64_t now) {
+  if (!writer->used) {
+    return false;
+  }
+  size_t max_bytes = writer->adaptive ? writer->policy.metrics.batch_bytes
+                                      : writer->config.batch_max_bytes;
+  uint32_t max_age_ms = writer->adaptive ? writer->policy.metrics.age_ms
+                                         : writer->config.batch_max_age_ms;
+  return writer->used >= max_bytes ||
+         now - writer->oldest_us >= (int64_t)max_age_ms * 1000;
+}
+
+esp_err_t influx_writer_write(influx_writer_handle_t writer, const char *line) {
+  size_t len = strlen(line);
+  size_t size = writer->config.buffer_size;
+  if (len + 1 > size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  if (writer->used + len + 1 > size) {
+    // the buffer only fills up while uploads fail, try to make room once
+    xSemaphoreGive(writer->lock);
+    influx_writer_flush(writer);
+    xSemaphoreTake(writer->lock, portMAX_DELAY);
+    if (writer->used + len + 1 > size) {
+      writer->stats.dropped++;
+      xSemaphoreGive(writer->lock);
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  int64_t now = esp_timer_get_time();
+  if (!writer->used) {
+    writer->oldest_us = now;
+  }
+  size_t head = (writer->tail + writer->used) % size;
+  ring_put(writer, head, line, len);
+  ring_put(writer, (head + len) % size, "\n", 1);
+  writer->used += len + 1;
+  writer->stats.records++;
+  bool due = batch_due(writer, now);
+  xSemaphoreGive(writer->lock);
+
+  if (due) {
+    // a failed batch stays buffered and is retried on the next trigger
+    influx_writer_flush(writer);
+  }
+  return ESP_OK;
+}
+
+esp_err_t influx_writer_poll(influx_writer_handle_t writer) {
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  bool due = batch_due(writer, esp_timer_get_time());
+  xSemaphoreGive(writer->lock);
+
+  return due ? influx_writer_flush(writer) : ESP_OK;
+}
+
+/* Feed the outcome of a request to the policy. */
+static void measure(influx_writer_handle_t writer, int64_t started,
+                    esp_err_t err) {
+  if (!writer->adaptive) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  // a rejected batch still means the server is reachable and answering
+  bool ok = err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE;
+
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  influx_policy_update(&writer->policy, ok, (now - started) / 1000, now);
+  uint32_t backoff_ms = writer->policy.metrics.backoff_ms;
+  uint32_t failures = writer->policy.metrics.failures;
+  xSemaphoreGive(writer->lock);
+
+  if (!ok) {
+    ESP_LOGW(TAG, "backing off for %u ms after %u failed requests",
+             (unsigned)backoff_ms, (unsigned)failures);
+  }
+}
+
+/* Send one batch and classify the response. */
+static esp_err_t classify(influx_writer_handle_t writer,
+                          const influx_body_t *body, influx_result_t *result) {
+  esp_err_t err =
+      writer->config.transport(writer->config.transport_ctx, body, result);
+  if (err != ESP_OK) {
+    return err;
+  }
+  int status_code = result->status_code;
+  if (status_code >= 200 && status_code <= 299) {
+    return ESP_OK;
+  }
+  if ((status_code == 429 || status_code == 503) && result->retry_after_s) {
+    uint32_t seconds = result->retry_after_s < MAX_RETRY_AFTER_S
+                           ? result->retry_after_s
+                           : MAX_RETRY_AFTER_S;
+    ESP_LOGW(TAG, "server asked to retry in %u s", (unsigned)seconds);
+    writer->retry_at_us = esp_timer_get_time() + seconds * 1000000LL;
+  }
+  // a client error will never succeed on retry, so the batch is dropped
+  // instead of blocking the buffer forever
+  if (status_code >= 400 && status_code < 500 && status_code != 429) {
+    if (result->partial && !result->error_line) {
+      ESP_LOGW(TAG, "server dropped part of a batch with status %d",
+               status_code);
+      return ESP_OK;
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  return ESP_FAIL;
+}
+
+/* Send one batch and tell the policy how it went. */
+static esp_err_t send_batch(influx_writer_handle_t writer,
+                            const influx_body_t *body,
+                            influx_result_t *result) {
+  memset(result, 0, sizeof(influx_result_t));
+  int64_t started = esp_timer_get_time();
+  esp_err_t err = classify(writer, body, result);
+  measure(writer, started, err);
+  return err;
+}
+
+static char body_at(const influx_body_t *body, size_t i) {
+  return i < body->len[0] ? body->data[0][i] : body->data[1][i - body->len[0]];
+}
+
+/* Find the 1-based line of body, including its newline. */
+static bool find_line(const influx_body_t *body, uint32_t line, size_t *off,
+                      size_t *len) {
+  size_t total = body->len[0] + body->len[1];
+  size_t start = 0;
+
+  for (uint32_t i = 1; line && start < total; i++) {
+    size_t end = start;
+    while (end < total && body_at(body, end++) != '\n') {
+    }
+    if (i == line) {
+      *off = start;
+      *len = end - start;
+      return true;
+    }
+    start = end;
+  }
+  return false;
+}
+
+/* Log and count a line the server will never take. */
+static void quarantine(influx_writer_handle_t writer, const influx_body_t *body,
+                       size_t off, size_t len, int status_code) {
+  // enough of the line to recognize it
+  char text[96];
+  size_t n = 0;
+  while (n < len && n < sizeof(text) - 1 && body_at(body, off + n) != '\n') {
+    text[n] = body_at(body, off + n);
+    n++;
+  }
+  text[n] = '\0';
+  ESP_LOGE(TAG, "line rejected with status %d, dropping it: %s", status_code,
+           text);
+
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  writer->stats.quarantined++;
+  xSemaphoreGive(writer->lock);
+}
+
+/* Bytes [off, off + len) of body as a body of its own. */
+static influx_body_t body_slice(const influx_body_t *body, size_t off,
+                                size_t len) {
+  influx_body_t slice = {.data = {NULL, NULL}, .len = {0, 0}};
+  int n = 0;
+  for (int i = 0; i < 2 && len; i++) {
+    if (off >= body->len[i]) {
+      off -= body->len[i];
+      continue;
+    }
+    size_t take = body->len[i] - off < len ? body->len[i] - off : len;
+    slice.data[n] = body->data[i] + off;
+    slice.len[n++] = take;
+    len -= take;
+    off = 0;
+  }
+  return slice;
+}
+
+/*
+ * Send body. If the server names a line it cannot take, that line is
+ * dropped, the lines in front of it go out on their own and the rest is
+ * tried again. *done is set to how many leading bytes of body are finished
+ * with, whether sent or dropped.
+ */
+static esp_err_t send_lines(influx_writer_handle_t writer,
+                            const influx_body_t *body, influx_result_t *result,
+                            size_t *done) {
+  size_t total = body->len[0] + body->len[1];
+  *done = 0;
+
+  for (int cuts = 0;; cuts++) {
+    influx_body_t rest = body_slice(body, *done, total - *done);
+    esp_err_t err = send_batch(writer, &rest, result);
+    size_t off, len;
+    if (err != ESP_ERR_INVALID_RESPONSE || cuts == MAX_QUARANTINE ||
+        !find_line(&rest, result->error_line, &off, &len)) {
+      if (err == ESP_OK || err == ESP_ERR_INVALID_RESPONSE) {
+        *done = total;
+      }
+      return err;
+    }
+    quarantine(writer, &rest, off, len, result->status_code);
+    if (result->partial) {
+      // the server already stored the other lines
+      *done = total;
+      return ESP_OK;
+    }
+
+    // the server stops at the first bad line, everything before it is good
+    if (off) {
+      influx_body_t good = body_slice(&rest, 0, off);
+      err = send_batch(writer, &good, result);
+      if (err != ESP_OK) {
+        if (err == ESP_ERR_INVALID_RESPONSE) {
+          *done = total;
+        }
+        return err;
+      }
+    }
+    *done += off + len;
+    if (*done == total) {
+      return ESP_OK;
+    }
+  }
+}
+
+/* Upload what the spool kept from an outage, oldest first. */
+static esp_err_t spool_drain(influx_writer_handle_t writer) {
+  influx_spool_handle_t spool = writer->config.spool;
+  influx_body_t body;
+  influx_result_t result;
+  size_t done;
+  esp_err_t err;
+
+  while ((err = influx_spool_peek(spool, &body)) == ESP_OK) {
+    err = send_lines(writer, &body, &result, &done);
+    xSemaphoreTake(writer->lock, portMAX_DELAY);
+    if (err == ESP_OK) {
+      writer->stats.requests++;
+      writer->stats.bytes += body.len[0];
+    } else if (err == ESP_ERR_INVALID_RESPONSE) {
+      writer->stats.rejected++;
+    } else {
+      writer->stats.failed++;
+    }
+    xSemaphoreGive(writer->lock);
+
+    if (err != ESP_OK && err != ESP_ERR_INVALID_RESPONSE) {
+      return err;
+    }
+    if (err == ESP_ERR_INVALID_RESPONSE) {
+      ESP_LOGE(TAG, "spooled batch of %u bytes rejected with status %d",
+               (unsigned)body.len[0], result.status_code);
+    }
+    influx_spool_consume(spool);
+  }
+  return err == ESP_ERR_NOT_FOUND ? ESP_OK : err;
+}
+
+/*
+ * Move len bytes at tail to the spool in chunks that end on a record
+ * boundary. Returns how many bytes made it.
+ */
+static size_t spool_spill(influx_writer_handle_t writer, size_t tail,
+                          size_t len) {
+  influx_spool_handle_t spool = writer->config.spool;
+  size_t size = writer->config.buffer_size;
+  size_t max = influx_spool_max_record(spool);
+  size_t spilled = 0;
+
+  while (spilled < len) {
+    size_t chunk = len - spilled;
+    if (chunk > max) {
+      chunk = max;
+      while (chunk && writer->buf[(tail + chunk - 1) % size] != '\n') {
+        chunk--;
+      }
+      if (!chunk) {
+        chunk = max;
+      }
+    }
+    size_t first = size - tail;
+    if (first > chunk) {
+      first = chunk;
+    }
+    influx_body_t body = {
+        .data = {writer->buf + tail, writer->buf},
+        .len = {first, chunk - first},
+    };
+    if (influx_spool_append(spool, &body) != ESP_OK) {
+      break;
+    }
+    tail = (tail + chunk) % size;
+    spilled += chunk;
+  }
+  return spilled;
+}
+
+esp_err_t influx_writer_flush(influx_writer_handle_t writer) {
+  if (xSemaphoreTake(writer->flush_lock, 0) != pdTRUE) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // records spooled during an outage are older than anything in RAM
+  esp_err_t err = ESP_OK;
+  int64_t now = esp_timer_get_time();
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  bool backoff = writer->adaptive && !influx_policy_ready(&writer->policy, now);
+  xSemaphoreGive(writer->lock);
+  if (now < writer->retry_at_us || backoff) {
+    // the server asked for a break or keeps failing, keep the batch or
+    // spool it
+    err = ESP_ERR_TIMEOUT;
+    xSemaphoreTake(writer->lock, portMAX_DELAY);
+    writer->stats.deferred++;
+    xSemaphoreGive(writer->lock);
+  } else if (writer->config.spool) {
+    err = spool_drain(writer);
+  }
+
+  // snapshot the pending region, producers keep appending behind it while
+  // the request is in flight
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  size_t size = writer->config.buffer_size;
+  size_t tail = writer->tail;
+  size_t len = writer->used;
+  int64_t started = esp_timer_get_time();
+  xSemaphoreGive(writer->lock);
+
+  if (len) {
+    size_t first = size - tail;
+    if (first > len) {
+      first = len;
+    }
+    influx_body_t body = {
+        .data = {writer->buf + tail, writer->buf},
+        .len = {first, len - first},
+    };
+    influx_result_t result = {0};
+    // bytes that leave the buffer: sent, rejected or spooled
+    size_t consumed = 0;
+    // still offline if the spool could not be drained, keep the order
+    bool sent = err == ESP_OK;
+    if (sent) {
+      err = send_lines(writer, &body, &result, &consumed);
+    }
+    bool rejected = err == ESP_ERR_INVALID_RESPONSE;
+
+    size_t spilled = 0;
+    if (err != ESP_OK && !rejected && writer->config.spool) {
+      spilled = spool_spill(writer, (tail + consumed) % size, len - consumed);
+      consumed += spilled;
+    }
+
+    xSemaphoreTake(writer->lock, portMAX_DELAY);
+    if (err == ESP_OK || rejected) {
+      if (rejected) {
+        writer->stats.rejected++;
+      } else {
+        writer->stats.requests++;
+        writer->stats.bytes += len;
+      }
+    } else {
+      writer->stats.failed += sent;
+      if (spilled) {
+        writer->stats.spooled++;
+      }
+    }
+    writer->tail = (tail + consumed) % size;
+    writer->used -= consumed;
+    if (consumed) {
+      // anything left was queued after the snapshot
+      writer->oldest_us = started;
+    }
+    xSemaphoreGive(writer->lock);
+
+    if (rejected) {
+      ESP_LOGE(TAG, "batch of %u bytes rejected with status %d, dropping it",
+               (unsigned)len, result.status_code);
+    } else if (err != ESP_OK) {
+      ESP_LOGW(TAG, "batch of %u bytes failed (%s, status %d), %s",
+               (unsigned)len, esp_err_to_name(err), result.status_code,
+               consumed == len ? "spooled it" : "keeping it");
+    }
+  }
+
+  xSemaphoreGive(writer->flush_lock);
+  return err;
+}
+
+void influx_writer_get_stats(influx_writer_handle_t writer,
+                             influx_writer_stats_t *stats) {
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  *stats = writer->stats;
+  stats->pending = writer->used;
+  xSemaphoreGive(writer->lock);
+}
+
+void influx_writer_get_policy(influx_writer_handle_t writer,
+                              influx_policy_metrics_t *metrics) {
+  xSemaphoreTake(writer->lock, portMAX_DELAY);
+  if (writer->adaptive) {
+    *metrics = writer->policy.metrics;
+  } else {
+    memset(metrics, 0, sizeof(influx_policy_metrics_t));
+    metrics->batch_bytes = writer->config.batch_max_bytes;
+    metrics->age_ms = writer->config.batch_max_age_ms;
+  }
+  xSemaphoreGive(writer->lock);
+}
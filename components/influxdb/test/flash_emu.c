@@ -0,0 +1,147 @@
+#include "flash_emu.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct flash_emu {
+  uint8_t *image;
+  size_t size;
+  size_t sector_size;
+  FILE *file;
+  bool armed;       // a power cut is scheduled
+  size_t budget;    // bytes that can still be programmed before it
+  bool dead;        // power is off
+  uint32_t violations;
+};
+
+static void sync_file(flash_emu_t *emu, size_t addr, size_t len) {
+  if (emu->file) {
+    fseek(emu->file, addr, SEEK_SET);
+    fwrite(emu->image + addr, 1, len, emu->file);
+    fflush(emu->file);
+  }
+}
+
+/* How many of len bytes get programmed before the power goes. */
+static size_t take_budget(flash_emu_t *emu, size_t len) {
+  if (!emu->armed) {
+    return len;
+  }
+  if (len >= emu->budget) {
+    len = emu->budget;
+    emu->dead = true;
+  }
+  emu->budget -= len;
+  return len;
+}
+
+static esp_err_t emu_read(void *ctx, size_t addr, void *buf, size_t len) {
+  flash_emu_t *emu = (flash_emu_t *)ctx;
+  if (emu->dead) {
+    return ESP_FAIL;
+  }
+  if (addr + len > emu->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  memcpy(buf, emu->image + addr, len);
+  return ESP_OK;
+}
+
+static esp_err_t emu_write(void *ctx, size_t addr, const void *buf,
+                           size_t len) {
+  flash_emu_t *emu = (flash_emu_t *)ctx;
+  const uint8_t *data = (const uint8_t *)buf;
+  if (emu->dead) {
+    return ESP_FAIL;
+  }
+  if (addr + len > emu->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  size_t done = take_budget(emu, len);
+  for (size_t i = 0; i < done; i++) {
+    if (data[i] & ~emu->image[addr + i]) {
+      emu->violations++;
+    }
+    // programming can only clear bits
+    emu->image[addr + i] &= data[i];
+  }
+  sync_file(emu, addr, done);
+  return done == len ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t emu_erase(void *ctx, size_t addr, size_t len) {
+  flash_emu_t *emu = (flash_emu_t *)ctx;
+  if (emu->dead) {
+    return ESP_FAIL;
+  }
+  if (addr % emu->sector_size || len % emu->sector_size ||
+      addr + len > emu->size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  size_t done = take_budget(emu, len);
+  memset(emu->image + addr, 0xff, done);
+  sync_file(emu, addr, done);
+  return done == len ? ESP_OK : ESP_FAIL;
+}
+
+flash_emu_t *flash_emu_create(size_t size, size_t sector_size,
+                              const char *path) {
+  flash_emu_t *emu = calloc(1, sizeof(flash_emu_t));
+  if (!emu) {
+    return NULL;
+  }
+  emu->image = malloc(size);
+  if (!emu->image) {
+    free(emu);
+    return NULL;
+  }
+  emu->size = size;
+  emu->sector_size = sector_size;
+  memset(emu->image, 0xff, size);
+  if (path) {
+    // reuse an image left by an earlier run, otherwise start erased
+    emu->file = fopen(path, "r+b");
+    if (emu->file) {
+      if (fread(emu->image, 1, size, emu->file) != size) {
+        memset(emu->image, 0xff, size);
+      }
+    } else {
+      emu->file = fopen(path, "w+b");
+    }
+    sync_file(emu, 0, size);
+  }
+  return emu;
+}
+
+void flash_emu_delete(flash_emu_t *emu) {
+  if (emu->file) {
+    fclose(emu->file);
+  }
+  free(emu->image);
+  free(emu);
+}
+
+void flash_emu_get_flash(flash_emu_t *emu, influx_spool_flash_t *flash) {
+  flash->read = emu_read;
+  flash->write = emu_write;
+  flash->erase = emu_erase;
+  flash->size = emu->size;
+  flash->sector_size = emu->sector_size;
+  flash->ctx = emu;
+}
+
+void flash_emu_cut_power(flash_emu_t *emu, size_t after_bytes) {
+  emu->armed = true;
+  emu->budget = after_bytes;
+}
+
+void flash_emu_power_on(flash_emu_t *emu) {
+  emu->armed = false;
+  emu->dead = false;
+}
+
+uint32_t flash_emu_violations(flash_emu_t *emu) {
+  return emu->violations;
+}
@@ -0,0 +1,27 @@
+#ifndef _FLASH_EMU_H_
+#define _FLASH_EMU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "influx_spool.h"
+
+/*
+ * NOR flash emulator for the spool tests. The image lives in RAM and, if a
+ * path is given, is written through to a file so it survives the process.
+ * A power cut can be scheduled after a number of programmed bytes: the
+ * operation in progress is left half done and everything after it fails
+ * until the next power on.
+ */
+typedef struct flash_emu flash_emu_t;
+
+flash_emu_t *flash_emu_create(size_t size, size_t sector_size,
+                              const char *path);
+void flash_emu_delete(flash_emu_t *emu);
+void flash_emu_get_flash(flash_emu_t *emu, influx_spool_flash_t *flash);
+void flash_emu_cut_power(flash_emu_t *emu, size_t after_bytes);
+void flash_emu_power_on(flash_emu_t *emu);
+// writes that tried to turn a 0 bit back into a 1 without an erase
+uint32_t flash_emu_violations(flash_emu_t *emu);
+
+#endif
@@ -0,0 +1,147 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "http_emu.h"
+
+#include <string.h>
+
+#include "esp_http_client.h"
+#include "esp_tls.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// the CA certificate main embeds, influx_http refers to it
+const uint8_t ca_cert_pem_start[] asm("_binary_ca_cert_pem_start") = "";
+const uint8_t ca_cert_pem_end[] asm("_binary_ca_cert_pem_end") = "";
+
+struct emu_client {
+  esp_http_client_config_t config;
+  bool connected;
+  bool dropped;     // the server went away, the client doesn't know yet
+  int requests;     // answered on this connection
+  int read_pos;     // of the response body
+};
+
+static struct emu_client s_client;
+static http_emu_server_t s_server = {.status_code = 204, .read_error_at = -1};
+static http_emu_stats_t s_stats;
+
+void http_emu_set_server(const http_emu_server_t *server) {
+  s_server = *server;
+  memset(&s_stats, 0, sizeof(s_stats));
+}
+
+void http_emu_get_stats(http_emu_stats_t *stats) { *stats = s_stats; }
+
+static void emu_event(esp_http_client_event_id_t id, char *key, char *value) {
+  esp_http_client_event_t evt = {
+      .event_id = id,
+      .client = &s_client,
+      .user_data = s_client.config.user_data,
+      .header_key = key,
+      .header_value = value,
+  };
+  if (s_client.config.event_handler) {
+    s_client.config.event_handler(&evt);
+  }
+}
+
+esp_http_client_handle_t esp_http_client_init(
+    const esp_http_client_config_t *config) {
+  memset(&s_client, 0, sizeof(s_client));
+  s_client.config = *config;
+  return &s_client;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+  return esp_http_client_close(client);
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client,
+                                     const char *key, const char *value) {
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client,
+                                        const char *key) {
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client,
+                               int write_len) {
+  s_client.read_pos = 0;
+  if (s_client.connected) {
+    return ESP_OK;
+  }
+  vTaskDelay(s_server.connect_ms / portTICK_PERIOD_MS);
+  s_client.connected = true;
+  s_client.dropped = false;
+  s_client.requests = 0;
+  s_stats.connects++;
+  emu_event(HTTP_EVENT_ON_CONNECTED, NULL, NULL);
+  return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *buffer,
+                          int len) {
+  if (s_client.dropped) {
+    s_stats.failed_writes++;
+    return -1;
+  }
+  return len;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+  if (s_client.dropped) {
+    return -1;
+  }
+  vTaskDelay(s_server.request_ms / portTICK_PERIOD_MS);
+  s_stats.requests++;
+  if (s_server.close) {
+    emu_event(HTTP_EVENT_ON_HEADER, "Connection", "close");
+  }
+  if (s_server.drop_after && ++s_client.requests == s_server.drop_after) {
+    s_client.dropped = true;  // after this response
+  }
+  return s_server.body ? strlen(s_server.body) : 0;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer,
+                         int len) {
+  int size = s_server.body ? strlen(s_server.body) : 0;
+  if (s_server.read_error_at >= 0) {
+    if (s_client.read_pos >= s_server.read_error_at) {
+      return -1;
+    }
+    if (s_server.read_error_at - s_client.read_pos < len) {
+      len = s_server.read_error_at - s_client.read_pos;
+    }
+  }
+  if (size - s_client.read_pos < len) {
+    len = size - s_client.read_pos;
+  }
+  if (len <= 0) {
+    return 0;
+  }
+  memcpy(buffer, s_server.body + s_client.read_pos, len);
+  s_client.read_pos += len;
+  return len;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+  return s_server.status_code;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+  if (s_client.connected) {
+    s_client.connected = false;
+    emu_event(HTTP_EVENT_DISCONNECTED, NULL, NULL);
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_tls_get_and_clear_last_error(void *h, int *esp_tls_code,
+                                           int *esp_tls_flags) {
+  return ESP_OK;
+}
+#endif
@@ -0,0 +1,34 @@
+#ifndef _HTTP_EMU_H_
+#define _HTTP_EMU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * esp_http_client stand-in for the influx_http tests in host builds, where
+ * it replaces the client. It plays a local InfluxDB: every new connection
+ * costs connect_ms (DNS, TCP and the TLS handshake) and every request
+ * request_ms, both slept with vTaskDelay so the client's latency counters
+ * see them. The server can close the connection after each response, drop
+ * an idle one silently, or cut a response body short.
+ */
+typedef struct {
+  uint32_t connect_ms;     // time a new connection takes
+  uint32_t request_ms;     // time from the request to its response headers
+  int status_code;         // of every response
+  const char *body;        // of every response, NULL for none
+  bool close;              // answer with Connection: close
+  int drop_after;          // requests before it drops a connection, 0 never
+  int read_error_at;       // body bytes before a read fails, -1 never
+} http_emu_server_t;
+
+typedef struct {
+  uint32_t connects;       // connections the server accepted
+  uint32_t requests;       // requests it answered
+  uint32_t failed_writes;  // requests sent on a dropped connection
+} http_emu_stats_t;
+
+void http_emu_set_server(const http_emu_server_t *server);
+void http_emu_get_stats(http_emu_stats_t *stats);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp32/rom/crc.h"
+#include "esp32/rom/miniz.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "influx_gzip.h"
+#include "influx_line.h"
+#include "unity.h"
+
+#define BATCH_MAX 4096
+
+/* Fill buf with one batch of the records the sensor tasks upload. */
+static size_t make_batch(char *buf, size_t size, bool bme680) {
+  static const char *const tags[] = {"host", "autumns-esp32"};
+  influx_series_t series;
+  influx_line_t line;
+  size_t len = 0;
+  int64_t timestamp = 1600000000000000000LL;
+
+  influx_series_init(&series, bme680 ? "bme680" : "bme280", tags, 1);
+  for (int i = 0;; i++) {
+    influx_line_begin(&line, buf + len, size - len, &series);
+    influx_line_add_fixed(&line, "temperature", 2153 + (i * 7) % 40, 2);
+    influx_line_add_fixed(&line, "humidity", 40125 + (i * 37) % 900, 3);
+    influx_line_add_fixed(&line, "pressure", 101325 + (i * 3) % 20, 2);
+    if (bme680) {
+      influx_line_add_fixed(&line, "gas_resistance", 120000 + i * 113, 0);
+    }
+    int n = influx_line_finish(&line, timestamp + i * 1000000000LL);
+    if (n < 0 || len + n + 1 >= size) {
+      return len;
+    }
+    len += n;
+    buf[len++] = '\n';
+  }
+}
+
+/* Inflate a gzip member with the ROM decompressor and compare with the input. */
+static void check_roundtrip(const influx_body_t *gz, const char *raw,
+                            size_t raw_len) {
+  const uint8_t *data = (const uint8_t *)gz->data[0];
+  size_t len = gz->len[0];
+  char *inflated = malloc(raw_len + 1);
+  TEST_ASSERT_NOT_NULL(inflated);
+
+  TEST_ASSERT_EQUAL_HEX8(0x1f, data[0]);
+  TEST_ASSERT_EQUAL_HEX8(0x8b, data[1]);
+  size_t n = tinfl_decompress_mem_to_mem(inflated, raw_len + 1, data + 10,
+                                         len - 18, 0);
+  TEST_ASSERT_EQUAL(raw_len, n);
+  TEST_ASSERT_EQUAL_MEMORY(raw, inflated, raw_len);
+
+  uint32_t crc = data[len - 8] | data[len - 7] << 8 | data[len - 6] << 16 |
+                 (uint32_t)data[len - 5] << 24;
+  uint32_t isize = data[len - 4] | data[len - 3] << 8 | data[len - 2] << 16 |
+                   (uint32_t)data[len - 1] << 24;
+  TEST_ASSERT_EQUAL_HEX32(crc32_le(0, (const uint8_t *)raw, raw_len), crc);
+  TEST_ASSERT_EQUAL(raw_len, isize);
+  free(inflated);
+}
+
+TEST_CASE("influx gzip compresses sensor batches", "[influxdb]")
+{
+  const size_t batch_sizes[] = {512, 2048, BATCH_MAX};
+  char *raw = malloc(BATCH_MAX);
+  influx_gzip_handle_t gzip = influx_gzip_create(BATCH_MAX);
+  TEST_ASSERT_NOT_NULL(raw);
+  TEST_ASSERT_NOT_NULL(gzip);
+
+  for (int sensor = 0; sensor < 2; sensor++) {
+    for (int i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+      size_t len = make_batch(raw, batch_sizes[i], sensor);
+      influx_body_t body = {.data = {raw, NULL}, .len = {len, 0}};
+      influx_body_t out;
+
+      int64_t start = esp_timer_get_time();
+      TEST_ASSERT_EQUAL(ESP_OK, influx_gzip_compress(gzip, &body, &out));
+      int64_t elapsed = esp_timer_get_time() - start;
+      check_roundtrip(&out, raw, len);
+
+      printf("%s batch %4u bytes: %4u gzipped, ratio %u.%02u, %u us/KiB\n",
+             sensor ? "bme680" : "bme280", (unsigned)len,
+             (unsigned)out.len[0], (unsigned)(len / out.len[0]),
+             (unsigned)(len * 100 / out.len[0] % 100),
+             (unsigned)(elapsed * 1024 / len));
+    }
+  }
+
+  free(raw);
+  influx_gzip_delete(gzip);
+}
+
+TEST_CASE("influx gzip handles wrapped and incompressible bodies", "[influxdb]")
+{
+  char *raw = malloc(BATCH_MAX);
+  influx_gzip_handle_t gzip = influx_gzip_create(BATCH_MAX);
+  TEST_ASSERT_NOT_NULL(raw);
+  TEST_ASSERT_NOT_NULL(gzip);
+  size_t len = make_batch(raw, BATCH_MAX, true);
+  influx_body_t out;
+
+  // a batch that wraps around the ring arrives in two segments
+  for (size_t split = 0; split <= len; split += len / 7) {
+    influx_body_t body = {.data = {raw, raw + split},
+                          .len = {split, len - split}};
+    TEST_ASSERT_EQUAL(ESP_OK, influx_gzip_compress(gzip, &body, &out));
+    check_roundtrip(&out, raw, len);
+  }
+
+  // random bytes do not shrink and must be sent as they are
+  for (size_t i = 0; i < len; i++) {
+    raw[i] = esp_random();
+  }
+  influx_body_t body = {.data = {raw, NULL}, .len = {len, 0}};
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    influx_gzip_compress(gzip, &body, &out));
+
+  free(raw);
+  influx_gzip_delete(gzip);
+}
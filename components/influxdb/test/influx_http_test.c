@@ -0,0 +1,135 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "http_emu.h"
+#include "influx_http.h"
+#include "unity.h"
+
+#define UPLOADS 20
+// a TLS handshake with an RSA-2048 server takes the ESP32 a few hundred ms,
+// far longer than the POST of one batch
+#define CONNECT_MS 250
+#define REQUEST_MS 20
+
+static const char s_batch[] =
+    "bme280,host=autumns-esp32 temperature=21.50,humidity=40.125 1\n"
+    "bme280,host=autumns-esp32 temperature=21.52,humidity=40.250 2\n";
+
+/* Upload the batch UPLOADS times, the mean time one upload takes in us. */
+static int64_t upload(influx_http_handle_t http, influx_http_stats_t *stats) {
+  influx_body_t body = {.data = {s_batch, NULL}, .len = {strlen(s_batch), 0}};
+  int64_t start = esp_timer_get_time();
+
+  for (int i = 0; i < UPLOADS; i++) {
+    influx_result_t result = {0};
+    TEST_ASSERT_EQUAL(ESP_OK, influx_http_transport(http, &body, &result));
+    TEST_ASSERT_EQUAL(204, result.status_code);
+  }
+  influx_http_get_stats(http, stats);
+  return (esp_timer_get_time() - start) / UPLOADS;
+}
+
+TEST_CASE("influx_http keeps the connection across uploads", "[influx_http]") {
+  http_emu_server_t server = {
+      .connect_ms = CONNECT_MS,
+      .request_ms = REQUEST_MS,
+      .status_code = 204,
+      .read_error_at = -1,
+  };
+  influx_http_stats_t kept, closed;
+  http_emu_stats_t emu;
+
+  // a server that closes every connection, like a client per upload
+  server.close = true;
+  http_emu_set_server(&server);
+  influx_http_handle_t http = influx_http_create();
+  TEST_ASSERT_NOT_NULL(http);
+  int64_t closed_us = upload(http, &closed);
+  influx_http_delete(http);
+  TEST_ASSERT_EQUAL(UPLOADS, closed.connects);
+  TEST_ASSERT_EQUAL(0, closed.reused);
+
+  server.close = false;
+  http_emu_set_server(&server);
+  http = influx_http_create();
+  TEST_ASSERT_NOT_NULL(http);
+  int64_t kept_us = upload(http, &kept);
+  influx_http_delete(http);
+  http_emu_get_stats(&emu);
+  TEST_ASSERT_EQUAL(1, kept.connects);
+  TEST_ASSERT_EQUAL(1, emu.connects);
+  TEST_ASSERT_EQUAL(UPLOADS - 1, kept.reused);
+  TEST_ASSERT_EQUAL(UPLOADS, kept.requests);
+  TEST_ASSERT_EQUAL(0, kept.errors);
+
+  printf("connection per upload: %lld us an upload, connect %u us, "
+         "request %u us\n",
+         (long long)closed_us, closed.connect_us_last,
+         closed.request_us_last);
+  printf("kept alive: %lld us an upload, %u connect of %u us, "
+         "request %u us\n",
+         (long long)kept_us, kept.connects, kept.connect_us_last,
+         kept.request_us_last);
+  TEST_ASSERT_INT_WITHIN(10000, CONNECT_MS * 1000, kept.connect_us_last);
+  TEST_ASSERT_INT_WITHIN(10000, REQUEST_MS * 1000, kept.request_us_last);
+  TEST_ASSERT_TRUE(kept_us * 4 < closed_us);
+}
+
+TEST_CASE("influx_http reconnects when the server dropped the connection",
+          "[influx_http]") {
+  http_emu_server_t server = {
+      .connect_ms = CONNECT_MS,
+      .request_ms = REQUEST_MS,
+      .status_code = 204,
+      .drop_after = 5,
+      .read_error_at = -1,
+  };
+  influx_http_stats_t stats;
+  http_emu_stats_t emu;
+
+  http_emu_set_server(&server);
+  influx_http_handle_t http = influx_http_create();
+  TEST_ASSERT_NOT_NULL(http);
+  upload(http, &stats);
+  influx_http_delete(http);
+  http_emu_get_stats(&emu);
+  // each dropped connection costs one failed write and a new handshake
+  TEST_ASSERT_EQUAL(UPLOADS / server.drop_after - 1, emu.failed_writes);
+  TEST_ASSERT_EQUAL(UPLOADS / server.drop_after, stats.connects);
+  TEST_ASSERT_EQUAL(UPLOADS, stats.requests);
+  TEST_ASSERT_EQUAL(0, stats.errors);
+}
+
+TEST_CASE("influx_http fails an upload whose response was cut short",
+          "[influx_http]") {
+  static const char error_body[] =
+      "{\"code\":\"invalid\",\"message\":\"unable to parse\"}";
+  influx_body_t body = {.data = {s_batch, NULL}, .len = {strlen(s_batch), 0}};
+  http_emu_server_t server = {
+      .status_code = 400,
+      .body = error_body,
+      .read_error_at = 10,
+  };
+  influx_http_stats_t stats;
+  influx_result_t result = {0};
+
+  http_emu_set_server(&server);
+  influx_http_handle_t http = influx_http_create();
+  TEST_ASSERT_NOT_NULL(http);
+  // the writer retries or spools a batch that failed
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, influx_http_transport(http, &body, &result));
+  influx_http_get_stats(http, &stats);
+  TEST_ASSERT_EQUAL(1, stats.errors);
+  TEST_ASSERT_EQUAL(0, stats.requests);
+
+  server.read_error_at = -1;
+  http_emu_set_server(&server);
+  TEST_ASSERT_EQUAL(ESP_OK, influx_http_transport(http, &body, &result));
+  TEST_ASSERT_EQUAL(400, result.status_code);
+  influx_http_delete(http);
+}
+#endif
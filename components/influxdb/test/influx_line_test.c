@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "influx_line.h"
+#include "unity.h"
+
+#define BENCH_RECORDS 10000
+#define BENCH_STACK 4096
+
+static const char *const TAGS[] = {"host", "autumns-esp32", "sensor", "bme680"};
+
+/* One BME680 sample in the units of bme680_values_fixed_t. */
+typedef struct {
+  int16_t temperature;      // 0.01 °C
+  uint32_t pressure;        // Pa
+  uint32_t humidity;        // 0.001 %
+  uint32_t gas_resistance;  // Ohm
+} sample_t;
+
+static const sample_t SAMPLE = {2153, 101325, 40125, 123456};
+
+static int encode_line(char *buf, size_t size, const influx_series_t *series,
+                       const sample_t *s, int64_t timestamp) {
+  influx_line_t line;
+  influx_line_begin(&line, buf, size, series);
+  influx_line_add_fixed(&line, "temperature", s->temperature, 2);
+  influx_line_add_fixed(&line, "humidity", s->humidity, 3);
+  influx_line_add_fixed(&line, "pressure", s->pressure, 2);
+  influx_line_add_fixed(&line, "gas_resistance", s->gas_resistance, 0);
+  return influx_line_finish(&line, timestamp);
+}
+
+static int encode_snprintf(char *buf, size_t size, const sample_t *s,
+                           int64_t timestamp) {
+  return snprintf(buf, size,
+                  "bme680,host=autumns-esp32,sensor=bme680 temperature=%.2f,"
+                  "humidity=%.3f,pressure=%.2f,gas_resistance=%.0f %lld",
+                  s->temperature / 100.0f, s->humidity / 1000.0f,
+                  s->pressure / 100.0f, (float)s->gas_resistance,
+                  (long long)timestamp);
+}
+
+TEST_CASE("influx line encodes fixed-point fields", "[influxdb]")
+{
+  const char *expected =
+      "bme680,host=autumns-esp32,sensor=bme680 temperature=21.53,"
+      "humidity=40.125,pressure=1013.25,gas_resistance=123456"
+      " 1600000000123456789";
+  influx_series_t series;
+  influx_line_t line;
+  char buf[160];
+
+  TEST_ASSERT_EQUAL(ESP_OK, influx_series_init(&series, "bme680", TAGS, 2));
+  TEST_ASSERT_EQUAL(strlen(expected),
+                    encode_line(buf, sizeof(buf), &series, &SAMPLE,
+                                1600000000123456789LL));
+  TEST_ASSERT_EQUAL_STRING(expected, buf);
+
+  influx_line_begin(&line, buf, sizeof(buf), &series);
+  influx_line_add_fixed(&line, "a", -5, 2);
+  influx_line_add_fixed(&line, "b", -2147483647 - 1, 3);
+  influx_line_add_fixed(&line, "c", 0, 1);
+  influx_line_add_int(&line, "d", -42);
+  TEST_ASSERT_GREATER_THAN(0, influx_line_finish(&line, 0));
+  TEST_ASSERT_EQUAL_STRING("bme680,host=autumns-esp32,sensor=bme680 "
+                           "a=-0.05,b=-2147483.648,c=0.0,d=-42i",
+                           buf);
+
+  // measurement and tags are escaped once, when the series is rendered
+  const char *const odd_tags[] = {"lo cation", "attic,north=1"};
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    influx_series_init(&series, "air quality", odd_tags, 1));
+  influx_line_begin(&line, buf, sizeof(buf), &series);
+  influx_line_add_int(&line, "v", 1);
+  TEST_ASSERT_GREATER_THAN(0, influx_line_finish(&line, 0));
+  TEST_ASSERT_EQUAL_STRING("air\\ quality,lo\\ cation=attic\\,north\\=1 v=1i",
+                           buf);
+}
+
+TEST_CASE("influx line never overruns its buffer", "[influxdb]")
+{
+  influx_series_t series;
+  char buf[160];
+  char expected[160];
+
+  TEST_ASSERT_EQUAL(ESP_OK, influx_series_init(&series, "bme680", TAGS, 2));
+  int len = encode_line(expected, sizeof(expected), &series, &SAMPLE, 1);
+  TEST_ASSERT_GREATER_THAN(0, len);
+
+  for (int size = 0; size <= len; size++) {
+    memset(buf, 0x55, sizeof(buf));
+    TEST_ASSERT_EQUAL(-1, encode_line(buf, size, &series, &SAMPLE, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x55, (uint8_t)buf[size]);
+  }
+  TEST_ASSERT_EQUAL(len, encode_line(buf, len + 1, &series, &SAMPLE, 1));
+  TEST_ASSERT_EQUAL_STRING(expected, buf);
+
+  // a series that does not fit is refused instead of truncated
+  char name[INFLUX_SERIES_MAX + 1];
+  memset(name, 'm', sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    influx_series_init(&series, name, NULL, 0));
+}
+
+typedef struct {
+  bool use_snprintf;
+  SemaphoreHandle_t done;
+  int64_t elapsed_us;
+  uint32_t stack_used;
+} bench_t;
+
+/* Runs on a fresh stack so that its high water mark is the encoder's. */
+static void bench_task(void *arg) {
+  bench_t *bench = (bench_t *)arg;
+  influx_series_t series;
+  char buf[160];
+  sample_t s = SAMPLE;
+
+  influx_series_init(&series, "bme680", TAGS, 2);
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_RECORDS; i++) {
+    s.temperature = 2000 + i % 1000;
+    if (bench->use_snprintf) {
+      encode_snprintf(buf, sizeof(buf), &s, 1600000000000000000LL + i);
+    } else {
+      encode_line(buf, sizeof(buf), &series, &s, 1600000000000000000LL + i);
+    }
+  }
+  bench->elapsed_us = esp_timer_get_time() - start;
+  bench->stack_used = BENCH_STACK - uxTaskGetStackHighWaterMark(NULL);
+  xSemaphoreGive(bench->done);
+  vTaskDelete(NULL);
+}
+
+TEST_CASE("influx line encoder vs snprintf", "[influxdb][benchmark]")
+{
+  const char *names[] = {"influx_line", "snprintf"};
+  bench_t bench;
+
+  bench.done = xSemaphoreCreateBinary();
+  TEST_ASSERT_NOT_NULL(bench.done);
+  for (int i = 0; i < 2; i++) {
+    bench.use_snprintf = i;
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(bench_task, "influx_bench",
+                                          BENCH_STACK, &bench, 5, NULL));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(bench.done, portMAX_DELAY));
+    printf("%-12s %7u records/s, %4u bytes of stack\n", names[i],
+           (unsigned)(BENCH_RECORDS * 1000000LL / (bench.elapsed_us + 1)),
+           (unsigned)bench.stack_used);
+  }
+  vSemaphoreDelete(bench.done);
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "influx_policy.h"
+#include "influx_writer.h"
+#include "unity.h"
+
+static const influx_policy_config_t POLICY = {
+    .min_batch_bytes = 256,
+    .max_batch_bytes = 2048,
+    .min_age_ms = 1000,
+    .max_age_ms = 30000,
+    .target_latency_ms = 500,
+    .min_backoff_ms = 1000,
+    .max_backoff_ms = 60000,
+};
+
+/*
+ * Simulated uploads: a sensor queues a record every 100 ms and a batch goes
+ * out as soon as the policy says so, taking as long as the server model.
+ */
+typedef struct {
+  uint32_t base_ms;        // latency of an empty request
+  uint32_t bytes_per_ms;   // upload speed
+  bool down;               // requests fail after base_ms
+  int64_t now_us;
+  size_t pending;
+  int64_t oldest_us;
+  int requests;
+} sim_t;
+
+#define SIM_RECORD_BYTES 60
+#define SIM_RECORD_PERIOD_US (100 * 1000)
+
+static void simulate(sim_t *sim, influx_policy_t *policy, int64_t duration_us) {
+  int64_t end = sim->now_us + duration_us;
+  for (; sim->now_us < end; sim->now_us += SIM_RECORD_PERIOD_US) {
+    if (!sim->pending) {
+      sim->oldest_us = sim->now_us;
+    }
+    sim->pending += SIM_RECORD_BYTES;
+
+    const influx_policy_metrics_t *m = &policy->metrics;
+    bool due = sim->pending >= m->batch_bytes ||
+               sim->now_us - sim->oldest_us >= m->age_ms * 1000LL;
+    if (!due || !influx_policy_ready(policy, sim->now_us)) {
+      continue;
+    }
+    uint32_t latency_ms = sim->base_ms;
+    if (!sim->down) {
+      latency_ms += sim->pending / sim->bytes_per_ms;
+    }
+    sim->now_us += latency_ms * 1000LL;
+    sim->requests++;
+    influx_policy_update(policy, !sim->down, latency_ms, sim->now_us);
+    if (!sim->down) {
+      sim->pending = 0;
+    }
+  }
+}
+
+TEST_CASE("influx policy converges to the server's latency", "[influxdb]")
+{
+  influx_policy_t policy;
+  influx_policy_init(&policy, &POLICY);
+  sim_t sim = {.base_ms = 40, .bytes_per_ms = 50};
+
+  // a fast server lets batches grow to the limits
+  simulate(&sim, &policy, 600 * 1000000LL);
+  int fast_requests = sim.requests;
+  TEST_ASSERT_EQUAL(POLICY.max_batch_bytes, policy.metrics.batch_bytes);
+  TEST_ASSERT_EQUAL(POLICY.max_age_ms, policy.metrics.age_ms);
+  TEST_ASSERT_EQUAL(0, policy.metrics.error_permille);
+
+  // a struggling one gets small batches within a few requests
+  sim.base_ms = 1500;
+  sim.requests = 0;
+  simulate(&sim, &policy, 600 * 1000000LL);
+  TEST_ASSERT_EQUAL(POLICY.min_batch_bytes, policy.metrics.batch_bytes);
+  TEST_ASSERT_EQUAL(POLICY.min_age_ms, policy.metrics.age_ms);
+  TEST_ASSERT_GREATER_THAN(POLICY.target_latency_ms, policy.metrics.latency_ms);
+  printf("requests per 10 min: %d fast, %d slow\n", fast_requests,
+         sim.requests);
+
+  // and once it recovers the batches grow back
+  sim.base_ms = 40;
+  simulate(&sim, &policy, 600 * 1000000LL);
+  TEST_ASSERT_EQUAL(POLICY.max_batch_bytes, policy.metrics.batch_bytes);
+  TEST_ASSERT_LESS_THAN(POLICY.target_latency_ms, policy.metrics.latency_ms);
+}
+
+TEST_CASE("influx policy backs off exponentially with jitter", "[influxdb]")
+{
+  influx_policy_t policy;
+  influx_policy_init(&policy, &POLICY);
+
+  int64_t now = 0;
+  for (uint32_t i = 1; i <= 12; i++) {
+    influx_policy_update(&policy, false, 100, now);
+    uint64_t base = (uint64_t)POLICY.min_backoff_ms << (i - 1);
+    if (base > POLICY.max_backoff_ms) {
+      base = POLICY.max_backoff_ms;
+    }
+    TEST_ASSERT_EQUAL(i, policy.metrics.failures);
+    TEST_ASSERT_GREATER_OR_EQUAL(base / 2, policy.metrics.backoff_ms);
+    TEST_ASSERT_LESS_OR_EQUAL(base, policy.metrics.backoff_ms);
+    TEST_ASSERT_FALSE(influx_policy_ready(&policy, now));
+    now += policy.metrics.backoff_ms * 1000LL;
+    TEST_ASSERT_TRUE(influx_policy_ready(&policy, now));
+  }
+  TEST_ASSERT_EQUAL(POLICY.min_batch_bytes, policy.metrics.batch_bytes);
+  TEST_ASSERT_GREATER_THAN(500, policy.metrics.error_permille);
+
+  // a dead server is asked a handful of times over ten minutes
+  sim_t sim = {.base_ms = 5000, .down = true};
+  influx_policy_init(&policy, &POLICY);
+  simulate(&sim, &policy, 600 * 1000000LL);
+  TEST_ASSERT_LESS_OR_EQUAL(25, sim.requests);
+
+  influx_policy_update(&policy, true, 100, now);
+  TEST_ASSERT_EQUAL(0, policy.metrics.failures);
+  TEST_ASSERT_EQUAL(0, policy.metrics.backoff_ms);
+  TEST_ASSERT_TRUE(influx_policy_ready(&policy, 0));
+}
+
+/* Stand-in for the server that answers after a set latency. */
+typedef struct {
+  uint32_t latency_ms;
+  int status_code;
+  int requests;
+} latency_server_t;
+
+static esp_err_t latency_transport(void *ctx, const influx_body_t *body,
+                                   influx_result_t *result) {
+  latency_server_t *server = (latency_server_t *)ctx;
+  vTaskDelay(server->latency_ms / portTICK_PERIOD_MS);
+  server->requests++;
+  result->status_code = server->status_code;
+  return ESP_OK;
+}
+
+TEST_CASE("influx writer adapts its batches to the server", "[influxdb]")
+{
+  const influx_policy_config_t policy = {
+      .min_batch_bytes = 64,
+      .max_batch_bytes = 512,
+      .min_age_ms = 100,
+      .max_age_ms = 5000,
+      .target_latency_ms = 100,
+      .min_backoff_ms = 200,
+      .max_backoff_ms = 1000,
+  };
+  latency_server_t server = {.latency_ms = 10, .status_code = 204};
+  influx_writer_config_t conf = {
+      .buffer_size = 1024,
+      .batch_max_bytes = 512,
+      .batch_max_age_ms = 5000,
+      .transport = latency_transport,
+      .transport_ctx = &server,
+      .policy = &policy,
+  };
+  influx_writer_handle_t writer = influx_writer_create(&conf);
+  TEST_ASSERT_NOT_NULL(writer);
+  influx_policy_metrics_t metrics;
+
+  // "m v=N\n" is 6 to 8 bytes, a few hundred fill several batches
+  char line[16];
+  for (int i = 0; i < 400; i++) {
+    snprintf(line, sizeof(line), "m v=%d", i);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+  }
+  influx_writer_get_policy(writer, &metrics);
+  TEST_ASSERT_EQUAL(512, metrics.batch_bytes);
+  TEST_ASSERT_EQUAL(5000, metrics.age_ms);
+
+  server.latency_ms = 300;
+  for (int i = 0; i < 400; i++) {
+    snprintf(line, sizeof(line), "m v=%d", i);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+  }
+  influx_writer_get_policy(writer, &metrics);
+  TEST_ASSERT_EQUAL(64, metrics.batch_bytes);
+  TEST_ASSERT_EQUAL(100, metrics.age_ms);
+  TEST_ASSERT_GREATER_THAN(100, metrics.latency_ms);
+
+  // a failure holds back the next requests until the backoff is over
+  server.latency_ms = 10;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  server.status_code = 500;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, "m v=1"));
+  TEST_ASSERT_EQUAL(ESP_FAIL, influx_writer_flush(writer));
+  int requests = server.requests;
+  TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, influx_writer_flush(writer));
+  TEST_ASSERT_EQUAL(requests, server.requests);
+  influx_writer_get_policy(writer, &metrics);
+  TEST_ASSERT_EQUAL(1, metrics.failures);
+  TEST_ASSERT_GREATER_OR_EQUAL(100, metrics.backoff_ms);
+
+  server.status_code = 204;
+  vTaskDelay((metrics.backoff_ms + 20) / portTICK_PERIOD_MS);
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  influx_writer_get_policy(writer, &metrics);
+  TEST_ASSERT_EQUAL(0, metrics.failures);
+  TEST_ASSERT_EQUAL(0, metrics.backoff_ms);
+
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(1, stats.deferred);
+  TEST_ASSERT_EQUAL(0, stats.dropped);
+  influx_writer_delete(writer);
+}
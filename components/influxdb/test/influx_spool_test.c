@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "flash_emu.h"
+#include "influx_spool.h"
+#include "sdkconfig.h"
+#include "unity.h"
+
+#define SECTOR_SIZE 4096
+#define SECTORS 8
+#define BATCH_SIZE 2048
+
+#if CONFIG_IDF_TARGET_LINUX
+#define IMAGE_PATH "influx_spool_test.img"
+#else
+#define IMAGE_PATH NULL
+#endif
+
+/* Record i, its timestamp is i so that a drain can tell where it starts. */
+static size_t make_record(char *buf, size_t size, int i) {
+  return snprintf(buf, size,
+                  "bme280,host=autumns-esp32 temperature=%d.%02d,humidity=40"
+                  " %d\n",
+                  20 + i % 10, i % 100, i);
+}
+
+static esp_err_t append_record(influx_spool_handle_t spool, int i) {
+  char line[96];
+  size_t len = make_record(line, sizeof(line), i);
+  influx_body_t body = {.data = {line, NULL}, .len = {len, 0}};
+  return influx_spool_append(spool, &body);
+}
+
+/*
+ * Drain the spool and check that it holds consecutive records in order,
+ * starting with record *first, or with whatever comes first if *first is -1.
+ * Returns the number of records.
+ */
+static int drain_records(influx_spool_handle_t spool, int *first) {
+  char expected[96];
+  influx_body_t body;
+  int next = *first;
+
+  while (influx_spool_peek(spool, &body) == ESP_OK) {
+    const char *p = body.data[0];
+    const char *end = p + body.len[0];
+    if (next < 0) {
+      const char *eol = memchr(p, '\n', end - p);
+      TEST_ASSERT_NOT_NULL(eol);
+      while (eol[-1] != ' ') {
+        eol--;
+      }
+      next = *first = atoi(eol);
+    }
+    while (p < end) {
+      size_t len = make_record(expected, sizeof(expected), next++);
+      TEST_ASSERT_TRUE(p + len <= end);
+      TEST_ASSERT_EQUAL_STRING_LEN(expected, p, len);
+      p += len;
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, influx_spool_consume(spool));
+  }
+  return *first < 0 ? 0 : next - *first;
+}
+
+static influx_spool_handle_t open_spool(flash_emu_t *emu) {
+  influx_spool_flash_t flash;
+  flash_emu_get_flash(emu, &flash);
+  return influx_spool_open(&flash, BATCH_SIZE);
+}
+
+TEST_CASE("influx spool keeps records across reboots", "[influxdb]")
+{
+  flash_emu_t *emu = flash_emu_create(SECTOR_SIZE * SECTORS, SECTOR_SIZE, NULL);
+  TEST_ASSERT_NOT_NULL(emu);
+  influx_spool_handle_t spool = open_spool(emu);
+  TEST_ASSERT_NOT_NULL(spool);
+
+  for (int i = 0; i < 200; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append_record(spool, i));
+  }
+  // send half of it, then reboot
+  influx_body_t body;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_spool_peek(spool, &body));
+  TEST_ASSERT_EQUAL(ESP_OK, influx_spool_consume(spool));
+  char first[96];
+  make_record(first, sizeof(first), 0);
+  TEST_ASSERT_EQUAL_STRING_LEN(first, body.data[0], strlen(first));
+  int sent = 0;
+  for (const char *p = body.data[0]; p < body.data[0] + body.len[0]; p++) {
+    sent += *p == '\n';
+  }
+  influx_spool_close(spool);
+
+  spool = open_spool(emu);
+  TEST_ASSERT_NOT_NULL(spool);
+  TEST_ASSERT_EQUAL(200 - sent, drain_records(spool, &sent));
+
+  influx_spool_stats_t stats;
+  influx_spool_get_stats(spool, &stats);
+  TEST_ASSERT_EQUAL(0, stats.pending);
+  TEST_ASSERT_EQUAL(0, stats.corrupt);
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, influx_spool_peek(spool, &body));
+  TEST_ASSERT_EQUAL(0, flash_emu_violations(emu));
+
+  influx_spool_close(spool);
+  flash_emu_delete(emu);
+}
+
+TEST_CASE("influx spool evicts the oldest segment when full", "[influxdb]")
+{
+  flash_emu_t *emu = flash_emu_create(SECTOR_SIZE * SECTORS, SECTOR_SIZE, NULL);
+  TEST_ASSERT_NOT_NULL(emu);
+  influx_spool_handle_t spool = open_spool(emu);
+  TEST_ASSERT_NOT_NULL(spool);
+
+  // about three times what fits
+  const int total = 3 * SECTORS * SECTOR_SIZE / 80;
+  for (int i = 0; i < total; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append_record(spool, i));
+  }
+  influx_spool_stats_t stats;
+  influx_spool_get_stats(spool, &stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.evicted);
+  TEST_ASSERT_EQUAL(total, stats.appended);
+
+  // whatever survived is the newest data, still in order
+  int first = stats.evicted;
+  TEST_ASSERT_EQUAL(total - stats.evicted, drain_records(spool, &first));
+  TEST_ASSERT_EQUAL(0, flash_emu_violations(emu));
+
+  influx_spool_close(spool);
+  flash_emu_delete(emu);
+}
+
+TEST_CASE("influx spool recovers from power cuts", "[influxdb]")
+{
+  // cut the power at every point of a run that wraps the ring once
+  for (size_t cut = 0; cut < SECTORS * SECTOR_SIZE * 3 / 2; cut += 97) {
+    flash_emu_t *emu =
+        flash_emu_create(SECTOR_SIZE * SECTORS, SECTOR_SIZE, IMAGE_PATH);
+    TEST_ASSERT_NOT_NULL(emu);
+    influx_spool_handle_t spool = open_spool(emu);
+    TEST_ASSERT_NOT_NULL(spool);
+
+    flash_emu_cut_power(emu, cut);
+    int written = 0;
+    while (append_record(spool, written) == ESP_OK) {
+      written++;
+    }
+    influx_spool_stats_t stats;
+    influx_spool_get_stats(spool, &stats);
+    int evicted = stats.evicted;
+    influx_spool_close(spool);
+
+    flash_emu_power_on(emu);
+    spool = open_spool(emu);
+    TEST_ASSERT_NOT_NULL(spool);
+    influx_spool_get_stats(spool, &stats);
+    TEST_ASSERT_LESS_OR_EQUAL(1, stats.corrupt);
+
+    // every acknowledged record that was not evicted survives, an eviction
+    // cut short before its erase may even leave older ones
+    TEST_ASSERT_EQUAL(ESP_OK, append_record(spool, written));
+    int first = -1;
+    int drained = drain_records(spool, &first);
+    TEST_ASSERT_LESS_OR_EQUAL(evicted, first);
+    TEST_ASSERT_EQUAL(written + 1, first + drained);
+    TEST_ASSERT_EQUAL(0, flash_emu_violations(emu));
+
+    influx_spool_close(spool);
+    flash_emu_delete(emu);
+    if (IMAGE_PATH) {
+      remove(IMAGE_PATH);
+    }
+  }
+}
+
+TEST_CASE("influx spool drain throughput", "[influxdb][benchmark]")
+{
+  flash_emu_t *emu = flash_emu_create(SECTOR_SIZE * SECTORS, SECTOR_SIZE, NULL);
+  TEST_ASSERT_NOT_NULL(emu);
+  influx_spool_handle_t spool = open_spool(emu);
+  TEST_ASSERT_NOT_NULL(spool);
+
+  int records = 0;
+  influx_spool_stats_t stats;
+  do {
+    TEST_ASSERT_EQUAL(ESP_OK, append_record(spool, records++));
+    influx_spool_get_stats(spool, &stats);
+  } while (!stats.evicted);
+
+  size_t pending = stats.pending;
+  int first = stats.evicted;
+  int64_t start = esp_timer_get_time();
+  drain_records(spool, &first);
+  int64_t elapsed = esp_timer_get_time() - start;
+  printf("drained %u bytes in %u us, %u KiB/s\n", (unsigned)pending,
+         (unsigned)elapsed,
+         (unsigned)(pending * 1000000LL / 1024 / (elapsed + 1)));
+
+  influx_spool_close(spool);
+  flash_emu_delete(emu);
+}
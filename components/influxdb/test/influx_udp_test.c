@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "influx_udp.h"
+#include "influx_writer.h"
+#include "lwip/sockets.h"
+#include "unity.h"
+
+#define PAYLOAD_SIZE 512
+
+/* Local listener standing in for InfluxDB or Telegraf. */
+typedef struct {
+  int sock;
+  uint16_t port;
+  volatile bool stop;
+  SemaphoreHandle_t done;
+  uint32_t datagrams;
+  uint32_t lines;
+  uint32_t malformed;  // too large or not ending on a whole line
+  char received[8192];
+  size_t len;
+} sink_t;
+
+static void sink_open(sink_t *sink) {
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  socklen_t addr_len = sizeof(addr);
+  struct timeval timeout = {.tv_sec = 0, .tv_usec = 100 * 1000};
+
+  memset(sink, 0, sizeof(sink_t));
+  sink->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  TEST_ASSERT_TRUE(sink->sock >= 0);
+  TEST_ASSERT_EQUAL(0, bind(sink->sock, (struct sockaddr *)&addr, addr_len));
+  TEST_ASSERT_EQUAL(0, getsockname(sink->sock, (struct sockaddr *)&addr,
+                                   &addr_len));
+  TEST_ASSERT_EQUAL(0, setsockopt(sink->sock, SOL_SOCKET, SO_RCVTIMEO,
+                                  &timeout, sizeof(timeout)));
+  sink->port = ntohs(addr.sin_port);
+}
+
+// receive one datagram, false once nothing arrived within the timeout
+static bool sink_receive(sink_t *sink) {
+  char datagram[PAYLOAD_SIZE + 1];
+  int len = recv(sink->sock, datagram, sizeof(datagram), 0);
+  if (len <= 0) {
+    return false;
+  }
+  sink->datagrams++;
+  if (len > PAYLOAD_SIZE || datagram[len - 1] != '\n') {
+    sink->malformed++;
+  }
+  for (int i = 0; i < len; i++) {
+    sink->lines += datagram[i] == '\n';
+  }
+  if (sink->len + len <= sizeof(sink->received)) {
+    memcpy(sink->received + sink->len, datagram, len);
+    sink->len += len;
+  }
+  return true;
+}
+
+static void sink_task(void *arg) {
+  sink_t *sink = (sink_t *)arg;
+  while (sink_receive(sink) || !sink->stop) {
+  }
+  xSemaphoreGive(sink->done);
+  vTaskDelete(NULL);
+}
+
+static influx_udp_handle_t create_udp(const sink_t *sink) {
+  influx_udp_config_t conf = {
+      .host = "127.0.0.1",
+      .port = sink->port,
+      .payload_size = PAYLOAD_SIZE,
+  };
+  return influx_udp_create(&conf);
+}
+
+TEST_CASE("influx udp packs whole lines into datagrams", "[influxdb]")
+{
+  char lines[4096];
+  size_t len = 0;
+  sink_t sink;
+  sink_open(&sink);
+  influx_udp_handle_t udp = create_udp(&sink);
+  TEST_ASSERT_NOT_NULL(udp);
+
+  for (int i = 0; len < 3000; i++) {
+    len += sprintf(lines + len, "bme280,host=udp-test temperature=%d.%02d %d\n",
+                   i, i % 100, i * 1000);
+  }
+  // split like a batch that wraps around the writer's ring buffer
+  influx_body_t body = {.data = {lines, lines + 1000},
+                        .len = {1000, len - 1000}};
+  influx_result_t result = {0};
+  TEST_ASSERT_EQUAL(ESP_OK, influx_udp_transport(udp, &body, &result));
+  TEST_ASSERT_EQUAL(204, result.status_code);
+  while (sink_receive(&sink)) {
+  }
+
+  influx_udp_stats_t stats;
+  influx_udp_get_stats(udp, &stats);
+  TEST_ASSERT_EQUAL(0, sink.malformed);
+  TEST_ASSERT_EQUAL(stats.datagrams, sink.datagrams);
+  // every datagram but the last is full up to less than one line
+  TEST_ASSERT_TRUE(stats.datagrams <= len / (PAYLOAD_SIZE - 64) + 1);
+  TEST_ASSERT_EQUAL(len, stats.bytes);
+  TEST_ASSERT_EQUAL(len, sink.len);
+  TEST_ASSERT_EQUAL_MEMORY(lines, sink.received, len);
+
+  // a line that fits into no datagram is dropped, its neighbours are not
+  char oversized[PAYLOAD_SIZE + 64];
+  memset(oversized, 'x', sizeof(oversized));
+  memcpy(oversized, "a v=1\n", 6);
+  memcpy(oversized + sizeof(oversized) - 7, "\nb v=2\n", 7);
+  body.data[0] = oversized;
+  body.len[0] = sizeof(oversized);
+  body.len[1] = 0;
+  sink.len = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_udp_transport(udp, &body, &result));
+  while (sink_receive(&sink)) {
+  }
+  influx_udp_get_stats(udp, &stats);
+  TEST_ASSERT_EQUAL(1, stats.oversized);
+  TEST_ASSERT_EQUAL(12, sink.len);
+  TEST_ASSERT_EQUAL_MEMORY("a v=1\nb v=2\n", sink.received, 12);
+
+  influx_udp_delete(udp);
+  close(sink.sock);
+}
+
+/* Push records through the writer as fast as pace_every allows. */
+static void run_load(const char *name, int records, int pace_every) {
+  char line[96];
+  sink_t sink;
+  sink_open(&sink);
+  sink.done = xSemaphoreCreateBinary();
+  influx_udp_handle_t udp = create_udp(&sink);
+  influx_writer_config_t conf = {
+      .buffer_size = PAYLOAD_SIZE * 2,
+      .batch_max_bytes = PAYLOAD_SIZE,
+      .batch_max_age_ms = 100,
+      .transport = influx_udp_transport,
+      .transport_ctx = udp,
+  };
+  influx_writer_handle_t writer = influx_writer_create(&conf);
+  TEST_ASSERT_NOT_NULL(writer);
+  xTaskCreate(sink_task, "udp_sink", 4096, &sink, 3, NULL);
+
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < records; i++) {
+    snprintf(line, sizeof(line),
+             "bme680,host=udp-test temperature=21.%02d,humidity=40.%03d %d",
+             i % 100, i % 1000, i);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+    if (pace_every && i % pace_every == pace_every - 1) {
+      vTaskDelay(1);
+    }
+  }
+  influx_writer_flush(writer);
+  int64_t elapsed = esp_timer_get_time() - start;
+
+  sink.stop = true;
+  xSemaphoreTake(sink.done, portMAX_DELAY);
+
+  influx_udp_stats_t stats;
+  influx_udp_get_stats(udp, &stats);
+  TEST_ASSERT_EQUAL(0, sink.malformed);
+  TEST_ASSERT_EQUAL(0, stats.oversized);
+  TEST_ASSERT_TRUE(sink.lines <= records);
+  TEST_ASSERT_TRUE(sink.datagrams <= stats.datagrams);
+  printf("%s: %u datagrams in %u us, %u datagrams/s, %u of %d lines lost\n",
+         name, (unsigned)stats.datagrams, (unsigned)elapsed,
+         (unsigned)(stats.datagrams * 1000000LL / (elapsed + 1)),
+         (unsigned)(records - sink.lines), records);
+
+  influx_writer_delete(writer);
+  influx_udp_delete(udp);
+  vSemaphoreDelete(sink.done);
+  close(sink.sock);
+}
+
+TEST_CASE("influx udp datagram rate and loss under load",
+          "[influxdb][benchmark]")
+{
+  run_load("paced", 2000, 20);
+  run_load("flood", 20000, 0);
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "influx_uploader.h"
+#include "influx_writer.h"
+#include "unity.h"
+
+#define RECORD_MAX 64
+#define SAMPLES 40
+#define SAMPLE_PERIOD_MS 50
+
+/* Server that takes its time and remembers every record it got. */
+typedef struct {
+  uint32_t latency_ms;
+  SemaphoreHandle_t entered;  // given when a request starts, if set
+  SemaphoreHandle_t gate;     // a request waits for it, if set
+  int requests;
+  char records[4096];
+  size_t len;
+} slow_server_t;
+
+static esp_err_t slow_transport(void *ctx, const influx_body_t *body,
+                                influx_result_t *result) {
+  slow_server_t *server = (slow_server_t *)ctx;
+  if (server->entered) {
+    xSemaphoreGive(server->entered);
+  }
+  if (server->gate) {
+    xSemaphoreTake(server->gate, portMAX_DELAY);
+  }
+  vTaskDelay(server->latency_ms / portTICK_PERIOD_MS);
+  for (int i = 0; i < 2; i++) {
+    TEST_ASSERT_TRUE(server->len + body->len[i] <= sizeof(server->records));
+    if (body->len[i]) {
+      memcpy(server->records + server->len, body->data[i], body->len[i]);
+      server->len += body->len[i];
+    }
+  }
+  server->requests++;
+  result->status_code = 204;
+  return ESP_OK;
+}
+
+static influx_writer_handle_t create_writer(slow_server_t *server,
+                                            size_t batch_max_bytes) {
+  influx_writer_config_t conf = {
+      .buffer_size = 2048,
+      .batch_max_bytes = batch_max_bytes,
+      .batch_max_age_ms = 60 * 1000,
+      .transport = slow_transport,
+      .transport_ctx = server,
+  };
+  return influx_writer_create(&conf);
+}
+
+static influx_uploader_handle_t create_uploader(influx_writer_handle_t writer,
+                                                size_t queue_len,
+                                                influx_drop_policy_t policy) {
+  influx_uploader_config_t conf = {
+      .writer = writer,
+      .queue_len = queue_len,
+      .record_max = RECORD_MAX,
+      .drop_policy = policy,
+      .poll_ms = 100,
+      .task_stack_size = 4096,
+      .task_priority = 2,
+  };
+  return influx_uploader_create(&conf);
+}
+
+typedef struct {
+  influx_uploader_handle_t uploader;
+  int64_t worst_us;  // largest deviation from the sampling period
+  SemaphoreHandle_t done;
+} sampler_t;
+
+/* Samples like bme280_run does and measures how regular the wakeups are. */
+static void sampler_task(void *arg) {
+  sampler_t *sampler = (sampler_t *)arg;
+  char line[RECORD_MAX];
+  TickType_t last_wakeup = xTaskGetTickCount();
+  int64_t last_us = 0;
+
+  for (int i = 0; i < SAMPLES; i++) {
+    vTaskDelayUntil(&last_wakeup, SAMPLE_PERIOD_MS / portTICK_PERIOD_MS);
+    int64_t now = esp_timer_get_time();
+    if (last_us) {
+      int64_t jitter = llabs(now - last_us - SAMPLE_PERIOD_MS * 1000);
+      if (jitter > sampler->worst_us) {
+        sampler->worst_us = jitter;
+      }
+    }
+    last_us = now;
+    snprintf(line, sizeof(line), "m,host=test v=%di", i);
+    influx_uploader_enqueue(sampler->uploader, line);
+  }
+  xSemaphoreGive(sampler->done);
+  vTaskDelete(NULL);
+}
+
+TEST_CASE("influx uploader keeps sampling regular with a slow server",
+          "[influxdb]")
+{
+  const uint32_t latencies_ms[] = {0, 400};
+  int64_t worst_us[2];
+
+  for (int i = 0; i < 2; i++) {
+    slow_server_t server = {.latency_ms = latencies_ms[i]};
+    // every other sample completes a batch
+    influx_writer_handle_t writer = create_writer(&server, 32);
+    TEST_ASSERT_NOT_NULL(writer);
+    influx_uploader_handle_t uploader =
+        create_uploader(writer, SAMPLES, INFLUX_DROP_NEWEST);
+    TEST_ASSERT_NOT_NULL(uploader);
+
+    sampler_t sampler = {.uploader = uploader};
+    sampler.done = xSemaphoreCreateBinary();
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(sampler_task, "sampler", 4096,
+                                          &sampler, 5, NULL));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(sampler.done, portMAX_DELAY));
+    vSemaphoreDelete(sampler.done);
+    worst_us[i] = sampler.worst_us;
+
+    influx_uploader_stats_t stats;
+    influx_uploader_get_stats(uploader, &stats);
+    TEST_ASSERT_EQUAL(SAMPLES, stats.enqueued);
+    TEST_ASSERT_EQUAL(0, stats.dropped_newest);
+    TEST_ASSERT_EQUAL(0, stats.dropped_busy);
+    influx_uploader_delete(uploader);
+    influx_writer_flush(writer);
+    influx_writer_delete(writer);
+
+    // nothing was lost while the server lagged behind
+    int records = 0;
+    for (size_t j = 0; j < server.len; j++) {
+      records += server.records[j] == '\n';
+    }
+    TEST_ASSERT_EQUAL(SAMPLES, records);
+    printf("server latency %u ms: %d requests, worst jitter %u us\n",
+           (unsigned)latencies_ms[i], server.requests, (unsigned)worst_us[i]);
+  }
+
+  // a slow server must not show up in the sampling cadence
+  TEST_ASSERT_LESS_OR_EQUAL(portTICK_PERIOD_MS * 1000, worst_us[1]);
+}
+
+/*
+ * Stall the upload task in a request, overfill the queue and check which
+ * records reach the server once it answers again.
+ */
+static void overfill(influx_drop_policy_t policy, int *first, int *last,
+                     influx_uploader_stats_t *stats) {
+  slow_server_t server = {0};
+  server.entered = xSemaphoreCreateBinary();
+  server.gate = xSemaphoreCreateCounting(16, 0);
+  influx_writer_handle_t writer = create_writer(&server, 1);
+  TEST_ASSERT_NOT_NULL(writer);
+  influx_uploader_handle_t uploader = create_uploader(writer, 4, policy);
+  TEST_ASSERT_NOT_NULL(uploader);
+
+  char line[RECORD_MAX];
+  TEST_ASSERT_EQUAL(ESP_OK, influx_uploader_enqueue(uploader, "m v=0i"));
+  TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(server.entered, portMAX_DELAY));
+  for (int i = 1; i <= 10; i++) {
+    snprintf(line, sizeof(line), "m v=%di", i);
+    esp_err_t err = influx_uploader_enqueue(uploader, line);
+    TEST_ASSERT_EQUAL(policy == INFLUX_DROP_NEWEST && i > 4 ? ESP_ERR_NO_MEM
+                                                            : ESP_OK,
+                      err);
+  }
+  influx_uploader_get_stats(uploader, stats);
+
+  for (int i = 0; i < 16; i++) {
+    xSemaphoreGive(server.gate);
+  }
+  influx_uploader_delete(uploader);
+  influx_writer_flush(writer);
+  influx_writer_delete(writer);
+
+  // record 0 was in flight, the rest are consecutive
+  server.records[server.len] = '\0';
+  TEST_ASSERT_EQUAL_STRING_LEN("m v=0i\n", server.records, 7);
+  char *p = server.records + 7;
+  *first = atoi(p + 4);
+  *last = *first - 1;
+  while (*p) {
+    TEST_ASSERT_EQUAL(*last + 1, atoi(p + 4));
+    *last += 1;
+    p = strchr(p, '\n') + 1;
+  }
+  vSemaphoreDelete(server.entered);
+  vSemaphoreDelete(server.gate);
+}
+
+TEST_CASE("influx uploader drop policies", "[influxdb]")
+{
+  influx_uploader_stats_t stats;
+  int first, last;
+
+  overfill(INFLUX_DROP_OLDEST, &first, &last, &stats);
+  TEST_ASSERT_EQUAL(7, first);
+  TEST_ASSERT_EQUAL(10, last);
+  TEST_ASSERT_EQUAL(6, stats.dropped_oldest);
+  TEST_ASSERT_EQUAL(0, stats.dropped_newest);
+  TEST_ASSERT_EQUAL(0, stats.dropped_busy);
+  TEST_ASSERT_EQUAL(4, stats.high_water);
+
+  overfill(INFLUX_DROP_NEWEST, &first, &last, &stats);
+  TEST_ASSERT_EQUAL(1, first);
+  TEST_ASSERT_EQUAL(4, last);
+  TEST_ASSERT_EQUAL(0, stats.dropped_oldest);
+  TEST_ASSERT_EQUAL(6, stats.dropped_newest);
+  TEST_ASSERT_EQUAL(0, stats.dropped_busy);
+  TEST_ASSERT_EQUAL(4, stats.high_water);
+}
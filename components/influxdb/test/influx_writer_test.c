@@ -0,0 +1,419 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "flash_emu.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "influx_spool.h"
+#include "influx_writer.h"
+#include "unity.h"
+
+#define RECORDS 1000
+
+/* Stand-in for the HTTP transport that only counts what would be sent. */
+typedef struct {
+  int requests;
+  size_t bytes;
+  int status_code;
+  char last[2048];
+  size_t last_len;
+} fake_server_t;
+
+static esp_err_t fake_transport(void *ctx, const influx_body_t *body,
+                                influx_result_t *result) {
+  fake_server_t *server = (fake_server_t *)ctx;
+  server->last_len = 0;
+  for (int i = 0; i < 2; i++) {
+    if (body->len[i]) {
+      memcpy(server->last + server->last_len, body->data[i], body->len[i]);
+      server->last_len += body->len[i];
+    }
+  }
+  server->requests++;
+  server->bytes += server->last_len;
+  result->status_code = server->status_code;
+  return ESP_OK;
+}
+
+static influx_writer_handle_t create_writer(fake_server_t *server,
+                                            size_t batch_max_bytes) {
+  memset(server, 0, sizeof(fake_server_t));
+  server->status_code = 204;
+  influx_writer_config_t conf = {
+      .buffer_size = 2048,
+      .batch_max_bytes = batch_max_bytes,
+      .batch_max_age_ms = 60 * 1000,
+      .transport = fake_transport,
+      .transport_ctx = server,
+  };
+  return influx_writer_create(&conf);
+}
+
+TEST_CASE("influx writer batches records", "[influxdb]")
+{
+  const size_t batch_sizes[] = {64, 256, 1024, 2048};
+  const char *line =
+      "bme280,host=autumns-esp32 temperature=21.53,humidity=40.12,"
+      "pressure=1013.25";
+  fake_server_t server;
+
+  for (int i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+    influx_writer_handle_t writer = create_writer(&server, batch_sizes[i]);
+    TEST_ASSERT_NOT_NULL(writer);
+    for (int j = 0; j < RECORDS; j++) {
+      TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+
+    influx_writer_stats_t stats;
+    influx_writer_get_stats(writer, &stats);
+    TEST_ASSERT_EQUAL(RECORDS, stats.records);
+    TEST_ASSERT_EQUAL(0, stats.dropped);
+    TEST_ASSERT_EQUAL(0, stats.pending);
+    TEST_ASSERT_EQUAL(server.requests, stats.requests);
+    TEST_ASSERT_EQUAL(RECORDS * (strlen(line) + 1), server.bytes);
+    printf("batch %4u bytes: %4d requests, %6u bytes, %4u records/request\n",
+           (unsigned)batch_sizes[i], server.requests, (unsigned)server.bytes,
+           (unsigned)(RECORDS / server.requests));
+    influx_writer_delete(writer);
+  }
+}
+
+TEST_CASE("influx writer keeps batches across failures", "[influxdb]")
+{
+  fake_server_t server;
+  influx_writer_handle_t writer = create_writer(&server, 2048);
+  TEST_ASSERT_NOT_NULL(writer);
+
+  // fill the buffer so that records wrap around its end
+  server.status_code = 503;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, "m v=1"));
+  TEST_ASSERT_EQUAL(ESP_FAIL, influx_writer_flush(writer));
+  server.status_code = 204;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+
+  char line[32];
+  server.status_code = 503;
+  int written = 0;
+  for (int i = 0; i < 400; i++) {
+    snprintf(line, sizeof(line), "m v=%d", i);
+    if (influx_writer_write(writer, line) == ESP_OK) {
+      written++;
+    }
+  }
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.dropped);
+  TEST_ASSERT_EQUAL(400, written + stats.dropped);
+
+  // the first record that was kept must still be the first one sent
+  server.status_code = 204;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  TEST_ASSERT_EQUAL_STRING_LEN("m v=0\nm v=1\n", server.last, 12);
+  TEST_ASSERT_EQUAL(stats.pending, server.last_len);
+
+  // a client error drops the batch instead of retrying it forever
+  server.status_code = 400;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, "m v=bad"));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, influx_writer_flush(writer));
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(1, stats.rejected);
+  TEST_ASSERT_EQUAL(0, stats.pending);
+
+  influx_writer_delete(writer);
+}
+
+/* Transport that checks records "m v=<n>" arrive exactly once, in order. */
+typedef struct {
+  int status_code;
+  int requests;
+  int next;
+} ordered_server_t;
+
+static esp_err_t ordered_transport(void *ctx, const influx_body_t *body,
+                                   influx_result_t *result) {
+  ordered_server_t *server = (ordered_server_t *)ctx;
+  result->status_code = server->status_code;
+  if (server->status_code != 204) {
+    return ESP_OK;
+  }
+  char line[32];
+  size_t len = 0;
+  for (int i = 0; i < 2; i++) {
+    for (size_t j = 0; j < body->len[i]; j++) {
+      char c = body->data[i][j];
+      if (c != '\n') {
+        line[len++] = c;
+        continue;
+      }
+      line[len] = '\0';
+      len = 0;
+      char expected[32];
+      snprintf(expected, sizeof(expected), "m v=%d", server->next++);
+      TEST_ASSERT_EQUAL_STRING(expected, line);
+    }
+  }
+  TEST_ASSERT_EQUAL(0, len);
+  server->requests++;
+  return ESP_OK;
+}
+
+TEST_CASE("influx writer spools batches during outages", "[influxdb]")
+{
+  flash_emu_t *emu = flash_emu_create(8 * 4096, 4096, NULL);
+  TEST_ASSERT_NOT_NULL(emu);
+  influx_spool_flash_t flash;
+  flash_emu_get_flash(emu, &flash);
+  influx_spool_handle_t spool = influx_spool_open(&flash, 2048);
+  TEST_ASSERT_NOT_NULL(spool);
+
+  ordered_server_t server = {.status_code = 503};
+  influx_writer_config_t conf = {
+      .buffer_size = 1024,
+      .batch_max_bytes = 512,
+      .batch_max_age_ms = 60 * 1000,
+      .transport = ordered_transport,
+      .transport_ctx = &server,
+      .spool = spool,
+  };
+  influx_writer_handle_t writer = influx_writer_create(&conf);
+  TEST_ASSERT_NOT_NULL(writer);
+
+  // far more than the RAM buffer holds, nothing may be dropped
+  char line[32];
+  for (int i = 0; i < 400; i++) {
+    snprintf(line, sizeof(line), "m v=%d", i);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+  }
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(0, stats.dropped);
+  TEST_ASSERT_GREATER_THAN(0, stats.spooled);
+
+  // back online: the spool drains first, then RAM, all in order
+  server.status_code = 204;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  TEST_ASSERT_EQUAL(400, server.next);
+  TEST_ASSERT_GREATER_THAN(1, server.requests);
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(0, stats.pending);
+
+  influx_spool_stats_t spool_stats;
+  influx_spool_get_stats(spool, &spool_stats);
+  TEST_ASSERT_EQUAL(0, spool_stats.pending);
+  TEST_ASSERT_EQUAL(spool_stats.appended, spool_stats.drained);
+
+  influx_writer_delete(writer);
+  influx_spool_close(spool);
+  flash_emu_delete(emu);
+}
+
+#define INJECT_RECORDS 200
+
+/*
+ * Stand-in for InfluxDB that refuses lines "m v=bad<n>" and reports the
+ * first of them, counting how often each good line "m v=<n>" was stored.
+ */
+typedef struct {
+  bool partial;            // store the good lines of a rejected batch, like 1.x
+  int status_code;         // answer everything with this instead, if set
+  uint32_t retry_after_s;  // sent along with status_code
+  int requests;
+  uint8_t stored[INJECT_RECORDS];
+  char flat[4096];
+} inject_server_t;
+
+static esp_err_t inject_transport(void *ctx, const influx_body_t *body,
+                                  influx_result_t *result) {
+  inject_server_t *server = (inject_server_t *)ctx;
+  server->requests++;
+  if (server->status_code) {
+    result->status_code = server->status_code;
+    result->retry_after_s = server->retry_after_s;
+    return ESP_OK;
+  }
+
+  TEST_ASSERT_TRUE(body->len[0] + body->len[1] < sizeof(server->flat));
+  size_t len = 0;
+  for (int i = 0; i < 2; i++) {
+    if (body->len[i]) {
+      memcpy(server->flat + len, body->data[i], body->len[i]);
+      len += body->len[i];
+    }
+  }
+  server->flat[len] = '\0';
+
+  uint32_t line = 0;
+  uint32_t first_bad = 0;
+  for (char *p = server->flat; *p; p = strchr(p, '\n') + 1) {
+    line++;
+    if (!strncmp(p, "m v=bad", 7) && !first_bad) {
+      first_bad = line;
+    }
+  }
+  if (!first_bad || server->partial) {
+    for (char *p = server->flat; *p; p = strchr(p, '\n') + 1) {
+      if (strncmp(p, "m v=bad", 7)) {
+        server->stored[atoi(p + 4)]++;
+      }
+    }
+  }
+  result->status_code = first_bad ? 400 : 204;
+  result->error_line = first_bad;
+  result->partial = first_bad && server->partial;
+  return ESP_OK;
+}
+
+static influx_writer_handle_t create_inject_writer(inject_server_t *server,
+                                                   influx_spool_handle_t spool) {
+  influx_writer_config_t conf = {
+      .buffer_size = 2048,
+      .batch_max_bytes = 256,
+      .batch_max_age_ms = 60 * 1000,
+      .transport = inject_transport,
+      .transport_ctx = server,
+      .spool = spool,
+  };
+  return influx_writer_create(&conf);
+}
+
+/* Write records 0..count-1, the ones with i % every == every / 2 are bad. */
+static int write_injected(influx_writer_handle_t writer, int count,
+                          int every) {
+  char line[32];
+  int bad = 0;
+  for (int i = 0; i < count; i++) {
+    if (i % every == every / 2) {
+      snprintf(line, sizeof(line), "m v=bad%d", i);
+      bad++;
+    } else {
+      snprintf(line, sizeof(line), "m v=%d", i);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+  }
+  return bad;
+}
+
+static void check_stored_once(const inject_server_t *server, int count,
+                              int every) {
+  for (int i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL(i % every == every / 2 ? 0 : 1, server->stored[i]);
+  }
+}
+
+TEST_CASE("influx writer quarantines lines the server rejects", "[influxdb]")
+{
+  for (int partial = 0; partial < 2; partial++) {
+    inject_server_t server = {.partial = partial};
+    influx_writer_handle_t writer = create_inject_writer(&server, NULL);
+    TEST_ASSERT_NOT_NULL(writer);
+
+    int bad = write_injected(writer, INJECT_RECORDS, 10);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+    check_stored_once(&server, INJECT_RECORDS, 10);
+
+    influx_writer_stats_t stats;
+    influx_writer_get_stats(writer, &stats);
+    if (partial) {
+      // the server drops all bad lines of a batch but only names the first
+      TEST_ASSERT_GREATER_THAN(0, stats.quarantined);
+      TEST_ASSERT_LESS_OR_EQUAL(bad, stats.quarantined);
+    } else {
+      TEST_ASSERT_EQUAL(bad, stats.quarantined);
+    }
+    TEST_ASSERT_EQUAL(0, stats.rejected);
+    TEST_ASSERT_EQUAL(0, stats.pending);
+    // a bad line costs at most two extra requests, the rejected one and
+    // one for the lines in front of it, none if the server kept the rest
+    if (partial) {
+      TEST_ASSERT_EQUAL(stats.requests, server.requests);
+    } else {
+      TEST_ASSERT_LESS_OR_EQUAL(stats.requests + 2 * bad, server.requests);
+    }
+    influx_writer_delete(writer);
+  }
+}
+
+TEST_CASE("influx writer gives up on batches with many bad lines",
+          "[influxdb]")
+{
+  inject_server_t server = {0};
+  influx_writer_handle_t writer = create_inject_writer(&server, NULL);
+  TEST_ASSERT_NOT_NULL(writer);
+
+  // a single batch that is mostly garbage
+  char line[32];
+  for (int i = 0; i < 20; i++) {
+    snprintf(line, sizeof(line), "m v=%s%d", i % 2 ? "" : "bad", i);
+    TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, line));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_RESPONSE, influx_writer_flush(writer));
+
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(1, stats.rejected);
+  TEST_ASSERT_EQUAL(0, stats.pending);
+  // MAX_QUARANTINE cuts, then the rest of the batch is dropped: nine
+  // rejected requests and seven for the good lines between the bad ones
+  TEST_ASSERT_EQUAL(8, stats.quarantined);
+  TEST_ASSERT_EQUAL(16, server.requests);
+  influx_writer_delete(writer);
+}
+
+TEST_CASE("influx writer quarantines lines in spooled batches", "[influxdb]")
+{
+  flash_emu_t *emu = flash_emu_create(8 * 4096, 4096, NULL);
+  TEST_ASSERT_NOT_NULL(emu);
+  influx_spool_flash_t flash;
+  flash_emu_get_flash(emu, &flash);
+  influx_spool_handle_t spool = influx_spool_open(&flash, 2048);
+  TEST_ASSERT_NOT_NULL(spool);
+
+  inject_server_t server = {.status_code = 503};
+  influx_writer_handle_t writer = create_inject_writer(&server, spool);
+  TEST_ASSERT_NOT_NULL(writer);
+
+  // spooled chunks are about one batch, so each holds at most one bad line
+  int bad = write_injected(writer, INJECT_RECORDS, 40);
+  server.status_code = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  check_stored_once(&server, INJECT_RECORDS, 40);
+
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.spooled);
+  TEST_ASSERT_EQUAL(bad, stats.quarantined);
+  TEST_ASSERT_EQUAL(0, stats.rejected);
+
+  influx_writer_delete(writer);
+  influx_spool_close(spool);
+  flash_emu_delete(emu);
+}
+
+TEST_CASE("influx writer honours Retry-After", "[influxdb]")
+{
+  inject_server_t server = {.status_code = 429, .retry_after_s = 1};
+  influx_writer_handle_t writer = create_inject_writer(&server, NULL);
+  TEST_ASSERT_NOT_NULL(writer);
+
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_write(writer, "m v=1"));
+  TEST_ASSERT_EQUAL(ESP_FAIL, influx_writer_flush(writer));
+  server.status_code = 0;
+
+  // nothing goes out until the server is ready again
+  TEST_ASSERT_EQUAL(ESP_ERR_TIMEOUT, influx_writer_flush(writer));
+  TEST_ASSERT_EQUAL(1, server.requests);
+  vTaskDelay(1100 / portTICK_PERIOD_MS);
+  TEST_ASSERT_EQUAL(ESP_OK, influx_writer_flush(writer));
+  TEST_ASSERT_EQUAL(2, server.requests);
+  TEST_ASSERT_EQUAL(1, server.stored[1]);
+
+  influx_writer_stats_t stats;
+  influx_writer_get_stats(writer, &stats);
+  TEST_ASSERT_EQUAL(1, stats.deferred);
+  TEST_ASSERT_EQUAL(1, stats.failed);
+  influx_writer_delete(writer);
+}
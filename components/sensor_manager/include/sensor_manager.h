@@ -0,0 +1,123 @@
+#ifndef _SENSOR_MANAGER_H_
+#define _SENSOR_MANAGER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "influx_line.h"
+#include "iot_i2c_bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+  SENSOR_BME280,
+  SENSOR_BME680,
+} sensor_type_t;
+
+/**
+ * One sensor of a node, a row of the table the manager is configured from.
+ *
+ * Oversampling takes the codes both drivers use: 0 skips the measurement,
+ * 1 to 5 are 1x to 16x. The BME280 needs all three measurements. The filter
+ * is a bme280_sensor_filter or bme680_filter_size_t.
+ */
+typedef struct {
+  uint8_t type;         // sensor_type_t
+  uint8_t port;         // I2C port
+  uint8_t addr;         // I2C address
+  uint8_t osr_t;        // temperature oversampling
+  uint8_t osr_p;        // pressure oversampling
+  uint8_t osr_h;        // humidity oversampling
+  uint8_t filter;       // IIR filter setting
+  uint16_t period_ms;   // time between samples
+  uint16_t heater_c;    // BME680 heater temperature, 0 skips the gas reading
+  uint16_t heater_ms;   // BME680 heating time
+  const char *location; // value of the location tag, NULL for none
+} sensor_config_t;
+
+typedef struct {
+  uint32_t samples;  // records handed to the sink
+  uint32_t errors;   // measurements that could not be started or read
+  uint32_t busy_us;  // time the scheduler spent on it, bus transfers included
+} sensor_stats_t;
+
+/**
+ * Takes the record of a sample. The fields are filled in, the sink finishes
+ * the line with a timestamp and sends it. Runs in the scheduler task.
+ */
+typedef void (*sensor_sink_t)(const sensor_config_t *config,
+                              influx_line_t *line, void *arg);
+
+typedef struct sensor_manager *sensor_manager_handle_t;
+
+/**
+ * @brief Create a manager for up to capacity sensors
+ *
+ * @param host value of the host tag of every record
+ * @param sink takes the records, with arg
+ *
+ * @return the manager, NULL when out of memory
+ */
+sensor_manager_handle_t sensor_manager_create(size_t capacity,
+                                              const char *host,
+                                              sensor_sink_t sink, void *arg);
+
+/**
+ * @brief Start the driver of a sensor and schedule its samples
+ *
+ * The first sample is taken at the next poll. Records are tagged with the
+ * address, host, location and port.
+ *
+ * @param config kept by the manager, must outlive it
+ * @param bus bus of config->port, shared with the other sensors on it
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM the manager is full or out of memory
+ *     - ESP_ERR_INVALID_ARG unknown sensor type
+ *     - ESP_ERR_INVALID_SIZE the tags don't fit a series
+ *     - ESP_FAIL the sensor did not answer or refused the settings
+ */
+esp_err_t sensor_manager_add(sensor_manager_handle_t mgr,
+                             const sensor_config_t *config,
+                             i2c_bus_handle_t bus);
+
+/**
+ * @brief Start the measurements that are due and collect the finished ones
+ *
+ * Conversions of all sensors overlap, the scheduler only waits for the bus.
+ *
+ * @return ticks until the next start or collection
+ */
+TickType_t sensor_manager_poll(sensor_manager_handle_t mgr);
+
+/**
+ * @brief Drive all sensors from one task that polls and sleeps in between
+ */
+esp_err_t sensor_manager_start(sensor_manager_handle_t mgr,
+                               uint32_t stack_depth, UBaseType_t priority);
+
+/**
+ * @brief Number of sensors added
+ */
+size_t sensor_manager_count(sensor_manager_handle_t mgr);
+
+/**
+ * @brief Counters of the sensor added as index, since it was added
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG no such sensor
+ */
+esp_err_t sensor_manager_get_stats(sensor_manager_handle_t mgr, size_t index,
+                                   sensor_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // _SENSOR_MANAGER_H_
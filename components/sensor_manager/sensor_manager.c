@@ -0,0 +1,266 @@
+#include "sensor_manager.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bme680.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "iot_bme280.h"
+
+static const char *TAG = "SENSORS";
+
+#define SENSOR_LINE_MAX 192  // the longest record, a BME680 with gas
+
+typedef struct {
+  const sensor_config_t *config;
+  union {
+    bme280_handle_t bme280;
+    bme680_sensor_t *bme680;
+  } dev;
+  influx_series_t series;
+  TickType_t next;   // start of the next sample
+  TickType_t ready;  // the running conversion is done
+  bool measuring;
+  sensor_stats_t stats;
+} sensor_t;
+
+struct sensor_manager {
+  const char *host;
+  sensor_sink_t sink;
+  void *arg;
+  size_t capacity;
+  size_t count;
+  char line[SENSOR_LINE_MAX];  // one record at a time, in the scheduler task
+  sensor_t sensors[];
+};
+
+// tick a is at or past b, across the wrap
+static bool tick_reached(TickType_t a, TickType_t b) {
+  return (int32_t)(a - b) >= 0;
+}
+
+sensor_manager_handle_t sensor_manager_create(size_t capacity,
+                                              const char *host,
+                                              sensor_sink_t sink, void *arg) {
+  sensor_manager_handle_t mgr =
+      calloc(1, sizeof(*mgr) + capacity * sizeof(sensor_t));
+  if (!mgr) return NULL;
+  mgr->host = host;
+  mgr->sink = sink;
+  mgr->arg = arg;
+  mgr->capacity = capacity;
+  return mgr;
+}
+
+static esp_err_t bme280_add(sensor_t *sensor, i2c_bus_handle_t bus) {
+  const sensor_config_t *config = sensor->config;
+
+  sensor->dev.bme280 = iot_bme280_create(bus, config->addr);
+  if (!sensor->dev.bme280) return ESP_ERR_NO_MEM;
+  // forced mode, the scheduler starts each conversion
+  if (iot_bme280_init(sensor->dev.bme280) != ESP_OK ||
+      iot_bme280_set_sampling(sensor->dev.bme280, BME280_MODE_FORCED,
+                              config->osr_t, config->osr_p, config->osr_h,
+                              config->filter,
+                              BME280_STANDBY_MS_0_5) != ESP_OK) {
+    iot_bme280_delete(sensor->dev.bme280, false);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t bme680_add(sensor_t *sensor, i2c_bus_handle_t bus) {
+  const sensor_config_t *config = sensor->config;
+
+  // the driver's I2C shim finds the bus by port
+  i2c_attach(config->port, bus);
+  bme680_sensor_t *dev = bme680_init_sensor(config->port, config->addr, 0);
+  if (!dev) return ESP_FAIL;
+  if (!bme680_set_oversampling_rates(dev, config->osr_t, config->osr_p,
+                                     config->osr_h) ||
+      !bme680_set_filter_size(dev, config->filter)) {
+    free(dev);
+    return ESP_FAIL;
+  }
+  if (config->heater_c) {
+    bme680_set_heater_profile(dev, 0, config->heater_c, config->heater_ms);
+    bme680_use_heater_profile(dev, 0);
+  } else {
+    bme680_use_heater_profile(dev, BME680_HEATER_NOT_USED);
+  }
+  sensor->dev.bme680 = dev;
+  return ESP_OK;
+}
+
+esp_err_t sensor_manager_add(sensor_manager_handle_t mgr,
+                             const sensor_config_t *config,
+                             i2c_bus_handle_t bus) {
+  static const char *const names[] = {"bme280", "bme680"};
+  char port[4], addr[8];
+  esp_err_t err;
+
+  if (config->type >= sizeof(names) / sizeof(names[0]))
+    return ESP_ERR_INVALID_ARG;
+  if (mgr->count == mgr->capacity) return ESP_ERR_NO_MEM;
+
+  sensor_t *sensor = &mgr->sensors[mgr->count];
+  sensor->config = config;
+  snprintf(port, sizeof(port), "%d", config->port);
+  snprintf(addr, sizeof(addr), "0x%02x", config->addr);
+  const char *const tags[] = {"addr", addr,  "host",     mgr->host,
+                              "port", port, "location", config->location};
+  // the location sorts between host and port when it is there
+  const char *const sorted[] = {tags[0], tags[1], tags[2], tags[3],
+                                tags[6], tags[7], tags[4], tags[5]};
+  err = influx_series_init(&sensor->series, names[config->type],
+                           config->location ? sorted : tags,
+                           config->location ? 4 : 3);
+  if (err != ESP_OK) return err;
+
+  if (config->type == SENSOR_BME280)
+    err = bme280_add(sensor, bus);
+  else
+    err = bme680_add(sensor, bus);
+  if (err != ESP_OK) return err;
+
+  sensor->next = xTaskGetTickCount();
+  sensor->measuring = false;
+  mgr->count++;
+  return ESP_OK;
+}
+
+static bool bme280_start(sensor_t *sensor, TickType_t *duration) {
+  *duration = iot_bme280_get_measurement_duration(sensor->dev.bme280);
+  return iot_bme280_start_forced_measurement(sensor->dev.bme280) == ESP_OK;
+}
+
+static bool bme680_start(sensor_t *sensor, TickType_t *duration) {
+  *duration = bme680_get_measurement_duration(sensor->dev.bme680);
+  return bme680_force_measurement(sensor->dev.bme680);
+}
+
+static bool bme280_collect(sensor_t *sensor, influx_line_t *line) {
+  bme280_values_fixed_t values;
+
+  if (iot_bme280_collect_forced_measurement(sensor->dev.bme280, &values) !=
+      ESP_OK)
+    return false;
+  influx_line_add_fixed(line, "temperature", values.temperature, 2);
+  // %RH * 1024 to thousandths and Pa * 256 to Pa, rounded
+  influx_line_add_fixed(line, "humidity", (values.humidity * 1000 + 512) / 1024,
+                        3);
+  influx_line_add_fixed(line, "pressure", (values.pressure + 128) >> 8, 2);
+  return true;
+}
+
+static bool bme680_collect(sensor_t *sensor, influx_line_t *line) {
+  const sensor_config_t *config = sensor->config;
+  bme680_values_fixed_t values;
+
+  if (!bme680_get_results_fixed(sensor->dev.bme680, &values)) return false;
+  // skipped measurements are left out instead of sent as invalid values
+  if (config->osr_t) {
+    influx_line_add_fixed(line, "temperature", values.temperature, 2);
+  }
+  if (config->osr_h) {
+    influx_line_add_fixed(line, "humidity", values.humidity, 3);
+  }
+  if (config->osr_p) {
+    influx_line_add_fixed(line, "pressure", values.pressure, 2);
+  }
+  if (config->heater_c) {
+    influx_line_add_fixed(line, "gas_resistance", values.gas_resistance, 0);
+  }
+  return true;
+}
+
+// start or collect the sample of a sensor when it is due
+static void sensor_step(sensor_manager_handle_t mgr, sensor_t *sensor,
+                        TickType_t now) {
+  const sensor_config_t *config = sensor->config;
+  bool ok;
+
+  if (sensor->measuring) {
+    if (!tick_reached(now, sensor->ready)) return;
+    influx_line_t line;
+    influx_line_begin(&line, mgr->line, sizeof(mgr->line), &sensor->series);
+    sensor->measuring = false;
+    if (config->type == SENSOR_BME280)
+      ok = bme280_collect(sensor, &line);
+    else
+      ok = bme680_collect(sensor, &line);
+    if (ok) {
+      mgr->sink(config, &line, mgr->arg);
+      sensor->stats.samples++;
+    } else {
+      sensor->stats.errors++;
+    }
+    return;
+  }
+
+  if (!tick_reached(now, sensor->next)) return;
+  TickType_t duration;
+  if (config->type == SENSOR_BME280)
+    ok = bme280_start(sensor, &duration);
+  else
+    ok = bme680_start(sensor, &duration);
+  if (ok) {
+    sensor->measuring = true;
+    sensor->ready = now + duration;
+  } else {
+    sensor->stats.errors++;
+  }
+  // keep the rate, unless the scheduler fell a whole period behind
+  sensor->next += config->period_ms / portTICK_PERIOD_MS;
+  if (tick_reached(now, sensor->next))
+    sensor->next = now + config->period_ms / portTICK_PERIOD_MS;
+}
+
+TickType_t sensor_manager_poll(sensor_manager_handle_t mgr) {
+  TickType_t now = xTaskGetTickCount();
+  TickType_t wait = portMAX_DELAY;
+
+  for (size_t i = 0; i < mgr->count; i++) {
+    sensor_t *sensor = &mgr->sensors[i];
+    int64_t start = esp_timer_get_time();
+    sensor_step(mgr, sensor, now);
+    sensor->stats.busy_us += esp_timer_get_time() - start;
+
+    TickType_t due = sensor->measuring ? sensor->ready : sensor->next;
+    if (tick_reached(now, due))
+      wait = 0;
+    else if (due - now < wait)
+      wait = due - now;
+  }
+  return wait;
+}
+
+static void sensor_manager_run(void *arg) {
+  sensor_manager_handle_t mgr = arg;
+
+  while (1) {
+    vTaskDelay(sensor_manager_poll(mgr));
+  }
+}
+
+esp_err_t sensor_manager_start(sensor_manager_handle_t mgr,
+                               uint32_t stack_depth, UBaseType_t priority) {
+  if (xTaskCreate(sensor_manager_run, "sensors", stack_depth, mgr, priority,
+                  NULL) != pdPASS) {
+    ESP_LOGE(TAG, "could not start the scheduler task");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+size_t sensor_manager_count(sensor_manager_handle_t mgr) { return mgr->count; }
+
+esp_err_t sensor_manager_get_stats(sensor_manager_handle_t mgr, size_t index,
+                                   sensor_stats_t *stats) {
+  if (index >= mgr->count) return ESP_ERR_INVALID_ARG;
+  *stats = mgr->sensors[index].stats;
+  return ESP_OK;
+}
@@ -0,0 +1,216 @@
+#include "sdkconfig.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bme280_sim.h"
+#include "bme680_sim.h"
+#include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "i2c_sim.h"
+#include "iot_i2c_bus.h"
+#include "sensor_manager.h"
+#include "unity.h"
+
+#define RUN_S 10
+#define LINE_MAX 192
+
+static const i2c_sim_point_t s_temperature[] = {{0, 21.5}};
+static const i2c_sim_point_t s_humidity[] = {{0, 45}};
+static const i2c_sim_point_t s_pressure[] = {{0, 1013.25}};
+static const i2c_sim_point_t s_gas[] = {{0, 50000}};
+
+// an enclosure with both kinds of sensors at both addresses of both ports
+static const sensor_config_t s_table[] = {
+    {SENSOR_BME280, I2C_NUM_0, 0x76, 1, 1, 1, 0, 1000, 0, 0, "inlet"},
+    {SENSOR_BME680, I2C_NUM_0, 0x77, 3, 0, 2, 3, 2000, 200, 100, "inlet"},
+    {SENSOR_BME680, I2C_NUM_1, 0x76, 1, 1, 1, 0, 500, 0, 0, NULL},
+    {SENSOR_BME280, I2C_NUM_1, 0x77, 5, 5, 5, 0, 1000, 0, 0, "outlet"},
+};
+
+static bme280_sim_t s_bme280[2];
+static bme680_sim_t s_bme680[2];
+static i2c_bus_handle_t s_buses[I2C_NUM_MAX];
+static sensor_manager_handle_t s_managers[5];
+
+static uint32_t s_records[sizeof(s_table) / sizeof(s_table[0])];
+static char s_lines[sizeof(s_table) / sizeof(s_table[0])][LINE_MAX];
+
+static void test_sink(const sensor_config_t *config, influx_line_t *line,
+                      void *arg) {
+  size_t i = config - s_table;
+  TEST_ASSERT_TRUE(influx_line_finish(line, 0) > 0);
+  TEST_ASSERT_TRUE(i < sizeof(s_table) / sizeof(s_table[0]));
+  s_records[i]++;
+  strncpy(s_lines[i], line->buf, LINE_MAX - 1);
+}
+
+static void test_discard(const sensor_config_t *config, influx_line_t *line,
+                         void *arg) {
+  TEST_ASSERT_TRUE(influx_line_finish(line, 0) > 0);
+}
+
+// a BME280 at 0x76 and a BME680 at 0x77 of each port, or two of a kind
+static void test_sims(bool mixed, sensor_type_t kind) {
+  i2c_config_t conf = {
+      .mode = I2C_MODE_MASTER,
+      .master.clk_speed = 400000,
+  };
+
+  i2c_sim_attach(NULL);
+  for (int i = 0; i < 2; i++) {
+    s_bme280[i].temperature = (i2c_sim_wave_t){s_temperature, 1};
+    s_bme280[i].humidity = (i2c_sim_wave_t){s_humidity, 1};
+    s_bme280[i].pressure = (i2c_sim_wave_t){s_pressure, 1};
+    s_bme680[i].temperature = (i2c_sim_wave_t){s_temperature, 1};
+    s_bme680[i].humidity = (i2c_sim_wave_t){s_humidity, 1};
+    s_bme680[i].pressure = (i2c_sim_wave_t){s_pressure, 1};
+    s_bme680[i].gas = (i2c_sim_wave_t){s_gas, 1};
+    if (mixed) {
+      bme280_sim_init(&s_bme280[i], i == 0 ? I2C_NUM_0 : I2C_NUM_1, 0x76 + i);
+      bme680_sim_init(&s_bme680[i], i == 0 ? I2C_NUM_0 : I2C_NUM_1, 0x77 - i,
+                      0);
+    } else {
+      bme280_sim_init(&s_bme280[i], I2C_NUM_0, 0x76 + i);
+      bme680_sim_init(&s_bme680[i], I2C_NUM_0, 0x76 + i, 0);
+    }
+    if (mixed || kind == SENSOR_BME280) i2c_sim_attach(&s_bme280[i].dev);
+    if (mixed || kind == SENSOR_BME680) i2c_sim_attach(&s_bme680[i].dev);
+  }
+  // the buses stay, the BME680 shim keeps a handle of each port
+  for (int port = 0; port < I2C_NUM_MAX; port++) {
+    if (!s_buses[port]) s_buses[port] = iot_i2c_bus_create(port, &conf);
+    TEST_ASSERT_NOT_NULL(s_buses[port]);
+  }
+  i2c_sim_reset_stats();
+  memset(s_records, 0, sizeof(s_records));
+}
+
+static void test_run(sensor_manager_handle_t mgr, uint32_t seconds) {
+  TickType_t start = xTaskGetTickCount();
+  while (xTaskGetTickCount() - start < seconds * 1000 / portTICK_PERIOD_MS) {
+    vTaskDelay(sensor_manager_poll(mgr));
+  }
+}
+
+static float test_field(const char *line, const char *key) {
+  float value = 0;
+  const char *field = strstr(line, key);
+  TEST_ASSERT_NOT_NULL(field);
+  sscanf(field + strlen(key), "%f", &value);
+  return value;
+}
+
+TEST_CASE("sensor manager drives several sensors from one task",
+          "[sensor_manager][host]") {
+  size_t count = sizeof(s_table) / sizeof(s_table[0]);
+  sensor_stats_t stats;
+
+  test_sims(true, SENSOR_BME280);
+  s_managers[0] = sensor_manager_create(count, "node", test_sink, NULL);
+  TEST_ASSERT_NOT_NULL(s_managers[0]);
+  for (int i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, sensor_manager_add(s_managers[0], &s_table[i],
+                                                 s_buses[s_table[i].port]));
+  }
+  TEST_ASSERT_EQUAL(count, sensor_manager_count(s_managers[0]));
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM,
+                    sensor_manager_add(s_managers[0], &s_table[0],
+                                       s_buses[I2C_NUM_0]));
+
+  test_run(s_managers[0], RUN_S);
+  for (int i = 0; i < count; i++) {
+    printf("%s\n", s_lines[i]);
+    TEST_ASSERT_EQUAL(ESP_OK, sensor_manager_get_stats(s_managers[0], i, &stats));
+    TEST_ASSERT_EQUAL(0, stats.errors);
+    TEST_ASSERT_EQUAL(s_records[i], stats.samples);
+    TEST_ASSERT_INT_WITHIN(1, RUN_S * 1000 / s_table[i].period_ms,
+                           s_records[i]);
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 21.5, test_field(s_lines[i], "temperature="));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    sensor_manager_get_stats(s_managers[0], count, &stats));
+
+  // tags tell the sensors apart, skipped measurements are left out
+  TEST_ASSERT_EQUAL(0, strncmp(s_lines[0],
+                               "bme280,addr=0x76,host=node,location=inlet,"
+                               "port=0 ", 49));
+  TEST_ASSERT_EQUAL(0, strncmp(s_lines[2], "bme680,addr=0x76,host=node,port=1 ",
+                               34));
+  TEST_ASSERT_NULL(strstr(s_lines[1], "pressure="));
+  TEST_ASSERT_FLOAT_WITHIN(500, 50000, test_field(s_lines[1], "gas_resistance="));
+  TEST_ASSERT_NULL(strstr(s_lines[2], "gas_resistance="));
+  TEST_ASSERT_FLOAT_WITHIN(0.05, 1013.25, test_field(s_lines[3], "pressure="));
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 45, test_field(s_lines[3], "humidity="));
+  i2c_sim_attach(NULL);
+}
+
+static size_t test_heap(void) { return mallinfo2().uordblks; }
+
+static int64_t test_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+TEST_CASE("sensor manager cost per sensor", "[sensor_manager][host]") {
+  // two of a kind on port 0, sampled once a second
+  static const sensor_config_t rows[][2] = {
+      {{SENSOR_BME280, I2C_NUM_0, 0x76, 1, 1, 1, 0, 1000, 0, 0, NULL},
+       {SENSOR_BME280, I2C_NUM_0, 0x77, 1, 1, 1, 0, 1000, 0, 0, NULL}},
+      {{SENSOR_BME680, I2C_NUM_0, 0x76, 3, 1, 2, 3, 1000, 200, 100, NULL},
+       {SENSOR_BME680, I2C_NUM_0, 0x77, 3, 1, 2, 3, 1000, 200, 100, NULL}},
+  };
+
+  for (int kind = 0; kind < 2; kind++) {
+    size_t heap[3];
+    i2c_sim_stats_t bus;
+
+    test_sims(false, rows[kind][0].type);
+    // a manager with room for one more takes one more slot
+    heap[0] = test_heap();
+    s_managers[1 + 2 * kind] = sensor_manager_create(1, "node", test_discard, NULL);
+    heap[1] = test_heap();
+    sensor_manager_handle_t mgr = sensor_manager_create(2, "node",
+                                                        test_discard, NULL);
+    s_managers[2 + 2 * kind] = mgr;
+    heap[2] = test_heap();
+    size_t slot = (heap[2] - heap[1]) - (heap[1] - heap[0]);
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      sensor_manager_add(mgr, &rows[kind][0], s_buses[I2C_NUM_0]));
+    TEST_ASSERT_EQUAL(ESP_OK,
+                      sensor_manager_add(mgr, &rows[kind][1], s_buses[I2C_NUM_0]));
+    size_t driver = (test_heap() - heap[2]) / 2;
+
+    i2c_sim_reset_stats();
+    int64_t cpu = test_cpu_ns();
+    test_run(mgr, RUN_S);
+    cpu = test_cpu_ns() - cpu;
+    i2c_sim_get_stats(I2C_NUM_0, &bus);
+
+    uint32_t samples = 0;
+    for (int i = 0; i < 2; i++) {
+      sensor_stats_t stats;
+      sensor_manager_get_stats(mgr, i, &stats);
+      TEST_ASSERT_EQUAL(0, stats.errors);
+      samples += stats.samples;
+    }
+    // the CPU time includes the simulated sensors, an upper bound
+    printf("%s: %zu bytes a sensor, %zu in the manager and %zu for the "
+           "driver\n",
+           kind ? "bme680" : "bme280", slot + driver, slot, driver);
+    printf("%s: %u samples, %.1f us host CPU and %.1f us on the 400 kHz bus "
+           "each, %.1f commands\n",
+           kind ? "bme680" : "bme280", samples, cpu / 1000.0 / samples,
+           bus.bus_ns / 1000.0 / samples, (float)bus.transactions / samples);
+    TEST_ASSERT_INT_WITHIN(2, 2 * RUN_S, samples);
+    // host pointers are twice the size, a sensor takes less on the ESP32
+    TEST_ASSERT_TRUE(slot + driver < 4096);
+  }
+  i2c_sim_attach(NULL);
+}
+#endif
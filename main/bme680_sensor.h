@@ -1,4 +0,0 @@
-#include "bme680.h"
-#include "esp_log.h"
-
-void bme680_init(void);
\ No newline at end of file
@@ -0,0 +1,281 @@
+#include "sensors.h"
+
+#include <stdio.h>
+
+#include "bme680.h"
+#include "driver/i2c.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "iot_bme280.h"
+#include "iot_i2c_bus.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "sensor_manager.h"
+#include "uploader.h"
+
+static const char *SENSORS_TAG = "SENSORS";
+
+// both Bosch sensors keep their chip ID at 0xD0 and answer at 0x76 or 0x77
+#define SENSORS_ID_REG 0xD0
+#define SENSORS_BME280_ID 0x60
+#define SENSORS_BME680_ID 0x61
+// auto clock remembers the rate each port settled on here
+#define SENSORS_NVS_NAMESPACE "i2c"
+
+static const uint8_t sensor_addrs[] = {0x76, 0x77};
+
+#ifdef CONFIG_BME280_TRANSPORT_UDP
+#define BME280_TRANSPORT UPLOADER_UDP
+#else
+#define BME280_TRANSPORT UPLOADER_HTTP
+#endif
+#ifdef CONFIG_BME680_TRANSPORT_UDP
+#define BME680_TRANSPORT UPLOADER_UDP
+#else
+#define BME680_TRANSPORT UPLOADER_HTTP
+#endif
+
+// every position a sensor can be found at with how it is sampled, only the
+// ones the probe finds are started; give them a location to tell enclosures
+// apart
+#define SENSORS_BME280(port, addr)                                     \
+  {SENSOR_BME280, port, addr, BME280_SAMPLING_X16, BME280_SAMPLING_X16, \
+   BME280_SAMPLING_X16, BME280_FILTER_OFF, 1000, 0, 0, NULL}
+// pressure is skipped, the heater runs at 200 degC for 100 ms
+#define SENSORS_BME680(port, addr)                                          \
+  {SENSOR_BME680, port, addr, osr_4x, osr_none, osr_2x, iir_size_7, 1000, \
+   200, 100, NULL}
+
+static const sensor_config_t sensor_table[] = {
+#ifdef CONFIG_ENABLE_BME280_SENSOR
+    SENSORS_BME280(I2C_NUM_0, 0x76), SENSORS_BME280(I2C_NUM_0, 0x77),
+    SENSORS_BME280(I2C_NUM_1, 0x76), SENSORS_BME280(I2C_NUM_1, 0x77),
+#endif
+#ifdef CONFIG_ENABLE_BME680_SENSOR
+    SENSORS_BME680(I2C_NUM_0, 0x76), SENSORS_BME680(I2C_NUM_0, 0x77),
+    SENSORS_BME680(I2C_NUM_1, 0x76), SENSORS_BME680(I2C_NUM_1, 0x77),
+#endif
+};
+
+// ports with sensors, for the traffic counters
+static i2c_bus_handle_t sensor_buses[I2C_NUM_MAX];
+static sensor_manager_handle_t sensor_manager;
+
+#ifndef CONFIG_I2C_PORT0_CLOCK_AUTO
+#define CONFIG_I2C_PORT0_CLOCK_AUTO 0
+#endif
+#ifndef CONFIG_I2C_PORT1_CLOCK_AUTO
+#define CONFIG_I2C_PORT1_CLOCK_AUTO 0
+#endif
+
+static const struct {
+  i2c_port_t port;
+  int scl;
+  int sda;
+  uint32_t clk_hz;
+  bool auto_clock;
+} sensor_ports[] = {
+#ifdef CONFIG_I2C_PORT0_ENABLE
+    {I2C_NUM_0, CONFIG_I2C_PORT0_SCL, CONFIG_I2C_PORT0_SDA,
+     CONFIG_I2C_PORT0_CLOCK_HZ, CONFIG_I2C_PORT0_CLOCK_AUTO},
+#endif
+#ifdef CONFIG_I2C_PORT1_ENABLE
+    {I2C_NUM_1, CONFIG_I2C_PORT1_SCL, CONFIG_I2C_PORT1_SDA,
+     CONFIG_I2C_PORT1_CLOCK_HZ, CONFIG_I2C_PORT1_CLOCK_AUTO},
+#endif
+};
+
+static void sensors_clock_key(i2c_port_t port, char *key) {
+  snprintf(key, 8, "clk%d", port);
+}
+
+// the clock auto mode settled on last time, or clk_hz if there is none
+static uint32_t sensors_load_clock(i2c_port_t port, uint32_t clk_hz) {
+  nvs_handle_t nvs;
+  char key[8];
+  uint32_t saved;
+
+  sensors_clock_key(port, key);
+  if (nvs_open(SENSORS_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+    return clk_hz;
+  if (nvs_get_u32(nvs, key, &saved) == ESP_OK && saved > 0 && saved < clk_hz)
+    clk_hz = saved;
+  nvs_close(nvs);
+  return clk_hz;
+}
+
+static void sensors_save_clock(i2c_port_t port, uint32_t clk_hz, void *arg) {
+  nvs_handle_t nvs;
+  char key[8];
+
+  sensors_clock_key(port, key);
+  if (nvs_open(SENSORS_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+  if (nvs_set_u32(nvs, key, clk_hz) == ESP_OK) nvs_commit(nvs);
+  nvs_close(nvs);
+}
+
+static void sensors_send(const sensor_config_t *config, influx_line_t *line,
+                         void *arg) {
+  if (influx_line_finish(line, uploader_timestamp()) <= 0) return;
+  ESP_LOGD(SENSORS_TAG, "%s", line->buf);
+  uploader_write(
+      config->type == SENSOR_BME680 ? BME680_TRANSPORT : BME280_TRANSPORT,
+      line->buf);
+}
+
+// false if the chip has no driver or no row in the table
+static bool sensors_start(i2c_bus_handle_t bus, i2c_port_t port,
+                          const i2c_bus_probe_result_t *found) {
+  static const char *const names[] = {"BME280", "BME680"};
+  sensor_type_t type;
+
+  switch (found->id) {
+    case SENSORS_BME280_ID:
+      type = SENSOR_BME280;
+      break;
+    case SENSORS_BME680_ID:
+      type = SENSOR_BME680;
+      break;
+    default:
+      ESP_LOGW(SENSORS_TAG, "no driver for chip 0x%02x at %d:0x%02x",
+               found->id, port, found->addr);
+      return false;
+  }
+  for (int i = 0; i < sizeof(sensor_table) / sizeof(sensor_table[0]); i++) {
+    const sensor_config_t *config = &sensor_table[i];
+    if (config->type != type || config->port != port ||
+        config->addr != found->addr)
+      continue;
+    esp_err_t err = sensor_manager_add(sensor_manager, config, bus);
+    ESP_LOGI(SENSORS_TAG, "%s at %d:0x%02x: %s", names[type], port,
+             found->addr, esp_err_to_name(err));
+    return err == ESP_OK;
+  }
+  ESP_LOGW(SENSORS_TAG, "%s at %d:0x%02x is not in the table", names[type],
+           port, found->addr);
+  return false;
+}
+
+static void sensors_telemetry_send(i2c_port_t port,
+                                   const i2c_bus_device_stats_t *stats) {
+  // upper bound of each latency bucket, the last one has none
+  static const char *const buckets[I2C_BUS_LATENCY_BUCKETS] = {
+      "lat_64us",   "lat_128us",  "lat_256us",  "lat_512us", "lat_1024us",
+      "lat_2048us", "lat_4096us", "lat_8192us", "lat_16384us", "lat_more"};
+  char port_tag[4], addr_tag[8];
+  snprintf(port_tag, sizeof(port_tag), "%d", port);
+  snprintf(addr_tag, sizeof(addr_tag), "0x%02x", stats->addr);
+  const char *const tags[] = {"addr", addr_tag, "host", CONFIG_ESP_HOSTNAME,
+                              "port", port_tag};
+  influx_series_t series;
+  influx_line_t line;
+  char buf[384];
+
+  if (influx_series_init(&series, "i2c", tags, 3) != ESP_OK) return;
+  influx_line_begin(&line, buf, sizeof(buf), &series);
+  influx_line_add_int(&line, "transactions", stats->transactions);
+  influx_line_add_int(&line, "bytes", stats->bytes);
+  influx_line_add_int(&line, "nacks", stats->nacks);
+  influx_line_add_int(&line, "timeouts", stats->timeouts);
+  influx_line_add_int(&line, "busy_us", stats->busy_us);
+  influx_line_add_int(&line, "max_us", stats->max_us);
+  influx_line_add_int(&line, "skipped", stats->skipped);
+  for (int i = 0; i < I2C_BUS_LATENCY_BUCKETS; i++) {
+    influx_line_add_int(&line, buckets[i], stats->latency[i]);
+  }
+  if (influx_line_finish(&line, uploader_timestamp()) > 0) {
+    uploader_write(UPLOADER_HTTP, buf);
+  }
+}
+
+// counters since boot, so lost records only cost resolution
+static void sensors_telemetry_run(void *pvParameters) {
+  i2c_bus_device_stats_t stats[4];
+  TickType_t last_wakeup = xTaskGetTickCount();
+
+  while (1) {
+    vTaskDelayUntil(&last_wakeup,
+                    CONFIG_I2C_TELEMETRY_INTERVAL_S * 1000 / portTICK_PERIOD_MS);
+    for (int port = 0; port < I2C_NUM_MAX; port++) {
+      size_t count = sizeof(stats) / sizeof(stats[0]);
+      if (!sensor_buses[port]) continue;
+      iot_i2c_bus_get_device_stats(sensor_buses[port], stats, &count);
+      for (int i = 0; i < count; i++) sensors_telemetry_send(port, &stats[i]);
+    }
+  }
+}
+
+void sensors_init(void) {
+  int64_t start = esp_timer_get_time();
+  int64_t deadline = start + CONFIG_I2C_PROBE_BUDGET_MS * 1000LL;
+  int total = 0;
+
+  sensor_manager = sensor_manager_create(
+      sizeof(sensor_table) / sizeof(sensor_table[0]), CONFIG_ESP_HOSTNAME,
+      sensors_send, NULL);
+  if (!sensor_manager) {
+    ESP_LOGE(SENSORS_TAG, "no memory for the sensor manager");
+    return;
+  }
+
+  for (int i = 0; i < sizeof(sensor_ports) / sizeof(sensor_ports[0]); i++) {
+    i2c_port_t port = sensor_ports[i].port;
+    uint32_t clk_hz = sensor_ports[i].clk_hz;
+    if (sensor_ports[i].auto_clock) clk_hz = sensors_load_clock(port, clk_hz);
+    i2c_config_t conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = sensor_ports[i].sda,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_io_num = sensor_ports[i].scl,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master.clk_speed = clk_hz,
+    };
+    i2c_bus_handle_t bus = iot_i2c_bus_create(port, &conf);
+    if (!bus) {
+      ESP_LOGE(SENSORS_TAG, "I2C port %d could not be set up", port);
+      continue;
+    }
+    if (sensor_ports[i].auto_clock) {
+      iot_i2c_bus_set_auto_clock(bus, true, sensors_save_clock, NULL);
+    }
+#if CONFIG_I2C_RETRY_ERRORS > 0
+    iot_i2c_bus_set_retry_budget(bus, CONFIG_I2C_RETRY_ERRORS,
+                                 CONFIG_I2C_RETRY_BACKOFF_MS);
+#endif
+    ESP_LOGI(SENSORS_TAG, "I2C port %d at %u Hz%s", port, clk_hz,
+             sensor_ports[i].auto_clock ? " (auto)" : "");
+
+    i2c_bus_probe_result_t found[sizeof(sensor_addrs)];
+    size_t found_count = sizeof(found) / sizeof(found[0]);
+    esp_err_t err =
+        iot_i2c_bus_probe(bus, SENSORS_ID_REG, sensor_addrs,
+                          sizeof(sensor_addrs), found, &found_count, deadline);
+    if (err == ESP_ERR_TIMEOUT) {
+      ESP_LOGW(SENSORS_TAG, "probe budget used up on port %d", port);
+    }
+    int started = 0;
+    for (int j = 0; j < found_count; j++) {
+      started += sensors_start(bus, port, &found[j]);
+    }
+    total += found_count;
+    // the sensors keep using this handle, a port without any is released
+    if (started == 0)
+      iot_i2c_bus_delete(bus);
+    else
+      sensor_buses[port] = bus;
+  }
+  ESP_LOGI(SENSORS_TAG, "%d sensors found in %lld us, %d started", total,
+           (long long)(esp_timer_get_time() - start),
+           (int)sensor_manager_count(sensor_manager));
+
+  // one task samples all of them
+  if (sensor_manager_count(sensor_manager) > 0) {
+    sensor_manager_start(sensor_manager, 4096, 10);
+  }
+
+  if (CONFIG_I2C_TELEMETRY_INTERVAL_S > 0 && total > 0) {
+    xTaskCreate(sensors_telemetry_run, "i2c_telemetry", 3072, NULL, 1, NULL);
+  }
+}
@@ -0,0 +1,4 @@
+// finds the BME280 and BME680 sensors on the configured I2C ports, starts a
+// driver for each one in the sensor table and samples them all from one
+// task, so one image runs any mix of them
+void sensors_init(void);
@@ -0,0 +1,174 @@
+#include "uploader.h"
+
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_sntp.h"
+#include "influx_http.h"
+#include "influx_spool.h"
+#include "influx_udp.h"
+#include "influx_uploader.h"
+#include "sdkconfig.h"
+
+static const char *UPLOADER_TAG = "UPLOADER";
+
+static influx_http_handle_t http = NULL;
+static influx_spool_handle_t spool = NULL;
+static influx_writer_handle_t writer = NULL;
+static influx_uploader_handle_t uploader = NULL;
+static influx_uploader_handle_t udp_uploader = NULL;
+
+// the upload task runs the HTTP client, gzip and the spool
+#define UPLOAD_TASK_STACK_SIZE (1024 * 6)
+#define UPLOAD_TASK_PRIORITY 1
+#define UPLOAD_RECORD_MAX 192
+// the UDP task only packs datagrams
+#define UDP_TASK_STACK_SIZE (1024 * 3)
+#define UDP_TASK_PRIORITY 2
+#define UDP_QUEUE_LEN 8
+
+// first pause after a failed upload, doubled up to CONFIG_INFLUXDB_BACKOFF_MAX_S
+#define UPLOAD_BACKOFF_MIN_MS 1000
+
+// anything earlier means the clock has not been set by SNTP yet
+#define VALID_EPOCH_S 1577836800
+
+#ifdef CONFIG_INFLUXDB_UDP
+static void udp_init(void) {
+  influx_udp_config_t udp_conf = {
+      .host = CONFIG_INFLUXDB_UDP_HOST,
+      .port = CONFIG_INFLUXDB_UDP_PORT,
+      .payload_size = CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE,
+  };
+  influx_udp_handle_t udp = influx_udp_create(&udp_conf);
+  if (!udp) {
+    ESP_LOGE(UPLOADER_TAG, "failed to create UDP sender");
+    return;
+  }
+
+  // same batching as HTTP, but a batch is one datagram and nothing is spooled
+  influx_writer_config_t conf = {
+      .buffer_size = CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE * 2,
+      .batch_max_bytes = CONFIG_INFLUXDB_UDP_PAYLOAD_SIZE,
+      .batch_max_age_ms = CONFIG_INFLUXDB_UDP_MAX_AGE_MS,
+      .transport = influx_udp_transport,
+      .transport_ctx = udp,
+  };
+  influx_writer_handle_t udp_writer = influx_writer_create(&conf);
+  if (!udp_writer) {
+    ESP_LOGE(UPLOADER_TAG, "failed to create UDP writer");
+    return;
+  }
+
+  influx_uploader_config_t upload_conf = {
+      .writer = udp_writer,
+      .queue_len = UDP_QUEUE_LEN,
+      .record_max = UPLOAD_RECORD_MAX,
+      .drop_policy = INFLUX_DROP_OLDEST,
+      .poll_ms = CONFIG_INFLUXDB_UDP_MAX_AGE_MS,
+      .task_stack_size = UDP_TASK_STACK_SIZE,
+      .task_priority = UDP_TASK_PRIORITY,
+  };
+  udp_uploader = influx_uploader_create(&upload_conf);
+  if (!udp_uploader) {
+    ESP_LOGE(UPLOADER_TAG, "failed to start UDP task");
+  }
+}
+#endif
+
+void uploader_init(void) {
+  sntp_setoperatingmode(SNTP_OPMODE_POLL);
+  sntp_setservername(0, CONFIG_SNTP_SERVER);
+  sntp_init();
+
+  http = influx_http_create();
+  if (!http) {
+    ESP_LOGE(UPLOADER_TAG, "failed to create InfluxDB client");
+    return;
+  }
+
+#ifdef CONFIG_INFLUXDB_SPOOL
+  influx_spool_flash_t flash;
+  if (influx_spool_partition(CONFIG_INFLUXDB_SPOOL_PARTITION, &flash) ==
+      ESP_OK) {
+    spool = influx_spool_open(&flash, CONFIG_INFLUXDB_BATCH_BUFFER_SIZE);
+  }
+  if (!spool) {
+    ESP_LOGW(UPLOADER_TAG, "no spool partition \"%s\", outages lose data",
+             CONFIG_INFLUXDB_SPOOL_PARTITION);
+  }
+#endif
+
+#ifdef CONFIG_INFLUXDB_ADAPTIVE
+  influx_policy_config_t policy = {
+      .min_batch_bytes = CONFIG_INFLUXDB_BATCH_MIN_BYTES,
+      .max_batch_bytes = CONFIG_INFLUXDB_BATCH_MAX_BYTES,
+      .min_age_ms = CONFIG_INFLUXDB_BATCH_MIN_AGE_MS,
+      .max_age_ms = CONFIG_INFLUXDB_BATCH_MAX_AGE_MS,
+      .target_latency_ms = CONFIG_INFLUXDB_TARGET_LATENCY_MS,
+      .min_backoff_ms = UPLOAD_BACKOFF_MIN_MS,
+      .max_backoff_ms = CONFIG_INFLUXDB_BACKOFF_MAX_S * 1000,
+  };
+#endif
+
+  influx_writer_config_t conf = {
+      .buffer_size = CONFIG_INFLUXDB_BATCH_BUFFER_SIZE,
+      .batch_max_bytes = CONFIG_INFLUXDB_BATCH_MAX_BYTES,
+      .batch_max_age_ms = CONFIG_INFLUXDB_BATCH_MAX_AGE_MS,
+      .transport = influx_http_transport,
+      .transport_ctx = http,
+      .spool = spool,
+#ifdef CONFIG_INFLUXDB_ADAPTIVE
+      .policy = &policy,
+#endif
+  };
+  writer = influx_writer_create(&conf);
+  if (!writer) {
+    ESP_LOGE(UPLOADER_TAG, "failed to create InfluxDB writer");
+    return;
+  }
+
+  influx_uploader_config_t upload_conf = {
+      .writer = writer,
+      .queue_len = CONFIG_INFLUXDB_QUEUE_LEN,
+      .record_max = UPLOAD_RECORD_MAX,
+#ifdef CONFIG_INFLUXDB_QUEUE_DROP_NEWEST
+      .drop_policy = INFLUX_DROP_NEWEST,
+#else
+      .drop_policy = INFLUX_DROP_OLDEST,
+#endif
+      .poll_ms = 1000,
+      .task_stack_size = UPLOAD_TASK_STACK_SIZE,
+      .task_priority = UPLOAD_TASK_PRIORITY,
+  };
+  uploader = influx_uploader_create(&upload_conf);
+  if (!uploader) {
+    ESP_LOGE(UPLOADER_TAG, "failed to start upload task");
+  }
+
+#ifdef CONFIG_INFLUXDB_UDP
+  udp_init();
+#endif
+}
+
+esp_err_t uploader_write(uploader_transport_t transport, const char *line) {
+  influx_uploader_handle_t target =
+      transport == UPLOADER_UDP ? udp_uploader : uploader;
+  if (!target) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = influx_uploader_enqueue(target, line);
+  if (err != ESP_OK) {
+    ESP_LOGW(UPLOADER_TAG, "record dropped: %s", esp_err_to_name(err));
+  }
+  return err;
+}
+
+int64_t uploader_timestamp(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if (tv.tv_sec < VALID_EPOCH_S) {
+    return 0;
+  }
+  return (int64_t)tv.tv_sec * 1000000000LL + (int64_t)tv.tv_usec * 1000LL;
+}
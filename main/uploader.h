@@ -0,0 +1,12 @@
+#include "influx_line.h"
+#include "influx_writer.h"
+
+typedef enum {
+  UPLOADER_HTTP,  // batched, retried and spooled
+  UPLOADER_UDP,   // sent within CONFIG_INFLUXDB_UDP_MAX_AGE_MS, may be lost
+} uploader_transport_t;
+
+void uploader_init(void);
+esp_err_t uploader_write(uploader_transport_t transport, const char *line);
+// nanoseconds since the epoch for influx_line_finish, 0 until SNTP has synced
+int64_t uploader_timestamp(void);